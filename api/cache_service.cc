@@ -22,11 +22,21 @@
 #include "cache_service.hh"
 #include "api/api-doc/cache_service.json.hh"
 #include "column_family.hh"
+#include "sstables/chunk_cache.hh"
 
 namespace api {
 using namespace json;
 namespace cs = httpd::cache_service_json;
 
+template<typename Func>
+static future<json::json_return_type> get_chunk_cache_stat(http_context& ctx, Func f) {
+    return ctx.db.map_reduce0([f](database& db) {
+        return f(sstables::global_chunk_cache());
+    }, int64_t(0), std::plus<int64_t>()).then([](const int64_t& res) {
+        return make_ready_future<json::json_return_type>(res);
+    });
+}
+
 void set_cache_service(http_context& ctx, routes& r) {
     cs::get_row_cache_save_period_in_seconds.set(r, [](std::unique_ptr<request> req) {
         // We never save the cache
@@ -279,6 +289,45 @@ void set_cache_service(http_context& ctx, routes& r) {
         // so currently returning a 0 for entries is ok
         return make_ready_future<json::json_return_type>(0);
     });
+
+    cs::get_chunk_capacity.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_chunk_cache_stat(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.max_size();
+        });
+    });
+
+    cs::get_chunk_hits.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_chunk_cache_stat(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().hits;
+        });
+    });
+
+    cs::get_chunk_requests.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_chunk_cache_stat(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().hits + cc.get_stats().misses;
+        });
+    });
+
+    cs::get_chunk_hit_rate.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return ctx.db.map_reduce0([](database& db) {
+            auto& stats = sstables::global_chunk_cache().get_stats();
+            return ratio_holder(stats.hits + stats.misses, stats.hits);
+        }, ratio_holder(), std::plus<ratio_holder>()).then([](const ratio_holder& res) {
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
+    cs::get_chunk_size.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_chunk_cache_stat(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().bytes;
+        });
+    });
+
+    cs::get_chunk_entries.set(r, [&ctx] (std::unique_ptr<request> req) {
+        return get_chunk_cache_stat(ctx, [] (const sstables::chunk_cache& cc) {
+            return cc.get_stats().entries;
+        });
+    });
 }
 
 }
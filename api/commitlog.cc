@@ -73,6 +73,14 @@ void set_commitlog(http_context& ctx, routes& r) {
     httpd::commitlog_json::get_total_commit_log_size.set(r, [&ctx](std::unique_ptr<request> req) {
         return acquire_cl_metric(ctx, std::bind(&db::commitlog::get_total_size, std::placeholders::_1));
     });
+
+    httpd::commitlog_json::get_segments_created.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_metric(ctx, std::bind(&db::commitlog::get_num_segments_created, std::placeholders::_1));
+    });
+
+    httpd::commitlog_json::get_segments_recycled.set(r, [&ctx](std::unique_ptr<request> req) {
+        return acquire_cl_metric(ctx, std::bind(&db::commitlog::get_num_segments_recycled, std::placeholders::_1));
+    });
 }
 
 }
@@ -361,6 +361,36 @@ void set_storage_service(http_context& ctx, routes& r) {
         });
     });
 
+    ss::get_repair_progress.set(r, [&ctx](std::unique_ptr<request> req) {
+        return repair_get_progress(ctx.db, boost::lexical_cast<int>(req->get_query_param("id")))
+                .then_wrapped([] (future<repair_progress>&& fut) {
+            repair_progress p;
+            try {
+                p = fut.get0();
+            } catch(std::runtime_error& e) {
+                return make_ready_future<json::json_return_type>(json_exception(httpd::bad_param_exception(e.what())));
+            }
+            ss::repair_progress res;
+            res.ranges_total = p.ranges_total;
+            res.ranges_done = p.ranges_done;
+            res.subranges_done = p.subrange_duration.count;
+            res.subrange_min_ms = p.subrange_duration.min;
+            res.subrange_mean_ms = p.subrange_duration.mean;
+            res.subrange_max_ms = p.subrange_duration.max;
+            res.parallelism = p.parallelism;
+            for (auto& t : p.recent_subranges) {
+                ss::repair_range_timing rt;
+                rt.column_family = t.cf;
+                rt.start_token = t.range.start() ? dht::global_partitioner().to_sstring(t.range.start()->value()) : sstring();
+                rt.end_token = t.range.end() ? dht::global_partitioner().to_sstring(t.range.end()->value()) : sstring();
+                rt.duration_ms = t.duration.count();
+                rt.succeeded = t.succeeded;
+                res.recent_subranges.push(rt);
+            }
+            return make_ready_future<json::json_return_type>(res);
+        });
+    });
+
     ss::force_terminate_all_repair_sessions.set(r, [](std::unique_ptr<request> req) {
         //TBD
         unimplemented();
@@ -54,6 +54,7 @@ static hs::progress_info get_progress_info(const streaming::progress_info& info)
     res.peer = boost::lexical_cast<std::string>(info.peer);
     res.session_index = 0;
     res.total_bytes = info.total_bytes;
+    res.bytes_per_second = info.bytes_per_second;
     return res;
 }
 
@@ -28,6 +28,7 @@ enum class compressor {
     lz4,
     snappy,
     deflate,
+    zstd,
 };
 
 class compression_parameters {
@@ -38,10 +39,15 @@ class compression_parameters {
     static constexpr auto SSTABLE_COMPRESSION = "sstable_compression";
     static constexpr auto CHUNK_LENGTH_KB = "chunk_length_kb";
     static constexpr auto CRC_CHECK_CHANCE = "crc_check_chance";
+    static constexpr auto ZSTD_DICTIONARY_SIZE_KB = "zstd_dictionary_size_kb";
+    // Dictionaries are trained on at most 1MB of samples, which is too
+    // little for larger ones.
+    static constexpr int MAX_ZSTD_DICTIONARY_SIZE_KB = 64;
 private:
     compressor _compressor = compressor::none;
     std::experimental::optional<int> _chunk_length;
     std::experimental::optional<double> _crc_check_chance;
+    std::experimental::optional<int> _zstd_dictionary_size;
 public:
     compression_parameters() = default;
     compression_parameters(compressor c) : _compressor(c) { }
@@ -59,6 +65,8 @@ class compression_parameters {
             _compressor = compressor::snappy;
         } else if (is_compressor_class(compressor_class, "DeflateCompressor")) {
             _compressor = compressor::deflate;
+        } else if (is_compressor_class(compressor_class, "ZstdCompressor")) {
+            _compressor = compressor::zstd;
         } else {
             throw exceptions::configuration_exception(sstring("Unsupported compression class '") + compressor_class + "'.");
         }
@@ -78,11 +86,22 @@ class compression_parameters {
                 throw exceptions::syntax_exception(sstring("Invalid double value ") + crc_chance->second + "for " + CRC_CHECK_CHANCE);
             }
         }
+        auto dictionary_size = options.find(ZSTD_DICTIONARY_SIZE_KB);
+        if (dictionary_size != options.end()) {
+            try {
+                _zstd_dictionary_size = std::stoi(dictionary_size->second) * 1024;
+            } catch (const std::exception& e) {
+                throw exceptions::syntax_exception(sstring("Invalid integer value ") + dictionary_size->second + " for " + ZSTD_DICTIONARY_SIZE_KB);
+            }
+        }
     }
 
     compressor get_compressor() const { return _compressor; }
     int32_t chunk_length() const { return _chunk_length.value_or(int(DEFAULT_CHUNK_LENGTH)); }
     double crc_check_chance() const { return _crc_check_chance.value_or(double(DEFAULT_CRC_CHECK_CHANCE)); }
+    // Size of the dictionary trained for the table's sstables; 0 means
+    // chunks are compressed without a dictionary.
+    int32_t zstd_dictionary_size() const { return _zstd_dictionary_size.value_or(0); }
 
     void validate() {
         if (_chunk_length) {
@@ -98,6 +117,17 @@ class compression_parameters {
         if (_crc_check_chance && (_crc_check_chance.value() < 0.0 || _crc_check_chance.value() > 1.0)) {
             throw exceptions::configuration_exception(sstring(CRC_CHECK_CHANCE) + " must be between 0.0 and 1.0.");
         }
+        if (_zstd_dictionary_size) {
+            if (_compressor != compressor::zstd) {
+                throw exceptions::configuration_exception(sstring(ZSTD_DICTIONARY_SIZE_KB) + " is only supported by ZstdCompressor.");
+            }
+            if (_zstd_dictionary_size.value() < 0) {
+                throw exceptions::configuration_exception(sstring("Invalid negative ") + ZSTD_DICTIONARY_SIZE_KB);
+            }
+            if (_zstd_dictionary_size.value() > MAX_ZSTD_DICTIONARY_SIZE_KB * 1024) {
+                throw exceptions::configuration_exception(sprint("%s must be at most %d", ZSTD_DICTIONARY_SIZE_KB, MAX_ZSTD_DICTIONARY_SIZE_KB));
+            }
+        }
     }
 
     std::map<sstring, sstring> get_options() const {
@@ -112,23 +142,27 @@ class compression_parameters {
         if (_crc_check_chance) {
             opts.emplace(sstring(CRC_CHECK_CHANCE), std::to_string(_crc_check_chance.value()));
         }
+        if (_zstd_dictionary_size) {
+            opts.emplace(sstring(ZSTD_DICTIONARY_SIZE_KB), std::to_string(_zstd_dictionary_size.value() / 1024));
+        }
         return opts;
     }
     bool operator==(const compression_parameters& other) const {
         return _compressor == other._compressor
                && _chunk_length == other._chunk_length
-               && _crc_check_chance == other._crc_check_chance;
+               && _crc_check_chance == other._crc_check_chance
+               && _zstd_dictionary_size == other._zstd_dictionary_size;
     }
     bool operator!=(const compression_parameters& other) const {
         return !(*this == other);
     }
 private:
     void validate_options(const std::map<sstring, sstring>& options) {
-        // currently, there are no options specific to a particular compressor
         static std::set<sstring> keywords({
             sstring(SSTABLE_COMPRESSION),
             sstring(CHUNK_LENGTH_KB),
             sstring(CRC_CHECK_CHANCE),
+            sstring(ZSTD_DICTIONARY_SIZE_KB),
         });
         for (auto&& opt : options) {
             if (!keywords.count(opt.first)) {
@@ -148,6 +182,8 @@ class compression_parameters {
             return "org.apache.cassandra.io.compress.SnappyCompressor";
         case compressor::deflate:
             return "org.apache.cassandra.io.compress.DeflateCompressor";
+        case compressor::zstd:
+            return "org.apache.cassandra.io.compress.ZstdCompressor";
         default:
             abort();
         }
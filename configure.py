@@ -173,6 +173,8 @@ scylla_tests = [
     'tests/lsa_sync_eviction_test',
     'tests/row_cache_alloc_stress',
     'tests/perf_row_cache_update',
+    'tests/perf/perf_row_cache_scan',
+    'tests/perf/perf_compaction_strategy',
     'tests/perf/perf_hash',
     'tests/perf/perf_cql_parser',
     'tests/perf/perf_simple_query',
@@ -201,6 +203,7 @@ scylla_tests = [
     'tests/gossiping_property_file_snitch_test',
     'tests/ec2_snitch_test',
     'tests/snitch_reset_test',
+    'tests/dynamic_snitch_test',
     'tests/network_topology_strategy_test',
     'tests/query_processor_test',
     'tests/batchlog_manager_test',
@@ -215,6 +218,9 @@ scylla_tests = [
     'tests/dynamic_bitset_test',
     'tests/auth_test',
     'tests/idl_test',
+    'tests/repair_test',
+    'tests/histogram_test',
+    'tests/cql_compression_test',
 ]
 
 apps = [
@@ -288,10 +294,13 @@ scylla_core = (['database.cc',
                  'mutation_partition_serializer.cc',
                  'mutation_reader.cc',
                  'mutation_query.cc',
+                 'querier.cc',
                  'key_reader.cc',
                  'keys.cc',
                  'sstables/sstables.cc',
                  'sstables/compress.cc',
+                 'sstables/chunk_cache.cc',
+                 'sstables/index_page_cache.cc',
                  'sstables/row.cc',
                  'sstables/key.cc',
                  'sstables/partition.cc',
@@ -413,6 +422,7 @@ scylla_core = (['database.cc',
                  'locator/token_metadata.cc',
                  'locator/locator.cc',
                  'locator/snitch_base.cc',
+                 'locator/dynamic_snitch.cc',
                  'locator/simple_snitch.cc',
                  'locator/rack_inferring_snitch.cc',
                  'locator/gossiping_property_file_snitch.cc',
@@ -431,6 +441,7 @@ scylla_core = (['database.cc',
                  'streaming/stream_request.cc',
                  'streaming/stream_summary.cc',
                  'streaming/stream_transfer_task.cc',
+                 'streaming/stream_sstable_files.cc',
                  'streaming/stream_receive_task.cc',
                  'streaming/stream_plan.cc',
                  'streaming/progress_info.cc',
@@ -539,6 +550,8 @@ tests_not_using_seastar_test_framework = set([
     'tests/lsa_sync_eviction_test',
     'tests/row_cache_alloc_stress',
     'tests/perf_row_cache_update',
+    'tests/perf/perf_row_cache_scan',
+    'tests/perf/perf_compaction_strategy',
     'tests/cartesian_product_test',
     'tests/perf/perf_hash',
     'tests/perf/perf_cql_parser',
@@ -554,6 +567,9 @@ tests_not_using_seastar_test_framework = set([
     'tests/managed_vector_test',
     'tests/dynamic_bitset_test',
     'tests/idl_test',
+    'tests/repair_test',
+    'tests/histogram_test',
+    'tests/cql_compression_test',
 ])
 
 for t in tests_not_using_seastar_test_framework:
@@ -698,7 +714,7 @@ for mode in build_modes:
 seastar_deps = 'practically_anything_can_change_so_lets_run_it_every_time_and_restat.'
 
 args.user_cflags += " " + pkg_config("--cflags", "jsoncpp")
-libs = "-lyaml-cpp -llz4 -lz -lsnappy " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem' + ' -lcrypt' + ' -lboost_date_time'
+libs = "-lyaml-cpp -llz4 -lz -lsnappy -lzstd " + pkg_config("--libs", "jsoncpp") + ' -lboost_filesystem' + ' -lcrypt' + ' -lboost_date_time'
 for pkg in pkgs:
     args.user_cflags += ' ' + pkg_config('--cflags', pkg)
     libs += ' ' + pkg_config('--libs', pkg)
@@ -64,6 +64,11 @@ class impl_count_function : public aggregate_function::aggregate {
     virtual void add_input(cql_serialization_format sf, const std::vector<opt_bytes>& values) override {
         ++_count;
     }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        if (partial) {
+            _count += value_cast<int64_t>(long_type->deserialize(*partial));
+        }
+    }
 };
 
     /**
@@ -92,6 +97,11 @@ class impl_sum_function_for final : public aggregate_function::aggregate {
         }
         _sum += value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
     }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        if (partial) {
+            _sum += value_cast<Type>(data_type_for<Type>()->deserialize(*partial));
+        }
+    }
 };
 
 template <typename Type>
@@ -134,6 +144,23 @@ class impl_avg_function_for final : public aggregate_function::aggregate {
         ++_count;
         _sum += value_cast<Type>(data_type_for<Type>()->deserialize(*values[0]));
     }
+    // The partial state is the count, as a fixed size bigint, followed by the sum.
+    virtual opt_bytes compute_partial(cql_serialization_format sf) override {
+        auto count = long_type->decompose(_count);
+        auto sum = data_type_for<Type>()->decompose(_sum);
+        bytes state(bytes::initialized_later(), count.size() + sum.size());
+        auto out = std::copy(count.begin(), count.end(), state.begin());
+        std::copy(sum.begin(), sum.end(), out);
+        return state;
+    }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        if (!partial) {
+            return;
+        }
+        bytes_view state(*partial);
+        _count += value_cast<int64_t>(long_type->deserialize(state.substr(0, sizeof(int64_t))));
+        _sum += value_cast<Type>(data_type_for<Type>()->deserialize(state.substr(sizeof(int64_t))));
+    }
 };
 
 template <typename Type>
@@ -176,6 +203,9 @@ class impl_max_function_for final : public aggregate_function::aggregate {
             _max = std::max(*_max, val);
         }
     }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        add_input(sf, { partial });
+    }
 };
 
 template <typename Type>
@@ -223,6 +253,9 @@ class impl_min_function_for final : public aggregate_function::aggregate {
             _min = std::min(*_min, val);
         }
     }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        add_input(sf, { partial });
+    }
 };
 
 template <typename Type>
@@ -264,6 +297,11 @@ class impl_count_function_for final : public aggregate_function::aggregate {
         }
         ++_count;
     }
+    virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) override {
+        if (partial) {
+            _count += value_cast<int64_t>(long_type->deserialize(*partial));
+        }
+    }
 };
 
 template <typename Type>
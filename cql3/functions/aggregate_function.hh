@@ -87,6 +87,27 @@ class aggregate_function : public virtual function {
          */
         virtual opt_bytes compute(cql_serialization_format sf) = 0;
 
+        /**
+         * Returns the partial state of this aggregate, which can be merged into another
+         * aggregate of the same function with <code>add_partial</code>. Replicas send it
+         * to the coordinator instead of the rows they aggregated.
+         * By default the partial state is the aggregate current value.
+         *
+         * @param protocol_version native protocol version
+         * @return the aggregate partial state.
+         */
+        virtual opt_bytes compute_partial(cql_serialization_format sf) {
+            return compute(sf);
+        }
+
+        /**
+         * Merges the partial state of another aggregate of the same function into this aggregate.
+         *
+         * @param protocol_version native protocol version
+         * @param partial the partial state, as returned by <code>compute_partial</code>.
+         */
+        virtual void add_partial(cql_serialization_format sf, const opt_bytes& partial) = 0;
+
         /**
          * Reset this aggregate.
          */
@@ -69,6 +69,14 @@ class aggregate_function_selector : public abstract_function_selector_for<functi
         return _aggregate->compute(sf);
     }
 
+    virtual bytes_opt get_partial_output(cql_serialization_format sf) override {
+        return _aggregate->compute_partial(sf);
+    }
+
+    virtual void add_partial_input(cql_serialization_format sf, const bytes_opt& partial) override {
+        _aggregate->add_partial(sf, partial);
+    }
+
     virtual void reset() override {
         _aggregate->reset();
     }
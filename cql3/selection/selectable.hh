@@ -114,6 +114,12 @@ class selectable::with_function : public selectable {
         }
         virtual shared_ptr<selectable> prepare(schema_ptr s) override;
         virtual bool processes_selection() const override;
+        const functions::function_name& function_name() const {
+            return _function_name;
+        }
+        const std::vector<shared_ptr<selectable::raw>>& args() const {
+            return _args;
+        }
     };
 };
 
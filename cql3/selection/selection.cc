@@ -121,6 +121,14 @@ class simple_selection : public selection {
             _current = std::move(*rs.current);
         }
 
+        virtual std::vector<bytes_opt> get_partial_output_row(cql_serialization_format sf) override {
+            throw std::runtime_error("selection without aggregates has no partial output");
+        }
+
+        virtual void add_partial_input_row(cql_serialization_format sf, const std::vector<bytes_opt>& partials) override {
+            throw std::runtime_error("selection without aggregates has no partial input");
+        }
+
         virtual bool is_aggregate() {
             return false;
         }
@@ -195,6 +203,24 @@ class selection_with_processing : public selection {
                 s->add_input(sf, rs);
             }
         }
+
+        virtual std::vector<bytes_opt> get_partial_output_row(cql_serialization_format sf) override {
+            std::vector<bytes_opt> partials;
+            partials.reserve(_selectors.size());
+            for (auto&& s : _selectors) {
+                partials.emplace_back(s->get_partial_output(sf));
+            }
+            return partials;
+        }
+
+        virtual void add_partial_input_row(cql_serialization_format sf, const std::vector<bytes_opt>& partials) override {
+            if (partials.size() != _selectors.size()) {
+                throw std::runtime_error(sprint("expected %d partial aggregates, got %d", _selectors.size(), partials.size()));
+            }
+            for (size_t i = 0; i < _selectors.size(); ++i) {
+                _selectors[i]->add_partial_input(sf, partials[i]);
+            }
+        }
     };
 
     std::unique_ptr<selectors> new_selectors() const override  {
@@ -219,11 +245,40 @@ ::shared_ptr<selection> selection::for_columns(schema_ptr schema, std::vector<co
 }
 
 uint32_t selection::add_column_for_ordering(const column_definition& c) {
+    // Replicas wouldn't know about the selector added for ordering.
+    _aggregate_selectors = std::experimental::nullopt;
     _columns.push_back(&c);
     _metadata->add_non_serialized_column(c.column_specification);
     return _columns.size() - 1;
 }
 
+// Describes a select clause made only of function calls whose arguments are
+// columns, in a form replicas can rebuild it from. The caller checks that the
+// functions are aggregates.
+static std::experimental::optional<std::vector<query::aggregate_selector>>
+describe_aggregates(const std::vector<::shared_ptr<raw_selector>>& raw_selectors) {
+    std::vector<query::aggregate_selector> aggregates;
+    aggregates.reserve(raw_selectors.size());
+    for (auto&& raw : raw_selectors) {
+        auto fun = dynamic_pointer_cast<selectable::with_function::raw>(raw->selectable_);
+        if (!fun) {
+            return std::experimental::nullopt;
+        }
+        query::aggregate_selector a;
+        a.function_keyspace = fun->function_name().keyspace;
+        a.function_name = fun->function_name().name;
+        for (auto&& arg : fun->args()) {
+            auto column = dynamic_pointer_cast<column_identifier::raw>(arg);
+            if (!column) {
+                return std::experimental::nullopt;
+            }
+            a.columns.emplace_back(column->to_string());
+        }
+        aggregates.emplace_back(std::move(a));
+    }
+    return std::move(aggregates);
+}
+
 ::shared_ptr<selection> selection::from_selectors(database& db, schema_ptr schema, const std::vector<::shared_ptr<raw_selector>>& raw_selectors) {
     std::vector<const column_definition*> defs;
 
@@ -233,12 +288,36 @@ ::shared_ptr<selection> selection::from_selectors(database& db, schema_ptr schem
 
     auto metadata = collect_metadata(schema, raw_selectors, *factories);
     if (processes_selection(raw_selectors)) {
-        return ::make_shared<selection_with_processing>(schema, std::move(defs), std::move(metadata), std::move(factories));
+        auto s = ::make_shared<selection_with_processing>(schema, std::move(defs), std::move(metadata), std::move(factories));
+        if (s->is_aggregate()) {
+            s->_aggregate_selectors = describe_aggregates(raw_selectors);
+        }
+        return s;
     } else {
         return ::make_shared<simple_selection>(schema, std::move(defs), std::move(metadata), false);
     }
 }
 
+::shared_ptr<selection> selection::for_aggregates(database& db, schema_ptr schema, const std::vector<query::aggregate_selector>& aggregates) {
+    std::vector<::shared_ptr<raw_selector>> raw_selectors;
+    raw_selectors.reserve(aggregates.size());
+    for (auto&& a : aggregates) {
+        std::vector<::shared_ptr<selectable::raw>> args;
+        args.reserve(a.columns.size());
+        for (auto&& column : a.columns) {
+            // The names were already case-folded on the coordinator.
+            args.emplace_back(::make_shared<column_identifier::raw>(column, true));
+        }
+        auto fun = ::make_shared<selectable::with_function::raw>(functions::function_name(a.function_keyspace, a.function_name), std::move(args));
+        raw_selectors.emplace_back(::make_shared<raw_selector>(std::move(fun), ::shared_ptr<column_identifier>()));
+    }
+    auto s = from_selectors(db, std::move(schema), raw_selectors);
+    if (!s->is_aggregate()) {
+        throw exceptions::invalid_request_exception("partial aggregation requested for a selection without aggregates");
+    }
+    return s;
+}
+
 std::vector<::shared_ptr<column_specification>>
 selection::collect_metadata(schema_ptr schema, const std::vector<::shared_ptr<raw_selector>>& raw_selectors,
         const selector_factories& factories) {
@@ -330,6 +409,18 @@ std::unique_ptr<result_set> result_set_builder::build() {
     return std::move(_result_set);
 }
 
+std::vector<bytes_opt> result_set_builder::build_partial() {
+    if (current) {
+        _selectors->add_input_row(_cql_serialization_format, *this);
+        current = std::experimental::nullopt;
+    }
+    return _selectors->get_partial_output_row(_cql_serialization_format);
+}
+
+void result_set_builder::add_partial(const std::vector<bytes_opt>& partials) {
+    _selectors->add_partial_input_row(_cql_serialization_format, partials);
+}
+
 result_set_builder::visitor::visitor(
         cql3::selection::result_set_builder& builder, const schema& s,
         const selection& selection)
@@ -73,6 +73,19 @@ class selectors {
 
     virtual std::vector<bytes_opt> get_output_row(cql_serialization_format sf) = 0;
 
+    /**
+     * Returns the partial states of the aggregates computed by the selectors.
+     * @see selector::get_partial_output
+     */
+    virtual std::vector<bytes_opt> get_partial_output_row(cql_serialization_format sf) = 0;
+
+    /**
+     * Merges partial states, as returned by <code>get_partial_output_row</code>, into the aggregates
+     * computed by the selectors.
+     * @see selector::add_partial_input
+     */
+    virtual void add_partial_input_row(cql_serialization_format sf, const std::vector<bytes_opt>& partials) = 0;
+
     virtual void reset() = 0;
 };
 
@@ -84,6 +97,7 @@ class selection {
     const bool _collect_timestamps;
     const bool _collect_TTLs;
     const bool _contains_static_columns;
+    std::experimental::optional<std::vector<query::aggregate_selector>> _aggregate_selectors;
 protected:
     selection(schema_ptr schema,
         std::vector<const column_definition*> columns,
@@ -186,6 +200,20 @@ class selection {
 public:
     static ::shared_ptr<selection> from_selectors(database& db, schema_ptr schema, const std::vector<::shared_ptr<raw_selector>>& raw_selectors);
 
+    /**
+     * Rebuilds, on a replica, the selection made of the given aggregates.
+     * @see get_aggregate_selectors
+     */
+    static ::shared_ptr<selection> for_aggregates(database& db, schema_ptr schema, const std::vector<query::aggregate_selector>& aggregates);
+
+    /**
+     * Describes the aggregates of this selection, so that replicas can compute partial aggregates
+     * for it. Disengaged unless the selection consists only of aggregates whose arguments are columns.
+     */
+    const std::experimental::optional<std::vector<query::aggregate_selector>>& get_aggregate_selectors() const {
+        return _aggregate_selectors;
+    }
+
     virtual std::unique_ptr<selectors> new_selectors() const = 0;
 
     /**
@@ -245,6 +273,13 @@ class result_set_builder {
     void add_collection(const column_definition& def, bytes_view c);
     void new_row();
     std::unique_ptr<result_set> build();
+
+    /**
+     * Like build(), but for an aggregate selection returns the partial states of the aggregates
+     * instead of their values, to be merged into another builder with add_partial().
+     */
+    std::vector<bytes_opt> build_partial();
+    void add_partial(const std::vector<bytes_opt>& partials);
     api::timestamp_type timestamp_of(size_t idx);
     int32_t ttl_of(size_t idx);
     
@@ -82,6 +82,29 @@ class selector : public assignment_testable {
      */
     virtual bytes_opt get_output(cql_serialization_format sf) = 0;
 
+    /**
+     * Returns the partial state of the aggregate computed by this <code>selector</code>, which
+     * <code>add_partial_input</code> of a <code>selector</code> for the same aggregate can merge.
+     * Only aggregate selectors have one.
+     *
+     * @param protocol_version protocol version used for serialization
+     * @return the partial state of the aggregate
+     */
+    virtual bytes_opt get_partial_output(cql_serialization_format sf) {
+        throw std::runtime_error("selector does not compute an aggregate");
+    }
+
+    /**
+     * Merges the partial state of an aggregate, as returned by <code>get_partial_output</code>, into
+     * the aggregate computed by this <code>selector</code>.
+     *
+     * @param protocol_version protocol version used for serialization
+     * @param partial the partial state of the aggregate
+     */
+    virtual void add_partial_input(cql_serialization_format sf, const bytes_opt& partial) {
+        throw std::runtime_error("selector does not compute an aggregate");
+    }
+
     /**
      * Returns the <code>selector</code> output type.
      *
@@ -565,7 +565,8 @@ ::shared_ptr<parsed_statement::prepared>
 modification_statement::parsed::prepare(database& db) {
     auto bound_names = get_bound_variables();
     auto statement = prepare(db, bound_names);
-    return ::make_shared<parsed_statement::prepared>(std::move(statement), *bound_names);
+    auto s = statement->s;
+    return ::make_shared<parsed_statement::prepared>(std::move(statement), *bound_names, std::move(s));
 }
 
 ::shared_ptr<modification_statement>
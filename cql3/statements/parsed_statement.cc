@@ -70,6 +70,13 @@ parsed_statement::prepared::prepared(::shared_ptr<cql_statement> statement_, con
     : prepared(statement_, names.get_specifications())
 { }
 
+parsed_statement::prepared::prepared(::shared_ptr<cql_statement> statement_, const variable_specifications& names, schema_ptr key_schema_)
+    : statement(std::move(statement_))
+    , bound_names(names.get_specifications())
+    , key_schema(key_schema_)
+    , partition_key_bind_indices(names.get_partition_key_bind_indices(*key_schema_))
+{ }
+
 parsed_statement::prepared::prepared(::shared_ptr<cql_statement> statement_, variable_specifications&& names)
     : prepared(statement_, std::move(names).get_specifications())
 { }
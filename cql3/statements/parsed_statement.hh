@@ -70,9 +70,16 @@ class parsed_statement {
     public:
         const ::shared_ptr<cql_statement> statement;
         const std::vector<::shared_ptr<column_specification>> bound_names;
+        // For statements on a single table, the bind indices making up its
+        // partition key, see variable_specifications::get_partition_key_bind_indices().
+        // Used to route execution to the shard owning the partition.
+        const schema_ptr key_schema;
+        const std::vector<uint16_t> partition_key_bind_indices;
 
         prepared(::shared_ptr<cql_statement> statement_, std::vector<::shared_ptr<column_specification>> bound_names_);
 
+        prepared(::shared_ptr<cql_statement> statement_, const variable_specifications& names, schema_ptr key_schema_);
+
         prepared(::shared_ptr<cql_statement> statement_, const variable_specifications& names);
 
         prepared(::shared_ptr<cql_statement> statement_, variable_specifications&& names);
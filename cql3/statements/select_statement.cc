@@ -47,6 +47,8 @@
 #include "query-result-reader.hh"
 #include "query_result_merger.hh"
 #include "service/pager/query_pagers.hh"
+#include "db/consistency_level.hh"
+#include "db/config.hh"
 
 namespace cql3 {
 
@@ -214,6 +216,21 @@ bool select_statement::needs_post_query_ordering() const {
     return _restrictions->key_is_in_relation() && !_parameters->orderings().empty();
 }
 
+bool select_statement::can_aggregate_on_replicas(distributed<service::storage_proxy>& proxy, db::consistency_level cl) const {
+    auto& db = proxy.local().get_db().local();
+    if (!db.get_config().aggregate_push_down() || !_selection->get_aggregate_selectors()) {
+        return false;
+    }
+    // A LIMIT restricts the rows which are aggregated, which replicas can't
+    // apply to their share of the rows.
+    if (_limit) {
+        return false;
+    }
+    // Replicas can't reconcile their rows with those of other replicas
+    // before aggregating them.
+    return db::block_for(db.find_keyspace(_schema->ks_name()), cl) == 1;
+}
+
 future<shared_ptr<transport::messages::result_message>>
 select_statement::execute(distributed<service::storage_proxy>& proxy, service::query_state& state, const query_options& options) {
     auto cl = options.get_consistency();
@@ -238,6 +255,10 @@ select_statement::execute(distributed<service::storage_proxy>& proxy, service::q
 
     auto key_ranges = _restrictions->get_partition_key_ranges(options);
 
+    if (aggregate && can_aggregate_on_replicas(proxy, cl)) {
+        return execute_aggregates_on_replicas(proxy, command, std::move(key_ranges), options, now);
+    }
+
     if (!aggregate && (page_size <= 0
             || !service::pager::query_pagers::may_need_paging(page_size,
                     *command, key_ranges))) {
@@ -359,6 +380,18 @@ shared_ptr<transport::messages::result_message> select_statement::process_result
     return ::make_shared<transport::messages::result_message::rows>(std::move(rs));
 }
 
+future<shared_ptr<transport::messages::result_message>>
+select_statement::execute_aggregates_on_replicas(distributed<service::storage_proxy>& proxy, lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges, const query_options& options, db_clock::time_point now) {
+    return proxy.local().query_partial_aggregates(_schema, cmd, std::move(partition_ranges), options.get_consistency(),
+            *_selection->get_aggregate_selectors()).then([this, &options, now] (std::vector<bytes_opt> partials) {
+        cql3::selection::result_set_builder builder(*_selection, now, options.get_cql_serialization_format());
+        builder.add_partial(partials);
+        auto msg = ::make_shared<transport::messages::result_message::rows>(builder.build());
+        return make_ready_future<shared_ptr<transport::messages::result_message>>(std::move(msg));
+    });
+}
+
 select_statement::raw_statement::raw_statement(::shared_ptr<cf_name> cf_name,
                                                ::shared_ptr<parameters> parameters,
                                                std::vector<::shared_ptr<selection::raw_selector>> select_clause,
@@ -406,7 +439,7 @@ select_statement::raw_statement::prepare(database& db) {
         std::move(ordering_comparator),
         prepare_limit(db, bound_names));
 
-    return ::make_shared<parsed_statement::prepared>(std::move(stmt), std::move(*bound_names));
+    return ::make_shared<parsed_statement::prepared>(std::move(stmt), *bound_names, schema);
 }
 
 ::shared_ptr<restrictions::statement_restrictions>
@@ -140,6 +140,12 @@ class select_statement : public cql_statement {
 
     shared_ptr<transport::messages::result_message> process_results(foreign_ptr<lw_shared_ptr<query::result>> results,
         lw_shared_ptr<query::read_command> cmd, const query_options& options, db_clock::time_point now);
+
+    // Computes the aggregates of the selection on the replicas, which return
+    // only partial states of the aggregates instead of the rows.
+    future<::shared_ptr<transport::messages::result_message>> execute_aggregates_on_replicas(distributed<service::storage_proxy>& proxy,
+        lw_shared_ptr<query::read_command> cmd, std::vector<query::partition_range>&& partition_ranges,
+        const query_options& options, db_clock::time_point now);
 #if 0
     private ResultMessage.Rows pageAggregateQuery(QueryPager pager, QueryOptions options, int pageSize, long now)
             throws RequestValidationException, RequestExecutionException
@@ -211,6 +217,7 @@ class select_statement : public cql_statement {
 private:
     int32_t get_limit(const query_options& options) const;
     bool needs_post_query_ordering() const;
+    bool can_aggregate_on_replicas(distributed<service::storage_proxy>& proxy, db::consistency_level cl) const;
 
 #if 0
     private int updateLimitForQuery(int limit)
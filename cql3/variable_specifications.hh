@@ -43,6 +43,7 @@
 
 #include "cql3/column_specification.hh"
 #include "cql3/column_identifier.hh"
+#include "schema.hh"
 
 #include <experimental/optional>
 #include <vector>
@@ -53,11 +54,14 @@ class variable_specifications final {
 private:
     std::vector<shared_ptr<column_identifier>> _variable_names;
     std::vector<::shared_ptr<column_specification>> _specs;
+    // The specifications as given to add(), before renaming by user names.
+    std::vector<::shared_ptr<column_specification>> _target_specs;
 
 public:
     variable_specifications(const std::vector<::shared_ptr<column_identifier>>& variable_names)
         : _variable_names{variable_names}
         , _specs{variable_names.size()}
+        , _target_specs{variable_names.size()}
     { }
 
     /**
@@ -80,7 +84,38 @@ class variable_specifications final {
         return std::move(_specs);
     }
 
+    /**
+     * Returns the bind indices of the variables which make up the partition key
+     * of the given table, in partition key component order, or an empty vector
+     * if the variables do not fully define the partition key, or bind some
+     * partition key column more than once.
+     */
+    std::vector<uint16_t> get_partition_key_bind_indices(const schema& s) const {
+        std::vector<uint16_t> indices(s.partition_key_size());
+        std::vector<bool> set(s.partition_key_size());
+        for (size_t i = 0; i < _target_specs.size(); ++i) {
+            auto& spec = _target_specs[i];
+            if (!spec || spec->ks_name != s.ks_name() || spec->cf_name != s.cf_name()) {
+                continue;
+            }
+            auto def = s.get_column_definition(spec->name->name());
+            if (!def || !def->is_partition_key()) {
+                continue;
+            }
+            if (set[def->component_index()]) {
+                return {};
+            }
+            indices[def->component_index()] = i;
+            set[def->component_index()] = true;
+        }
+        if (std::find(set.begin(), set.end(), false) != set.end()) {
+            return {};
+        }
+        return indices;
+    }
+
     void add(int32_t bind_index, ::shared_ptr<column_specification> spec) {
+        _target_specs[bind_index] = spec;
         auto name = _variable_names[bind_index];
         // Use the user name, if there is one
         if (name) {
@@ -39,6 +39,8 @@
 #include <boost/algorithm/string/split.hpp>
 #include "sstables/sstables.hh"
 #include "sstables/compaction.hh"
+#include "sstables/chunk_cache.hh"
+#include "sstables/index_page_cache.hh"
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include "locator/simple_snitch.hh"
@@ -46,6 +48,8 @@
 #include <boost/function_output_iterator.hpp>
 #include <boost/range/algorithm/heap_algorithm.hpp>
 #include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/remove.hpp>
+#include <boost/range/algorithm/sort.hpp>
 #include "frozen_mutation.hh"
 #include "mutation_partition_applier.hh"
 #include "core/do_with.hh"
@@ -124,8 +128,10 @@ column_family::column_family(schema_ptr schema, config config, no_commitlog cl,
 partition_presence_checker
 column_family::make_partition_presence_checker(lw_shared_ptr<sstable_list> old_sstables) {
     return [this, old_sstables = std::move(old_sstables)] (partition_key_view key) {
+        auto&& legacy = key.legacy_form(*_schema);
+        auto hash = utils::make_hashed_key(legacy.begin(), legacy.size());
         for (auto&& s : *old_sstables) {
-            if (s.second->filter_has_key(*_schema, key)) {
+            if (s.second->filter_has_key(hash)) {
                 return partition_presence_checker_result::maybe_exists;
             }
         }
@@ -169,7 +175,8 @@ class range_sstable_reader final : public mutation_reader::impl {
     // the priority changes.
     const io_priority_class& _pc;
 public:
-    range_sstable_reader(schema_ptr s, lw_shared_ptr<sstable_list> sstables, const query::partition_range& pr, const io_priority_class& pc)
+    range_sstable_reader(schema_ptr s, lw_shared_ptr<sstable_list> sstables, const query::partition_range& pr, const io_priority_class& pc,
+            bool use_chunk_cache = true)
         : _pr(pr)
         , _sstables(std::move(sstables))
         , _pc(pc)
@@ -177,7 +184,7 @@ class range_sstable_reader final : public mutation_reader::impl {
         std::vector<mutation_reader> readers;
         for (const lw_shared_ptr<sstables::sstable>& sst : *_sstables | boost::adaptors::map_values) {
             // FIXME: make sstable::read_range_rows() return ::mutation_reader so that we can drop this wrapper.
-            mutation_reader reader = make_mutation_reader<sstable_range_wrapping_reader>(sst, s, pr, pc);
+            mutation_reader reader = make_mutation_reader<sstable_range_wrapping_reader>(sst, s, pr, pc, use_chunk_cache);
             if (sst->is_shared()) {
                 reader = make_filtering_reader(std::move(reader), belongs_to_current_shard);
             }
@@ -193,20 +200,65 @@ class range_sstable_reader final : public mutation_reader::impl {
     }
 };
 
+// Returns the sstables whose filters admit the key, newest first.
+static std::vector<sstables::shared_sstable>
+sstables_with_key(const sstable_list& sstables, const utils::hashed_key& hash) {
+    std::vector<sstables::shared_sstable> ret;
+    for (const lw_shared_ptr<sstables::sstable>& sst : sstables | boost::adaptors::map_values) {
+        if (sst->filter_has_key(hash)) {
+            ret.push_back(sst);
+        }
+    }
+    boost::sort(ret, [] (const sstables::shared_sstable& a, const sstables::shared_sstable& b) {
+        return a->compare_by_max_timestamp(*b) > 0;
+    });
+    return ret;
+}
+
 class single_key_sstable_reader final : public mutation_reader::impl {
     schema_ptr _schema;
     sstables::key _key;
+    // Computed once, when the key is decorated, for all the sstables.
+    dht::token _token;
+    utils::hashed_key _hash;
     mutation_opt _m;
     bool _done = false;
     lw_shared_ptr<sstable_list> _sstables;
+    // Sstables whose filters admit the key, newest first.
+    std::vector<sstables::shared_sstable> _candidates;
+    // If engaged, only rows in these ranges are needed.
+    std::experimental::optional<query::clustering_row_ranges> _ck_ranges;
     // Use a pointer instead of copying, so we don't need to regenerate the reader if
     // the priority changes.
     const io_priority_class& _pc;
+private:
+    future<> read_from(const sstables::shared_sstable& sst) {
+        // The sstable is one of the candidates, so its filter admits the key.
+        auto f = _ck_ranges ? sst->read_row(_schema, _key, _token, *_ck_ranges, _pc) : sst->read_row(_schema, _key, _token, _pc);
+        return f.then([this] (mutation_opt mo) {
+            apply(_m, std::move(mo));
+        });
+    }
+    // An sstable with no tombstones has no partition tombstone, and one can
+    // only shadow sstables with no data newer than the sstable's own.
+    bool newest_may_shadow_older() const {
+        auto& stats = _candidates.front()->get_stats_metadata();
+        if (stats.estimated_tombstone_drop_time.bin.map.empty()) {
+            return false;
+        }
+        return std::any_of(std::next(_candidates.begin()), _candidates.end(), [&stats] (const sstables::shared_sstable& sst) {
+            return sst->get_stats_metadata().max_timestamp <= stats.max_timestamp;
+        });
+    }
 public:
-    single_key_sstable_reader(schema_ptr schema, lw_shared_ptr<sstable_list> sstables, const partition_key& key, const io_priority_class& pc)
+    single_key_sstable_reader(schema_ptr schema, lw_shared_ptr<sstable_list> sstables, const dht::decorated_key& dk, const io_priority_class& pc,
+            std::experimental::optional<query::clustering_row_ranges> ck_ranges = {})
         : _schema(std::move(schema))
-        , _key(sstables::key::from_partition_key(*_schema, key))
+        , _key(sstables::key::from_partition_key(*_schema, dk.key()))
+        , _token(dk.token())
+        , _hash(dk.key_hash(*_schema))
         , _sstables(std::move(sstables))
+        , _ck_ranges(std::move(ck_ranges))
         , _pc(pc)
     { }
 
@@ -214,17 +266,84 @@ class single_key_sstable_reader final : public mutation_reader::impl {
         if (_done) {
             return make_ready_future<mutation_opt>();
         }
-        return parallel_for_each(*_sstables | boost::adaptors::map_values, [this](const lw_shared_ptr<sstables::sstable>& sstable) {
-            return sstable->read_row(_schema, _key, _pc).then([this](mutation_opt mo) {
-                apply(_m, std::move(mo));
+        _done = true;
+        _candidates = sstables_with_key(*_sstables, _hash);
+        if (_candidates.empty()) {
+            return make_ready_future<mutation_opt>();
+        }
+        // Reading the newest sstable first only pays off if it may carry a
+        // partition tombstone which shadows older sstables. Otherwise all of
+        // them are read in a single parallel round.
+        if (!newest_may_shadow_older()) {
+            return parallel_for_each(_candidates, [this] (const sstables::shared_sstable& sst) {
+                return read_from(sst);
+            }).then([this] {
+                return std::move(_m);
+            });
+        }
+        // If the newest sstable carries a partition tombstone, older sstables
+        // with no data newer than it can be skipped. The rest is read in
+        // parallel so that latency doesn't grow with their number.
+        return read_from(_candidates.front()).then([this] {
+            auto t = _m ? _m->partition().partition_tombstone() : tombstone();
+            auto older = std::next(_candidates.begin());
+            auto first_shadowed = std::find_if(older, _candidates.end(), [t] (const sstables::shared_sstable& sst) {
+                return sst->get_stats_metadata().max_timestamp <= t.timestamp;
+            });
+            auto rest = boost::make_iterator_range(older, first_shadowed);
+            return parallel_for_each(rest, [this] (const sstables::shared_sstable& sst) {
+                return read_from(sst);
             });
         }).then([this] {
-            _done = true;
             return std::move(_m);
         });
     }
 };
 
+// Reads a single partition around the cache if some sstable holds it with a
+// promoted index, that is, if it is wide enough for reads of a clustering
+// slice to be better served by skipping to the blocks they need than by
+// caching it whole. Otherwise the partition is read through the cache.
+class wide_partition_bypassing_reader final : public mutation_reader::impl {
+    sstables::key _key;
+    dht::token _token;
+    utils::hashed_key _hash;
+    lw_shared_ptr<sstable_list> _sstables;
+    const io_priority_class& _pc;
+    std::function<mutation_reader ()> _make_cached_reader;
+    std::function<mutation_reader ()> _make_uncached_reader;
+    mutation_reader _reader;
+    bool _started = false;
+public:
+    wide_partition_bypassing_reader(const schema& s, lw_shared_ptr<sstable_list> sstables, const dht::decorated_key& dk, const io_priority_class& pc,
+            std::function<mutation_reader ()> make_cached_reader, std::function<mutation_reader ()> make_uncached_reader)
+        : _key(sstables::key::from_partition_key(s, dk.key()))
+        , _token(dk.token())
+        , _hash(dk.key_hash(s))
+        , _sstables(std::move(sstables))
+        , _pc(pc)
+        , _make_cached_reader(std::move(make_cached_reader))
+        , _make_uncached_reader(std::move(make_uncached_reader))
+    { }
+
+    virtual future<mutation_opt> operator()() override {
+        if (_started) {
+            return _reader();
+        }
+        _started = true;
+        // Only sstables which may hold the partition have their index
+        // looked up, and the index pages read stay cached for the read
+        // which follows.
+        auto candidates = make_lw_shared(sstables_with_key(*_sstables, _hash));
+        return map_reduce(candidates->begin(), candidates->end(), [this] (const sstables::shared_sstable& sst) {
+            return sst->has_promoted_index(_key, _token, _pc);
+        }, false, std::logical_or<bool>()).then([this, candidates] (bool wide) {
+            _reader = wide ? _make_uncached_reader() : _make_cached_reader();
+            return _reader();
+        });
+    }
+};
+
 mutation_reader
 column_family::make_sstable_reader(schema_ptr s, const query::partition_range& pr, const io_priority_class& pc) const {
     if (pr.is_singular() && pr.start()->value().has_key()) {
@@ -232,7 +351,7 @@ column_family::make_sstable_reader(schema_ptr s, const query::partition_range& p
         if (dht::shard_of(pos.token()) != engine().cpu_id()) {
             return make_empty_reader(); // range doesn't belong to this shard
         }
-        return make_mutation_reader<single_key_sstable_reader>(std::move(s), _sstables, *pos.key(), pc);
+        return make_mutation_reader<single_key_sstable_reader>(std::move(s), _sstables, pos.as_decorated_key(), pc);
     } else {
         // range_sstable_reader is not movable so we need to wrap it
         return make_mutation_reader<range_sstable_reader>(std::move(s), _sstables, pr, pc);
@@ -315,13 +434,9 @@ column_family::make_reader(schema_ptr s, const query::partition_range& range, co
     // We need to handle this in range queries though, as they are always
     // deferring. scanning_reader from memtable.cc is falling back to reading
     // the sstable when memtable is flushed. After memtable is moved to cache,
-    // new readers will no longer use the old memtable, but until then
-    // performance may suffer. We should fix this when we add support for
-    // range queries in cache, so that scans can always be satisfied form
+    // new readers will no longer use the old memtable. Cache tracks which
+    // ranges it holds completely, so scans over them are satisfied from
     // memtable and cache only, as long as data is not evicted.
-    //
-    // https://github.com/scylladb/scylla/issues/309
-    // https://github.com/scylladb/scylla/issues/185
 
     for (auto&& mt : *_memtables) {
         readers.emplace_back(mt->make_reader(s, range, pc));
@@ -336,6 +451,76 @@ column_family::make_reader(schema_ptr s, const query::partition_range& range, co
     return make_combined_reader(std::move(readers));
 }
 
+mutation_reader
+column_family::make_streaming_reader(schema_ptr s, const query::partition_range& range,
+        const std::unordered_set<int64_t>& excluded_generations, const io_priority_class& pc) const {
+    if (query::is_wrap_around(range, *s)) {
+        fail(unimplemented::cause::WRAP_AROUND);
+    }
+
+    std::vector<mutation_reader> readers;
+    readers.reserve(_memtables->size() + 1);
+    for (auto&& mt : *_memtables) {
+        readers.emplace_back(mt->make_reader(s, range, pc));
+    }
+
+    auto sstables = make_lw_shared<sstable_list>();
+    for (auto&& entry : *_sstables) {
+        if (!excluded_generations.count(entry.first)) {
+            sstables->emplace(entry);
+        }
+    }
+    // Streaming goes through the sstables once, so it bypasses the chunk cache.
+    readers.emplace_back(make_mutation_reader<range_sstable_reader>(std::move(s), std::move(sstables), range, pc, false));
+
+    return make_combined_reader(std::move(readers));
+}
+
+mutation_reader
+column_family::make_reader(schema_ptr s, const query::partition_range& range, const query::partition_slice& slice,
+        const io_priority_class& pc) const {
+    if (!range.is_singular() || !range.start()->value().has_key() || !s->clustering_key_size()) {
+        return make_reader(std::move(s), range, pc);
+    }
+    const dht::ring_position& pos = range.start()->value();
+    auto& ck_ranges = slice.row_ranges(*s, *pos.key());
+    // No range at all selects just the partition-level part, which is read
+    // with the first promoted index block.
+    auto restricted = ck_ranges.empty() || std::any_of(ck_ranges.begin(), ck_ranges.end(), [] (const query::clustering_range& r) {
+        return r.start() || r.end();
+    });
+    if (!restricted || dht::shard_of(pos.token()) != engine().cpu_id()) {
+        return make_reader(std::move(s), range, pc);
+    }
+
+    auto dk = pos.as_decorated_key();
+    if (_config.enable_cache && _cache.contains(dk)) {
+        return make_reader(std::move(s), range, pc);
+    }
+    // Hashed once, for the filters of all the sstables.
+    dk.key_hash(*s);
+
+    // Like make_reader(), the memtables and the sstables must be read as of
+    // the same point in time.
+    auto make_uncached_reader = [this, s, &range, dk, ck_ranges, &pc] {
+        std::vector<mutation_reader> readers;
+        readers.reserve(_memtables->size() + 1);
+        for (auto&& mt : *_memtables) {
+            readers.emplace_back(mt->make_reader(s, range, pc));
+        }
+        readers.emplace_back(make_mutation_reader<single_key_sstable_reader>(s, _sstables, dk, pc, ck_ranges));
+        return make_combined_reader(std::move(readers));
+    };
+    if (!_config.enable_cache) {
+        return make_uncached_reader();
+    }
+    auto make_cached_reader = [this, s, &range, &pc] {
+        return make_reader(s, range, pc);
+    };
+    return make_mutation_reader<wide_partition_bypassing_reader>(*s, _sstables, dk, pc,
+            std::move(make_cached_reader), std::move(make_uncached_reader));
+}
+
 // Not performance critical. Currently used for testing only.
 template <typename Func>
 future<bool>
@@ -540,7 +725,17 @@ void column_family::add_sstable(lw_shared_ptr<sstables::sstable> sstable) {
     // allow in-progress reads to continue using old list
     _sstables = make_lw_shared<sstable_list>(*_sstables);
     update_stats_for_new_sstable(sstable->bytes_on_disk());
+    if (sstable->get_compression_dictionary()) {
+        _compression_dictionary = sstable->get_compression_dictionary();
+    }
     _sstables->emplace(generation, std::move(sstable));
+    evict_queriers();
+}
+
+void column_family::evict_queriers() {
+    if (_config.queriers) {
+        _config.queriers->evict_all_for_table(_schema->id());
+    }
 }
 
 lw_shared_ptr<memtable> column_family::new_memtable() {
@@ -616,6 +811,7 @@ column_family::seal_active_streaming_memtable() {
                 sstables::sstable::format_types::big);
 
             newtab->set_unshared();
+            newtab->set_compression_dictionary(_compression_dictionary);
 
             auto&& priority = service::get_local_streaming_write_priority();
             // This is somewhat similar to the main memtable flush, but with important differences.
@@ -668,6 +864,7 @@ column_family::seal_active_memtable() {
         return make_ready_future<>();
     }
     _memtables->add_memtable();
+    evict_queriers();
 
     assert(_highest_flushed_rp < old->replay_position()
     || (_highest_flushed_rp == db::replay_position() && old->replay_position() == db::replay_position())
@@ -704,6 +901,7 @@ column_family::try_flush_memtable_to_sstable(lw_shared_ptr<memtable> old) {
     _config.cf_stats->pending_memtables_flushes_count++;
     _config.cf_stats->pending_memtables_flushes_bytes += memtable_size;
     newtab->set_unshared();
+    newtab->set_compression_dictionary(_compression_dictionary);
     dblog.debug("Flushing to {}", newtab->get_filename());
     // Note that due to our sharded architecture, it is possible that
     // in the face of a value change some shards will backup sstables
@@ -863,6 +1061,9 @@ column_family::rebuild_sstable_list(const std::vector<sstables::shared_sstable>&
         // FIXME: rename the new sstable(s). Verify a rename doesn't cause
         // problems for the sstable object.
         update_stats_for_new_sstable(newtab->data_size());
+        if (newtab->get_compression_dictionary()) {
+            _compression_dictionary = newtab->get_compression_dictionary();
+        }
         new_sstable_list->emplace(newtab->generation(), newtab);
     }
 
@@ -871,6 +1072,7 @@ column_family::rebuild_sstable_list(const std::vector<sstables::shared_sstable>&
     }
 
     _sstables = std::move(new_sstable_list);
+    evict_queriers();
 }
 
 future<>
@@ -892,8 +1094,23 @@ column_family::compact_sstables(sstables::compaction_descriptor descriptor, bool
                 sst->set_unshared();
                 return sst;
         };
-        return sstables::compact_sstables(*sstables_to_compact, *this, create_sstable, descriptor.max_sstable_bytes, descriptor.level,
-                cleanup).then([this, sstables_to_compact] (auto new_sstables) {
+        auto max_sstable_bytes = descriptor.max_sstable_bytes;
+        sstables::compaction_release_fn release;
+        if (_config.compaction_fragment_size) {
+            // Incremental compaction: replace inputs as soon as the sealed
+            // output covers them, so that their space is given back early.
+            max_sstable_bytes = std::min(max_sstable_bytes, _config.compaction_fragment_size);
+            release = [this, sstables_to_compact] (const std::vector<sstables::shared_sstable>& sealed,
+                    const std::vector<sstables::shared_sstable>& exhausted) {
+                this->rebuild_sstable_list(sealed, exhausted);
+                for (auto& sst : exhausted) {
+                    sstables_to_compact->erase(boost::remove(*sstables_to_compact, sst), sstables_to_compact->end());
+                }
+                _compaction_manager.release_compacting_sstables(exhausted);
+            };
+        }
+        return sstables::compact_sstables(*sstables_to_compact, *this, create_sstable, max_sstable_bytes, descriptor.level,
+                cleanup, std::move(release)).then([this, sstables_to_compact] (auto new_sstables) {
             this->rebuild_sstable_list(new_sstables, *sstables_to_compact);
         });
     });
@@ -943,6 +1160,13 @@ column_family::load_new_sstables(std::vector<sstables::entry_descriptor> new_tab
             auto last = sst->get_last_partition_key(*_schema);
             if (belongs_to_current_shard(*_schema, first, last)) {
                 this->add_sstable(sst);
+                if (_config.enable_cache) {
+                    // Cache doesn't know about partitions from the new sstable.
+                    auto& partitioner = dht::global_partitioner();
+                    _cache.invalidate(query::partition_range::make(
+                        {partitioner.decorate_key(*_schema, std::move(first)), true},
+                        {partitioner.decorate_key(*_schema, std::move(last)), true}));
+                }
             } else {
                 sst->mark_for_deletion();
             }
@@ -1173,6 +1397,24 @@ database::database(const db::config& cfg)
     _compaction_manager.start(2);
     setup_collectd();
 
+    auto chunk_cache_size = size_t(cfg.compressed_chunk_cache_size_in_mb()) << 20;
+    if (!chunk_cache_size) {
+        chunk_cache_size = memory::stats().total_memory() / 20;
+    }
+    sstables::global_chunk_cache().set_max_size(chunk_cache_size);
+    auto index_page_cache_size = size_t(cfg.index_page_cache_size_in_mb()) << 20;
+    if (!index_page_cache_size) {
+        index_page_cache_size = memory::stats().total_memory() / 50;
+    }
+    sstables::global_index_page_cache().set_max_size(index_page_cache_size);
+    auto querier_cache_size = size_t(cfg.querier_cache_size_in_mb()) << 20;
+    if (!querier_cache_size) {
+        querier_cache_size = memory::stats().total_memory() / 50;
+    }
+    _querier_cache.set_max_size(querier_cache_size);
+    sstables::sstable::set_column_index_size(size_t(cfg.column_index_size_in_kb()) << 10);
+    sstables::sstable::set_filter_format(cfg.blocked_bloom_filters() ? utils::filter_format::blocked : utils::filter_format::classic);
+
     dblog.info("Row: max_vector_size: {}, internal_count: {}", size_t(row::max_vector_size), size_t(row::internal_count));
 }
 
@@ -1438,6 +1680,7 @@ future<> database::drop_column_family(const sstring& ks_name, const sstring& cf_
     auto& ks = find_keyspace(ks_name);
     auto cf = _column_families.at(uuid);
     _column_families.erase(uuid);
+    _querier_cache.evict_all_for_table(uuid);
     ks.metadata()->remove_column_family(cf->schema());
     _ks_cf_to_uuid.erase(std::make_pair(ks_name, cf_name));
     return truncate(ks, *cf, std::move(tsf)).then([this, cf] {
@@ -1557,9 +1800,12 @@ keyspace::make_column_family_config(const schema& s) const {
     cfg.enable_commitlog = _config.enable_commitlog;
     cfg.enable_cache = _config.enable_cache;
     cfg.max_memtable_size = _config.max_memtable_size;
+    cfg.compaction_fragment_size = _config.compaction_fragment_size;
+    cfg.compaction_sub_range_size = _config.compaction_sub_range_size;
     cfg.dirty_memory_region_group = _config.dirty_memory_region_group;
     cfg.streaming_dirty_memory_region_group = _config.streaming_dirty_memory_region_group;
     cfg.cf_stats = _config.cf_stats;
+    cfg.queriers = _config.queriers;
     cfg.enable_incremental_backups = _config.enable_incremental_backups;
 
     return cfg;
@@ -1700,6 +1946,92 @@ compare_atomic_cell_for_merge(atomic_cell_view left, atomic_cell_view right) {
     return 0;
 }
 
+// Adds the rows of the partition selected by the query, at most limit of
+// them, to the result. Returns the number of rows added.
+static uint32_t add_partition(query::result::builder& builder, const schema& s, const query::read_command& cmd,
+        mutation& m, uint32_t limit) {
+    auto p_builder = builder.add_partition(*m.schema(), m.key());
+    auto is_distinct = cmd.slice.options.contains(query::partition_slice::option::distinct);
+    return m.partition().query(p_builder, s, cmd.timestamp, !is_distinct ? limit : 1);
+}
+
+struct range_read_state {
+    range_read_state(schema_ptr s, const query::read_command& cmd, querier_cache* queriers,
+                     std::function<stop_iteration (mutation&&)> consumer)
+            : schema(std::move(s))
+            , cmd(cmd)
+            , queriers(queriers)
+            , consumer(std::move(consumer)) {
+    }
+    schema_ptr schema;
+    const query::read_command& cmd;
+    querier_cache* queriers;
+    std::function<stop_iteration (mutation&&)> consumer;
+    querier_snapshot snapshot;
+    // The range the reader reads, owned by the querier if it is suspended.
+    std::unique_ptr<query::partition_range> range;
+    mutation_reader reader;
+    // The partition the consumer stopped at.
+    std::experimental::optional<dht::decorated_key> last;
+    bool range_empty = false;
+};
+
+future<>
+column_family::read_range(schema_ptr s, const query::read_command& cmd, const query::partition_range& range,
+        querier_cache* queriers, std::function<stop_iteration (mutation&&)> consumer) const {
+    auto rs_ptr = std::make_unique<range_read_state>(std::move(s), cmd, queriers, std::move(consumer));
+    auto& rs = *rs_ptr;
+    auto& pc = service::get_local_sstable_query_read_priority();
+    std::experimental::optional<querier> resumed;
+    if (queriers) {
+        resumed = queriers->lookup(cmd.query_id, *rs.schema, snapshot_for_querier(), range);
+    }
+    auto f = make_ready_future<>();
+    if (resumed) {
+        rs.snapshot = resumed->snapshot();
+        rs.range = std::move(resumed->range());
+        rs.reader = std::move(resumed->reader());
+        // The page starts after the partition the previous one ended in,
+        // unless that partition has rows left. The reader is past it, so
+        // they are read again, with the slice of this page.
+        if (range.start()->is_inclusive()) {
+            auto last = make_lw_shared<query::partition_range>(query::partition_range::make_singular(resumed->last()));
+            auto reader = make_lw_shared<mutation_reader>(make_reader(rs.schema, *last, cmd.slice, pc));
+            f = (*reader)().then([&rs, last, reader] (mutation_opt mo) {
+                if (mo) {
+                    auto key = mo->decorated_key();
+                    if (rs.consumer(std::move(*mo)) == stop_iteration::yes) {
+                        rs.last = std::move(key);
+                    }
+                }
+            });
+        }
+    } else {
+        rs.snapshot = snapshot_for_querier();
+        rs.range = std::make_unique<query::partition_range>(range);
+        rs.reader = make_reader(rs.schema, *rs.range, cmd.slice, pc);
+    }
+    return f.then([&rs] {
+        return do_until([&rs] { return rs.last || rs.range_empty; }, [&rs] {
+            return rs.reader().then([&rs] (mutation_opt mo) {
+                if (!mo) {
+                    rs.range_empty = true;
+                    return;
+                }
+                auto key = mo->decorated_key();
+                if (rs.consumer(std::move(*mo)) == stop_iteration::yes) {
+                    rs.last = std::move(key);
+                }
+            });
+        });
+    }).then([rs_ptr = std::move(rs_ptr), &rs] {
+        if (rs.queriers && rs.last && !rs.range_empty) {
+            rs.queriers->insert(rs.cmd.query_id, querier(rs.schema, std::move(rs.snapshot), std::move(rs.range),
+                    std::move(rs.reader), std::move(*rs.last)));
+        }
+    });
+}
+
 struct query_state {
     explicit query_state(schema_ptr s,
                          const query::read_command& cmd,
@@ -1716,38 +2048,35 @@ struct query_state {
     const query::read_command& cmd;
     query::result::builder builder;
     uint32_t limit;
-    bool range_empty = false;   // Avoid ubsan false-positive when moving after construction
     std::vector<query::partition_range>::const_iterator current_partition_range;
     std::vector<query::partition_range>::const_iterator range_end;
-    mutation_reader reader;
     bool done() const {
         return !limit || current_partition_range == range_end;
     }
+    stop_iteration consume(mutation&& m) {
+        limit -= add_partition(builder, *schema, cmd, m, limit);
+        return limit ? stop_iteration::no : stop_iteration::yes;
+    }
 };
 
 future<lw_shared_ptr<query::result>>
-column_family::query(schema_ptr s, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& partition_ranges) {
+column_family::query(schema_ptr s, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& partition_ranges,
+        querier_cache* queriers) {
     utils::latency_counter lc;
     _stats.reads.set_latency(lc);
     auto qs_ptr = std::make_unique<query_state>(std::move(s), cmd, request, partition_ranges);
     auto& qs = *qs_ptr;
+    // Pages of reversed queries end where the previous page started, so
+    // they never continue a suspended reader.
+    if (cmd.query_id == utils::UUID() || partition_ranges.size() != 1
+            || cmd.slice.options.contains(query::partition_slice::option::reversed)) {
+        queriers = nullptr;
+    }
     {
-        return do_until(std::bind(&query_state::done, &qs), [this, &qs] {
+        return do_until(std::bind(&query_state::done, &qs), [this, &qs, queriers] {
             auto&& range = *qs.current_partition_range++;
-            qs.reader = make_reader(qs.schema, range, service::get_local_sstable_query_read_priority());
-            qs.range_empty = false;
-            return do_until([&qs] { return !qs.limit || qs.range_empty; }, [&qs] {
-                return qs.reader().then([&qs](mutation_opt mo) {
-                    if (mo) {
-                        auto p_builder = qs.builder.add_partition(*mo->schema(), mo->key());
-                        auto is_distinct = qs.cmd.slice.options.contains(query::partition_slice::option::distinct);
-                        auto limit = !is_distinct ? qs.limit : 1;
-                        auto rows_added = mo->partition().query(p_builder, *qs.schema, qs.cmd.timestamp, limit);
-                        qs.limit -= rows_added;
-                    } else {
-                        qs.range_empty = true;
-                    }
-                });
+            return read_range(qs.schema, qs.cmd, range, queriers, [&qs] (mutation&& m) {
+                return qs.consume(std::move(m));
             });
         }).then([qs_ptr = std::move(qs_ptr), &qs] {
             return make_ready_future<lw_shared_ptr<query::result>>(
@@ -1761,6 +2090,89 @@ column_family::query(schema_ptr s, const query::read_command& cmd, query::result
     }
 }
 
+future<reconcilable_result>
+column_family::query_mutations(schema_ptr s, const query::read_command& cmd, const query::partition_range& range,
+        querier_cache* queriers) {
+    if (cmd.row_limit == 0) {
+        return make_ready_future<reconcilable_result>(reconcilable_result());
+    }
+    // See query().
+    if (cmd.query_id == utils::UUID() || cmd.slice.options.contains(query::partition_slice::option::reversed)) {
+        queriers = nullptr;
+    }
+    auto builder = make_lw_shared<reconcilable_result_builder>(cmd.slice, cmd.row_limit, cmd.timestamp);
+    return read_range(std::move(s), cmd, range, queriers, [builder] (mutation&& m) {
+        return builder->consume(std::move(m));
+    }).then([builder] {
+        return builder->build();
+    });
+}
+
+struct paged_query_state {
+    explicit paged_query_state(schema_ptr s,
+                               lw_shared_ptr<query::read_command> cmd,
+                               const std::vector<query::partition_range>& ranges,
+                               uint32_t page_rows,
+                               std::function<void (const query::result&)> consumer)
+            : schema(std::move(s))
+            , cmd(std::move(cmd))
+            , page_rows(page_rows)
+            , consumer(std::move(consumer))
+            , builder(std::make_unique<query::result::builder>(this->cmd->slice, query::result_request::only_result))
+            , limit(this->cmd->row_limit)
+            , current_partition_range(ranges.begin())
+            , range_end(ranges.end()) {
+    }
+    schema_ptr schema;
+    lw_shared_ptr<query::read_command> cmd;
+    uint32_t page_rows;
+    std::function<void (const query::result&)> consumer;
+    // query::result::builder can't be moved, nor reused after build().
+    std::unique_ptr<query::result::builder> builder;
+    uint32_t rows_in_page = 0;
+    bool page_empty = true;
+    uint32_t limit;
+    std::vector<query::partition_range>::const_iterator current_partition_range;
+    std::vector<query::partition_range>::const_iterator range_end;
+    bool done() const {
+        return !limit || current_partition_range == range_end;
+    }
+    stop_iteration consume(mutation&& m) {
+        auto rows_added = add_partition(*builder, *schema, *cmd, m, limit);
+        limit -= rows_added;
+        rows_in_page += rows_added;
+        page_empty = false;
+        if (rows_in_page >= page_rows) {
+            flush();
+        }
+        return limit ? stop_iteration::no : stop_iteration::yes;
+    }
+    void flush() {
+        if (page_empty) {
+            return;
+        }
+        consumer(builder->build());
+        builder = std::make_unique<query::result::builder>(cmd->slice, query::result_request::only_result);
+        rows_in_page = 0;
+        page_empty = true;
+    }
+};
+
+future<>
+column_family::query_in_pages(schema_ptr s, lw_shared_ptr<query::read_command> cmd, const std::vector<query::partition_range>& partition_ranges,
+        uint32_t page_rows, std::function<void (const query::result&)> consumer) {
+    auto qs_ptr = std::make_unique<paged_query_state>(std::move(s), std::move(cmd), partition_ranges, page_rows, std::move(consumer));
+    auto& qs = *qs_ptr;
+    return do_until(std::bind(&paged_query_state::done, &qs), [this, &qs] {
+        auto&& range = *qs.current_partition_range++;
+        return read_range(qs.schema, *qs.cmd, range, nullptr, [&qs] (mutation&& m) {
+            return qs.consume(std::move(m));
+        });
+    }).then([qs_ptr = std::move(qs_ptr), &qs] {
+        qs.flush();
+    });
+}
+
 mutation_source
 column_family::as_mutation_source() const {
     return mutation_source([this] (schema_ptr s, const query::partition_range& range, const io_priority_class& pc) {
@@ -1771,13 +2183,13 @@ column_family::as_mutation_source() const {
 future<lw_shared_ptr<query::result>>
 database::query(schema_ptr s, const query::read_command& cmd, query::result_request request, const std::vector<query::partition_range>& ranges) {
     column_family& cf = find_column_family(cmd.cf_id);
-    return cf.query(std::move(s), cmd, request, ranges);
+    return cf.query(std::move(s), cmd, request, ranges, &_querier_cache);
 }
 
 future<reconcilable_result>
 database::query_mutations(schema_ptr s, const query::read_command& cmd, const query::partition_range& range) {
     column_family& cf = find_column_family(cmd.cf_id);
-    return mutation_query(std::move(s), cf.as_mutation_source(), range, cmd.slice, cmd.row_limit, cmd.timestamp);
+    return cf.query_mutations(std::move(s), cmd, range, &_querier_cache);
 }
 
 std::unordered_set<sstring> database::get_initial_tokens() {
@@ -1847,6 +2259,7 @@ column_family::apply(const mutation& m, const db::replay_position& rp) {
     utils::latency_counter lc;
     _stats.writes.set_latency(lc);
     _memtables->active_memtable().apply(m, rp);
+    ++_writes;
     _memtables->seal_on_overflow();
     _stats.writes.mark(lc);
     if (lc.is_start()) {
@@ -1860,6 +2273,7 @@ column_family::apply(const frozen_mutation& m, const schema_ptr& m_schema, const
     _stats.writes.set_latency(lc);
     check_valid_rp(rp);
     _memtables->active_memtable().apply(m, m_schema, rp);
+    ++_writes;
     _memtables->seal_on_overflow();
     _stats.writes.mark(lc);
     if (lc.is_start()) {
@@ -1997,6 +2411,32 @@ future<> database::apply_streaming_mutation(schema_ptr s, const frozen_mutation&
     });
 }
 
+future<> database::apply_streaming_mutations(schema_ptr s, const std::vector<const frozen_mutation*>& ms) {
+    if (!s->is_synced()) {
+        throw std::runtime_error(sprint("attempted to mutate using not synced schema of %s.%s, version=%s",
+                                 s->ks_name(), s->cf_name(), s->version()));
+    }
+    // The batch is bounded by stream_mutation_batch_size_in_kb, so it is
+    // throttled as a whole. Yield only when preemption is due, so that a
+    // large batch doesn't stall the reactor.
+    return _streaming_throttler.throttle().then([this, s = std::move(s), &ms] {
+        return do_with(ms.begin(), [this, s, &ms] (auto& it) {
+            return repeat([this, s, &ms, &it] {
+                while (it != ms.end()) {
+                    const frozen_mutation& m = **it++;
+                    find_column_family(m.column_family_id()).apply_streaming_mutation(s, m);
+                    if (need_preempt() && it != ms.end()) {
+                        return later().then([] {
+                            return stop_iteration::no;
+                        });
+                    }
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            });
+        });
+    });
+}
+
 keyspace::config
 database::make_keyspace_config(const keyspace_metadata& ksm) {
     // FIXME support multiple directories
@@ -2016,9 +2456,12 @@ database::make_keyspace_config(const keyspace_metadata& ksm) {
         cfg.enable_cache = false;
         cfg.max_memtable_size = std::numeric_limits<size_t>::max();
     }
+    cfg.compaction_fragment_size = uint64_t(_cfg->compaction_fragment_size_in_mb()) << 20;
+    cfg.compaction_sub_range_size = uint64_t(_cfg->compaction_sub_range_size_in_mb()) << 20;
     cfg.dirty_memory_region_group = &_dirty_memory_region_group;
     cfg.streaming_dirty_memory_region_group = &_streaming_dirty_memory_region_group;
     cfg.cf_stats = &_cf_stats;
+    cfg.queriers = &_querier_cache;
     cfg.enable_incremental_backups = _enable_incremental_backups;
     return cfg;
 }
@@ -2079,6 +2522,7 @@ database::stop() {
         }
         return make_ready_future<>();
     }).then([this] {
+        _querier_cache.clear();
         return parallel_for_each(_column_families, [this] (auto& val_pair) {
             return val_pair.second->stop();
         });
@@ -2099,6 +2543,8 @@ future<> database::truncate(sstring ksname, sstring cfname, timestamp_func tsf)
 
 future<> database::truncate(const keyspace& ks, column_family& cf, timestamp_func tsf)
 {
+    // Suspended readers would keep the truncated sstables alive.
+    _querier_cache.evict_all_for_table(cf.schema()->id());
     const auto durable = ks.metadata()->durable_writes();
     const auto auto_snapshot = get_config().auto_snapshot();
 
@@ -2500,6 +2946,7 @@ void column_family::clear() {
     _memtables->add_memtable();
     _streaming_memtables->clear();
     _streaming_memtables->add_memtable();
+    evict_queriers();
 }
 
 // NOTE: does not need to be futurized, but might eventually, depending on
@@ -2525,6 +2972,7 @@ future<db::replay_position> column_family::discard_sstables(db_clock::time_point
         }
 
         _sstables = std::move(pruned);
+        evict_queriers();
         dblog.debug("cleaning out row cache");
         _cache.clear();
 
@@ -37,6 +37,7 @@
 #include <functional>
 #include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <set>
 #include <iostream>
@@ -70,6 +71,7 @@
 #include "sstables/estimated_histogram.hh"
 #include "sstables/compaction.hh"
 #include "key_reader.hh"
+#include "querier.hh"
 #include <seastar/core/rwlock.hh>
 #include <seastar/core/shared_future.hh>
 
@@ -212,9 +214,17 @@ class column_family {
         bool enable_commitlog = true;
         bool enable_incremental_backups = false;
         size_t max_memtable_size = 5'000'000;
+        // Maximum size of compaction output fragments, 0 if compaction isn't incremental.
+        uint64_t compaction_fragment_size = 0;
+        // Size of the input each concurrent compaction sub-range gets, 0
+        // if compactions aren't split.
+        uint64_t compaction_sub_range_size = 0;
         logalloc::region_group* dirty_memory_region_group = nullptr;
         logalloc::region_group* streaming_dirty_memory_region_group = nullptr;
         ::cf_stats* cf_stats = nullptr;
+        // Suspended readers of the shard; those of this column family are
+        // dropped once its memtable or sstable set changes.
+        querier_cache* queriers = nullptr;
     };
     struct no_commitlog {};
     struct stats {
@@ -244,7 +254,12 @@ class column_family {
     schema_ptr _schema;
     config _config;
     stats _stats;
+    // Read latencies of this table's replicas, as seen when coordinating reads
+    // on this shard. Used to time speculative retries.
+    std::unordered_map<gms::inet_address, utils::decaying_histogram> _replica_read_latencies;
     lw_shared_ptr<memtable_list> _memtables;
+    // Writes applied to _memtables, which suspended queriers don't see.
+    uint64_t _writes = 0;
 
     // In older incarnations, we simply commited the mutations to memtables.
     // However, doing that makes it harder for us to provide QoS within the
@@ -272,6 +287,10 @@ class column_family {
     rwlock _sstables_lock;
     mutable row_cache _cache; // Cache covers only sstables.
     std::experimental::optional<int64_t> _sstable_generation = {};
+    // zstd dictionary of the sstable added last, which memtable flushes reuse
+    // rather than training one on every small flush. Compaction trains anew,
+    // so the dictionary follows the data as it changes.
+    lw_shared_ptr<const sstables::compression_dictionary> _compression_dictionary;
 
     db::replay_position _highest_flushed_rp;
     // Provided by the database that owns this commitlog
@@ -295,6 +314,16 @@ class column_family {
     void update_stats_for_new_sstable(uint64_t disk_space_used_by_sstable);
     void add_sstable(sstables::sstable&& sstable);
     void add_sstable(lw_shared_ptr<sstables::sstable> sstable);
+    // Called when snapshot_for_querier() changes. Suspended queriers can't
+    // be resumed anymore, and would only keep the old memtable and sstables
+    // alive until they expire.
+    void evict_queriers();
+    // Reads the partitions of one range of a query, until the range ends or
+    // the consumer stops. If queriers is given, a page of a paged query
+    // resumes the reader suspended by the query's previous page, if it is
+    // still valid, and suspends its reader in turn if the consumer stops.
+    future<> read_range(schema_ptr s, const query::read_command& cmd, const query::partition_range& range,
+        querier_cache* queriers, std::function<stop_iteration (mutation&&)> consumer) const;
     lw_shared_ptr<memtable> new_memtable();
     lw_shared_ptr<memtable> new_streaming_memtable();
     future<stop_iteration> try_flush_memtable_to_sstable(lw_shared_ptr<memtable> memt);
@@ -364,6 +393,19 @@ class column_family {
             const query::partition_range& range = query::full_partition_range,
             const io_priority_class& pc = default_priority_class()) const;
 
+    // Like make_reader(), but bypasses the cache and skips the sstables with
+    // the given generations. Used by streaming after those sstables were
+    // sent to the peer as whole files.
+    mutation_reader make_streaming_reader(schema_ptr schema, const query::partition_range& range,
+            const std::unordered_set<int64_t>& excluded_generations,
+            const io_priority_class& pc = default_priority_class()) const;
+
+    // Like make_reader(), but the returned partitions are only guaranteed to
+    // hold the rows selected by the slice, which lets single partition reads
+    // skip the parts of wide partitions they don't need.
+    mutation_reader make_reader(schema_ptr schema, const query::partition_range& range,
+            const query::partition_slice& slice, const io_priority_class& pc) const;
+
     mutation_source as_mutation_source() const;
 
     // Queries can be satisfied from multiple data sources, so they are returned
@@ -400,9 +442,36 @@ class column_family {
     void apply_streaming_mutation(schema_ptr, const frozen_mutation&);
 
     // Returns at most "cmd.limit" rows
+    //
+    // If queriers is given, a page of a paged query (cmd.query_id is set)
+    // reading a single range resumes the reader suspended there by the
+    // query's previous page, if it is still valid, and suspends its reader
+    // there in turn once its rows fill the page.
     future<lw_shared_ptr<query::result>> query(schema_ptr,
         const query::read_command& cmd, query::result_request request,
-        const std::vector<query::partition_range>& ranges);
+        const std::vector<query::partition_range>& ranges,
+        querier_cache* queriers = nullptr);
+
+    // Like query(), but returns the rows in reconcilable form, see
+    // mutation_query(). Pages of range scans are read this way.
+    future<reconcilable_result> query_mutations(schema_ptr,
+        const query::read_command& cmd, const query::partition_range& range,
+        querier_cache* queriers = nullptr);
+
+    // The data readers created now read, see querier_snapshot.
+    querier_snapshot snapshot_for_querier() const {
+        return { _memtables->back(), _sstables, _writes };
+    }
+
+    // Like query(), but hands the rows to the consumer in pages of whole
+    // partitions holding about page_rows rows each, instead of returning
+    // all of them at once. Only the current page is kept in memory, so it
+    // can scan the whole column family. Used to aggregate rows on the
+    // replica which holds them.
+    future<> query_in_pages(schema_ptr,
+        lw_shared_ptr<query::read_command> cmd,
+        const std::vector<query::partition_range>& ranges, uint32_t page_rows,
+        std::function<void (const query::result&)> consumer);
 
     future<> populate(sstring datadir);
 
@@ -472,6 +541,14 @@ class column_family {
     future<bool> snapshot_exists(sstring name);
 
     future<> load_new_sstables(std::vector<sstables::entry_descriptor> new_tables);
+    // Reserves a generation for an sstable whose components are written
+    // outside of this column family and then passed to load_new_sstables().
+    int64_t new_sstable_generation() {
+        return calculate_generation_for_new_table();
+    }
+    const sstring& dir() const {
+        return _config.datadir;
+    }
     future<> snapshot(sstring name);
     future<> clear_snapshot(sstring name);
     future<std::unordered_map<sstring, snapshot_details>> get_snapshot_details();
@@ -480,6 +557,10 @@ class column_family {
         return _config.enable_incremental_backups;
     }
 
+    uint64_t compaction_sub_range_size() const {
+        return _config.compaction_sub_range_size;
+    }
+
     void set_incremental_backups(bool val) {
         _config.enable_incremental_backups = val;
     }
@@ -508,6 +589,10 @@ class column_family {
         return _stats;
     }
 
+    utils::decaying_histogram& replica_read_latency(gms::inet_address ep) {
+        return _replica_read_latencies[ep];
+    }
+
     compaction_manager& get_compaction_manager() const {
         return _compaction_manager;
     }
@@ -672,9 +757,15 @@ class keyspace {
         bool enable_cache = true;
         bool enable_incremental_backups = false;
         size_t max_memtable_size = 5'000'000;
+        // Maximum size of compaction output fragments, 0 if compaction isn't incremental.
+        uint64_t compaction_fragment_size = 0;
+        // Size of the input each concurrent compaction sub-range gets, 0
+        // if compactions aren't split.
+        uint64_t compaction_sub_range_size = 0;
         logalloc::region_group* dirty_memory_region_group = nullptr;
         logalloc::region_group* streaming_dirty_memory_region_group = nullptr;
         ::cf_stats* cf_stats = nullptr;
+        querier_cache* queriers = nullptr;
     };
 private:
     std::unique_ptr<locator::abstract_replication_strategy> _replication_strategy;
@@ -747,6 +838,9 @@ class database {
     compaction_manager _compaction_manager;
     std::vector<scollectd::registration> _collectd;
     bool _enable_incremental_backups = false;
+    // Readers of paged queries suspended between pages. They refer to the
+    // column families, so the cache must be destroyed before them.
+    querier_cache _querier_cache;
 
     future<> init_commitlog();
     future<> apply_in_memory(const frozen_mutation& m, const schema_ptr& m_schema, const db::replay_position&);
@@ -782,6 +876,12 @@ class database {
         throttle_state(size_t max_space, logalloc::region_group& region);
         throttle_state(size_t max_space, logalloc::region_group& region, throttle_state& parent);
         future<> throttle();
+        // Memory used relative to the throttling threshold, or to the
+        // parent's if that is closer; 1 or more means writes are throttled.
+        float pressure() const {
+            auto p = float(_region_group.memory_used()) / _max_space;
+            return _parent ? std::max(p, _parent->pressure()) : p;
+        }
     };
 
     throttle_state _memtables_throttler;
@@ -814,6 +914,10 @@ class database {
         return _compaction_manager;
     }
 
+    querier_cache& get_querier_cache() {
+        return _querier_cache;
+    }
+
     future<> init_system_keyspace();
     future<> load_sstables(distributed<service::storage_proxy>& p); // after init_system_keyspace()
 
@@ -856,6 +960,14 @@ class database {
     future<reconcilable_result> query_mutations(schema_ptr, const query::read_command& cmd, const query::partition_range& range);
     future<> apply(schema_ptr, const frozen_mutation&);
     future<> apply_streaming_mutation(schema_ptr, const frozen_mutation&);
+    // Applies mutations of a single table, all owned by this shard, under
+    // one streaming throttle wait.
+    future<> apply_streaming_mutations(schema_ptr, const std::vector<const frozen_mutation*>&);
+    // How close streaming writes on this shard are to being throttled, see
+    // throttle_state::pressure().
+    float streaming_memory_pressure() const {
+        return _streaming_throttler.pressure();
+    }
     keyspace::config make_keyspace_config(const keyspace_metadata& ksm);
     const sstring& get_snitch_name() const;
     future<> clear_snapshot(sstring tag, std::vector<sstring> keyspace_names);
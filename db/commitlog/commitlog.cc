@@ -150,6 +150,7 @@ const std::string db::commitlog::descriptor::SEPARATOR("-");
 const std::string db::commitlog::descriptor::FILENAME_PREFIX(
         "CommitLog" + SEPARATOR);
 const std::string db::commitlog::descriptor::FILENAME_EXTENSION(".log");
+const std::string db::commitlog::descriptor::RECYCLED_FILENAME_PREFIX("Recycled-");
 
 class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_manager> {
 public:
@@ -180,6 +181,7 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
         uint64_t bytes_written = 0;
         uint64_t bytes_slack = 0;
         uint64_t segments_created = 0;
+        uint64_t segments_recycled = 0;
         uint64_t segments_destroyed = 0;
         uint64_t pending_writes = 0;
         uint64_t pending_flushes = 0;
@@ -274,6 +276,8 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     future<sseg_ptr> new_segment();
     future<sseg_ptr> active_segment();
     future<sseg_ptr> allocate_segment(bool active);
+    void discard_segment_file(const descriptor& d);
+    future<> adopt_recycled_segments(std::vector<sstring> names);
 
     future<> clear();
     future<> sync_all_segments();
@@ -303,7 +307,9 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     buffer_type acquire_buffer(size_t s);
     void release_buffer(buffer_type&&);
 
-    future<std::vector<descriptor>> list_descriptors(sstring dir);
+    // Names of recycled segment files, if requested, are put into recycled;
+    // they are never part of the result.
+    future<std::vector<descriptor>> list_descriptors(sstring dir, std::vector<sstring>* recycled = nullptr);
 
     flush_handler_id add_flush_handler(flush_handler h) {
         auto id = ++_flush_ids;
@@ -320,6 +326,9 @@ class db::commitlog::segment_manager : public ::enable_shared_from_this<segment_
     segment_id_type _ids = 0;
     std::vector<sseg_ptr> _segments;
     std::deque<sseg_ptr> _reserve_segments;
+    // Files of discarded segments, to be renamed and overwritten by new ones
+    // instead of creating new files.
+    std::deque<sstring> _recycled_segments;
     std::vector<buffer_type> _temp_buffers;
     std::unordered_map<flush_handler_id, flush_handler> _flush_handlers;
     flush_handler_id _flush_ids = 0;
@@ -389,6 +398,9 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     uint64_t _flush_pos = 0;
     uint64_t _buf_pos = 0;
     bool _closed = false;
+    // Set if the file held another segment before, so that what lies past
+    // the last chunk we write is stale data rather than zeros.
+    bool _recycled;
 
     using buffer_type = segment_manager::buffer_type;
     using sseg_ptr = segment_manager::sseg_ptr;
@@ -444,6 +456,8 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     static constexpr size_t segment_overhead_size = 2 * sizeof(uint32_t);
     static constexpr size_t descriptor_header_size = 5 * sizeof(uint32_t);
     static constexpr uint32_t segment_magic = ('S'<<24) |('C'<< 16) | ('L' << 8) | 'C';
+    // Set in the version field of the header of recycled segments.
+    static constexpr uint32_t recycled_flag = 1u << 31;
 
     // The commit log (chained) sync marker/header size in bytes (int: length + int: checksum [segmentId, position])
     static constexpr size_t sync_marker_size = 2 * sizeof(uint32_t);
@@ -452,12 +466,11 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
     // TODO : tune initial / default size
     static constexpr size_t default_size = align_up<size_t>(128 * 1024, alignment);
 
-    segment(::shared_ptr<segment_manager> m, const descriptor& d, file && f, bool active)
-            : _segment_manager(std::move(m)), _desc(std::move(d)), _file(std::move(f)), _sync_time(
+    segment(::shared_ptr<segment_manager> m, const descriptor& d, file && f, bool active, bool recycled)
+            : _segment_manager(std::move(m)), _desc(std::move(d)), _file(std::move(f)), _recycled(recycled), _sync_time(
                     clock_type::now()), _queue(0)
     {
-        ++_segment_manager->totals.segments_created;
-        logger.debug("Created new {} segment {}", active ? "active" : "reserve", *this);
+        logger.debug("Created new {} segment {}{}", active ? "active" : "reserve", *this, recycled ? " (recycled)" : "");
     }
     ~segment() {
         if (is_clean()) {
@@ -465,8 +478,7 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
             ++_segment_manager->totals.segments_destroyed;
             _segment_manager->totals.total_size_on_disk -= size_on_disk();
             _segment_manager->totals.total_size -= (size_on_disk() + _buffer.size());
-            commit_io_check(::unlink,
-                    (_segment_manager->cfg.commit_log_location + "/" + _desc.filename()).c_str());
+            _segment_manager->discard_segment_file(_desc);
         } else {
             logger.warn("Segment {} is dirty and is left on disk.", *this);
         }
@@ -627,11 +639,12 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 
         if (off == 0) {
             // first block. write file header.
+            uint32_t ver = _desc.ver | (_recycled ? recycled_flag : 0);
             out.write(segment_magic);
-            out.write(_desc.ver);
+            out.write(ver);
             out.write(_desc.id);
             crc32_nbo crc;
-            crc.process(_desc.ver);
+            crc.process(ver);
             crc.process<int32_t>(_desc.id & 0xffffffff);
             crc.process<int32_t>(_desc.id >> 32);
             out.write(crc.checksum());
@@ -859,16 +872,17 @@ class db::commitlog::segment: public enable_lw_shared_from_this<segment> {
 const size_t db::commitlog::segment::default_size;
 
 future<std::vector<db::commitlog::descriptor>>
-db::commitlog::segment_manager::list_descriptors(sstring dirname) {
+db::commitlog::segment_manager::list_descriptors(sstring dirname, std::vector<sstring>* recycled) {
     struct helper {
         sstring _dirname;
         file _file;
         subscription<directory_entry> _list;
         std::vector<db::commitlog::descriptor> _result;
+        std::vector<sstring>* _recycled;
 
         helper(helper&&) = default;
-        helper(sstring n, file && f)
-                : _dirname(std::move(n)), _file(std::move(f)), _list(
+        helper(sstring n, file && f, std::vector<sstring>* recycled)
+                : _dirname(std::move(n)), _file(std::move(f)), _recycled(recycled), _list(
                         _file.list_directory(
                                 std::bind(&helper::process, this,
                                         std::placeholders::_1))) {
@@ -883,6 +897,12 @@ db::commitlog::segment_manager::list_descriptors(sstring dirname) {
             };
             return entry_type(de).then([this, de](std::experimental::optional<directory_entry_type> type) {
                 if (type == directory_entry_type::regular && de.name[0] != '.') {
+                    if (de.name.find(descriptor::RECYCLED_FILENAME_PREFIX) == 0) {
+                        if (_recycled) {
+                            _recycled->push_back(_dirname + "/" + de.name);
+                        }
+                        return make_ready_future<>();
+                    }
                     try {
                         _result.emplace_back(de.name);
                     } catch (std::domain_error& e) {
@@ -898,8 +918,8 @@ db::commitlog::segment_manager::list_descriptors(sstring dirname) {
         }
     };
 
-    return open_checked_directory(commit_error, dirname).then([this, dirname](file dir) {
-        auto h = make_lw_shared<helper>(std::move(dirname), std::move(dir));
+    return open_checked_directory(commit_error, dirname).then([this, dirname, recycled](file dir) {
+        auto h = make_lw_shared<helper>(std::move(dirname), std::move(dir), recycled);
         return h->done().then([h]() {
             return make_ready_future<std::vector<db::commitlog::descriptor>>(std::move(h->_result));
         }).finally([h] {});
@@ -907,7 +927,8 @@ db::commitlog::segment_manager::list_descriptors(sstring dirname) {
 }
 
 future<> db::commitlog::segment_manager::init() {
-    return list_descriptors(cfg.commit_log_location).then([this](std::vector<descriptor> descs) {
+    auto recycled = make_lw_shared<std::vector<sstring>>();
+    return list_descriptors(cfg.commit_log_location, recycled.get()).then([this, recycled](std::vector<descriptor> descs) {
         segment_id_type id = std::chrono::duration_cast<std::chrono::milliseconds>(runtime::get_boot_time().time_since_epoch()).count() + 1;
         for (auto& d : descs) {
             id = std::max(id, replay_position(d.id).base_id());
@@ -920,6 +941,37 @@ future<> db::commitlog::segment_manager::init() {
         auto delay = engine().cpu_id() * std::ceil(double(cfg.commitlog_sync_period_in_ms) / smp::count);
         logger.trace("Delaying timer loop {} ms", delay);
         this->arm(delay);
+        return this->adopt_recycled_segments(std::move(*recycled));
+    });
+}
+
+/**
+ * Takes over the recycled segment files left by a previous run on this shard,
+ * as long as they fit in our share of disk space. The rest are deleted.
+ */
+future<> db::commitlog::segment_manager::adopt_recycled_segments(std::vector<sstring> names) {
+    return do_with(std::move(names), [this](std::vector<sstring>& names) {
+        return do_for_each(names, [this](const sstring& name) {
+            auto basename = name.substr(name.rfind('/') + 1);
+            segment_id_type id;
+            try {
+                id = descriptor(basename.substr(descriptor::RECYCLED_FILENAME_PREFIX.size())).id;
+            } catch (std::domain_error& e) {
+                logger.warn("Ignoring recycled file {}: {}", name, e.what());
+                return make_ready_future<>();
+            }
+            if (replay_position(id).shard_id() % smp::count != engine().cpu_id()) {
+                return make_ready_future<>();
+            }
+            return commit_io_check([name] { return engine().file_size(name); }).then([this, name](uint64_t size) {
+                if (size == max_size && (_recycled_segments.size() + 1) * max_size <= max_disk_size) {
+                    logger.debug("Adopting recycled segment {}", name);
+                    _recycled_segments.push_back(name);
+                    return make_ready_future<>();
+                }
+                return commit_io_check(remove_file, name);
+            });
+        });
     });
 }
 
@@ -954,6 +1006,19 @@ scollectd::registrations db::commitlog::segment_manager::create_counters() {
                                     });
                         })
         ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "queue_length", "recycled_segments")
+                , make_typed(data_type::GAUGE
+                        , std::bind(&decltype(_recycled_segments)::size, &_recycled_segments))
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "segments_created")
+                , make_typed(data_type::DERIVE, totals.segments_created)
+        ),
+        add_polled_metric(type_instance_id("commitlog"
+                        , per_cpu_plugin_instance, "total_operations", "segments_recycled")
+                , make_typed(data_type::DERIVE, totals.segments_recycled)
+        ),
         add_polled_metric(type_instance_id("commitlog"
                         , per_cpu_plugin_instance, "total_operations", "alloc")
                 , make_typed(data_type::DERIVE, totals.allocation_count)
@@ -1046,15 +1111,47 @@ void db::commitlog::segment_manager::flush_segments(bool force) {
 
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::allocate_segment(bool active) {
     descriptor d(next_id());
-    return open_checked_file_dma(commit_error, cfg.commit_log_location + "/" + d.filename(), open_flags::wo | open_flags::create).then([this, d, active](file f) {
+    auto filename = cfg.commit_log_location + "/" + d.filename();
+    if (!_recycled_segments.empty()) {
+        // Overwriting a file in place saves the extent allocation and metadata
+        // updates which creating and growing a new one costs.
+        auto recycled = std::move(_recycled_segments.front());
+        _recycled_segments.pop_front();
+        return commit_io_check(rename_file, recycled, filename).then([this, filename] {
+            return open_checked_file_dma(commit_error, filename, open_flags::wo);
+        }).then([this, d, active](file f) {
+            ++totals.segments_recycled;
+            return make_lw_shared<segment>(this->shared_from_this(), d, std::move(f), active, true);
+        });
+    }
+    return open_checked_file_dma(commit_error, filename, open_flags::wo | open_flags::create).then([this, d, active](file f) {
         // xfs doesn't like files extended betond eof, so enlarge the file
         return f.truncate(max_size).then([this, d, active, f] () mutable {
-            auto s = make_lw_shared<segment>(this->shared_from_this(), d, std::move(f), active);
+            ++totals.segments_created;
+            auto s = make_lw_shared<segment>(this->shared_from_this(), d, std::move(f), active, false);
             return make_ready_future<sseg_ptr>(s);
         });
     });
 }
 
+/**
+ * Called when a segment is clean and no longer used. Its file is kept for
+ * reuse if the files we have stay within our share of disk space, and
+ * deleted otherwise.
+ */
+void db::commitlog::segment_manager::discard_segment_file(const descriptor& d) {
+    auto filename = cfg.commit_log_location + "/" + d.filename();
+    auto files = _segments.size() + _reserve_segments.size() + _recycled_segments.size();
+    if ((files + 1) * max_size <= max_disk_size) {
+        auto recycled = cfg.commit_log_location + "/" + descriptor::RECYCLED_FILENAME_PREFIX + d.filename();
+        commit_io_check(::rename, filename.c_str(), recycled.c_str());
+        _recycled_segments.push_back(std::move(recycled));
+        logger.debug("Segment {} kept for recycling", d.filename());
+        return;
+    }
+    commit_io_check(::unlink, filename.c_str());
+}
+
 future<db::commitlog::segment_manager::sseg_ptr> db::commitlog::segment_manager::new_segment() {
     if (_shutdown) {
         throw std::runtime_error("Commitlog has been shut down. Cannot add data");
@@ -1166,6 +1263,7 @@ future<> db::commitlog::segment_manager::shutdown() {
 void db::commitlog::segment_manager::orphan_all() {
     _segments.clear();
     _reserve_segments.clear();
+    _recycled_segments.clear();
 }
 
 /*
@@ -1448,22 +1546,29 @@ const db::commitlog::config& db::commitlog::active_config() const {
 // on error at startup if required
 future<std::unique_ptr<subscription<temporary_buffer<char>, db::replay_position>>>
 db::commitlog::read_log_file(const sstring& filename, commit_load_reader_func next, position_type off) {
-    return open_checked_file_dma(commit_error, filename, open_flags::ro).then([next = std::move(next), off](file f) {
+    segment_id_type id = 0;
+    try {
+        id = descriptor(filename).id;
+    } catch (std::domain_error&) {
+        // Not named like a segment; trust the header.
+    }
+    return open_checked_file_dma(commit_error, filename, open_flags::ro).then([next = std::move(next), off, id](file f) {
        return std::make_unique<subscription<temporary_buffer<char>, replay_position>>(
-           read_log_file(std::move(f), std::move(next), off));
+           read_log_file(std::move(f), std::move(next), off, id));
     });
 }
 
 // No commit_io_check needed in the log reader since the database will fail
 // on error at startup if required
 subscription<temporary_buffer<char>, db::replay_position>
-db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type off) {
+db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type off, segment_id_type expected_id) {
     struct work {
         file f;
         stream<temporary_buffer<char>, replay_position> s;
         input_stream<char> fin;
         input_stream<char> r;
         uint64_t id = 0;
+        uint64_t expected_id = 0;
         size_t pos = 0;
         size_t next = 0;
         size_t start_off = 0;
@@ -1472,9 +1577,10 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
         size_t corrupt_size = 0;
         bool eof = false;
         bool header = true;
+        bool recycled = false;
 
-        work(file f, position_type o = 0)
-                : f(f), fin(make_file_input_stream(f)), start_off(o) {
+        work(file f, position_type o = 0, segment_id_type expected_id = 0)
+                : f(f), fin(make_file_input_stream(f)), expected_id(expected_id), start_off(o) {
         }
         work(work&&) = default;
 
@@ -1537,7 +1643,15 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                     throw std::runtime_error("Checksum error in file header");
                 }
 
+                if (expected_id != 0 && id != expected_id) {
+                    // A recycled file which was renamed, but not written to
+                    // before we stopped. Whatever it holds is stale.
+                    logger.debug("Segment header has id {}, expected {}. Skipping stale file.", id, expected_id);
+                    return stop();
+                }
+
                 this->id = id;
+                this->recycled = ver & segment::recycled_flag;
                 this->next = 0;
 
                 return make_ready_future<>();
@@ -1569,8 +1683,14 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
                 if (cs != checksum) {
                     // if a chunk header checksum is broken, we shall just assume that all
                     // remaining is as well. We cannot trust the "next" pointer, so...
-                    logger.debug("Checksum error in segment chunk at {}.", pos);
-                    corrupt_size += (file_size - pos);
+                    // In a recycled segment, this is where the data of the previous
+                    // segment starts: chunk checksums cover the segment id.
+                    if (recycled) {
+                        logger.debug("End of recycled segment data at {}.", pos);
+                    } else {
+                        logger.debug("Checksum error in segment chunk at {}.", pos);
+                        corrupt_size += (file_size - pos);
+                    }
                     return stop();
                 }
 
@@ -1661,7 +1781,7 @@ db::commitlog::read_log_file(file f, commit_load_reader_func next, position_type
         }
     };
 
-    auto w = make_lw_shared<work>(std::move(f), off);
+    auto w = make_lw_shared<work>(std::move(f), off, expected_id);
     auto ret = w->s.listen(std::move(next));
 
     w->s.started().then(std::bind(&work::read_file, w.get())).then([w] {
@@ -1718,6 +1838,10 @@ uint64_t db::commitlog::get_num_segments_created() const {
     return _segment_manager->totals.segments_created;
 }
 
+uint64_t db::commitlog::get_num_segments_recycled() const {
+    return _segment_manager->totals.segments_recycled;
+}
+
 uint64_t db::commitlog::get_num_segments_destroyed() const {
     return _segment_manager->totals.segments_destroyed;
 }
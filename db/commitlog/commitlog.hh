@@ -130,6 +130,7 @@ class commitlog {
         static const std::string SEPARATOR;
         static const std::string FILENAME_PREFIX;
         static const std::string FILENAME_EXTENSION;
+        static const std::string RECYCLED_FILENAME_PREFIX;
 
         descriptor(descriptor&&) = default;
         descriptor(const descriptor&) = default;
@@ -251,6 +252,7 @@ class commitlog {
     uint64_t get_write_limit_exceeded_count() const;
     uint64_t get_flush_limit_exceeded_count() const;
     uint64_t get_num_segments_created() const;
+    uint64_t get_num_segments_recycled() const;
     uint64_t get_num_segments_destroyed() const;
     /**
      * Get number of inactive (finished), segments lingering
@@ -313,7 +315,7 @@ class commitlog {
         uint64_t _bytes;
     };
 
-    static subscription<temporary_buffer<char>, replay_position> read_log_file(file, commit_load_reader_func, position_type = 0);
+    static subscription<temporary_buffer<char>, replay_position> read_log_file(file, commit_load_reader_func, position_type = 0, segment_id_type expected_id = 0);
     static future<std::unique_ptr<subscription<temporary_buffer<char>, replay_position>>> read_log_file(
             const sstring&, commit_load_reader_func, position_type = 0);
 private:
@@ -318,6 +318,12 @@ class config {
     val(in_memory_compaction_limit_in_mb, uint32_t, 64, Invalid,     \
             "Size limit for rows being compacted in memory. Larger rows spill to disk and use a slower two-pass compaction process. When this occurs, a message is logged specifying the row key. The recommended value is 5 to 10 percent of the available Java heap size."  \
     )                                                   \
+    val(compaction_fragment_size_in_mb, uint32_t, 0, Used,     \
+            "When non-zero, compaction writes its output as sstables of at most this size, and deletes input SSTables as soon as the output written so far covers them. This bounds the temporary disk space a compaction needs by roughly this size instead of the size of its input. 0 disables incremental compaction."  \
+    )                                                   \
+    val(compaction_sub_range_size_in_mb, uint32_t, 1024, Used,     \
+            "Compactions whose input is at least twice this size are split into token sub-ranges of about this much input each, up to 8, which are compacted concurrently. 0 disables the split."  \
+    )                                                   \
     val(preheat_kernel_page_cache, bool, false, Unused, \
             "Enable or disable kernel page cache preheating from contents of the key cache after compaction. When enabled it preheats only first page (4KB) of each row to optimize for sequential access. It can be harmful for fat rows, see CASSANDRA-4937 for more details."    \
     )   \
@@ -337,6 +343,18 @@ class config {
     val(file_cache_size_in_mb, uint32_t, 512, Unused,  \
             "Total memory to use for SSTable-reading buffers."  \
     )   \
+    val(compressed_chunk_cache_size_in_mb, uint32_t, 0, Used,  \
+            "Memory, per shard, used to cache uncompressed chunks of compressed SSTables, so that reads of hot data do not uncompress it again. Chunks are evicted before cached rows when memory runs low. If left at 0, a twentieth of the shard's memory is used."  \
+    )   \
+    val(index_page_cache_size_in_mb, uint32_t, 0, Used,  \
+            "Memory, per shard, used to cache parsed partition index pages, so that point reads of hot SSTables find the partition's position without reading the Index file. If left at 0, a fiftieth of the shard's memory is used."  \
+    )   \
+    val(querier_cache_size_in_mb, uint32_t, 0, Used,  \
+            "Memory, per shard, kept alive by the readers of paged queries, which are suspended between pages so that the next page continues reading where the previous one ended instead of looking up its start again. Suspended readers are dropped after 10 seconds. If left at 0, a fiftieth of the shard's memory is used."  \
+    )   \
+    val(blocked_bloom_filters, bool, false, Used,  \
+            "Write the bloom filters of new SSTables in a layout which keeps all the bits of a partition key within one cache line, making lookups cheaper. Such SSTables cannot be read by Cassandra, nor by Scylla versions which predate this option, so enable it only once all nodes are upgraded and SSTables will not be moved to Cassandra."  \
+    )   \
     val(memtable_flush_queue_size, uint32_t, 4, Unused,     \
             "The number of full memtables to allow pending flush (memtables waiting for a write thread). At a minimum, set to the maximum number of indexes created on a single table.\n"  \
             "Related information: Flushing data from the memtable"  \
@@ -351,7 +369,7 @@ class config {
             "See memtable_heap_space_in_mb"  \
     )   \
     /* Cache and index settings */  \
-    val(column_index_size_in_kb, uint32_t, 64, Unused,     \
+    val(column_index_size_in_kb, uint32_t, 64, Used,     \
             "Granularity of the index of rows within a partition. For huge rows, decrease this setting to improve seek time. If you use key cache, be careful not to make this setting too large because key cache will be overwhelmed. If you're unsure of the size of the rows, it's best to use the default setting."  \
     )   \
     val(index_summary_capacity_in_mb, uint32_t, 0, Unused,     \
@@ -475,7 +493,7 @@ class config {
             "The maximum number of tombstones a query can scan before aborting."  \
     )   \
     /* Network timeout settings */  \
-    val(range_request_timeout_in_ms, uint32_t, 10000, Unused,     \
+    val(range_request_timeout_in_ms, uint32_t, 10000, Used,     \
             "The time in milliseconds that the coordinator waits for sequential or index scans to complete."  \
     )   \
     val(read_request_timeout_in_ms, uint32_t, 5000, Used,     \
@@ -529,6 +547,24 @@ class config {
     val(streaming_socket_timeout_in_ms, uint32_t, 0, Unused,     \
             "Enable or disable socket timeout for streaming operations. When a timeout occurs during streaming, streaming is retried from the start of the current file. Avoid setting this value too low, as it can result in a significant amount of data re-streaming."  \
     )   \
+    val(stream_mutation_batch_size_in_kb, uint32_t, 1024, Used,     \
+            "Streaming packs partitions into batches of about this size, and sends one batch per message. Set to 0 to send one partition per message, which is needed when streaming to nodes that do not support batches."  \
+    )   \
+    val(stream_mutation_window, uint32_t, 8, Used,     \
+            "Maximum number of mutation batches each shard keeps in flight to a single peer while streaming."  \
+    )   \
+    val(stream_whole_sstables, bool, true, Used,     \
+            "Send sstables which lie entirely inside a streamed range as their component files, instead of as mutations. The receiver must have the same number of shards to accept them. Disable when streaming to nodes that do not support it."  \
+    )   \
+    val(repair_row_level, bool, true, Used,     \
+            "When repair finds a token range which differs between replicas, exchange per-row hashes and transfer only the rows which are missing or differ, instead of streaming the whole range. Disable when repairing with nodes that do not support it."  \
+    )   \
+    val(repair_max_parallelism, uint32_t, 100, Used,     \
+            "Upper bound on the number of token ranges a repair checksums and synchronizes at once. Within it the bound adapts to the achieved repair throughput, streaming memory pressure and foreground request latency."  \
+    )   \
+    val(aggregate_push_down, bool, false, Used,     \
+            "Compute aggregates such as count(*) of queries at consistency levels which read from a single replica on the replicas, which then return partial results instead of all rows to the coordinator. Enable only once all nodes of the cluster support it."  \
+    )   \
     /* Native transport (CQL Binary Protocol) */    \
     val(start_native_transport, bool, true, Unused,                \
             "Enable or disable the native transport server. Uses the same address as the rpc_address, but the port is different from the rpc_port. See native_transport_port."  \
@@ -581,13 +617,16 @@ class config {
     )   \
     /* Advanced fault detection settings */ \
     /* Settings to handle poorly performing or failing nodes. */    \
-    val(dynamic_snitch_badness_threshold, double, 0, Unused,     \
+    val(dynamic_snitch, bool, true, Used,     \
+            "Wrap the endpoint_snitch in a dynamic snitch, which ranks replicas by their recent response latency and reported load, and routes reads away from slow ones."  \
+    )   \
+    val(dynamic_snitch_badness_threshold, double, 0.1, Used,     \
             "Sets the performance threshold for dynamically routing requests away from a poorly performing node. A value of 0.2 means Cassandra continues to prefer the static snitch values until the node response time is 20% worse than the best performing node. Until the threshold is reached, incoming client requests are statically routed to the closest replica (as determined by the snitch). Having requests consistently routed to a given replica can help keep a working set of data hot when read repair is less than 1."  \
     )   \
-    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 60000, Unused,     \
+    val(dynamic_snitch_reset_interval_in_ms, uint32_t, 600000, Used,     \
             "Time interval in milliseconds to reset all node scores, which allows a bad node to recover."  \
     )   \
-    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Unused,     \
+    val(dynamic_snitch_update_interval_in_ms, uint32_t, 100, Used,     \
             "The time interval for how often the snitch calculates node scores. Because score calculation is CPU intensive, be careful when reducing this interval."  \
     )   \
     val(hinted_handoff_enabled, bool, true, Unused,     \
@@ -708,7 +747,7 @@ class config {
     val(api_address, sstring, "", Used, "Http Rest API address") \
     val(api_ui_dir, sstring, "swagger-ui/dist/", Used, "The directory location of the API GUI") \
     val(api_doc_dir, sstring, "api/api-doc/", Used, "The API definition file directory") \
-    val(load_balance, sstring, "none", Used, "CQL request load balancing: 'none' or round-robin'") \
+    val(load_balance, sstring, "none", Used, "CQL request load balancing: 'none', 'round-robin' or 'token-aware'") \
     val(consistent_rangemovement, bool, true, Used, "When set to true, range movements will be consistent. It means: 1) it will refuse to bootstrapp a new node if other bootstrapping/leaving/moving nodes detected. 2) data will be streamed to a new node only from the node which is no longer responsible for the token range. Same as -Dcassandra.consistent.rangemovement in cassandra") \
     val(join_ring, bool, true, Used, "When set to true, a node will join the token ring. When set to false, a node will not join the token ring. User can use nodetool join to initiate ring joinging later. Same as -Dcassandra.join_ring in cassandra.") \
     val(load_ring_state, bool, true, Used, "When set to true, load tokens and host_ids previously saved. Same as -Dcassandra.load_ring_state in cassandra.") \
@@ -217,6 +217,15 @@ decorated_key::less_compare(const schema& s, const ring_position& other) const {
     return tri_compare(s, other) < 0;
 }
 
+const utils::hashed_key&
+decorated_key::key_hash(const schema& s) const {
+    if (!_hash) {
+        auto&& legacy = _key.legacy_form(s);
+        _hash = utils::make_hashed_key(legacy.begin(), legacy.size());
+    }
+    return *_hash;
+}
+
 bool
 decorated_key::less_compare(const schema& s, const decorated_key& other) const {
     return tri_compare(s, other) < 0;
@@ -45,6 +45,7 @@
 #include "types.hh"
 #include "keys.hh"
 #include "utils/managed_bytes.hh"
+#include "utils/hashed_key.hh"
 #include <memory>
 #include <random>
 #include <utility>
@@ -126,6 +127,9 @@ class decorated_key {
 public:
     dht::token _token;
     partition_key _key;
+    // The hash sstable filters are probed with. Filled in by partitioners
+    // which compute it anyway, otherwise on first use.
+    mutable std::experimental::optional<utils::hashed_key> _hash = {};
 
     struct less_comparator {
         schema_ptr s;
@@ -152,6 +156,8 @@ class decorated_key {
     const partition_key& key() const {
         return _key;
     }
+
+    const utils::hashed_key& key_hash(const schema& s) const;
 };
 
 using decorated_key_opt = std::experimental::optional<decorated_key>;
@@ -166,7 +172,7 @@ class i_partitioner {
      * @param key the raw, client-facing key
      * @return decorated version of key
      */
-    decorated_key decorate_key(const schema& s, const partition_key& key) {
+    virtual decorated_key decorate_key(const schema& s, const partition_key& key) {
         return { get_token(s, key), key };
     }
 
@@ -176,7 +182,7 @@ class i_partitioner {
      * @param key the raw, client-facing key
      * @return decorated version of key
      */
-    decorated_key decorate_key(const schema& s, partition_key&& key) {
+    virtual decorated_key decorate_key(const schema& s, partition_key&& key) {
         auto token = get_token(s, key);
         return { std::move(token), std::move(key) };
     }
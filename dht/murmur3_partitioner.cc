@@ -69,6 +69,21 @@ murmur3_partitioner::get_token(const schema& s, partition_key_view key) {
     return get_token(hash[0]);
 }
 
+// The token is derived from the same hash sstable filters use, so keep it
+// along to save hashing the key again when probing them.
+decorated_key
+murmur3_partitioner::decorate_key(const schema& s, const partition_key& key) {
+    return decorate_key(s, partition_key(key));
+}
+
+decorated_key
+murmur3_partitioner::decorate_key(const schema& s, partition_key&& key) {
+    auto&& legacy = key.legacy_form(s);
+    auto hash = utils::make_hashed_key(legacy.begin(), legacy.size());
+    auto token = get_token(hash.hash[0]);
+    return { std::move(token), std::move(key), hash };
+}
+
 token murmur3_partitioner::get_random_token() {
     auto rand = dht::get_random_number<uint64_t>();
     return get_token(rand);
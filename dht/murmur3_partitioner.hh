@@ -31,6 +31,8 @@ class murmur3_partitioner final : public i_partitioner {
     virtual const sstring name() { return "org.apache.cassandra.dht.Murmur3Partitioner"; }
     virtual token get_token(const schema& s, partition_key_view key) override;
     virtual token get_token(const sstables::key_view& key) override;
+    virtual decorated_key decorate_key(const schema& s, const partition_key& key) override;
+    virtual decorated_key decorate_key(const schema& s, partition_key&& key) override;
     virtual token get_random_token() override;
     virtual bool preserves_order() override { return false; }
     virtual std::map<token, float> describe_ownership(const std::vector<token>& sorted_tokens) override;
@@ -22,3 +22,29 @@
 class partition_checksum {
   std::array<uint8_t, 32> digest();
 };
+
+class repair_hash_tree {
+  std::vector<partition_checksum> leaves();
+};
+
+struct repair_row_hash {
+  clustering_key key;
+  partition_checksum hash;
+};
+
+struct repair_partition_hashes {
+  partition_key key;
+  partition_checksum partition_hash;
+  std::vector<repair_row_hash> rows;
+};
+
+struct repair_partition_rows {
+  partition_key key;
+  bool partition_level;
+  std::vector<clustering_key> rows;
+};
+
+struct repair_row_position {
+  partition_key key;
+  std::experimental::optional<clustering_key> row;
+};
@@ -45,6 +45,13 @@ class read_command {
     query::partition_slice slice;
     uint32_t row_limit;
     std::chrono::time_point<gc_clock, gc_clock::duration> timestamp;
+    utils::UUID query_id [[version 1.3]];
+};
+
+struct aggregate_selector {
+    sstring function_keyspace;
+    sstring function_name;
+    std::vector<sstring> columns;
 };
 
 }
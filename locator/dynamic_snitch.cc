@@ -0,0 +1,206 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "locator/dynamic_snitch.hh"
+#include "gms/gossiper.hh"
+#include "utils/fb_utilities.hh"
+
+#include <boost/range/algorithm/sort.hpp>
+
+namespace locator {
+
+// Weight of a new sample in an endpoint's average latency.
+static constexpr double latency_average_weight = 0.1;
+// Weight of the severity reported at each update in an endpoint's average
+// severity, so that a compaction starting or ending does not reorder
+// replicas at once.
+static constexpr double severity_average_weight = 0.1;
+// How much severity adds to a score: a node compacting on all its shards is
+// penalized like one half as fast as the slowest.
+static constexpr double severity_score_weight = 0.5;
+
+std::unique_ptr<i_endpoint_snitch> make_dynamic_snitch(std::unique_ptr<i_endpoint_snitch> subsnitch) {
+    return std::make_unique<dynamic_snitch>(std::move(subsnitch), i_endpoint_snitch::dynamic_snitch_cfg());
+}
+
+dynamic_snitch::dynamic_snitch(std::unique_ptr<i_endpoint_snitch> subsnitch, const dynamic_snitch_config& cfg)
+    : _subsnitch(std::move(subsnitch))
+    , _cfg(cfg)
+    , _update_timer([this] { update_scores(); })
+    , _reset_timer([this] { reset(); })
+{
+}
+
+future<> dynamic_snitch::start() {
+    return _subsnitch->start().then([this] {
+        _update_timer.arm_periodic(_cfg.update_interval);
+        _reset_timer.arm_periodic(_cfg.reset_interval);
+        _state = snitch_state::running;
+    });
+}
+
+future<> dynamic_snitch::stop() {
+    _update_timer.cancel();
+    _reset_timer.cancel();
+    return _subsnitch->stop().then([this] {
+        _state = snitch_state::stopped;
+    });
+}
+
+future<> dynamic_snitch::pause_io() {
+    return _subsnitch->pause_io().then([this] {
+        _state = snitch_state::io_paused;
+    });
+}
+
+void dynamic_snitch::resume_io() {
+    _subsnitch->resume_io();
+    _state = snitch_state::running;
+}
+
+void dynamic_snitch::receive_timing(inet_address endpoint, std::chrono::steady_clock::duration latency) {
+    double us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    auto i = _latencies.find(endpoint);
+    if (i == _latencies.end()) {
+        _latencies.emplace(endpoint, us);
+    } else {
+        i->second += latency_average_weight * (us - i->second);
+    }
+}
+
+double dynamic_snitch::get_severity(inet_address endpoint) const {
+    if (!gms::get_gossiper().local_is_initialized()) {
+        return 0;
+    }
+    auto state = gms::get_local_gossiper().get_endpoint_state_for_endpoint(endpoint);
+    if (!state) {
+        return 0;
+    }
+    auto severity = state->get_application_state(gms::application_state::SEVERITY);
+    if (!severity) {
+        return 0;
+    }
+    try {
+        return std::stod(severity->value);
+    } catch (...) {
+        return 0;
+    }
+}
+
+void dynamic_snitch::update_scores() {
+    double max_latency = 0;
+    for (auto&& e : _latencies) {
+        max_latency = std::max(max_latency, e.second);
+    }
+    std::unordered_map<inet_address, double> severities;
+    _scores.clear();
+    double total = 0;
+    for (auto&& e : _latencies) {
+        auto severity = get_severity(e.first);
+        auto i = _severities.find(e.first);
+        if (i != _severities.end()) {
+            severity = i->second + severity_average_weight * (severity - i->second);
+        }
+        severities.emplace(e.first, severity);
+        double score = max_latency > 0 ? e.second / max_latency : 0;
+        score += severity_score_weight * severity;
+        _scores.emplace(e.first, score);
+        total += score;
+    }
+    _severities = std::move(severities);
+    _default_score = _scores.empty() ? 0 : total / _scores.size();
+}
+
+void dynamic_snitch::reset() {
+    _latencies.clear();
+}
+
+double dynamic_snitch::get_score(inet_address endpoint) const {
+    // Endpoints we have no samples for are neither preferred nor avoided.
+    auto i = _scores.find(endpoint);
+    return i == _scores.end() ? _default_score : i->second;
+}
+
+std::vector<inet_address> dynamic_snitch::get_sorted_list_by_proximity(
+    inet_address address,
+    std::unordered_set<inet_address>& unsorted_address) {
+
+    std::vector<inet_address>
+        preferred(unsorted_address.begin(), unsorted_address.end());
+
+    sort_by_proximity(address, preferred);
+    return preferred;
+}
+
+void dynamic_snitch::sort_by_proximity(
+    inet_address address, std::vector<inet_address>& addresses) {
+
+    _subsnitch->sort_by_proximity(address, addresses);
+
+    // Scores only describe how this node sees other nodes.
+    if (address != utils::fb_utilities::get_broadcast_address() || _scores.empty()) {
+        return;
+    }
+
+    //
+    // Compare the scores of the subsnitch order against the sorted scores,
+    // position by position: if any of them is worse than the best possible
+    // score for its position by more than the badness threshold, sort by
+    // score instead.
+    //
+    std::vector<double> subsnitch_scores;
+    subsnitch_scores.reserve(addresses.size());
+    for (auto&& a : addresses) {
+        subsnitch_scores.push_back(get_score(a));
+    }
+    auto sorted_scores = subsnitch_scores;
+    boost::sort(sorted_scores);
+    for (size_t i = 0; i < subsnitch_scores.size(); ++i) {
+        if (subsnitch_scores[i] > sorted_scores[i] * (1.0 + _cfg.badness_threshold)) {
+            sort_by_score(address, addresses);
+            return;
+        }
+    }
+}
+
+void dynamic_snitch::sort_by_score(inet_address address, std::vector<inet_address>& addresses) {
+    std::stable_sort(addresses.begin(), addresses.end(),
+              [this, &address](inet_address& a1, inet_address& a2)
+    {
+        return compare_endpoints(address, a1, a2) < 0;
+    });
+}
+
+int dynamic_snitch::compare_endpoints(
+    inet_address& target, inet_address& a1, inet_address& a2) {
+
+    if (target != utils::fb_utilities::get_broadcast_address()) {
+        return _subsnitch->compare_endpoints(target, a1, a2);
+    }
+    auto score1 = get_score(a1);
+    auto score2 = get_score(a2);
+    if (score1 == score2) {
+        return _subsnitch->compare_endpoints(target, a1, a2);
+    }
+    return score1 < score2 ? -1 : 1;
+}
+
+} // namespace locator
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "locator/snitch_base.hh"
+#include "core/timer.hh"
+
+#include <unordered_map>
+
+namespace locator {
+
+/**
+ * A snitch which wraps another one, and re-sorts the replicas it orders by
+ * proximity according to their recent performance.
+ *
+ * Each endpoint gets a score: its average recent response latency, as fed by
+ * receive_timing(), relative to the slowest endpoint's, plus a fraction of
+ * the average severity it reports over gossip (the fraction of its shards
+ * busy compacting). Endpoints with no latency samples get the average score.
+ * When sorting for the local node, the subsnitch order is kept unless one of
+ * the endpoints scores worse than its position warrants by more than the
+ * badness threshold, in which case endpoints are sorted by score.
+ *
+ * Scores are recomputed every update interval, and all latency samples are
+ * dropped every reset interval, so that a node which stopped receiving reads
+ * because it was slow gets a chance to recover.
+ */
+class dynamic_snitch : public i_endpoint_snitch {
+    std::unique_ptr<i_endpoint_snitch> _subsnitch;
+    dynamic_snitch_config _cfg;
+    // Exponentially weighted moving average of response latency, in
+    // microseconds.
+    std::unordered_map<inet_address, double> _latencies;
+    // Moving average of the severity of the endpoints in _latencies
+    std::unordered_map<inet_address, double> _severities;
+    std::unordered_map<inet_address, double> _scores;
+    // Score of the endpoints with no latency samples: the average score
+    double _default_score = 0;
+    timer<> _update_timer;
+    timer<> _reset_timer;
+public:
+    dynamic_snitch(std::unique_ptr<i_endpoint_snitch> subsnitch, const dynamic_snitch_config& cfg);
+
+    virtual sstring get_rack(inet_address endpoint) override {
+        return _subsnitch->get_rack(endpoint);
+    }
+
+    virtual sstring get_datacenter(inet_address endpoint) override {
+        return _subsnitch->get_datacenter(endpoint);
+    }
+
+    virtual std::vector<inet_address> get_sorted_list_by_proximity(
+        inet_address address,
+        std::unordered_set<inet_address>& unsorted_address) override;
+
+    virtual void sort_by_proximity(
+        inet_address address, std::vector<inet_address>& addresses) override;
+
+    virtual int compare_endpoints(
+        inet_address& target, inet_address& a1, inet_address& a2) override;
+
+    virtual bool is_worth_merging_for_range_query(
+        std::vector<inet_address>& merged,
+        std::vector<inet_address>& l1,
+        std::vector<inet_address>& l2) override {
+        return _subsnitch->is_worth_merging_for_range_query(merged, l1, l2);
+    }
+
+    virtual void receive_timing(inet_address endpoint, std::chrono::steady_clock::duration latency) override;
+
+    virtual future<> gossiper_starting() override {
+        _gossip_started = true;
+        return _subsnitch->gossiper_starting();
+    }
+
+    virtual future<> start() override;
+    virtual future<> stop() override;
+    virtual future<> pause_io() override;
+    virtual void resume_io() override;
+
+    virtual void set_my_dc(const sstring& new_dc) override {
+        _subsnitch->set_my_dc(new_dc);
+    }
+    virtual void set_my_rack(const sstring& new_rack) override {
+        _subsnitch->set_my_rack(new_rack);
+    }
+    virtual void set_prefer_local(bool prefer_local) override {
+        _subsnitch->set_prefer_local(prefer_local);
+    }
+    virtual void set_local_private_addr(const sstring& addr_str) override {
+        _subsnitch->set_local_private_addr(addr_str);
+    }
+
+    virtual sstring get_name() const override {
+        return _subsnitch->get_name();
+    }
+
+    virtual void set_my_distributed(distributed<snitch_ptr>* d) override {
+        _subsnitch->set_my_distributed(d);
+    }
+
+    virtual void reload_gossiper_state() override {
+        _subsnitch->reload_gossiper_state();
+    }
+
+    double get_score(inet_address endpoint) const;
+private:
+    void update_scores();
+    void reset();
+    double get_severity(inet_address endpoint) const;
+    void sort_by_score(inet_address address, std::vector<inet_address>& addresses);
+};
+
+} // namespace locator
@@ -38,6 +38,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <unordered_set>
 #include <vector>
 
@@ -53,6 +54,21 @@ struct snitch_ptr;
 
 typedef gms::inet_address inet_address;
 
+/**
+ * Settings of the dynamic snitch, which, when enabled, wraps every snitch
+ * created by i_endpoint_snitch::create_snitch() and reset_snitch().
+ */
+struct dynamic_snitch_config {
+    bool enabled = false;
+    // How often endpoint scores are recomputed
+    std::chrono::milliseconds update_interval{100};
+    // How often latency samples are forgotten, so that bad nodes may recover
+    std::chrono::milliseconds reset_interval{600000};
+    // How much worse than the best score the static order may be before it
+    // is overridden, as a fraction
+    double badness_threshold = 0.1;
+};
+
 struct i_endpoint_snitch {
 private:
     template <typename... A>
@@ -117,6 +133,14 @@ struct i_endpoint_snitch {
         std::vector<inet_address>& l1,
         std::vector<inet_address>& l2) = 0;
 
+    /**
+     * called with the time it took endpoint to respond to a request this node
+     * sent it
+     */
+    virtual void receive_timing(inet_address endpoint, std::chrono::steady_clock::duration latency) {
+        // noop by default
+    }
+
     virtual ~i_endpoint_snitch() { assert(_state == snitch_state::stopped); };
 
     // noop by default
@@ -159,6 +183,12 @@ struct i_endpoint_snitch {
         return snitch_instance().local();
     }
 
+    // Should be set before the snitch is created.
+    static dynamic_snitch_config& dynamic_snitch_cfg() {
+        static dynamic_snitch_config cfg;
+        return cfg;
+    }
+
     void set_snitch_ready() {
         _state = snitch_state::running;
     }
@@ -243,6 +273,12 @@ struct snitch_ptr {
     ptr_type _ptr;
 };
 
+/**
+ * Wraps subsnitch in a dynamic snitch configured by
+ * i_endpoint_snitch::dynamic_snitch_cfg(), see dynamic_snitch.hh.
+ */
+std::unique_ptr<i_endpoint_snitch> make_dynamic_snitch(std::unique_ptr<i_endpoint_snitch> subsnitch);
+
 /**
  * Initializes the distributed<snitch_ptr> object
  *
@@ -269,6 +305,10 @@ future<> i_endpoint_snitch::init_snitch_obj(
                     return create_object<i_endpoint_snitch>(snitch_name, std::forward<A>(a)...);
                 }, std::move(a))));
 
+                if (dynamic_snitch_cfg().enabled) {
+                    s = make_dynamic_snitch(std::move(s));
+                }
+
                 s->set_my_distributed(&snitch_obj);
                 local_inst = std::move(s);
             } catch (no_such_class& e) {
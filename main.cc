@@ -379,6 +379,11 @@ int main(int ac, char** av) {
                 smp::invoke_on_all([] { engine().set_strict_dma(false); }).get();
             }
             supervisor_notify("creating snitch");
+            auto& snitch_cfg = i_endpoint_snitch::dynamic_snitch_cfg();
+            snitch_cfg.enabled = cfg->dynamic_snitch();
+            snitch_cfg.update_interval = std::chrono::milliseconds(cfg->dynamic_snitch_update_interval_in_ms());
+            snitch_cfg.reset_interval = std::chrono::milliseconds(cfg->dynamic_snitch_reset_interval_in_ms());
+            snitch_cfg.badness_threshold = cfg->dynamic_snitch_badness_threshold();
             i_endpoint_snitch::create_snitch(cfg->endpoint_snitch()).get();
             // #293 - do not stop anything
             // engine().at_exit([] { return i_endpoint_snitch::stop_snitch(); });
@@ -531,7 +536,7 @@ int main(int ac, char** av) {
             supervisor_notify("starting streaming service");
             streaming::stream_session::init_streaming_service(db).get();
             api::set_server_stream_manager(ctx).get();
-            // Start handling REPAIR_CHECKSUM_RANGE messages
+            // Start handling the repair messages
             net::get_messaging_service().invoke_on_all([&db] (auto& ms) {
                 ms.register_repair_checksum_range([&db] (sstring keyspace, sstring cf, query::range<dht::token> range) {
                     return do_with(std::move(keyspace), std::move(cf), std::move(range),
@@ -539,6 +544,37 @@ int main(int ac, char** av) {
                         return checksum_range(db, keyspace, cf, range);
                     });
                 });
+                ms.register_repair_checksum_tree([&db] (sstring keyspace, sstring cf, query::range<dht::token> range, unsigned depth) {
+                    return do_with(std::move(keyspace), std::move(cf), std::move(range),
+                            [&db, depth] (auto& keyspace, auto& cf, auto& range) {
+                        return checksum_tree(db, keyspace, cf, range, depth);
+                    });
+                });
+                ms.register_repair_row_hashes([&db] (sstring keyspace, sstring cf, query::range<dht::token> range, uint64_t max_rows,
+                        std::experimental::optional<repair_row_position> after) {
+                    return do_with(std::move(keyspace), std::move(cf), std::move(range), std::move(after),
+                            [&db, max_rows] (auto& keyspace, auto& cf, auto& range, auto& after) {
+                        return repair_row_hashes(db, keyspace, cf, range, max_rows, after);
+                    });
+                });
+                ms.register_repair_get_rows([&db] (sstring keyspace, sstring cf, std::vector<repair_partition_rows> rows) {
+                    return do_with(std::move(keyspace), std::move(cf), std::move(rows),
+                            [&db] (auto& keyspace, auto& cf, auto& rows) {
+                        return repair_get_rows(db, keyspace, cf, rows);
+                    });
+                });
+                ms.register_repair_put_rows([&db] (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms) {
+                    auto from = net::messaging_service::get_source(cinfo);
+                    return do_with(std::move(fms), [&db, from] (auto& fms) {
+                        return repair_apply_rows(db, fms, from);
+                    });
+                });
+                ms.register_repair_flush_rows([&db] (sstring keyspace, sstring cf, query::range<dht::token> range) {
+                    return do_with(std::move(keyspace), std::move(cf), std::move(range),
+                            [&db] (auto& keyspace, auto& cf, auto& range) {
+                        return repair_flush_rows(db, keyspace, cf, range);
+                    });
+                });
             }).get();
             supervisor_notify("starting storage service", true);
             auto& ss = service::get_local_storage_service();
@@ -305,8 +305,15 @@ static unsigned get_rpc_client_idx(messaging_verb verb) {
     } else if (verb == messaging_verb::PREPARE_MESSAGE ||
                verb == messaging_verb::PREPARE_DONE_MESSAGE ||
                verb == messaging_verb::STREAM_MUTATION ||
+               verb == messaging_verb::STREAM_MUTATION_BATCH ||
+               verb == messaging_verb::STREAM_SSTABLE_BEGIN ||
+               verb == messaging_verb::STREAM_SSTABLE_CHUNK ||
+               verb == messaging_verb::STREAM_SSTABLE_END ||
                verb == messaging_verb::STREAM_MUTATION_DONE ||
-               verb == messaging_verb::COMPLETE_MESSAGE) {
+               verb == messaging_verb::COMPLETE_MESSAGE ||
+               verb == messaging_verb::REPAIR_GET_ROWS ||
+               verb == messaging_verb::REPAIR_PUT_ROWS ||
+               verb == messaging_verb::REPAIR_FLUSH_ROWS) {
         idx = 2;
     }
     return idx;
@@ -609,6 +616,52 @@ future<> messaging_service::send_stream_mutation(msg_addr id, UUID plan_id, froz
         plan_id, std::move(fm), dst_cpu_id);
 }
 
+// STREAM_MUTATION_BATCH
+void messaging_service::register_stream_mutation_batch(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::STREAM_MUTATION_BATCH, std::move(func));
+}
+future<> messaging_service::send_stream_mutation_batch(msg_addr id, UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id) {
+    return send_message_timeout_and_retry<void>(this, messaging_verb::STREAM_MUTATION_BATCH, id,
+        streaming_timeout, streaming_nr_retry, streaming_wait_before_retry,
+        plan_id, std::move(fms), dst_cpu_id);
+}
+
+// STREAM_SSTABLE_BEGIN
+void messaging_service::register_stream_sstable_begin(std::function<future<int64_t> (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id,
+        sstring version, sstring format, std::vector<sstring> components, unsigned src_shard_count, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::STREAM_SSTABLE_BEGIN, std::move(func));
+}
+future<int64_t> messaging_service::send_stream_sstable_begin(msg_addr id, UUID plan_id, UUID cf_id,
+        sstring version, sstring format, std::vector<sstring> components, unsigned src_shard_count, unsigned dst_cpu_id) {
+    return send_message_timeout_and_retry<int64_t>(this, messaging_verb::STREAM_SSTABLE_BEGIN, id,
+        streaming_timeout, streaming_nr_retry, streaming_wait_before_retry,
+        plan_id, cf_id, std::move(version), std::move(format), std::move(components), src_shard_count, dst_cpu_id);
+}
+
+// STREAM_SSTABLE_CHUNK
+void messaging_service::register_stream_sstable_chunk(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, int64_t generation,
+        unsigned component, uint64_t offset, bytes data, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::STREAM_SSTABLE_CHUNK, std::move(func));
+}
+future<> messaging_service::send_stream_sstable_chunk(msg_addr id, UUID plan_id, int64_t generation,
+        unsigned component, uint64_t offset, bytes data, unsigned dst_cpu_id) {
+    return send_message_timeout_and_retry<void>(this, messaging_verb::STREAM_SSTABLE_CHUNK, id,
+        streaming_timeout, streaming_nr_retry, streaming_wait_before_retry,
+        plan_id, generation, component, offset, std::move(data), dst_cpu_id);
+}
+
+// STREAM_SSTABLE_END
+void messaging_service::register_stream_sstable_end(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id, int64_t generation,
+        std::vector<uint64_t> sizes, unsigned dst_cpu_id)>&& func) {
+    register_handler(this, messaging_verb::STREAM_SSTABLE_END, std::move(func));
+}
+future<> messaging_service::send_stream_sstable_end(msg_addr id, UUID plan_id, UUID cf_id, int64_t generation,
+        std::vector<uint64_t> sizes, unsigned dst_cpu_id) {
+    return send_message_timeout_and_retry<void>(this, messaging_verb::STREAM_SSTABLE_END, id,
+        streaming_timeout, streaming_nr_retry, streaming_wait_before_retry,
+        plan_id, cf_id, generation, std::move(sizes), dst_cpu_id);
+}
+
 // STREAM_MUTATION_DONE
 void messaging_service::register_stream_mutation_done(std::function<future<> (const rpc::client_info& cinfo,
         UUID plan_id, std::vector<range<dht::token>> ranges, UUID cf_id, unsigned dst_cpu_id)>&& func) {
@@ -776,6 +829,16 @@ future<query::result_digest> messaging_service::send_read_digest(msg_addr id, cl
     return send_message_timeout<query::result_digest>(this, net::messaging_verb::READ_DIGEST, std::move(id), timeout, cmd, pr);
 }
 
+void messaging_service::register_read_partial_aggregates(std::function<future<std::vector<bytes_opt>> (const rpc::client_info&, query::read_command cmd, std::vector<query::partition_range> prs, std::vector<query::aggregate_selector> aggregates)>&& func) {
+    register_handler(this, net::messaging_verb::READ_PARTIAL_AGGREGATES, std::move(func));
+}
+void messaging_service::unregister_read_partial_aggregates() {
+    _rpc->unregister_handler(net::messaging_verb::READ_PARTIAL_AGGREGATES);
+}
+future<std::vector<bytes_opt>> messaging_service::send_read_partial_aggregates(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const std::vector<query::partition_range>& prs, const std::vector<query::aggregate_selector>& aggregates) {
+    return send_message_timeout<std::vector<bytes_opt>>(this, net::messaging_verb::READ_PARTIAL_AGGREGATES, std::move(id), timeout, cmd, prs, aggregates);
+}
+
 // Wrapper for TRUNCATE
 void messaging_service::register_truncate(std::function<future<> (sstring, sstring)>&& func) {
     register_handler(this, net::messaging_verb::TRUNCATE, std::move(func));
@@ -818,4 +881,82 @@ future<partition_checksum> messaging_service::send_repair_checksum_range(
             std::move(keyspace), std::move(cf), std::move(range));
 }
 
+// Wrapper for REPAIR_CHECKSUM_TREE
+void messaging_service::register_repair_checksum_tree(
+        std::function<future<repair_hash_tree> (sstring keyspace,
+                sstring cf, query::range<dht::token> range, unsigned depth)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_CHECKSUM_TREE, std::move(f));
+}
+void messaging_service::unregister_repair_checksum_tree() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_CHECKSUM_TREE);
+}
+future<repair_hash_tree> messaging_service::send_repair_checksum_tree(
+        msg_addr id, sstring keyspace, sstring cf, ::range<dht::token> range, unsigned depth)
+{
+    return send_message<repair_hash_tree>(this,
+            messaging_verb::REPAIR_CHECKSUM_TREE, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(range), depth);
+}
+
+// Wrapper for REPAIR_ROW_HASHES
+void messaging_service::register_repair_row_hashes(
+        std::function<future<std::vector<repair_partition_hashes>> (sstring keyspace,
+                sstring cf, query::range<dht::token> range, uint64_t max_rows,
+                std::experimental::optional<repair_row_position> after)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_ROW_HASHES, std::move(f));
+}
+void messaging_service::unregister_repair_row_hashes() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_ROW_HASHES);
+}
+future<std::vector<repair_partition_hashes>> messaging_service::send_repair_row_hashes(
+        msg_addr id, sstring keyspace, sstring cf, ::range<dht::token> range, uint64_t max_rows,
+        std::experimental::optional<repair_row_position> after)
+{
+    return send_message<std::vector<repair_partition_hashes>>(this,
+            messaging_verb::REPAIR_ROW_HASHES, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(range), max_rows, std::move(after));
+}
+
+// Wrapper for REPAIR_GET_ROWS
+void messaging_service::register_repair_get_rows(
+        std::function<future<std::vector<frozen_mutation>> (sstring keyspace,
+                sstring cf, std::vector<repair_partition_rows> rows)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_GET_ROWS, std::move(f));
+}
+void messaging_service::unregister_repair_get_rows() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_GET_ROWS);
+}
+future<std::vector<frozen_mutation>> messaging_service::send_repair_get_rows(
+        msg_addr id, sstring keyspace, sstring cf, std::vector<repair_partition_rows> rows)
+{
+    return send_message<std::vector<frozen_mutation>>(this,
+            messaging_verb::REPAIR_GET_ROWS, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(rows));
+}
+
+// Wrapper for REPAIR_PUT_ROWS
+void messaging_service::register_repair_put_rows(
+        std::function<future<> (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_PUT_ROWS, std::move(f));
+}
+void messaging_service::unregister_repair_put_rows() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_PUT_ROWS);
+}
+future<> messaging_service::send_repair_put_rows(msg_addr id, std::vector<frozen_mutation> fms) {
+    return send_message<void>(this, messaging_verb::REPAIR_PUT_ROWS, std::move(id), std::move(fms));
+}
+
+// Wrapper for REPAIR_FLUSH_ROWS
+void messaging_service::register_repair_flush_rows(
+        std::function<future<> (sstring keyspace, sstring cf, query::range<dht::token> range)>&& f) {
+    register_handler(this, messaging_verb::REPAIR_FLUSH_ROWS, std::move(f));
+}
+void messaging_service::unregister_repair_flush_rows() {
+    _rpc->unregister_handler(messaging_verb::REPAIR_FLUSH_ROWS);
+}
+future<> messaging_service::send_repair_flush_rows(msg_addr id, sstring keyspace, sstring cf, ::range<dht::token> range) {
+    return send_message<void>(this, messaging_verb::REPAIR_FLUSH_ROWS, std::move(id),
+            std::move(keyspace), std::move(cf), std::move(range));
+}
+
 } // namespace net
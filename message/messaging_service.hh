@@ -55,6 +55,10 @@ class seed_provider_type;
 class frozen_mutation;
 class frozen_schema;
 class partition_checksum;
+class repair_hash_tree;
+struct repair_partition_hashes;
+struct repair_partition_rows;
+struct repair_row_position;
 
 namespace dht {
     class token;
@@ -97,7 +101,17 @@ enum class messaging_verb : int32_t {
     REPAIR_CHECKSUM_RANGE = 20,
     GET_SCHEMA_VERSION = 21,
     SCHEMA_CHECK = 22,
-    LAST = 23,
+    STREAM_MUTATION_BATCH = 23,
+    STREAM_SSTABLE_BEGIN = 24,
+    STREAM_SSTABLE_CHUNK = 25,
+    STREAM_SSTABLE_END = 26,
+    REPAIR_CHECKSUM_TREE = 27,
+    REPAIR_ROW_HASHES = 28,
+    REPAIR_GET_ROWS = 29,
+    REPAIR_PUT_ROWS = 30,
+    READ_PARTIAL_AGGREGATES = 31,
+    REPAIR_FLUSH_ROWS = 32,
+    LAST = 33,
 };
 
 } // namespace net
@@ -213,6 +227,30 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void register_stream_mutation(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, frozen_mutation fm, unsigned dst_cpu_id)>&& func);
     future<> send_stream_mutation(msg_addr id, UUID plan_id, frozen_mutation fm, unsigned dst_cpu_id);
 
+    // Wrapper for STREAM_MUTATION_BATCH verb
+    void register_stream_mutation_batch(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id)>&& func);
+    future<> send_stream_mutation_batch(msg_addr id, UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id);
+
+    // Wrapper for STREAM_SSTABLE_BEGIN verb
+    // Returns the generation of the sstable on the receiver, or -1 if the
+    // receiver cannot take the sstable as a whole.
+    void register_stream_sstable_begin(std::function<future<int64_t> (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id,
+            sstring version, sstring format, std::vector<sstring> components, unsigned src_shard_count, unsigned dst_cpu_id)>&& func);
+    future<int64_t> send_stream_sstable_begin(msg_addr id, UUID plan_id, UUID cf_id,
+            sstring version, sstring format, std::vector<sstring> components, unsigned src_shard_count, unsigned dst_cpu_id);
+
+    // Wrapper for STREAM_SSTABLE_CHUNK verb
+    void register_stream_sstable_chunk(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, int64_t generation,
+            unsigned component, uint64_t offset, bytes data, unsigned dst_cpu_id)>&& func);
+    future<> send_stream_sstable_chunk(msg_addr id, UUID plan_id, int64_t generation,
+            unsigned component, uint64_t offset, bytes data, unsigned dst_cpu_id);
+
+    // Wrapper for STREAM_SSTABLE_END verb
+    void register_stream_sstable_end(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id, int64_t generation,
+            std::vector<uint64_t> sizes, unsigned dst_cpu_id)>&& func);
+    future<> send_stream_sstable_end(msg_addr id, UUID plan_id, UUID cf_id, int64_t generation,
+            std::vector<uint64_t> sizes, unsigned dst_cpu_id);
+
     void register_stream_mutation_done(std::function<future<> (const rpc::client_info& cinfo, UUID plan_id, std::vector<range<dht::token>> ranges, UUID cf_id, unsigned dst_cpu_id)>&& func);
     future<> send_stream_mutation_done(msg_addr id, UUID plan_id, std::vector<range<dht::token>> ranges, UUID cf_id, unsigned dst_cpu_id);
 
@@ -224,6 +262,31 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void unregister_repair_checksum_range();
     future<partition_checksum> send_repair_checksum_range(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range);
 
+    // Wrapper for REPAIR_CHECKSUM_TREE verb
+    void register_repair_checksum_tree(std::function<future<repair_hash_tree> (sstring keyspace, sstring cf, range<dht::token> range, unsigned depth)>&& func);
+    void unregister_repair_checksum_tree();
+    future<repair_hash_tree> send_repair_checksum_tree(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range, unsigned depth);
+
+    // Wrapper for REPAIR_ROW_HASHES verb
+    void register_repair_row_hashes(std::function<future<std::vector<repair_partition_hashes>> (sstring keyspace, sstring cf, range<dht::token> range, uint64_t max_rows, std::experimental::optional<repair_row_position> after)>&& func);
+    void unregister_repair_row_hashes();
+    future<std::vector<repair_partition_hashes>> send_repair_row_hashes(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range, uint64_t max_rows, std::experimental::optional<repair_row_position> after);
+
+    // Wrapper for REPAIR_GET_ROWS verb
+    void register_repair_get_rows(std::function<future<std::vector<frozen_mutation>> (sstring keyspace, sstring cf, std::vector<repair_partition_rows> rows)>&& func);
+    void unregister_repair_get_rows();
+    future<std::vector<frozen_mutation>> send_repair_get_rows(msg_addr id, sstring keyspace, sstring cf, std::vector<repair_partition_rows> rows);
+
+    // Wrapper for REPAIR_PUT_ROWS verb
+    void register_repair_put_rows(std::function<future<> (const rpc::client_info& cinfo, std::vector<frozen_mutation> fms)>&& func);
+    void unregister_repair_put_rows();
+    future<> send_repair_put_rows(msg_addr id, std::vector<frozen_mutation> fms);
+
+    // Wrapper for REPAIR_FLUSH_ROWS verb
+    void register_repair_flush_rows(std::function<future<> (sstring keyspace, sstring cf, range<dht::token> range)>&& func);
+    void unregister_repair_flush_rows();
+    future<> send_repair_flush_rows(msg_addr id, sstring keyspace, sstring cf, range<dht::token> range);
+
     // Wrapper for GOSSIP_ECHO verb
     void register_gossip_echo(std::function<future<> ()>&& func);
     void unregister_gossip_echo();
@@ -299,6 +362,11 @@ class messaging_service : public seastar::async_sharded_service<messaging_servic
     void unregister_read_digest();
     future<query::result_digest> send_read_digest(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const query::partition_range& pr);
 
+    // Wrapper for READ_PARTIAL_AGGREGATES
+    void register_read_partial_aggregates(std::function<future<std::vector<bytes_opt>> (const rpc::client_info&, query::read_command cmd, std::vector<query::partition_range> prs, std::vector<query::aggregate_selector> aggregates)>&& func);
+    void unregister_read_partial_aggregates();
+    future<std::vector<bytes_opt>> send_read_partial_aggregates(msg_addr id, clock_type::time_point timeout, const query::read_command& cmd, const std::vector<query::partition_range>& prs, const std::vector<query::aggregate_selector>& aggregates);
+
     // Wrapper for TRUNCATE
     void register_truncate(std::function<future<>(sstring, sstring)>&& func);
     void unregister_truncate();
@@ -63,6 +63,32 @@ to_data_query_result(const reconcilable_result& r, schema_ptr s, const query::pa
     return builder.build();
 }
 
+stop_iteration reconcilable_result_builder::consume(mutation&& m) {
+    // FIXME: Make data sources respect row_ranges so that we don't have to filter them out here.
+    auto is_distinct = _slice.options.contains(query::partition_slice::option::distinct);
+    auto is_reversed = _slice.options.contains(query::partition_slice::option::reversed);
+    auto limit = !is_distinct ? _limit : 1;
+    auto rows_left = m.partition().compact_for_query(*m.schema(), _query_time, _slice.row_ranges(*m.schema(), m.key()),
+        is_reversed, limit);
+    _limit -= rows_left;
+
+    if (rows_left || !m.partition().empty()) {
+        // NOTE: We must return all columns, regardless of what's in
+        // partition_slice, for the results to be reconcilable with tombstones.
+        // That's because row's presence depends on existence of any
+        // column in a row (See mutation_partition::query). We could
+        // optimize this case and only send cell timestamps, without data,
+        // for the cells which are not queried for (TODO).
+        _result.emplace_back(partition{rows_left, freeze(m)});
+    }
+
+    return _limit ? stop_iteration::no : stop_iteration::yes;
+}
+
+reconcilable_result reconcilable_result_builder::build() {
+    return reconcilable_result(_requested_limit - _limit, std::move(_result));
+}
+
 future<reconcilable_result>
 mutation_query(schema_ptr s,
     const mutation_source& source,
@@ -73,12 +99,8 @@ mutation_query(schema_ptr s,
 {
     struct query_state {
         const query::partition_range& range;
-        const query::partition_slice& slice;
-        uint32_t requested_limit;
-        gc_clock::time_point query_time;
-        uint32_t limit;
+        reconcilable_result_builder builder;
         mutation_reader reader;
-        std::vector<partition> result;
 
         query_state(
             const query::partition_range& range,
@@ -87,10 +109,7 @@ mutation_query(schema_ptr s,
             gc_clock::time_point query_time
         )
             : range(range)
-            , slice(slice)
-            , requested_limit(requested_limit)
-            , query_time(query_time)
-            , limit(requested_limit)
+            , builder(slice, requested_limit, query_time)
         { }
     };
 
@@ -102,28 +121,9 @@ mutation_query(schema_ptr s,
                    [&source, s = std::move(s)] (query_state& state) -> future<reconcilable_result> {
         state.reader = source(std::move(s), state.range, service::get_local_sstable_query_read_priority());
         return consume(state.reader, [&state] (mutation&& m) {
-            // FIXME: Make data sources respect row_ranges so that we don't have to filter them out here.
-            auto is_distinct = state.slice.options.contains(query::partition_slice::option::distinct);
-            auto is_reversed = state.slice.options.contains(query::partition_slice::option::reversed);
-            auto limit = !is_distinct ? state.limit : 1;
-            auto rows_left = m.partition().compact_for_query(*m.schema(), state.query_time, state.slice.row_ranges(*m.schema(), m.key()),
-                is_reversed, limit);
-            state.limit -= rows_left;
-
-            if (rows_left || !m.partition().empty()) {
-                // NOTE: We must return all columns, regardless of what's in
-                // partition_slice, for the results to be reconcilable with tombstones.
-                // That's because row's presence depends on existence of any
-                // column in a row (See mutation_partition::query). We could
-                // optimize this case and only send cell timestamps, without data,
-                // for the cells which are not queried for (TODO).
-                state.result.emplace_back(partition{rows_left, freeze(m)});
-            }
-
-            return state.limit ? stop_iteration::no : stop_iteration::yes;
+            return state.builder.consume(std::move(m));
         }).then([&state] {
-            return make_ready_future<reconcilable_result>(
-                reconcilable_result(state.requested_limit - state.limit, std::move(state.result)));
+            return make_ready_future<reconcilable_result>(state.builder.build());
         });
     });
 }
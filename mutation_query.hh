@@ -96,6 +96,27 @@ class reconcilable_result {
 
 query::result to_data_query_result(const reconcilable_result&, schema_ptr, const query::partition_slice&);
 
+// Collects the partitions of a query in reconcilable form, see
+// mutation_query().
+class reconcilable_result_builder {
+    const query::partition_slice& _slice;
+    gc_clock::time_point _query_time;
+    uint32_t _requested_limit;
+    uint32_t _limit;
+    std::vector<partition> _result;
+public:
+    reconcilable_result_builder(const query::partition_slice& slice, uint32_t row_limit, gc_clock::time_point query_time)
+        : _slice(slice)
+        , _query_time(query_time)
+        , _requested_limit(row_limit)
+        , _limit(row_limit)
+    { }
+
+    // Stops once row_limit rows were collected.
+    stop_iteration consume(mutation&& m);
+    reconcilable_result build();
+};
+
 // Performs a query on given data source returning data in reconcilable form.
 //
 // Reads at most row_limit rows. If less rows are returned, the data source
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <seastar/core/scollectd.hh>
+
+#include "querier.hh"
+
+// Readers keep buffers for the sstables they read besides their own state;
+// a rough estimate.
+static constexpr size_t reader_memory_estimate = 128 * 1024;
+
+bool querier::continued_by(const schema& s, const query::partition_range& range) const {
+    if (!range.start() || !range.start()->value().has_key()
+            || !range.start()->value().equal(s, dht::ring_position(_last))) {
+        return false;
+    }
+    if (range.is_singular() || _range->is_singular()) {
+        return range.is_singular() && _range->is_singular();
+    }
+    auto& end = range.end();
+    auto& our_end = _range->end();
+    if (!end || !our_end) {
+        return !end && !our_end;
+    }
+    return end->is_inclusive() == our_end->is_inclusive() && end->value().equal(s, our_end->value());
+}
+
+size_t querier::memory_usage() const {
+    return sizeof(querier) + reader_memory_estimate;
+}
+
+constexpr std::chrono::seconds querier_cache::entry_ttl;
+
+querier_cache::querier_cache()
+    : _expiry_timer([this] { evict_expired(); })
+{
+    _expiry_timer.arm_periodic(entry_ttl / 2);
+    setup_collectd();
+}
+
+querier_cache::~querier_cache() {
+    _lru.clear();
+}
+
+void querier_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.bytes)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "drops")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.drops)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "expirations")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.expirations)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("querier_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "queriers")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.entries)
+        ),
+    }));
+}
+
+querier_cache::entries_type::iterator querier_cache::find(const entry& e) {
+    auto r = _entries.equal_range(e.key);
+    auto i = r.first;
+    while (&i->second != &e) {
+        ++i;
+    }
+    return i;
+}
+
+void querier_cache::erase(entries_type::iterator i) {
+    --_stats.entries;
+    _stats.bytes -= i->second.size;
+    // Unlinks the entry from _lru.
+    _entries.erase(i);
+}
+
+void querier_cache::evict_to_fit() {
+    while (_stats.bytes > _max_size) {
+        erase(find(_lru.back()));
+        ++_stats.evictions;
+    }
+}
+
+void querier_cache::evict_expired() {
+    // Entries are inserted at the front and never touched afterwards, so the
+    // LRU order is also the order of expiry.
+    auto now = lowres_clock::now();
+    while (!_lru.empty() && _lru.back().expires <= now) {
+        erase(find(_lru.back()));
+        ++_stats.expirations;
+    }
+}
+
+void querier_cache::insert(utils::UUID key, querier q) {
+    auto size = q.memory_usage();
+    if (size > _max_size) {
+        return;
+    }
+    auto i = _entries.emplace(std::piecewise_construct, std::forward_as_tuple(key),
+            std::forward_as_tuple(key, std::move(q), size, lowres_clock::now() + entry_ttl));
+    _lru.push_front(i->second);
+    ++_stats.entries;
+    _stats.bytes += size;
+    evict_to_fit();
+}
+
+std::experimental::optional<querier> querier_cache::lookup(const utils::UUID& key, const schema& s,
+        const querier_snapshot& current, const query::partition_range& range) {
+    auto r = _entries.equal_range(key);
+    for (auto i = r.first; i != r.second; ++i) {
+        if (!i->second.q.continued_by(s, range)) {
+            continue;
+        }
+        if (!i->second.q.valid_for(s, current)) {
+            erase(i);
+            ++_stats.drops;
+            break;
+        }
+        auto q = std::move(i->second.q);
+        erase(i);
+        ++_stats.hits;
+        return std::move(q);
+    }
+    ++_stats.misses;
+    return {};
+}
+
+void querier_cache::evict_all_for_table(const utils::UUID& cf_id) {
+    auto i = _entries.begin();
+    while (i != _entries.end()) {
+        if (i->second.q.schema()->id() == cf_id) {
+            erase(i++);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void querier_cache::clear() {
+    while (!_entries.empty()) {
+        erase(_entries.begin());
+    }
+}
+
+void querier_cache::set_max_size(size_t size) {
+    _max_size = size;
+    evict_to_fit();
+}
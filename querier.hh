@@ -0,0 +1,189 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <experimental/optional>
+#include <boost/intrusive/list.hpp>
+
+#include "core/shared_ptr.hh"
+#include "core/timer.hh"
+#include "core/reactor.hh"
+#include "memtable.hh"
+#include "mutation_reader.hh"
+#include "query-request.hh"
+#include "sstables/sstables.hh"
+#include "utils/UUID.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+// The data a column family's readers are created from: its active memtable
+// and its sstable set. Readers don't see memtables and sstables which are
+// added after they are created, and may have read ahead of the partition
+// they are suspended at, so a suspended reader may only be resumed as long
+// as none of them has changed and nothing was written since. Both are held,
+// so that a new memtable or sstable set can never reuse the address of the
+// ones in a snapshot.
+struct querier_snapshot {
+    lw_shared_ptr<memtable> active_memtable;
+    lw_shared_ptr<sstables::sstable_list> sstables;
+    // The number of writes applied to the column family.
+    uint64_t writes = 0;
+
+    bool operator==(const querier_snapshot& o) const {
+        return active_memtable == o.active_memtable && sstables == o.sstables && writes == o.writes;
+    }
+    bool operator!=(const querier_snapshot& o) const {
+        return !(*this == o);
+    }
+};
+
+// The reader of a paged, single-range query, suspended where the query's
+// page ended. The next page of the query continues from it instead of
+// creating new memtable, cache and sstable readers and seeking to where the
+// page ended again.
+//
+// A querier can only serve a page which continues the range it was created
+// for from the partition the previous page ended in. The reader is past that
+// partition, so if the page reads the rest of its rows, they are read again.
+class querier {
+    schema_ptr _schema;
+    querier_snapshot _snapshot;
+    // The reader refers to the range, so it must not move.
+    std::unique_ptr<query::partition_range> _range;
+    mutation_reader _reader;
+    // The partition the page ended in, already read from _reader.
+    dht::decorated_key _last;
+public:
+    querier(schema_ptr s, querier_snapshot snapshot, std::unique_ptr<query::partition_range> range,
+            mutation_reader reader, dht::decorated_key last)
+        : _schema(std::move(s))
+        , _snapshot(std::move(snapshot))
+        , _range(std::move(range))
+        , _reader(std::move(reader))
+        , _last(std::move(last))
+    { }
+
+    const schema_ptr& schema() const {
+        return _schema;
+    }
+    // Whether a page reading the given range continues where this querier
+    // stopped: the range starts at the partition the previous page ended
+    // in, and ends where the querier's range ends.
+    bool continued_by(const schema& s, const query::partition_range& range) const;
+    // Whether the querier can still serve a page, i.e. the schema and the
+    // data it reads are those of the column family.
+    bool valid_for(const schema& s, const querier_snapshot& current) const {
+        return _schema->version() == s.version() && _snapshot == current;
+    }
+    // Estimate of the memory kept alive by the querier. Readers don't report
+    // the memory they use, so their buffers are accounted for by a constant.
+    size_t memory_usage() const;
+
+    const querier_snapshot& snapshot() const {
+        return _snapshot;
+    }
+    std::unique_ptr<query::partition_range>& range() {
+        return _range;
+    }
+    mutation_reader& reader() {
+        return _reader;
+    }
+    const dht::decorated_key& last() const {
+        return _last;
+    }
+};
+
+// Per-shard cache of suspended queriers, keyed by the id of the paged query
+// they belong to. A query may have one querier for each range it reads on a
+// shard. Queriers are evicted in LRU order once they use more than the
+// cache's budget, and after entry_ttl, as queries may be abandoned by their
+// clients at any page.
+class querier_cache {
+public:
+    static constexpr std::chrono::seconds entry_ttl{10};
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        // Found, but could not be resumed as the data or schema changed.
+        uint64_t drops = 0;
+        uint64_t evictions = 0;
+        uint64_t expirations = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+private:
+    struct entry {
+        boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> lru_link;
+        utils::UUID key;
+        querier q;
+        size_t size;
+        lowres_clock::time_point expires;
+
+        entry(utils::UUID key, querier q, size_t size, lowres_clock::time_point expires)
+            : key(std::move(key)), q(std::move(q)), size(size), expires(expires)
+        { }
+    };
+    using entries_type = std::unordered_multimap<utils::UUID, entry>;
+    using lru_type = boost::intrusive::list<entry,
+        boost::intrusive::member_hook<entry, decltype(entry::lru_link), &entry::lru_link>,
+        boost::intrusive::constant_time_size<false>>;
+
+    entries_type _entries;
+    lru_type _lru;
+    size_t _max_size = 0;
+    stats _stats;
+    timer<lowres_clock> _expiry_timer;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    void setup_collectd();
+    entries_type::iterator find(const entry&);
+    void erase(entries_type::iterator);
+    void evict_to_fit();
+    void evict_expired();
+public:
+    querier_cache();
+    ~querier_cache();
+
+    // Saves the querier of the given query, once its page is done.
+    void insert(utils::UUID key, querier q);
+    // Removes and returns the querier of the given query which can serve a
+    // page reading the given range, if there is one.
+    std::experimental::optional<querier> lookup(const utils::UUID& key, const schema& s,
+            const querier_snapshot& current, const query::partition_range& range);
+    // Drops the queriers reading a column family, which is going away.
+    void evict_all_for_table(const utils::UUID& cf_id);
+    void clear();
+
+    // Maximum memory kept alive by queriers; 0 disables the cache.
+    void set_max_size(size_t size);
+    size_t max_size() const {
+        return _max_size;
+    }
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
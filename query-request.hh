@@ -155,20 +155,37 @@ class read_command {
     partition_slice slice;
     uint32_t row_limit;
     gc_clock::time_point timestamp;
+    // Identifies the paged query the command reads a page of, so that
+    // replicas can resume the readers of its previous page. Null for
+    // commands which are not part of a paged query.
+    utils::UUID query_id;
 public:
     read_command(utils::UUID cf_id,
                  table_schema_version schema_version,
                  partition_slice slice,
                  uint32_t row_limit = max_rows,
-                 gc_clock::time_point now = gc_clock::now())
+                 gc_clock::time_point now = gc_clock::now(),
+                 utils::UUID query_id = utils::UUID())
         : cf_id(std::move(cf_id))
         , schema_version(std::move(schema_version))
         , slice(std::move(slice))
         , row_limit(row_limit)
         , timestamp(now)
+        , query_id(std::move(query_id))
     { }
 
     friend std::ostream& operator<<(std::ostream& out, const read_command& r);
 };
 
+// One aggregate function call of a select clause, whose arguments are all
+// columns (none for count(*)). Replicas rebuild the aggregate from it to
+// compute partial aggregates over their data, so that the coordinator of an
+// aggregation query only receives their partial states.
+// Can be accessed across cores.
+struct aggregate_selector {
+    sstring function_keyspace;
+    sstring function_name;
+    std::vector<sstring> columns;
+};
+
 }
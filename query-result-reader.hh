@@ -157,6 +157,18 @@ class result_view {
         }
     }
 
+    // Returns the number of clustered rows in the result. Partitions which
+    // only have a static row are not counted.
+    static uint32_t count_rows(const query::result& res) {
+        return do_with(res, [] (result_view v) {
+            uint32_t count = 0;
+            for (auto&& p : v._v.partitions()) {
+                count += p.rows().size();
+            }
+            return count;
+        });
+    }
+
     template <typename ResultVisitor>
     static void consume(const query::result& res, const partition_slice& slice, ResultVisitor&& visitor) {
         do_with(res, [&] (result_view v) {
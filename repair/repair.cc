@@ -27,13 +27,19 @@
 #include "db/config.hh"
 #include "service/storage_service.hh"
 #include "service/priority_manager.hh"
+#include "service/storage_proxy.hh"
+#include "service/migration_manager.hh"
+#include "message/messaging_service.hh"
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/range/irange.hpp>
+#include <experimental/optional>
 
 #include <cryptopp/sha.h>
 #include <seastar/core/gate.hh>
+#include <seastar/core/bitops.hh>
 
 static logging::logger logger("repair");
 
@@ -187,6 +193,11 @@ static std::vector<gms::inet_address> get_neighbors(database& db,
 }
 
 
+// How many of the last finished sub-ranges repair_progress lists.
+constexpr size_t repair_max_recent_subranges = 64;
+// How many finished repairs have their progress kept.
+constexpr size_t repair_max_finished_progress = 16;
+
 // The repair_tracker tracks ongoing repair operations and their progress.
 // A repair which has already finished successfully is dropped from this
 // table, but a failed repair will remain in the table forever so it can
@@ -204,6 +215,9 @@ static class {
     // Successfully-finished repairs are those with id < _next_repair_command
     // but aren't listed as running or failed the status map.
     std::unordered_map<int, repair_status> _status;
+    std::unordered_map<int, repair_progress> _progress;
+    // Finished repairs with an entry in _progress, oldest first.
+    std::deque<int> _finished;
     // Used to allow shutting down repairs in progress, and waiting for them.
     seastar::gate _gate;
 public:
@@ -217,6 +231,11 @@ static class {
         } else {
             _status[id] = repair_status::FAILED;
         }
+        _finished.push_back(id);
+        if (_finished.size() > repair_max_finished_progress) {
+            _progress.erase(_finished.front());
+            _finished.pop_front();
+        }
         _gate.leave();
     }
     repair_status get(int id) {
@@ -233,6 +252,30 @@ static class {
     int next_repair_command() {
         return _next_repair_command++;
     }
+    void set_ranges_total(int id, size_t ranges) {
+        _progress[id].ranges_total = ranges;
+    }
+    void range_done(int id) {
+        _progress[id].ranges_done++;
+    }
+    void subrange_done(int id, repair_range_timing timing) {
+        auto& p = _progress[id];
+        p.subrange_duration.mark(timing.duration.count());
+        if (p.recent_subranges.size() == repair_max_recent_subranges) {
+            p.recent_subranges.pop_front();
+        }
+        p.recent_subranges.push_back(std::move(timing));
+    }
+    repair_progress get_progress(int id) {
+        if (id >= _next_repair_command) {
+            throw std::runtime_error(sprint("unknown repair id %d", id));
+        }
+        auto it = _progress.find(id);
+        if (it == _progress.end()) {
+            return repair_progress();
+        }
+        return it->second;
+    }
     future<> shutdown() {
         return _gate.close();
     }
@@ -308,6 +351,64 @@ std::ostream& operator<<(std::ostream& out, const partition_checksum& c) {
     return out;
 }
 
+repair_hash_tree::repair_hash_tree(std::vector<partition_checksum> leaves)
+        : _nodes(leaves.size() * 2) {
+    if (leaves.empty() || (leaves.size() & (leaves.size() - 1))) {
+        throw std::invalid_argument(sprint("repair_hash_tree: %d leaves is not a power of two", leaves.size()));
+    }
+    std::copy(leaves.begin(), leaves.end(), _nodes.begin() + leaf_count());
+    for (size_t i = leaf_count() - 1; i > 0; i--) {
+        _nodes[i] = _nodes[2 * i];
+        _nodes[i].add(_nodes[2 * i + 1]);
+    }
+}
+
+unsigned repair_hash_tree::depth() const {
+    return count_trailing_zeros(leaf_count());
+}
+
+void repair_hash_tree::add(size_t leaf, const partition_checksum& c) {
+    for (size_t i = leaf_count() + leaf; i > 0; i /= 2) {
+        _nodes[i].add(c);
+    }
+}
+
+void repair_hash_tree::add(const repair_hash_tree& other) {
+    if (other._nodes.size() != _nodes.size()) {
+        throw std::invalid_argument(sprint("repair_hash_tree: cannot add a tree of depth %d to one of depth %d", other.depth(), depth()));
+    }
+    for (size_t i = 1; i < _nodes.size(); i++) {
+        _nodes[i].add(other._nodes[i]);
+    }
+}
+
+std::vector<partition_checksum> repair_hash_tree::leaves() const {
+    return std::vector<partition_checksum>(_nodes.begin() + leaf_count(), _nodes.end());
+}
+
+std::vector<size_t> repair_hash_tree::differing_leaves(const repair_hash_tree& other) const {
+    if (other._nodes.size() != _nodes.size()) {
+        throw std::invalid_argument(sprint("repair_hash_tree: cannot compare a tree of depth %d to one of depth %d", other.depth(), depth()));
+    }
+    std::vector<size_t> ret;
+    // Depth-first, left subtree first, so the leaves come out in order.
+    std::vector<size_t> pending{1};
+    while (!pending.empty()) {
+        auto i = pending.back();
+        pending.pop_back();
+        if (_nodes[i] == other._nodes[i]) {
+            continue;
+        }
+        if (i >= leaf_count()) {
+            ret.push_back(i - leaf_count());
+        } else {
+            pending.push_back(2 * i + 1);
+            pending.push_back(2 * i);
+        }
+    }
+    return ret;
+}
+
 // Calculate the checksum of the data held *on this shard* of a column family,
 // in the given token range.
 // All parameters to this function are constant references, and the caller
@@ -378,17 +479,655 @@ future<partition_checksum> checksum_range(seastar::sharded<database> &db,
     });
 }
 
-static future<> sync_range(seastar::sharded<database>& db,
+// Trees deeper than this are refused, this bounds the memory a tree
+// request can take to 2^(max_depth+1) checksums of 32 bytes each, 64KB,
+// so that the trees of all sub-ranges being repaired at once stay small.
+constexpr unsigned repair_tree_max_depth = 10;
+
+// Appends, in order, the 2^depth - 1 tokens which split (lo, hi] into 2^depth
+// leaves of about equal token width. hi == minimum_token() stands for the
+// end of the ring. A part too narrow to split any further goes to the last
+// leaf of its subtree, and the other leaves of that subtree stay empty.
+static void add_split_points(std::vector<dht::token>& out, const dht::token& lo, const dht::token& hi, unsigned depth) {
+    if (!depth) {
+        return;
+    }
+    auto mid = dht::global_partitioner().midpoint(lo, hi);
+    if (!(lo < mid) || !(hi == dht::minimum_token() || mid < hi)) {
+        mid = lo;
+    }
+    add_split_points(out, lo, mid, depth - 1);
+    out.push_back(mid);
+    add_split_points(out, mid, hi, depth - 1);
+}
+
+// Every replica computes the same split points for the same range and
+// depth, so that their hash trees have the same leaves.
+static std::vector<dht::token> tree_split_points(const ::range<dht::token>& range, unsigned depth) {
+    std::vector<dht::token> splits;
+    splits.reserve((size_t(1) << depth) - 1);
+    add_split_points(splits,
+            range.start() ? range.start()->value() : dht::minimum_token(),
+            range.end() ? range.end()->value() : dht::minimum_token(),
+            depth);
+    return splits;
+}
+
+// Leaf i covers the tokens in (splits[i-1], splits[i]].
+static size_t tree_leaf_of(const std::vector<dht::token>& splits, const dht::token& t) {
+    return std::lower_bound(splits.begin(), splits.end(), t) - splits.begin();
+}
+
+// Returns the token ranges covered by the given leaves, which must be
+// sorted. Adjacent leaves are merged into one range.
+static std::vector<::range<dht::token>> tree_leaf_ranges(const ::range<dht::token>& range,
+        const std::vector<dht::token>& splits, const std::vector<size_t>& leaves) {
+    using bound = ::range<dht::token>::bound;
+    std::vector<::range<dht::token>> ret;
+    for (size_t i = 0; i < leaves.size();) {
+        auto first = leaves[i];
+        auto last = first;
+        while (++i < leaves.size() && leaves[i] == last + 1) {
+            last++;
+        }
+        auto start = first == 0 ? range.start() : std::experimental::make_optional(bound(splits[first - 1], false));
+        auto end = last == splits.size() ? range.end() : std::experimental::make_optional(bound(splits[last], true));
+        ret.emplace_back(std::move(start), std::move(end));
+    }
+    return ret;
+}
+
+// Calculate the hash tree of the data held *on this shard* of a column
+// family, in the given token range. The same caveats as for
+// checksum_range_shard() apply.
+static future<repair_hash_tree> checksum_tree_shard(database &db,
+        const sstring& keyspace_name, const sstring& cf_name,
+        const ::range<dht::token>& range, const std::vector<dht::token>& splits, unsigned depth) {
+    auto& cf = db.find_column_family(keyspace_name, cf_name);
+    return do_with(query::to_partition_range(range), [&cf, &splits, depth] (const auto& partition_range) {
+        return do_with(cf.make_reader(cf.schema(), partition_range, service::get_local_streaming_read_priority()), repair_hash_tree(depth),
+            [&splits] (auto& reader, auto& tree) {
+            return repeat([&reader, &tree, &splits] () {
+                return reader().then([&tree, &splits] (auto mopt) {
+                    if (mopt) {
+                        tree.add(tree_leaf_of(splits, mopt->token()), partition_checksum(*mopt));
+                        return stop_iteration::no;
+                    } else {
+                        return stop_iteration::yes;
+                    }
+                });
+            }).then([&tree] {
+                return std::move(tree);
+            });
+        });
+    });
+}
+
+future<repair_hash_tree> checksum_tree(seastar::sharded<database> &db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, unsigned depth) {
+    if (depth > repair_tree_max_depth) {
+        return make_exception_future<repair_hash_tree>(std::invalid_argument(
+                sprint("Hash tree depth %d exceeds the maximum of %d", depth, repair_tree_max_depth)));
+    }
+    unsigned shard_begin = range.start() ?
+            dht::shard_of(range.start()->value()) : 0;
+    unsigned shard_end = range.end() ?
+            dht::shard_of(range.end()->value())+1 : smp::count;
+    return do_with(tree_split_points(range, depth), repair_hash_tree(depth),
+            [shard_begin, shard_end, &db, &keyspace, &cf, &range, depth] (const auto& splits, auto& result) {
+        return parallel_for_each(boost::counting_iterator<int>(shard_begin),
+                boost::counting_iterator<int>(shard_end),
+                [&db, &keyspace, &cf, &range, &splits, &result, depth] (unsigned shard) {
+            return db.invoke_on(shard, [&keyspace, &cf, &range, &splits, depth] (database& db) {
+                return checksum_tree_shard(db, keyspace, cf, range, splits, depth);
+            }).then([&result] (repair_hash_tree tree) {
+                result.add(tree);
+            });
+        }).then([&result] {
+            return make_ready_future<repair_hash_tree>(std::move(result));
+        });
+    });
+}
+
+// Hashes a partition like hashing_partition_visitor does, but finishes the
+// hash at each clustering row, giving one hash for the partition-level part
+// (which the visitor is fed first) and one for each row.
+class row_hashing_visitor : public mutation_partition_visitor {
+    sha256_hasher _h;
+    hashing_partition_visitor<sha256_hasher> _v;
+    repair_partition_hashes& _out;
+    bool _in_row = false;
+
+    void finish() {
+        std::array<uint8_t, 32> digest;
+        _h.finalize(digest);
+        if (_in_row) {
+            _out.rows.back().hash = partition_checksum(digest);
+        } else {
+            _out.partition_hash = partition_checksum(digest);
+        }
+    }
+public:
+    row_hashing_visitor(const schema& s, repair_partition_hashes& out)
+        : _v(_h, s)
+        , _out(out)
+    { }
+
+    virtual void accept_partition_tombstone(tombstone t) override {
+        _v.accept_partition_tombstone(t);
+    }
+
+    virtual void accept_static_cell(column_id id, atomic_cell_view cell) override {
+        _v.accept_static_cell(id, cell);
+    }
+
+    virtual void accept_static_cell(column_id id, collection_mutation_view cell) override {
+        _v.accept_static_cell(id, cell);
+    }
+
+    virtual void accept_row_tombstone(clustering_key_prefix_view prefix, tombstone t) override {
+        _v.accept_row_tombstone(prefix, t);
+    }
+
+    virtual void accept_row(clustering_key_view key, tombstone deleted_at, const row_marker& rm) override {
+        finish();
+        _in_row = true;
+        _out.rows.push_back(repair_row_hash{clustering_key(key), partition_checksum()});
+        _v.accept_row(key, deleted_at, rm);
+    }
+
+    virtual void accept_row_cell(column_id id, atomic_cell_view cell) override {
+        _v.accept_row_cell(id, cell);
+    }
+
+    virtual void accept_row_cell(column_id id, collection_mutation_view cell) override {
+        _v.accept_row_cell(id, cell);
+    }
+
+    void done() {
+        finish();
+    }
+};
+
+static future<std::vector<repair_partition_hashes>> repair_row_hashes_shard(database &db,
+        const sstring& keyspace_name, const sstring& cf_name,
+        const ::range<dht::token>& range, uint64_t max_rows,
+        const std::experimental::optional<repair_row_position>& after) {
+    auto& cf = db.find_column_family(keyspace_name, cf_name);
+    std::experimental::optional<dht::decorated_key> after_dk;
+    if (after) {
+        after_dk = dht::global_partitioner().decorate_key(*cf.schema(), after->key);
+    }
+    return do_with(query::to_partition_range(range), std::move(after_dk),
+            [&cf, max_rows, &after] (const auto& partition_range, const auto& after_dk) {
+        return do_with(cf.make_reader(cf.schema(), partition_range, service::get_local_streaming_read_priority()),
+                std::vector<repair_partition_hashes>(), uint64_t(0),
+                [max_rows, &after, &after_dk] (auto& reader, auto& hashes, auto& rows) {
+            return repeat([&reader, &hashes, &rows, max_rows, &after, &after_dk] () {
+                if (rows >= max_rows) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return reader().then([&hashes, &rows, max_rows, &after, &after_dk] (auto mopt) {
+                    if (!mopt) {
+                        return stop_iteration::yes;
+                    }
+                    auto& s = *mopt->schema();
+                    bool continued = false;
+                    if (after_dk) {
+                        auto c = mopt->decorated_key().tri_compare(s, *after_dk);
+                        if (c < 0) {
+                            return stop_iteration::no;
+                        }
+                        continued = c == 0;
+                    }
+                    repair_partition_hashes p{mopt->key(), partition_checksum(), {}};
+                    row_hashing_visitor v(s, p);
+                    mopt->partition().accept(s, v);
+                    v.done();
+                    if (continued) {
+                        // An earlier window ended in this partition, and
+                        // covered its partition-level part and the rows up
+                        // to after's.
+                        p.partition_hash = partition_checksum();
+                        if (after->row) {
+                            clustering_key::less_compare less(s);
+                            p.rows.erase(p.rows.begin(), std::find_if(p.rows.begin(), p.rows.end(), [&] (const repair_row_hash& r) {
+                                return less(*after->row, r.key);
+                            }));
+                        }
+                        if (p.rows.empty()) {
+                            return stop_iteration::no;
+                        }
+                    }
+                    // Cut a partition which doesn't fit short, so that a
+                    // wide partition is spread over several windows. A
+                    // continued one keeps a row at least, so that each
+                    // window gets past the previous one.
+                    auto room = std::max<uint64_t>(max_rows - rows - 1, continued);
+                    if (p.rows.size() > room) {
+                        p.rows.erase(p.rows.begin() + room, p.rows.end());
+                    }
+                    rows += 1 + p.rows.size();
+                    hashes.push_back(std::move(p));
+                    return stop_iteration::no;
+                });
+            }).then([&hashes] {
+                return std::move(hashes);
+            });
+        });
+    });
+}
+
+uint64_t repair_count_rows(const std::vector<repair_partition_hashes>& hashes) {
+    uint64_t n = 0;
+    for (auto& p : hashes) {
+        n += 1 + p.rows.size();
+    }
+    return n;
+}
+
+future<std::vector<repair_partition_hashes>> repair_row_hashes(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, uint64_t max_rows,
+        const std::experimental::optional<repair_row_position>& after) {
+    unsigned shard_begin = range.start() ?
+            dht::shard_of(range.start()->value()) : 0;
+    unsigned shard_end = range.end() ?
+            dht::shard_of(range.end()->value())+1 : smp::count;
+    // Shards own consecutive token ranges, so visiting them in shard order
+    // keeps the partitions in ring order, and lets us stop at the first
+    // shard which fills the result.
+    return do_with(std::vector<repair_partition_hashes>(), uint64_t(0), shard_begin,
+            [shard_end, &db, &keyspace, &cf, &range, max_rows, &after] (auto& result, auto& rows, auto& shard) {
+        return do_until([&rows, &shard, shard_end, max_rows] { return shard == shard_end || rows >= max_rows; },
+                [&db, &keyspace, &cf, &range, &result, &rows, &shard, max_rows, &after] {
+            return db.invoke_on(shard++, [&keyspace, &cf, &range, max_rows = max_rows - rows, &after] (database& db) {
+                return repair_row_hashes_shard(db, keyspace, cf, range, max_rows, after);
+            }).then([&result, &rows] (std::vector<repair_partition_hashes> hashes) {
+                rows += repair_count_rows(hashes);
+                std::move(hashes.begin(), hashes.end(), std::back_inserter(result));
+            });
+        }).then([&result] {
+            return std::move(result);
+        });
+    });
+}
+
+// Returns a mutation holding just the selected parts of m.
+static mutation select_rows(const mutation& m, const repair_partition_rows& rows) {
+    auto& s = *m.schema();
+    auto& p = m.partition();
+    mutation ret(m.decorated_key(), m.schema());
+    if (rows.partition_level) {
+        ret.partition().apply(p.partition_tombstone());
+        ret.partition().static_row() = row(p.static_row());
+        for (auto& rt : p.row_tombstones()) {
+            ret.partition().apply_row_tombstone(s, rt.prefix(), rt.t());
+        }
+    }
+    for (auto& key : rows.rows) {
+        auto i = p.clustered_rows().find(key, rows_entry::compare(s));
+        if (i != p.clustered_rows().end()) {
+            ret.partition().insert_row(s, i->key(), i->row());
+        }
+    }
+    return ret;
+}
+
+future<std::vector<frozen_mutation>> repair_get_rows(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<repair_partition_rows>& rows) {
+    auto s = db.local().find_column_family(keyspace, cf).schema();
+    return do_with(std::vector<frozen_mutation>(), [&db, &keyspace, &cf, &rows, s = std::move(s)] (auto& result) {
+        return parallel_for_each(rows, [&db, &keyspace, &cf, &result, s] (const repair_partition_rows& p) {
+            auto dk = dht::global_partitioner().decorate_key(*s, p.key);
+            auto shard = dht::shard_of(dk.token());
+            return db.invoke_on(shard, [&keyspace, &cf, &p, dk = std::move(dk)] (database& db) {
+                auto& table = db.find_column_family(keyspace, cf);
+                // Only the selected rows of a wide partition are read. The
+                // reader only looks at the row ranges of the slice.
+                query::clustering_row_ranges ck_ranges;
+                for (auto& key : p.rows) {
+                    ck_ranges.push_back(query::clustering_range::make_singular(key));
+                }
+                query::partition_slice slice(std::move(ck_ranges), {}, {}, {});
+                return do_with(query::partition_range::make_singular(dk), std::move(slice),
+                        [&table, &p] (const auto& pr, const auto& slice) {
+                    return do_with(table.make_reader(table.schema(), pr, slice, service::get_local_streaming_read_priority()), [&p] (auto& reader) {
+                        return reader().then([&p] (mutation_opt mopt) -> std::experimental::optional<frozen_mutation> {
+                            if (!mopt) {
+                                return {};
+                            }
+                            return freeze(select_rows(*mopt, p));
+                        });
+                    });
+                });
+            }).then([&result] (std::experimental::optional<frozen_mutation> fm) {
+                if (fm) {
+                    result.push_back(std::move(*fm));
+                }
+            });
+        }).then([&result] {
+            return std::move(result);
+        });
+    });
+}
+
+future<> repair_apply_rows(seastar::sharded<database>& db, const std::vector<frozen_mutation>& fms, net::msg_addr from) {
+    if (fms.empty()) {
+        return make_ready_future<>();
+    }
+    // repair_get_rows() reads a single table, so all mutations share the
+    // table and schema version.
+    auto& first = fms.front();
+    for (auto& fm : fms) {
+        if (fm.column_family_id() != first.column_family_id() || fm.schema_version() != first.schema_version()) {
+            return make_exception_future<>(std::runtime_error(sprint("Repair rows from %s mix tables or schema versions", from.addr)));
+        }
+    }
+    return service::get_schema_for_write(first.schema_version(), from).then([&fms] (schema_ptr s) {
+        return service::get_storage_proxy().local().mutate_streaming_mutations(s, fms);
+    });
+}
+
+future<> repair_flush_rows(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf, const ::range<dht::token>& range) {
+    // Like the receiver of a stream plan, flush the streaming memtables the
+    // rows went to and drop the repaired range from the cache, so that reads
+    // see the rows once we report them applied.
+    unsigned shard_begin = range.start() ?
+            dht::shard_of(range.start()->value()) : 0;
+    unsigned shard_end = range.end() ?
+            dht::shard_of(range.end()->value())+1 : smp::count;
+    return parallel_for_each(boost::irange<unsigned>(shard_begin, shard_end), [&db, &keyspace, &cf, &range] (unsigned shard) {
+        return db.invoke_on(shard, [&keyspace, &cf, &range] (database& db) {
+            std::vector<query::partition_range> ranges{query::to_partition_range(range)};
+            return db.find_column_family(keyspace, cf).flush_streaming_mutations(std::move(ranges));
+        });
+    });
+}
+
+static repair_partition_rows all_rows(const repair_partition_hashes& p) {
+    repair_partition_rows ret{p.key, true, {}};
+    ret.rows.reserve(p.rows.size());
+    for (auto& r : p.rows) {
+        ret.rows.push_back(r.key);
+    }
+    return ret;
+}
+
+// Compares the row hashes of two replicas, both in ring order, and returns
+// the rows which the first one has to send to the second, and those it has
+// to fetch from it. Rows present on both sides with different hashes go
+// both ways, and are reconciled when applied.
+std::pair<std::vector<repair_partition_rows>, std::vector<repair_partition_rows>>
+repair_diff_rows(const schema& s, const std::vector<repair_partition_hashes>& local, const std::vector<repair_partition_hashes>& remote) {
+    std::vector<repair_partition_rows> to_send;
+    std::vector<repair_partition_rows> to_fetch;
+    auto& partitioner = dht::global_partitioner();
+    clustering_key::less_compare less(s);
+    auto l = local.begin();
+    auto r = remote.begin();
+    while (l != local.end() || r != remote.end()) {
+        int c;
+        if (l == local.end()) {
+            c = 1;
+        } else if (r == remote.end()) {
+            c = -1;
+        } else {
+            c = partitioner.decorate_key(s, l->key).tri_compare(s, partitioner.decorate_key(s, r->key));
+        }
+        if (c < 0) {
+            to_send.push_back(all_rows(*l++));
+            continue;
+        }
+        if (c > 0) {
+            to_fetch.push_back(all_rows(*r++));
+            continue;
+        }
+        bool partition_level = l->partition_hash != r->partition_hash;
+        repair_partition_rows send{l->key, partition_level, {}};
+        repair_partition_rows fetch{r->key, partition_level, {}};
+        auto lr = l->rows.begin();
+        auto rr = r->rows.begin();
+        while (lr != l->rows.end() || rr != r->rows.end()) {
+            if (rr == r->rows.end() || (lr != l->rows.end() && less(lr->key, rr->key))) {
+                send.rows.push_back((lr++)->key);
+            } else if (lr == l->rows.end() || less(rr->key, lr->key)) {
+                fetch.rows.push_back((rr++)->key);
+            } else {
+                if (lr->hash != rr->hash) {
+                    send.rows.push_back(lr->key);
+                    fetch.rows.push_back(rr->key);
+                }
+                ++lr;
+                ++rr;
+            }
+        }
+        if (send.partition_level || !send.rows.empty()) {
+            to_send.push_back(std::move(send));
+        }
+        if (fetch.partition_level || !fetch.rows.empty()) {
+            to_fetch.push_back(std::move(fetch));
+        }
+        ++l;
+        ++r;
+    }
+    return { std::move(to_send), std::move(to_fetch) };
+}
+
+uint64_t repair_count_rows(const std::vector<repair_partition_rows>& rows) {
+    uint64_t n = 0;
+    for (auto& p : rows) {
+        n += p.partition_level + p.rows.size();
+    }
+    return n;
+}
+
+// Rows are requested, and sent, in messages of at most this many rows
+// (counting a partition-level part as one).
+constexpr size_t repair_rows_per_message = 1024;
+// Row hashes are exchanged in messages of about this many rows, a few MB.
+constexpr uint64_t repair_row_hashes_per_message = 65536;
+
+std::vector<std::vector<repair_partition_rows>> repair_split_rows(std::vector<repair_partition_rows> rows, size_t max_rows) {
+    std::vector<std::vector<repair_partition_rows>> ret(1);
+    size_t n = 0;
+    for (auto& p : rows) {
+        auto key = p.rows.begin();
+        bool partition_level = p.partition_level;
+        do {
+            // Start a new batch when this one has no room left for the
+            // partition-level part and one row.
+            if (n > 0 && n + partition_level + (key != p.rows.end()) > max_rows) {
+                ret.emplace_back();
+                n = 0;
+            }
+            auto take = std::min<size_t>(p.rows.end() - key, max_rows - n - partition_level);
+            ret.back().push_back(repair_partition_rows{p.key, partition_level, std::vector<clustering_key>(key, key + take)});
+            n += partition_level + take;
+            partition_level = false;
+            key += take;
+        } while (key != p.rows.end());
+    }
+    if (ret.back().empty()) {
+        ret.pop_back();
+    }
+    return ret;
+}
+
+// Transfers the rows which differ between our row hashes and the peer's,
+// taken over the same range.
+static future<> sync_row_diff(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, gms::inet_address peer,
+        const std::vector<repair_partition_hashes>& local,
+        const std::vector<repair_partition_hashes>& remote) {
+    auto s = db.local().find_column_family(keyspace, cf).schema();
+    auto diff = repair_diff_rows(*s, local, remote);
+    logger.info("Repair of range {} with node {}: sending {} and fetching {} rows", range, peer,
+            repair_count_rows(diff.first), repair_count_rows(diff.second));
+    return do_with(repair_split_rows(std::move(diff.first), repair_rows_per_message),
+            repair_split_rows(std::move(diff.second), repair_rows_per_message),
+            [&db, &keyspace, &cf, &range, peer] (const auto& to_send, const auto& to_fetch) {
+        // The rows of every batch go to the streaming memtables, which both
+        // sides flush once the whole range is transferred.
+        return do_for_each(to_send, [&db, &keyspace, &cf, peer] (const auto& rows) {
+            return repair_get_rows(db, keyspace, cf, rows).then([peer] (std::vector<frozen_mutation> fms) {
+                if (fms.empty()) {
+                    return make_ready_future<>();
+                }
+                return net::get_local_messaging_service().send_repair_put_rows(net::msg_addr{peer}, std::move(fms));
+            });
+        }).then([&keyspace, &cf, &range, &to_send, peer] {
+            if (to_send.empty()) {
+                return make_ready_future<>();
+            }
+            return net::get_local_messaging_service().send_repair_flush_rows(net::msg_addr{peer}, keyspace, cf, range);
+        }).then([&db, &keyspace, &cf, &to_fetch, peer] {
+            return do_for_each(to_fetch, [&db, &keyspace, &cf, peer] (const auto& rows) {
+                return net::get_local_messaging_service().send_repair_get_rows(net::msg_addr{peer}, keyspace, cf, rows).then(
+                        [&db, peer] (std::vector<frozen_mutation> fms) {
+                    return do_with(std::move(fms), [&db, peer] (const auto& fms) {
+                        return repair_apply_rows(db, fms, net::msg_addr{peer});
+                    });
+                });
+            });
+        }).then([&db, &keyspace, &cf, &range, &to_fetch] {
+            if (to_fetch.empty()) {
+                return make_ready_future<>();
+            }
+            return repair_flush_rows(db, keyspace, cf, range);
+        });
+    });
+}
+
+// Orders row positions as the readers return them: by partition, then the
+// partition-level part before the rows.
+static int compare(const schema& s, const repair_row_position& a, const repair_row_position& b) {
+    auto& partitioner = dht::global_partitioner();
+    auto c = partitioner.decorate_key(s, a.key).tri_compare(s, partitioner.decorate_key(s, b.key));
+    if (c != 0) {
+        return c;
+    }
+    if (!a.row || !b.row) {
+        return bool(a.row) - bool(b.row);
+    }
+    clustering_key::less_compare less(s);
+    return less(*a.row, *b.row) ? -1 : less(*b.row, *a.row);
+}
+
+static repair_row_position last_position(const repair_partition_hashes& p) {
+    if (p.rows.empty()) {
+        return { p.key, {} };
+    }
+    return { p.key, p.rows.back().key };
+}
+
+// Drops the hashes past end.
+static void trim_row_hashes(const schema& s, std::vector<repair_partition_hashes>& hashes, const repair_row_position& end) {
+    auto& partitioner = dht::global_partitioner();
+    auto end_dk = partitioner.decorate_key(s, end.key);
+    auto past_end = std::find_if(hashes.begin(), hashes.end(), [&] (const repair_partition_hashes& p) {
+        return partitioner.decorate_key(s, p.key).tri_compare(s, end_dk) >= 0;
+    });
+    if (past_end != hashes.end() && past_end->key.equal(s, end.key)) {
+        auto& rows = past_end->rows;
+        if (!end.row) {
+            rows.clear();
+        } else {
+            clustering_key::less_compare less(s);
+            rows.erase(std::find_if(rows.begin(), rows.end(), [&] (const repair_row_hash& r) {
+                return less(*end.row, r.key);
+            }), rows.end());
+        }
+        ++past_end;
+    }
+    hashes.erase(past_end, hashes.end());
+}
+
+std::experimental::optional<repair_row_position> repair_trim_row_hashes(const schema& s,
+        std::vector<repair_partition_hashes>& local, std::vector<repair_partition_hashes>& remote, uint64_t max_rows) {
+    std::experimental::optional<repair_row_position> end;
+    if (repair_count_rows(local) >= max_rows) {
+        end = last_position(local.back());
+    }
+    if (repair_count_rows(remote) >= max_rows) {
+        auto remote_end = last_position(remote.back());
+        if (!end || compare(s, remote_end, *end) < 0) {
+            end = std::move(remote_end);
+        }
+    }
+    if (end) {
+        // The peer was asked for hashes up to our last token, so either
+        // side can hold rows past the other's end.
+        trim_row_hashes(s, local, *end);
+        trim_row_hashes(s, remote, *end);
+    }
+    return end;
+}
+
+// Row-level counterpart of sync_ranges(), for a single range and peer:
+// compare per-row hashes with the peer, and transfer only the rows which
+// are missing or differ on either side. The range is walked in windows of
+// about repair_row_hashes_per_message rows, so that neither the hashes
+// nor the rows of a large range have to fit in a single message. A window
+// can end inside a wide partition, and the next one continues after the
+// last row it covered.
+static future<> sync_rows(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, gms::inet_address peer) {
+    return do_with(range.start(), std::experimental::optional<repair_row_position>(),
+            [&db, &keyspace, &cf, &range, peer] (auto& start, auto& after) {
+        return repeat([&db, &keyspace, &cf, &range, &start, &after, peer] {
+            ::range<dht::token> window(start, range.end());
+            return repair_row_hashes(db, keyspace, cf, window, repair_row_hashes_per_message, after).then(
+                    [&db, &keyspace, &cf, &range, &start, &after, peer, window] (std::vector<repair_partition_hashes> local) {
+                // Ask the peer only about the part of the window we got.
+                auto remote_window = window;
+                if (repair_count_rows(local) >= repair_row_hashes_per_message) {
+                    auto& partitioner = dht::global_partitioner();
+                    auto s = db.local().find_column_family(keyspace, cf).schema();
+                    remote_window = ::range<dht::token>(start, ::range<dht::token>::bound(partitioner.get_token(*s, local.back().key), true));
+                }
+                return net::get_local_messaging_service().send_repair_row_hashes(net::msg_addr{peer}, keyspace, cf,
+                        remote_window, repair_row_hashes_per_message, after).then(
+                        [&db, &keyspace, &cf, &range, &start, &after, peer, local = std::move(local)] (std::vector<repair_partition_hashes> remote) mutable {
+                    auto& partitioner = dht::global_partitioner();
+                    auto s = db.local().find_column_family(keyspace, cf).schema();
+                    auto end = repair_trim_row_hashes(*s, local, remote, repair_row_hashes_per_message);
+                    ::range<dht::token> synced(start, end ? std::experimental::make_optional(::range<dht::token>::bound(partitioner.get_token(*s, end->key), true)) : range.end());
+                    return do_with(std::move(local), std::move(remote), std::move(synced),
+                            [&db, &keyspace, &cf, peer] (const auto& local, const auto& remote, const auto& synced) {
+                        return sync_row_diff(db, keyspace, cf, synced, peer, local, remote);
+                    }).then([&start, &after, s, end = std::move(end)] () mutable {
+                        if (!end) {
+                            return stop_iteration::yes;
+                        }
+                        // The rest of end's partition, and the partitions
+                        // sharing its token, are still to be compared.
+                        start = ::range<dht::token>::bound(dht::global_partitioner().get_token(*s, end->key), true);
+                        after = std::move(end);
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        });
+    });
+}
+
+static future<> sync_ranges(seastar::sharded<database>& db,
         const sstring& keyspace, const sstring& cf,
-        const ::range<dht::token>& range,
-        std::vector<gms::inet_address>& neighbors) {
+        const std::vector<::range<dht::token>>& ranges,
+        const std::vector<gms::inet_address>& neighbors) {
     return do_with(streaming::stream_plan("repair-in"),
                    streaming::stream_plan("repair-out"),
-            [&db, &keyspace, &cf, &range, &neighbors]
+            [&db, &keyspace, &cf, &ranges, &neighbors]
             (auto& sp_in, auto& sp_out) {
         for (const auto& peer : neighbors) {
-            sp_in.request_ranges(peer, keyspace, {range}, {cf});
-            sp_out.transfer_ranges(peer, keyspace, {range}, {cf});
+            sp_in.request_ranges(peer, keyspace, ranges, {cf});
+            sp_out.transfer_ranges(peer, keyspace, ranges, {cf});
         }
         return sp_in.execute().discard_result().then([&sp_out] {
                 return sp_out.execute().discard_result();
@@ -398,6 +1137,52 @@ static future<> sync_range(seastar::sharded<database>& db,
         });
     });
 }
+
+// Nodes which don't know REPAIR_CHECKSUM_TREE yet are asked for the
+// checksum of the whole range, which we take as a tree of depth 0.
+static future<repair_hash_tree> neighbor_checksum_tree(gms::inet_address neighbor,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, unsigned depth) {
+    auto& ms = net::get_local_messaging_service();
+    return ms.send_repair_checksum_tree(net::msg_addr{neighbor}, keyspace, cf, range, depth).handle_exception(
+            [neighbor, &keyspace, &cf, &range] (std::exception_ptr ep) {
+        try {
+            std::rethrow_exception(ep);
+        } catch (rpc::unknown_verb_error&) {
+            logger.debug("Node {} doesn't support checksum trees, asking for the checksum of range {}", neighbor, range);
+            return net::get_local_messaging_service().send_repair_checksum_range(net::msg_addr{neighbor}, keyspace, cf, range).then(
+                    [] (partition_checksum c) {
+                return repair_hash_tree(std::vector<partition_checksum>{c});
+            });
+        }
+    });
+}
+
+// Returns the leaves of our tree which may differ from the neighbor's. A
+// tree of depth 0 only tells if any of them does.
+static std::vector<size_t> differing_leaves(const repair_hash_tree& ours, const repair_hash_tree& theirs) {
+    if (ours.depth() == theirs.depth()) {
+        return ours.differing_leaves(theirs);
+    }
+    if (ours.root() == theirs.root()) {
+        return {};
+    }
+    auto all = boost::irange<size_t>(0, ours.leaf_count());
+    return std::vector<size_t>(all.begin(), all.end());
+}
+
+// Each leaf of a range's hash tree should hold about this many partitions,
+// so a single differing partition costs streaming about as many.
+constexpr uint64_t repair_tree_leaf_partitions = 256;
+
+static unsigned tree_depth(uint64_t estimated_partitions) {
+    unsigned depth = 0;
+    while (depth < repair_tree_max_depth && (estimated_partitions >> depth) > repair_tree_leaf_partitions) {
+        depth++;
+    }
+    return depth;
+}
+
 static void split_and_add(std::vector<::range<dht::token>>& ranges,
         const range<dht::token>& range,
         uint64_t estimated_partitions, uint64_t target_partitions) {
@@ -418,27 +1203,192 @@ static void split_and_add(std::vector<::range<dht::token>>& ranges,
 }
 // We don't need to wait for one checksum to finish before we start the
 // next, but doing too many of these operations in parallel also doesn't
-// make sense, so we limit the number of concurrent ongoing checksum
-// requests with a semaphore.
+// make sense, so the repair_scheduler bounds the number of sub-ranges being
+// checksummed and synced at once.
 //
-// FIXME: We shouldn't use a magic number here, but rather bind it to
-// some resource. Otherwise we'll be doing too little in some machines,
-// and too much in others.
-//
-// FIXME: This would be better of in a repair service, or even a per-shard
-// repair instance holding all repair state. However, since we are anyway
-// considering ditching those semaphores for a more fine grained resource-based
-// solution, let's do the simplest thing here and change it later
-constexpr int parallelism = 100;
-static thread_local semaphore parallelism_semaphore(parallelism);
+// Rather than a fixed number, which would be too little on some machines
+// and too much on others, the bound adapts every few seconds, as decided by
+// repair_parallelism_policy:
+//  - It is halved when streaming writes on any shard get close to being
+//    throttled for memory, or when the mean latency of foreground reads and
+//    writes grows past twice its usual level, as repair is then hurting
+//    the node.
+//  - Otherwise, when all permits were in use, it grows by a quarter, but
+//    only as long as growing keeps raising the rate at which sub-ranges
+//    complete - once the disks or the network are saturated, more
+//    concurrency only adds memory.
+// Like the repair_tracker, it is only used by cpu 0, which drives all
+// repairs.
+constexpr unsigned repair_initial_parallelism = 16;
+constexpr float repair_max_memory_pressure = 0.9;
+constexpr double repair_max_latency_growth = 2;
+// Foreground requests sampled in a period for its mean latency to count.
+constexpr int64_t repair_min_latency_samples = 64;
+
+repair_parallelism_policy::repair_parallelism_policy(unsigned max)
+    : _max(std::max(1u, max))
+    , _limit(std::min(_max, repair_initial_parallelism))
+{
+}
+
+unsigned repair_parallelism_policy::adjust(const sample& s, bool saturated, uint64_t completed) {
+    bool foreground_suffers = false;
+    if (_have_latency && s.latency_count - _latency_count >= repair_min_latency_samples) {
+        auto latency = double(s.latency_sum - _latency_sum) / (s.latency_count - _latency_count);
+        if (!_latency_baseline || latency < _latency_baseline) {
+            _latency_baseline = latency;
+        } else if (latency > _latency_baseline * repair_max_latency_growth) {
+            foreground_suffers = true;
+        } else {
+            _latency_baseline += (latency - _latency_baseline) / 16;
+        }
+    }
+    _have_latency = true;
+    _latency_sum = s.latency_sum;
+    _latency_count = s.latency_count;
+
+    if (s.memory_pressure >= repair_max_memory_pressure || foreground_suffers) {
+        _limit = std::max(1u, _limit / 2);
+        _grew = false;
+    } else if (saturated && _limit < _max) {
+        // Hold after an increase which did not speed repair up.
+        if (!_grew || completed > _last_completed) {
+            _limit = std::min(_max, _limit + std::max(1u, _limit / 4));
+            _grew = true;
+        } else {
+            _grew = false;
+        }
+    }
+    _last_completed = completed;
+    return _limit;
+}
+
+void repair_parallelism_policy::idle() {
+    _have_latency = false;
+}
+
+class repair_scheduler {
+    static std::chrono::seconds adjust_period() { return std::chrono::seconds(5); }
+
+    seastar::sharded<database>* _db = nullptr;
+    std::experimental::optional<repair_parallelism_policy> _policy;
+    semaphore _sem{0};
+    unsigned _limit = 0;
+    // Permits to retire as they are returned, after the limit shrank while
+    // they were in use.
+    unsigned _debt = 0;
+    unsigned _active = 0;
+    // Collected during the current period
+    bool _saturated = false;
+    uint64_t _completed = 0;
+    bool _adjusting = false;
+    timer<> _timer{[this] { adjust(); }};
+
+    void set_limit(unsigned limit) {
+        if (limit > _limit) {
+            auto grow = limit - _limit;
+            auto paid = std::min(grow, _debt);
+            _debt -= paid;
+            _sem.signal(grow - paid);
+        } else {
+            auto shrink = _limit - limit;
+            auto reclaimed = std::min<size_t>(shrink, _sem.current());
+            _sem.try_wait(reclaimed);
+            _debt += shrink - reclaimed;
+        }
+        _limit = limit;
+    }
+
+    using sample = repair_parallelism_policy::sample;
+
+    future<sample> take_sample() {
+        return _db->map_reduce0([] (database& db) {
+            return db.streaming_memory_pressure();
+        }, 0.0f, [] (float a, float b) {
+            return std::max(a, b);
+        }).then([] (float memory_pressure) {
+            return service::get_storage_proxy().map_reduce0([memory_pressure] (service::storage_proxy& sp) {
+                auto& stats = sp.get_stats();
+                return sample{memory_pressure, stats.read.sum + stats.write.sum, stats.read.total + stats.write.total};
+            }, sample{memory_pressure}, [] (sample a, sample b) {
+                a.latency_sum += b.latency_sum;
+                a.latency_count += b.latency_count;
+                return a;
+            });
+        });
+    }
+
+    void adjust() {
+        auto saturated = std::exchange(_saturated, false);
+        auto completed = std::exchange(_completed, uint64_t(0));
+        if (!_active && !_sem.waiters()) {
+            // Repair is idle. Start over with fresh latency samples when it
+            // resumes, as the foreground load may have changed meanwhile.
+            _timer.cancel();
+            _policy->idle();
+            return;
+        }
+        if (_adjusting) {
+            return;
+        }
+        _adjusting = true;
+        take_sample().then([this, saturated, completed] (sample s) {
+            auto limit = _policy->adjust(s, saturated, completed);
+            if (limit != _limit) {
+                logger.debug("repair parallelism {} -> {} (memory pressure {}, {} sub-ranges completed)",
+                        _limit, limit, s.memory_pressure, completed);
+                set_limit(limit);
+            }
+        }).handle_exception([] (std::exception_ptr ep) {
+            logger.warn("Failed to adjust repair parallelism: {}", ep);
+        }).finally([this] {
+            _adjusting = false;
+        });
+    }
+public:
+    future<> enter(seastar::sharded<database>& db) {
+        if (!_db) {
+            _db = &db;
+            _policy.emplace(db.local().get_config().repair_max_parallelism());
+            set_limit(_policy->limit());
+        }
+        if (!_timer.armed()) {
+            _timer.arm_periodic(adjust_period());
+        }
+        if (!_sem.current()) {
+            _saturated = true;
+        }
+        return _sem.wait(1).then([this] {
+            ++_active;
+        });
+    }
+    void leave() {
+        --_active;
+        ++_completed;
+        if (_debt) {
+            --_debt;
+        } else {
+            _sem.signal(1);
+        }
+    }
+    unsigned limit() const {
+        return _limit;
+    }
+    void stop() {
+        _timer.cancel();
+    }
+};
+
+static thread_local repair_scheduler scheduler;
 
 // Repair a single cf in a single local range.
 // Comparable to RepairJob in Origin.
 static future<> repair_cf_range(seastar::sharded<database>& db,
         sstring keyspace, sstring cf, ::range<dht::token> range,
-        std::vector<gms::inet_address>& neighbors) {
+        std::vector<gms::inet_address>& neighbors, int id) {
     if (neighbors.empty()) {
         // Nothing to do in this case...
+        repair_tracker.range_done(id);
         return make_ready_future<>();
     }
 
@@ -476,31 +1426,34 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
         // FIXME: this "100" needs to be a parameter.
         split_and_add(ranges, range, estimated_partitions, 100);
     }
+    // Rather than a single checksum per range, replicas compare hash trees
+    // whose leaves each hold about repair_tree_leaf_partitions partitions,
+    // and only the leaves which differ are streamed.
+    auto depth = tree_depth(estimated_partitions / ranges.size());
 
     return do_with(seastar::gate(), true, std::move(keyspace), std::move(cf), std::move(ranges),
-        [&db, &neighbors] (auto& completion, auto& success, const auto& keyspace, const auto& cf, const auto& ranges) {
-        return do_for_each(ranges, [&completion, &success, &db, &neighbors, &keyspace, &cf]
+        [&db, &neighbors, depth, id] (auto& completion, auto& success, const auto& keyspace, const auto& cf, const auto& ranges) {
+        return do_for_each(ranges, [&completion, &success, &db, &neighbors, &keyspace, &cf, depth, id]
                            (const auto& range) {
 
             check_in_shutdown();
-            return parallelism_semaphore.wait(1).then([&completion, &success, &db, &neighbors, &keyspace, &cf, &range] {
-
-                // Ask this node, and all neighbors, to calculate checksums in
-                // this range. When all are done, compare the results, and if
-                // there are any differences, sync the content of this range.
-                std::vector<future<partition_checksum>> checksums;
-                checksums.reserve(1 + neighbors.size());
-                checksums.push_back(checksum_range(db, keyspace, cf, range));
+            return scheduler.enter(db).then([&completion, &success, &db, &neighbors, &keyspace, &cf, &range, depth, id] {
+                auto start = std::chrono::steady_clock::now();
+
+                // Ask this node, and all neighbors, to calculate hash trees
+                // of this range. When all are done, compare the results, and
+                // sync the content of the leaves which differ.
+                std::vector<future<repair_hash_tree>> trees;
+                trees.reserve(1 + neighbors.size());
+                trees.push_back(checksum_tree(db, keyspace, cf, range, depth));
                 for (auto&& neighbor : neighbors) {
-                    checksums.push_back(
-                            net::get_local_messaging_service().send_repair_checksum_range(
-                                    net::msg_addr{neighbor},keyspace, cf, range));
+                    trees.push_back(neighbor_checksum_tree(neighbor, keyspace, cf, range, depth));
                 }
 
                 completion.enter();
-                when_all(checksums.begin(), checksums.end()).then(
-                        [&db, &keyspace, &cf, &range, &neighbors, &success]
-                        (std::vector<future<partition_checksum>> checksums) {
+                when_all(trees.begin(), trees.end()).then(
+                        [&db, &keyspace, &cf, &range, &neighbors, &success, depth]
+                        (std::vector<future<repair_hash_tree>> checksums) {
                     // If only some of the replicas of this range are alive,
                     // we set success=false so repair will fail, but we can
                     // still do our best to repair available replicas.
@@ -523,33 +1476,79 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
                     if (!checksums[0].available() || live_neighbors.empty()) {
                         return make_ready_future<>();
                     }
-                    // If one of the available checksums is different, repair
-                    // all the neighbors which returned a checksum.
-                    auto checksum0 = checksums[0].get();
+                    // Collect the leaves in which any live neighbor differs
+                    // from us. As in a checksum mismatch of the whole range,
+                    // all live neighbors are synced in those leaves, so that
+                    // they all end up with the same data, not just each one
+                    // with us.
+                    auto tree0 = checksums[0].get0();
+                    std::vector<bool> differs(tree0.leaf_count());
                     for (unsigned i = 1; i < checksums.size(); i++) {
-                        if (checksums[i].available() && checksum0 != checksums[i].get()) {
-                            logger.info("Found differing range {} on nodes {}", range, live_neighbors);
-                            return do_with(std::move(live_neighbors), [&db, &keyspace, &cf, &range] (auto& live_neighbors) {
-                                return sync_range(db, keyspace, cf, range, live_neighbors);
-                            });
+                        if (!checksums[i].available()) {
+                            continue;
+                        }
+                        auto leaves = differing_leaves(tree0, checksums[i].get0());
+                        if (!leaves.empty()) {
+                            logger.info("Found {} differing of {} leaves in range {} on node {}",
+                                    leaves.size(), tree0.leaf_count(), range, neighbors[i - 1]);
+                        }
+                        for (auto leaf : leaves) {
+                            differs[leaf] = true;
                         }
                     }
-                    return make_ready_future<>();
+                    std::vector<size_t> leaves;
+                    for (size_t leaf = 0; leaf < differs.size(); leaf++) {
+                        if (differs[leaf]) {
+                            leaves.push_back(leaf);
+                        }
+                    }
+                    if (leaves.empty()) {
+                        return make_ready_future<>();
+                    }
+                    auto ranges = tree_leaf_ranges(range, tree_split_points(range, depth), leaves);
+                    // When most leaves differ, as with a node which lost its
+                    // data, comparing rows would not save much, so we stream
+                    // those ranges whole.
+                    if (!db.local().get_config().repair_row_level() || leaves.size() * 2 > tree0.leaf_count()) {
+                        return do_with(std::move(ranges), std::move(live_neighbors), [&db, &keyspace, &cf] (const auto& ranges, const auto& live_neighbors) {
+                            return sync_ranges(db, keyspace, cf, ranges, live_neighbors);
+                        });
+                    }
+                    // Row-level sync is between us and one peer at a time.
+                    // After a pass over all peers we hold the rows of all of
+                    // them, so a second pass over all but the last one gives
+                    // the earlier peers the rows of the later ones.
+                    auto peers = live_neighbors;
+                    peers.insert(peers.end(), live_neighbors.begin(), live_neighbors.end() - 1);
+                    return do_with(std::move(ranges), std::move(peers), [&db, &keyspace, &cf] (const auto& ranges, const auto& peers) {
+                        return do_for_each(peers, [&db, &keyspace, &cf, &ranges] (gms::inet_address peer) {
+                            return do_for_each(ranges, [&db, &keyspace, &cf, peer] (const auto& range) {
+                                return sync_rows(db, keyspace, cf, range, peer);
+                            });
+                        });
+                    });
+                }).then([] {
+                    return true;
                 }).handle_exception([&success, &range] (std::exception_ptr eptr) {
-                    // Something above (e.g., sync_range) failed. We could
+                    // Something above (e.g., sync_ranges) failed. We could
                     // stop the repair immediately, or let it continue with
                     // other ranges (at the moment, we do the latter). But in
                     // any case, we need to remember that the repair failed to
                     // tell the caller.
                     success = false;
                     logger.warn("Failed sync of range {}: {}", range, eptr);
+                    return false;
+                }).then([&cf, &range, id, start] (bool succeeded) {
+                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                    repair_tracker.subrange_done(id, repair_range_timing{cf, range, duration, succeeded});
                 }).finally([&completion] {
-                    parallelism_semaphore.signal(1);
+                    scheduler.leave();
                     completion.leave(); // notify do_for_each that we're done
                 });
             });
-        }).finally([&success, &completion] {
-            return completion.close().then([&success] {
+        }).finally([&success, &completion, id] {
+            return completion.close().then([&success, id] {
+                repair_tracker.range_done(id);
                 return success ? make_ready_future<>() :
                         make_exception_future<>(std::runtime_error("Checksum or sync of partial range failed"));
             });
@@ -562,13 +1561,13 @@ static future<> repair_cf_range(seastar::sharded<database>& db,
 static future<> repair_range(seastar::sharded<database>& db, sstring keyspace,
         ::range<dht::token> range, std::vector<sstring>& cfs,
         const std::vector<sstring>& data_centers,
-        const std::vector<sstring>& hosts) {
+        const std::vector<sstring>& hosts, int repair_id) {
     auto id = utils::UUID_gen::get_time_UUID();
-    return do_with(get_neighbors(db.local(), keyspace, range, data_centers, hosts), [&db, &cfs, keyspace, id, range] (auto& neighbors) {
+    return do_with(get_neighbors(db.local(), keyspace, range, data_centers, hosts), [&db, &cfs, keyspace, id, range, repair_id] (auto& neighbors) {
         logger.info("[repair #{}] new session: will sync {} on range {} for {}.{}", id, neighbors, range, keyspace, cfs);
         return do_for_each(cfs.begin(), cfs.end(),
-                [&db, keyspace, &neighbors, id, range] (auto&& cf) {
-            return repair_cf_range(db, keyspace, cf, range, neighbors);
+                [&db, keyspace, &neighbors, id, range, repair_id] (auto&& cf) {
+            return repair_cf_range(db, keyspace, cf, range, neighbors, repair_id);
         });
     });
 }
@@ -777,7 +1776,7 @@ static future<> repair_ranges(seastar::sharded<database>& db, sstring keyspace,
         return do_for_each(ranges.begin(), ranges.end(), [&db, keyspace, &cfs, &data_centers, &hosts, id] (auto&& range) {
 #endif
             check_in_shutdown();
-            return repair_range(db, keyspace, range, cfs, data_centers, hosts);
+            return repair_range(db, keyspace, range, cfs, data_centers, hosts, id);
         }).then([id] {
             logger.info("repair {} completed sucessfully", id);
             repair_tracker.done(id, true);
@@ -880,6 +1879,7 @@ static int do_repair_start(seastar::sharded<database>& db, sstring keyspace,
         cfs = list_column_families(db.local(), keyspace);
     }
 
+    repair_tracker.set_ranges_total(id, ranges.size() * cfs.size());
     repair_ranges(db, std::move(keyspace), std::move(ranges), std::move(cfs),
             id, options.data_centers, options.hosts);
 
@@ -899,10 +1899,19 @@ future<repair_status> repair_get_status(seastar::sharded<database>& db, int id)
     });
 }
 
+future<repair_progress> repair_get_progress(seastar::sharded<database>& db, int id) {
+    return db.invoke_on(0, [id] (database& localdb) {
+        auto progress = repair_tracker.get_progress(id);
+        progress.parallelism = scheduler.limit();
+        return progress;
+    });
+}
+
 future<> repair_shutdown(seastar::sharded<database>& db) {
     logger.info("Starting shutdown of repair");
     return db.invoke_on(0, [] (database& localdb) {
         return repair_tracker.shutdown().then([] {
+            scheduler.stop();
             logger.info("Completed shutdown of repair");
         });
     });
@@ -23,6 +23,8 @@
 
 #include <unordered_map>
 #include <exception>
+#include <deque>
+#include <chrono>
 
 #include <seastar/core/sstring.hh>
 #include <seastar/core/sharded.hh>
@@ -30,7 +32,11 @@
 
 #include "database.hh"
 #include "utils/UUID.hh"
+#include "utils/histogram.hh"
 
+namespace net {
+struct msg_addr;
+}
 
 class repair_exception : public std::exception {
 private:
@@ -63,6 +69,32 @@ enum class repair_status { RUNNING, SUCCESSFUL, FAILED };
 // different CPU (cpu 0) and that might be a deferring operation.
 future<repair_status> repair_get_status(seastar::sharded<database>& db, int id);
 
+struct repair_range_timing {
+    sstring cf;
+    ::range<dht::token> range;
+    std::chrono::milliseconds duration;
+    bool succeeded;
+};
+
+struct repair_progress {
+    // A repair works through (local token range, column family) pairs, each
+    // of which is split into sub-ranges repaired concurrently.
+    size_t ranges_total = 0;
+    size_t ranges_done = 0;
+    // Durations of the finished sub-ranges, in milliseconds.
+    utils::ihistogram subrange_duration;
+    // The most recently finished sub-ranges, oldest first.
+    std::deque<repair_range_timing> recent_subranges;
+    // The current bound on concurrently repaired sub-ranges, shared by all
+    // the repairs running on this node.
+    unsigned parallelism = 0;
+};
+
+// repair_get_progress() returns how far the given repair got, also after
+// it finished, as long as it is one of the last few repairs to finish.
+// Older ones report no progress.
+future<repair_progress> repair_get_progress(seastar::sharded<database>& db, int id);
+
 // repair_shutdown() stops all ongoing repairs started on this node (and
 // prevents any further repairs from being started). It returns a future
 // saying when all repairs have stopped, and attempts to stop them as
@@ -70,6 +102,39 @@ future<repair_status> repair_get_status(seastar::sharded<database>& db, int id);
 // stop them abruptly).
 future<> repair_shutdown(seastar::sharded<database>& db);
 
+// Decides how many sub-ranges all repairs on this node may repair at once,
+// from how loaded the node is and how fast repair goes; see repair.cc.
+class repair_parallelism_policy {
+public:
+    // Cumulative foreground latencies, and the current memory pressure
+    // of streaming writes, of the whole node.
+    struct sample {
+        float memory_pressure = 0;
+        int64_t latency_sum = 0;
+        int64_t latency_count = 0;
+    };
+private:
+    unsigned _max;
+    unsigned _limit;
+    uint64_t _last_completed = 0;
+    bool _grew = false;
+    bool _have_latency = false;
+    int64_t _latency_sum = 0;
+    int64_t _latency_count = 0;
+    double _latency_baseline = 0;
+public:
+    explicit repair_parallelism_policy(unsigned max);
+    unsigned limit() const {
+        return _limit;
+    }
+    // Called once a period, with whether repair had to wait for a permit
+    // and how many sub-ranges completed in it. Returns the new limit.
+    unsigned adjust(const sample& s, bool saturated, uint64_t completed);
+    // Called when no repair is running; latency is sampled anew when one
+    // starts.
+    void idle();
+};
+
 // The class partition_checksum calculates a 256-bit cryptographically-secure
 // checksum of a set of partitions fed to it. The checksum of a partition set
 // is calculated by calculating a strong hash function (SHA-256) of each
@@ -100,3 +165,127 @@ class partition_checksum {
 future<partition_checksum> checksum_range(seastar::sharded<database> &db,
         const sstring& keyspace, const sstring& cf,
         const ::range<dht::token>& range);
+
+// A hash tree (Merkle tree) over the partitions of a token range. The range
+// is split into 2^depth leaves of about equal token width. Each leaf holds
+// the partition_checksum of the partitions in it, and each inner node the
+// sum of its children. Replicas build trees of the same shape for the same
+// range and depth, so comparing their trees top-down finds the leaves which
+// differ without looking at the subtrees which agree.
+class repair_hash_tree {
+private:
+    // Heap order: _nodes[1] is the root, the children of node i are 2i and
+    // 2i+1, and the leaves are the second half. _nodes[0] is unused.
+    std::vector<partition_checksum> _nodes;
+public:
+    explicit repair_hash_tree(unsigned depth = 0) : _nodes(size_t(2) << depth) { }
+    // Rebuilds a tree from its leaves. Their number must be a power of two.
+    explicit repair_hash_tree(std::vector<partition_checksum> leaves);
+    size_t leaf_count() const { return _nodes.size() / 2; }
+    unsigned depth() const;
+    const partition_checksum& root() const { return _nodes[1]; }
+    // Adds a partition's checksum to a leaf.
+    void add(size_t leaf, const partition_checksum& c);
+    // Merges a tree of the same shape built from other partitions.
+    void add(const repair_hash_tree& other);
+    std::vector<partition_checksum> leaves() const;
+    // Returns, in order, the leaves whose checksums differ from the other
+    // tree's, which must have the same shape.
+    std::vector<size_t> differing_leaves(const repair_hash_tree& other) const;
+};
+
+// Calculate the hash tree of the given depth over the data held on all
+// shards of a column family, in the given token range. The same lifetime
+// rules as for checksum_range() apply.
+future<repair_hash_tree> checksum_tree(seastar::sharded<database> &db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, unsigned depth);
+
+// Row-level repair: instead of streaming every partition of a differing
+// range, replicas exchange a hash per clustering row, and only the rows
+// whose hashes are missing or differ on the other side are transferred.
+// The partition tombstone, static row and range tombstones of a partition
+// are hashed, and transferred, together as its "partition-level" part.
+struct repair_row_hash {
+    clustering_key key;
+    partition_checksum hash;
+};
+
+struct repair_partition_hashes {
+    partition_key key;
+    partition_checksum partition_hash;
+    // In clustering order.
+    std::vector<repair_row_hash> rows;
+};
+
+// Selects parts of a partition: its partition-level part if partition_level
+// is set, and the listed clustering rows.
+struct repair_partition_rows {
+    partition_key key;
+    bool partition_level;
+    std::vector<clustering_key> rows;
+};
+
+// A position in the row hashes of a range: the partition-level part of the
+// partition with the given key if row is disengaged, else the given row of
+// that partition.
+struct repair_row_position {
+    partition_key key;
+    std::experimental::optional<clustering_key> row;
+};
+
+// Calculate the row hashes of the data held on all shards of a column
+// family, in the given token range, in ring order. The same lifetime rules
+// as for checksum_range() apply.
+// If after is given, the range starts at its partition's token, and only
+// the hashes which come after it are returned; those of its partition have
+// no partition-level part (an empty partition_hash).
+// Once max_rows rows are collected (counting each partition as one more),
+// the result ends, possibly in the middle of a partition, so when it holds
+// that many rows what follows its last position is left to another call.
+future<std::vector<repair_partition_hashes>> repair_row_hashes(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const ::range<dht::token>& range, uint64_t max_rows,
+        const std::experimental::optional<repair_row_position>& after = {});
+
+// Counts rows like repair_row_hashes() does for max_rows.
+uint64_t repair_count_rows(const std::vector<repair_partition_hashes>& hashes);
+
+// Given our and a peer's row hashes, both from repair_row_hashes() with
+// max_rows, over a window whose end the peer's was limited to our last
+// token if ours was cut short, returns the last position up to which both
+// are complete, or nothing if both cover the whole window. The hashes past
+// that position are dropped from both.
+std::experimental::optional<repair_row_position> repair_trim_row_hashes(const schema& s,
+        std::vector<repair_partition_hashes>& local, std::vector<repair_partition_hashes>& remote, uint64_t max_rows);
+
+// Returns mutations holding just the selected parts of the given
+// partitions, as far as this node has them.
+future<std::vector<frozen_mutation>> repair_get_rows(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf,
+        const std::vector<repair_partition_rows>& rows);
+
+// Compares the row hashes of two replicas, both in ring order, and returns
+// the rows which the first one has to send to the second, and those it has
+// to fetch from it.
+std::pair<std::vector<repair_partition_rows>, std::vector<repair_partition_rows>>
+repair_diff_rows(const schema& s, const std::vector<repair_partition_hashes>& local, const std::vector<repair_partition_hashes>& remote);
+
+// Counts the selected rows, a partition-level part counting as one.
+uint64_t repair_count_rows(const std::vector<repair_partition_rows>& rows);
+
+// Splits a selection of rows, in order, into batches of at most max_rows
+// rows each. A partition with more rows is split between batches.
+std::vector<std::vector<repair_partition_rows>> repair_split_rows(std::vector<repair_partition_rows> rows, size_t max_rows);
+
+// Applies rows obtained from repair_get_rows() on the node "from". Like
+// streamed mutations, they are written to the streaming memtables, and
+// become visible to reads once repair_flush_rows() is called for a range
+// holding them.
+future<> repair_apply_rows(seastar::sharded<database>& db, const std::vector<frozen_mutation>& fms, net::msg_addr from);
+
+// Flushes the rows applied by repair_apply_rows() to the column family,
+// on all shards, and drops the given range from the cache. Called once per
+// synced range rather than for every batch of rows.
+future<> repair_flush_rows(seastar::sharded<database>& db,
+        const sstring& keyspace, const sstring& cf, const ::range<dht::token>& range);
@@ -27,6 +27,7 @@
 #include <seastar/util/defer.hh>
 #include "memtable.hh"
 #include <chrono>
+#include <algorithm>
 #include "utils/move.hh"
 
 using namespace std::chrono_literals;
@@ -50,13 +51,20 @@ cache_tracker::cache_tracker() {
         return with_allocator(_region.allocator(), [this] {
           // Removing a partition may require reading large keys when we rebalance
           // the rbtree, so linearize anything we read
+          for (auto c : _tracked_caches) {
+            if (c->evict() == memory::reclaiming_result::reclaimed_something) {
+                return memory::reclaiming_result::reclaimed_something;
+            }
+          }
           return with_linearized_managed_bytes([&] {
            try {
             if (_lru.empty()) {
                 return memory::reclaiming_result::reclaimed_nothing;
             }
+            _lru.back().on_evicted();
             _lru.pop_back_and_dispose(current_deleter<cache_entry>());
             --_partitions;
+            ++_evictions;
             ++_modification_count;
             return memory::reclaiming_result::reclaimed_something;
            } catch (std::bad_alloc&) {
@@ -107,6 +115,11 @@ cache_tracker::setup_collectd() {
                 , "total_operations", "merges")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _merges)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _evictions)
+        ),
         scollectd::add_polled_metric(scollectd::type_instance_id("cache"
                 , scollectd::per_cpu_plugin_instance
                 , "objects", "partitions")
@@ -120,6 +133,8 @@ void cache_tracker::clear() {
         _lru.clear_and_dispose(current_deleter<cache_entry>());
     });
     _partitions = 0;
+    // Invalidates continuity of the ranges after the last entries.
+    ++_evictions;
     ++_modification_count;
 }
 
@@ -164,6 +179,14 @@ const logalloc::region& cache_tracker::region() const {
     return _region;
 }
 
+void cache_tracker::add_tracked_cache(tracked_cache& c) {
+    _tracked_caches.push_back(&c);
+}
+
+void cache_tracker::remove_tracked_cache(tracked_cache& c) {
+    _tracked_caches.erase(std::remove(_tracked_caches.begin(), _tracked_caches.end(), &c), _tracked_caches.end());
+}
+
 // Reader which populates the cache using data from the delegate.
 class populating_reader final : public mutation_reader::impl {
     schema_ptr _schema;
@@ -245,6 +268,27 @@ class just_cache_scanning_reader final : public mutation_reader::impl {
     just_cache_scanning_reader(schema_ptr s, row_cache& cache, const query::partition_range& range)
         : _schema(std::move(s)), _cache(cache), _range(range)
     { }
+    // Returns true iff the cache is known to contain every partition of the
+    // underlying data source which falls between the last partition returned
+    // by this reader (or the start of the range) and the next one it will
+    // return (or the end of the range).
+    bool next_is_continuous() {
+        if (!_cache._continuity_tracking) {
+            return false;
+        }
+        return _cache._read_section(_cache._tracker.region(), [this] {
+          return with_linearized_managed_bytes([&] {
+            update_iterators();
+            if (_it != _end) {
+                return _it->continuous();
+            }
+            if (_end != _cache._partitions.end()) {
+                return _end->continuous();
+            }
+            return _cache.tail_continuous();
+          });
+        });
+    }
     virtual future<mutation_opt> operator()() override {
         return _cache._read_section(_cache._tracker.region(), [this] {
           return with_linearized_managed_bytes([&] {
@@ -265,37 +309,59 @@ class just_cache_scanning_reader final : public mutation_reader::impl {
 class scanning_and_populating_reader final : public mutation_reader::impl {
     row_cache& _cache;
     schema_ptr _schema;
-    mutation_reader _primary;
+    just_cache_scanning_reader _primary;
     bool _secondary_only = false;
     mutation_opt _next_primary;
     mutation_source& _underlying;
     mutation_reader _secondary;
     utils::phased_barrier::phase_type _secondary_phase;
+    // Continuity generation in which _secondary was known to reflect the
+    // underlying data source starting from _last.
+    uint64_t _secondary_generation = 0;
     const query::partition_range& _original_range;
     query::partition_range _range;
     key_source& _underlying_keys;
+    query::partition_range _keys_range;
     key_reader _keys;
+    // Set when _keys is not positioned right after _last and needs to be
+    // recreated before use.
+    bool _keys_stale = true;
+    uint64_t _keys_generation;
     dht::decorated_key_opt _next_key;
     dht::decorated_key_opt _last_secondary_key;
+    // The last partition returned by this reader.
+    dht::decorated_key_opt _last;
     const io_priority_class _pc;
 public:
     scanning_and_populating_reader(schema_ptr s, row_cache& cache, const query::partition_range& range, const io_priority_class& pc)
         : _cache(cache), _schema(s),
-          _primary(make_mutation_reader<just_cache_scanning_reader>(s, cache, range)),
+          _primary(s, cache, range),
           _underlying(cache._underlying), _original_range(range), _underlying_keys(cache._underlying_keys),
-          _keys(_underlying_keys(range, pc)),
+          _keys_range(range),
+          _keys_generation(cache._continuity_generation),
           _pc(pc)
     { }
     virtual future<mutation_opt> operator()() override {
-        // FIXME: store in cache information whether the immediate successor
-        // of the current entry is present. As long as it is consulting
-        // index_reader is not necessary.
         if (_secondary_only) {
             return next_secondary();
         }
+        if (_primary.next_is_continuous()) {
+            // The underlying data source has nothing we don't already have
+            // in cache up to the next entry, no need to look for keys.
+            return _primary().then([this] (mutation_opt&& mo) {
+                _next_key = {};
+                _keys_stale = true;
+                if (mo) {
+                    _cache.on_hit();
+                    _last = mo->decorated_key();
+                }
+                return std::move(mo);
+            });
+        }
         return next_key().then([this] (dht::decorated_key_opt dk) mutable {
             return _primary().then([this, dk = std::move(dk)] (mutation_opt&& mo) {
                 if (!mo && !dk) {
+                    mark_tail_continuous(_keys_generation);
                     return make_ready_future<mutation_opt>();
                 }
                 if (mo) {
@@ -303,8 +369,12 @@ class scanning_and_populating_reader final : public mutation_reader::impl {
                     if (cmp >= 0) {
                         if (cmp) {
                             _next_key = std::move(dk);
+                        } else if (dk) {
+                            // dk immediately follows _last in the underlying data source.
+                            mark_continuous(mo->decorated_key(), _keys_generation);
                         }
                         _cache.on_hit();
+                        _last = mo->decorated_key();
                         return make_ready_future<mutation_opt>(std::move(mo));
                     }
                 }
@@ -319,6 +389,9 @@ class scanning_and_populating_reader final : public mutation_reader::impl {
                 _range = query::partition_range(query::partition_range::bound { std::move(*dk), true }, std::move(end));
                 _last_secondary_key = {};
                 _secondary_phase = _cache._populate_phaser.phase();
+                // The secondary reader starts at the key which follows _last, so the
+                // range it covers is contiguous with _last only as long as _keys is current.
+                _secondary_generation = std::min(_keys_generation, _cache._continuity_generation);
                 _secondary = _underlying(_cache._schema, _range, _pc);
                 _secondary_only = true;
                 return next_secondary();
@@ -326,19 +399,44 @@ class scanning_and_populating_reader final : public mutation_reader::impl {
         });
     }
 private:
+    // Called when the underlying data source, as observed in given continuity
+    // generation, has no partitions between _last and dk.
+    void mark_continuous(const dht::decorated_key& dk, uint64_t generation) {
+        if (generation != _cache._continuity_generation) {
+            return;
+        }
+        if (!_last && _original_range.start()) {
+            return;
+        }
+        _cache.mark_continuous(_last, dk);
+    }
+    // Called when the underlying data source, as observed in given continuity
+    // generation, has no partitions after _last within the scanned range.
+    void mark_tail_continuous(uint64_t generation) {
+        if (_original_range.end() || generation != _cache._continuity_generation) {
+            return;
+        }
+        // Without _last, the scan only saw that nothing follows its start,
+        // which says nothing about the partitions before it.
+        if (!_last && _original_range.start()) {
+            return;
+        }
+        _cache.mark_tail_continuous(_last);
+    }
     future<mutation_opt> next_secondary() {
         if (_secondary_phase != _cache._populate_phaser.phase()) {
             assert(_last_secondary_key);
             auto cmp = dht::ring_position_comparator(*_schema);
             _range = _range.split_after(*_last_secondary_key, cmp);
             _secondary_phase = _cache._populate_phaser.phase();
+            _secondary_generation = _cache._continuity_generation;
             _secondary = _underlying(_cache._schema, _range, _pc);
         }
         return _secondary().then([this, op = _cache._populate_phaser.start()] (mutation_opt&& mo) {
             if (!mo && _next_primary) {
-                auto cmp = dht::ring_position_comparator(*_schema);
-                _range = _original_range.split_after(_next_primary->decorated_key(), cmp);
-                _keys = _underlying_keys(_range, _pc);
+                mark_continuous(_next_primary->decorated_key(), _secondary_generation);
+                _last = _next_primary->decorated_key();
+                _keys_stale = true;
                 _secondary_only = false;
                 _cache.on_hit();
                 return std::move(_next_primary);
@@ -346,7 +444,11 @@ class scanning_and_populating_reader final : public mutation_reader::impl {
             if (mo) {
                 _cache.populate(*mo);
                 mo->upgrade(_schema);
+                mark_continuous(mo->decorated_key(), _secondary_generation);
                 _last_secondary_key = mo->decorated_key();
+                _last = mo->decorated_key();
+            } else {
+                mark_tail_continuous(_secondary_generation);
             }
             _cache.on_miss();
             return std::move(mo);
@@ -356,6 +458,15 @@ class scanning_and_populating_reader final : public mutation_reader::impl {
         if (_next_key) {
             return make_ready_future<dht::decorated_key_opt>(move_and_disengage(_next_key));
         }
+        if (_keys_stale) {
+            if (_last) {
+                auto cmp = dht::ring_position_comparator(*_schema);
+                _keys_range = _original_range.split_after(*_last, cmp);
+            }
+            _keys_generation = _cache._continuity_generation;
+            _keys = _underlying_keys(_keys_range, _pc);
+            _keys_stale = false;
+        }
         return _keys();
     }
 };
@@ -399,6 +510,14 @@ row_cache::make_reader(schema_ptr s, const query::partition_range& range, const
     return make_scanning_reader(std::move(s), range, pc);
 }
 
+bool row_cache::contains(const dht::decorated_key& dk) {
+    return _read_section(_tracker.region(), [&] {
+        return with_linearized_managed_bytes([&] {
+            return _partitions.find(dk, cache_entry::compare(_schema)) != _partitions.end();
+        });
+    });
+}
+
 row_cache::~row_cache() {
     clear();
 }
@@ -425,6 +544,8 @@ void row_cache::populate(const mutation& m) {
 }
 
 void row_cache::clear() {
+    ++_continuity_generation;
+    _tail_continuous = false;
     with_allocator(_tracker.allocator(), [this] {
         // We depend on clear_and_dispose() below not looking up any keys.
         // Using with_linearized_managed_bytes() is no helps, because we don't
@@ -437,6 +558,9 @@ void row_cache::clear() {
 }
 
 future<> row_cache::update(memtable& m, partition_presence_checker presence_checker) {
+    // Underlying data source has already changed, readers created before
+    // cannot be trusted to tell which ranges are complete.
+    ++_continuity_generation;
     _tracker.region().merge(m._region); // Now all data in memtable belongs to cache
     auto attr = seastar::thread_attributes();
     attr.scheduling_group = &_update_thread_scheduling_group;
@@ -491,9 +615,13 @@ future<> row_cache::update(memtable& m, partition_presence_checker presence_chec
                                     partition_presence_checker_result::definitely_doesnt_exist) {
                                 cache_entry* entry = current_allocator().construct<cache_entry>(
                                         mem_e.schema(), std::move(mem_e.key()), std::move(mem_e.partition()));
+                                // The new entry splits a range, which retains its continuity.
+                                entry->set_continuous(cache_i == _partitions.end() ? tail_continuous() : cache_i->continuous());
                                 upgrade_entry(*entry);
                                 _tracker.insert(*entry);
                                 _partitions.insert(cache_i, *entry);
+                            } else {
+                                break_continuity(cache_i);
                             }
                             i = m.partitions.erase(i);
                             current_allocator().destroy(&mem_e);
@@ -527,11 +655,16 @@ void row_cache::touch(const dht::decorated_key& dk) {
 }
 
 void row_cache::invalidate_locked(const dht::decorated_key& dk) {
-    _partitions.erase_and_dispose(dk, cache_entry::compare(_schema),
-        [this, deleter = current_deleter<cache_entry>()](auto&& p) mutable {
+    ++_continuity_generation;
+    auto i = _partitions.lower_bound(dk, cache_entry::compare(_schema));
+    if (i != _partitions.end() && i->key().equal(*_schema, dk)) {
+        i = _partitions.erase_and_dispose(i, [this, deleter = current_deleter<cache_entry>()](auto&& p) mutable {
             _tracker.on_erase();
             deleter(p);
         });
+    }
+    // The partition is present in the underlying data source but not in cache.
+    break_continuity(i);
 }
 
 void row_cache::invalidate(const dht::decorated_key& dk) {
@@ -578,6 +711,8 @@ void row_cache::invalidate(const query::partition_range& range) {
             deleter(p);
         });
     });
+    ++_continuity_generation;
+    break_continuity(end);
   });
 }
 
@@ -596,6 +731,7 @@ cache_entry::cache_entry(cache_entry&& o) noexcept
     , _p(std::move(o._p))
     , _lru_link()
     , _cache_link()
+    , _continuous(o._continuous)
 {
     {
         auto prev = o._lru_link.prev_;
@@ -614,6 +750,64 @@ void row_cache::set_schema(schema_ptr new_schema) noexcept {
     _schema = std::move(new_schema);
 }
 
+void row_cache::set_continuity_tracking(bool enabled) {
+    _continuity_tracking = enabled;
+}
+
+void cache_entry::on_evicted() noexcept {
+    auto it = row_cache::partitions_type::s_iterator_to(*this);
+    ++it;
+    // The successor of the last entry is the header node. Continuity of the
+    // range after the last entry is invalidated through tracker's eviction count.
+    if (!row_cache::partitions_type::node_algorithms::is_header(it.pointed_node())) {
+        it->set_continuous(false);
+    }
+}
+
+bool row_cache::tail_continuous() const {
+    return _tail_continuous && _tail_continuous_evictions == _tracker.evictions();
+}
+
+void row_cache::break_continuity(partitions_type::iterator next) {
+    if (next == _partitions.end()) {
+        _tail_continuous = false;
+    } else {
+        next->set_continuous(false);
+    }
+}
+
+void row_cache::mark_continuous(const dht::decorated_key_opt& prev, const dht::decorated_key& dk) {
+    _read_section(_tracker.region(), [&] {
+      with_linearized_managed_bytes([&] {
+        auto cmp = cache_entry::compare(_schema);
+        auto i = _partitions.lower_bound(dk, cmp);
+        if (i == _partitions.end() || !i->key().equal(*_schema, dk)) {
+            return;
+        }
+        if (i == _partitions.begin()) {
+            if (!prev) {
+                i->set_continuous(true);
+            }
+            return;
+        }
+        if (prev && std::prev(i)->key().equal(*_schema, *prev)) {
+            i->set_continuous(true);
+        }
+      });
+    });
+}
+
+void row_cache::mark_tail_continuous(const dht::decorated_key_opt& prev) {
+    _read_section(_tracker.region(), [&] {
+      with_linearized_managed_bytes([&] {
+        if (_partitions.empty() ? !prev : prev && _partitions.rbegin()->key().equal(*_schema, *prev)) {
+            _tail_continuous = true;
+            _tail_continuous_evictions = _tracker.evictions();
+        }
+      });
+    });
+}
+
 mutation cache_entry::read(const schema_ptr& s) {
     auto m = mutation(_schema, _key, _p);
     if (_schema != s) {
@@ -59,6 +59,7 @@ class cache_entry {
     mutation_partition _p;
     lru_link_type _lru_link;
     cache_link_type _cache_link;
+    bool _continuous = false;
     friend class size_calculator;
 public:
     friend class row_cache;
@@ -85,6 +86,16 @@ class cache_entry {
     schema_ptr& schema() { return _schema; }
     mutation read(const schema_ptr&);
 
+    // True iff every partition of the underlying data source which falls
+    // between the preceding entry (or the start of the ring if there is none)
+    // and this entry is present in cache. Both ends are exclusive.
+    bool continuous() const { return _continuous; }
+    void set_continuous(bool value) { _continuous = value; }
+
+    // Must be called before the entry is removed from cache. The range between
+    // its neighbours will no longer be complete.
+    void on_evicted() noexcept;
+
     struct compare {
         dht::decorated_key::less_comparator _c;
 
@@ -114,6 +125,16 @@ class cache_entry {
     };
 };
 
+// A cache which keeps its entries in the region of cache_tracker, so that
+// its memory is reclaimed along with that of cached partitions.
+class tracked_cache {
+public:
+    virtual ~tracked_cache() {}
+    // Evicts the least recently used entry, if any. Invoked with the
+    // allocator of the tracker's region.
+    virtual memory::reclaiming_result evict() noexcept = 0;
+};
+
 // Tracks accesses and performs eviction of cache entries.
 class cache_tracker final {
 public:
@@ -126,10 +147,12 @@ class cache_tracker final {
     uint64_t _insertions = 0;
     uint64_t _merges = 0;
     uint64_t _partitions = 0;
+    uint64_t _evictions = 0;
     uint64_t _modification_count = 0;
     std::unique_ptr<scollectd::registrations> _collectd_registrations;
     logalloc::region _region;
     lru_type _lru;
+    std::vector<tracked_cache*> _tracked_caches;
 private:
     void setup_collectd();
 public:
@@ -146,6 +169,12 @@ class cache_tracker final {
     logalloc::region& region();
     const logalloc::region& region() const;
     uint64_t modification_count() const { return _modification_count; }
+    uint64_t evictions() const { return _evictions; }
+    // Registered caches are evicted from before partitions are. They have
+    // budgets of their own, and a partition cached here saves reading
+    // sstables altogether.
+    void add_tracked_cache(tracked_cache&);
+    void remove_tracked_cache(tracked_cache&);
 };
 
 // Returns a reference to shard-wide cache_tracker.
@@ -162,6 +191,10 @@ cache_tracker& global_cache_tracker();
 // Cache needs to be maintained externally so that it remains consistent with the underlying data source.
 // Any incremental change to the underlying data source should result in update() being called on cache.
 //
+// Besides partitions, cache tracks which ranges between cached partitions are known
+// to be complete (see cache_entry::continuous()). Range scans over such ranges are
+// served from cache alone, without consulting the underlying data source.
+//
 class row_cache final {
 public:
     using partitions_type = bi::set<cache_entry,
@@ -179,6 +212,15 @@ class row_cache final {
     stats _stats{};
     schema_ptr _schema;
     partitions_type _partitions; // Cached partitions are complete.
+    // True iff every partition of the underlying data source which comes
+    // after the last entry is present in cache. Valid only if there were no
+    // evictions since it was set, see tail_continuous().
+    bool _tail_continuous = false;
+    uint64_t _tail_continuous_evictions = 0;
+    // Changes whenever continuity information gathered by readers from the
+    // underlying data source may have become stale.
+    uint64_t _continuity_generation = 0;
+    bool _continuity_tracking = true;
     mutation_source _underlying;
     key_source _underlying_keys;
 
@@ -200,6 +242,15 @@ class row_cache final {
     void on_miss();
     void upgrade_entry(cache_entry&);
     void invalidate_locked(const dht::decorated_key&);
+    bool tail_continuous() const;
+    // Marks the range preceding given entry as incomplete.
+    void break_continuity(partitions_type::iterator next);
+    // Marks the range between prev and dk as complete. prev is disengaged if
+    // dk is the first partition of the ring.
+    void mark_continuous(const dht::decorated_key_opt& prev, const dht::decorated_key& dk);
+    // Marks the range after prev as complete. prev is disengaged if the
+    // underlying data source is empty.
+    void mark_tail_continuous(const dht::decorated_key_opt& prev);
     static thread_local seastar::thread_scheduling_group _update_thread_scheduling_group;
 public:
     ~row_cache();
@@ -215,6 +266,9 @@ class row_cache final {
     mutation_reader make_reader(schema_ptr, const query::partition_range& = query::full_partition_range, const io_priority_class& = default_priority_class());
 
     const stats& stats() const { return _stats; }
+
+    // Returns true if the partition is cached. Doesn't count as a hit or a miss.
+    bool contains(const dht::decorated_key& dk);
 public:
     // Populate cache from given mutation. The mutation must contain all
     // information there is for its partition in the underlying data sources.
@@ -249,6 +303,10 @@ class row_cache final {
     void set_schema(schema_ptr) noexcept;
     const schema_ptr& schema() const;
 
+    // Enables or disables serving range scans from cache alone when the
+    // scanned range is known to be complete. Enabled by default.
+    void set_continuity_tracking(bool enabled);
+
     friend class just_cache_scanning_reader;
     friend class scanning_and_populating_reader;
 };
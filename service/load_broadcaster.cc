@@ -63,10 +63,19 @@ void load_broadcaster::start_broadcasting() {
         }, int64_t(0), std::plus<int64_t>()).then([this] (int64_t size) {
             gms::versioned_value::factory value_factory;
             return _gossiper.add_local_application_state(gms::application_state::LOAD,
-                value_factory.load(size)).then([this] {
-                _timer.arm(BROADCAST_INTERVAL);
-                return make_ready_future<>();
-            });
+                value_factory.load(size));
+        }).then([this] {
+            // Severity is the fraction of shards busy compacting; the dynamic
+            // snitch of other nodes steers reads away from us while it is high.
+            return _db.map_reduce0([](database& db) {
+                return db.get_compaction_manager().get_stats().active_tasks ? 1u : 0u;
+            }, 0u, std::plus<unsigned>());
+        }).then([this] (unsigned compacting_shards) {
+            gms::versioned_value::factory value_factory;
+            return _gossiper.add_local_application_state(gms::application_state::SEVERITY,
+                value_factory.severity(double(compacting_shards) / smp::count));
+        }).then([this] {
+            _timer.arm(BROADCAST_INTERVAL);
         });
     });
 
@@ -62,7 +62,16 @@ class service::pager::query_pagers::impl : public query_pager {
                     , _options(options)
                     , _cmd(std::move(cmd))
                     , _ranges(std::move(ranges))
-    {}
+    {
+        // Replicas suspend their readers at the end of a page under the
+        // query's id, and resume them when the next page carries it.
+        auto state = _options.get_paging_state();
+        if (state && state->get_query_id() != utils::UUID()) {
+            _cmd->query_id = state->get_query_id();
+        } else {
+            _cmd->query_id = utils::make_random_uuid();
+        }
+    }
 
 private:   
     future<> fetch_page(cql3::selection::result_set_builder& builder, uint32_t page_size, db_clock::time_point now) override {
@@ -320,7 +329,7 @@ class service::pager::query_pagers::impl : public query_pager {
         return _exhausted ?
                         nullptr :
                         ::make_shared<const paging_state>(*_last_pkey,
-                                        _last_ckey, _max);
+                                        _last_ckey, _max, _cmd->query_id);
     }
 
 private:
@@ -55,6 +55,7 @@
 #include "db/config.hh"
 #include "db/batchlog_manager.hh"
 #include "exceptions/exceptions.hh"
+#include <deque>
 #include <boost/range/algorithm_ext/push_back.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/adaptor/reversed.hpp>
@@ -65,17 +66,24 @@
 #include <boost/range/algorithm/find_if.hpp>
 #include <boost/range/algorithm/remove_if.hpp>
 #include <boost/range/algorithm/heap_algorithm.hpp>
+#include <boost/range/iterator_range.hpp>
 #include <boost/range/numeric.hpp>
 #include <boost/range/algorithm/sort.hpp>
+#include <boost/range/irange.hpp>
 #include "utils/latency.hh"
 #include "schema.hh"
 #include "schema_registry.hh"
+#include "cql3/selection/selection.hh"
 #include "utils/joinpoint.hh"
 
 namespace service {
 
 static logging::logger logger("storage_proxy");
 
+// Percentile speculative retry needs this many recent latency samples for
+// each replica before it trusts their percentiles.
+static constexpr uint64_t speculative_retry_min_samples = 100;
+
 distributed<service::storage_proxy> _the_storage_proxy;
 
 using namespace exceptions;
@@ -122,6 +130,7 @@ class abstract_write_response_handler {
     size_t _cl_acks = 0;
     bool _cl_achieved = false;
     bool _throttled = false;
+    storage_proxy::clock_type::time_point _start = storage_proxy::clock_type::now();
 protected:
     size_t total_block_for() {
         // original comment from cassandra:
@@ -151,6 +160,9 @@ class abstract_write_response_handler {
             }
         }
     };
+    storage_proxy::clock_type::time_point start_time() const {
+        return _start;
+    }
     void unthrottle() {
         _proxy->_stats.background_writes++;
         _proxy->_stats.background_write_bytes += _mutation->representation().size();
@@ -305,6 +317,7 @@ void storage_proxy::remove_response_handler(storage_proxy::response_id_type id)
 void storage_proxy::got_response(storage_proxy::response_id_type id, gms::inet_address from) {
     auto it = _response_handlers.find(id);
     if (it != _response_handlers.end()) {
+        locator::i_endpoint_snitch::get_local_snitch_ptr()->receive_timing(from, clock_type::now() - it->second.handler->start_time());
         if (it->second.handler->response(from)) {
             remove_response_handler(id); // last one, remove entry. Will cancel expiration timer too.
         }
@@ -379,6 +392,11 @@ storage_proxy::storage_proxy(distributed<database>& db) : _db(db) {
                 , "total_operations", "read retries")
                 , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.read_retries)
         ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "partial aggregate reads")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.partial_aggregate_reads)
+        ),
         scollectd::add_polled_metric(scollectd::type_instance_id("storage_proxy"
                 , scollectd::per_cpu_plugin_instance
                 , "total_operations", "write timeouts")
@@ -843,6 +861,25 @@ storage_proxy::mutate_streaming_mutation(const schema_ptr& s, const frozen_mutat
     });
 }
 
+future<>
+storage_proxy::mutate_streaming_mutations(const schema_ptr& s, const std::vector<frozen_mutation>& ms) {
+    std::vector<std::vector<const frozen_mutation*>> per_shard(smp::count);
+    for (auto& m : ms) {
+        per_shard[_db.local().shard_of(m)].push_back(&m);
+    }
+    return do_with(std::move(per_shard), global_schema_ptr(s), [this] (auto& per_shard, auto& gs) {
+        auto shards = boost::irange<unsigned>(0, smp::count);
+        return parallel_for_each(shards.begin(), shards.end(), [this, &per_shard, &gs] (unsigned shard) {
+            if (per_shard[shard].empty()) {
+                return make_ready_future<>();
+            }
+            return _db.invoke_on(shard, [&ms = per_shard[shard], gs] (database& db) {
+                return db.apply_streaming_mutations(gs, ms);
+            });
+        });
+    });
+}
+
 
 /**
  * Helper for create_write_response_handler, shared across mutate/mutate_atomically.
@@ -1859,9 +1896,22 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
             });
         });
     }
+    // Records how long ep took to answer a data or digest read, for timing
+    // speculative retries and for the dynamic snitch. Failures count too, as
+    // a timed out replica is slow.
+    void record_replica_latency(gms::inet_address ep, clock_type::time_point start) {
+        auto latency = clock_type::now() - start;
+        auto& db = _proxy->get_db().local();
+        if (db.column_family_exists(_schema->id())) {
+            db.find_column_family(_schema).replica_read_latency(ep).mark(latency);
+        }
+        locator::i_endpoint_snitch::get_local_snitch_ptr()->receive_timing(ep, latency);
+    }
     future<> make_data_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end, clock_type::time_point timeout) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver), timeout] (gms::inet_address ep) {
-            return make_data_request(ep, timeout).then_wrapped([resolver, ep] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+            auto start = clock_type::now();
+            return make_data_request(ep, timeout).then_wrapped([this, resolver, ep, start] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+                record_replica_latency(ep, start);
                 try {
                     resolver->add_data(ep, f.get0());
                 } catch(...) {
@@ -1872,7 +1922,9 @@ class abstract_read_executor : public enable_shared_from_this<abstract_read_exec
     }
     future<> make_digest_requests(digest_resolver_ptr resolver, targets_iterator begin, targets_iterator end, clock_type::time_point timeout) {
         return parallel_for_each(begin, end, [this, resolver = std::move(resolver), timeout] (gms::inet_address ep) {
-            return make_digest_request(ep, timeout).then_wrapped([resolver, ep] (future<query::result_digest> f) {
+            auto start = clock_type::now();
+            return make_digest_request(ep, timeout).then_wrapped([this, resolver, ep, start] (future<query::result_digest> f) {
+                record_replica_latency(ep, start);
                 try {
                     resolver->add_digest(ep, f.get0());
                 } catch(...) {
@@ -2011,6 +2063,32 @@ class always_speculating_read_executor : public abstract_read_executor {
 // this executor sends request to an additional replica after some time below timeout
 class speculating_read_executor : public abstract_read_executor {
     timer<> _speculate_timer;
+private:
+    // With CUSTOM speculative retry, the configured delay. With PERCENTILE,
+    // the configured percentile of the recent read latency of the slowest of
+    // the replicas we ask up front, or half the read timeout if we don't
+    // know enough about them yet.
+    clock_type::duration speculation_delay() {
+        auto& retry = _schema->speculative_retry();
+        if (retry.get_type() == speculative_retry::type::CUSTOM) {
+            return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double, std::milli>(retry.get_value()));
+        }
+        auto& db = _proxy->get_db().local();
+        auto fallback = std::chrono::milliseconds(db.get_config().read_request_timeout_in_ms() / 2);
+        if (!db.column_family_exists(_schema->id())) {
+            return fallback;
+        }
+        auto& cf = db.find_column_family(_schema);
+        clock_type::duration delay(0);
+        for (auto ep : boost::make_iterator_range(_targets.begin(), _targets.end() - 1)) {
+            auto& latency = cf.replica_read_latency(ep);
+            if (latency.count() < speculative_retry_min_samples) {
+                return fallback;
+            }
+            delay = std::max(delay, latency.percentile(retry.get_value()));
+        }
+        return delay;
+    }
 public:
     using abstract_read_executor::abstract_read_executor;
     virtual future<> make_requests(digest_resolver_ptr resolver, std::chrono::steady_clock::time_point timeout) {
@@ -2023,9 +2101,7 @@ class speculating_read_executor : public abstract_read_executor {
                 f.finally([exec = shared_from_this()]{});
             }
         });
-        // FIXME: the timeout should come from previous latency statistics for a partition
-        auto speculate_timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(_proxy->get_db().local().get_config().read_request_timeout_in_ms()/2);
-        _speculate_timer.arm(speculate_timeout);
+        _speculate_timer.arm(clock_type::now() + speculation_delay());
 
         // if CL + RR result in covering all replicas, getReadExecutor forces AlwaysSpeculating.  So we know
         // that the last replica in our list is "extra."
@@ -2180,30 +2256,149 @@ storage_proxy::query_singular(lw_shared_ptr<query::read_command> cmd, std::vecto
     });
 }
 
-future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>
-storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout, std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results,
-        lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-        std::vector<query::partition_range>&& ranges, int concurrency_factor) {
-    schema_ptr schema = local_schema_registry().get(cmd->schema_version);
-    keyspace& ks = _db.local().find_keyspace(schema->ks_name());
-    std::vector<::shared_ptr<abstract_read_executor>> exec;
-    auto concurrent_fetch_starting_index = i;
-    auto p = shared_from_this();
+// Reads a partition range, split into vnode ranges by get_restricted_ranges(),
+// as a pipeline of range requests.
+//
+// Consecutive vnode ranges which can be read from the same replicas are
+// merged into one request, to save RPCs. A new request is issued whenever
+// one completes, as long as the rows received so far, together with the rows
+// expected from the vnode ranges in flight, don't cover the row limit. The
+// rows expected per vnode range are the average returned so far, so the
+// number of ranges in flight adapts to how dense the data is.
+//
+// Results are merged in token order as soon as all requests before them are
+// done. The scan completes once the merged results hold row_limit rows, and
+// doesn't wait for the requests issued after them.
+class range_scan : public enable_lw_shared_from_this<range_scan> {
+    struct request {
+        size_t ranges;
+        uint32_t rows = 0;
+        stdx::optional<foreign_ptr<lw_shared_ptr<query::result>>> result;
+
+        explicit request(size_t ranges) : ranges(ranges) { }
+    };
 
-    while (i != ranges.end() && std::distance(i, concurrent_fetch_starting_index) < concurrency_factor) {
-        query::partition_range& range = *i;
-        std::vector<gms::inet_address> live_endpoints = get_live_sorted_endpoints(ks, end_token(range));
-        std::vector<gms::inet_address> filtered_endpoints = filter_for_query(cl, ks, live_endpoints);
-        ++i;
+    shared_ptr<storage_proxy> _proxy;
+    schema_ptr _schema;
+    keyspace& _ks;
+    lw_shared_ptr<query::read_command> _cmd;
+    db::consistency_level _cl;
+    std::chrono::steady_clock::time_point _timeout;
+    std::vector<query::partition_range> _ranges;
+    std::vector<query::partition_range>::iterator _next;
+    // Requests whose results were not merged yet, in token order. Elements
+    // are only removed once done, so in-flight requests can refer to theirs.
+    std::deque<request> _requests;
+    size_t _requests_in_flight = 0;
+    size_t _ranges_in_flight = 0;
+    size_t _ranges_done = 0;
+    uint64_t _rows_received = 0;
+    float _initial_rows_per_range;
+    query::result_merger _merger;
+    uint64_t _merged_rows = 0;
+    promise<foreign_ptr<lw_shared_ptr<query::result>>> _done;
+    bool _finished = false;
+    // A request may complete within send(), when its future is ready
+    // already; done() then leaves issuing more requests to the issue()
+    // call in progress, rather than recursing into it.
+    bool _issuing = false;
+    bool _reissue = false;
+public:
+    // Bounds the requests a single scan has in flight, so that full scans
+    // don't flood the replicas. Also bounds how many vnode ranges are merged
+    // into a request, so that a full scan still reads in parallel.
+    static constexpr size_t max_requests_in_flight = 32;
+    // The number of vnode ranges a scan starts with. The window then at most
+    // doubles with every range read, until the observed row density says
+    // how many ranges are needed.
+    static constexpr size_t initial_ranges_in_flight = 4;
+
+    range_scan(shared_ptr<storage_proxy> proxy, schema_ptr s, keyspace& ks, lw_shared_ptr<query::read_command> cmd,
+            db::consistency_level cl, std::chrono::steady_clock::time_point timeout,
+            std::vector<query::partition_range> ranges, float initial_rows_per_range)
+        : _proxy(std::move(proxy))
+        , _schema(std::move(s))
+        , _ks(ks)
+        , _cmd(std::move(cmd))
+        , _cl(cl)
+        , _timeout(timeout)
+        , _ranges(std::move(ranges))
+        , _next(_ranges.begin())
+        , _initial_rows_per_range(initial_rows_per_range)
+    { }
+
+    future<foreign_ptr<lw_shared_ptr<query::result>>> run() {
+        auto f = _done.get_future();
+        issue();
+        return f;
+    }
+private:
+    float rows_per_range() const {
+        return _ranges_done ? float(_rows_received) / _ranges_done : _initial_rows_per_range;
+    }
+
+    // The number of vnode ranges which should be in flight to receive the
+    // rows still missing.
+    size_t ranges_wanted() const {
+        if (_rows_received >= _cmd->row_limit) {
+            return 0;
+        }
+        // The initial estimate is a guess, so don't put the whole ring in
+        // flight on its strength; widen the window exponentially instead.
+        auto window = std::max(initial_ranges_in_flight, 2 * _ranges_done);
+        auto per_range = rows_per_range();
+        if (per_range <= 0) {
+            return window;
+        }
+        auto wanted = std::ceil((_cmd->row_limit - _rows_received) / per_range);
+        return size_t(std::min({wanted, double(window), double(_ranges.size())}));
+    }
+
+    void issue() {
+        if (_issuing) {
+            _reissue = true;
+            return;
+        }
+        _issuing = true;
+        try {
+            do {
+                _reissue = false;
+                auto wanted = ranges_wanted();
+                while (!_finished && _next != _ranges.end() && _requests_in_flight < max_requests_in_flight && _ranges_in_flight < wanted) {
+                    auto remaining = size_t(std::distance(_next, _ranges.end()));
+                    send(std::max<size_t>(1, std::min(wanted - _ranges_in_flight, remaining / max_requests_in_flight)));
+                }
+            } while (_reissue && !_finished);
+        } catch (...) {
+            _issuing = false;
+            if (!_finished) {
+                fail(std::current_exception());
+            }
+            return;
+        }
+        _issuing = false;
+        if (!_finished && !_requests_in_flight) {
+            finish();
+        }
+    }
+
+    // Sends one request for the next vnode ranges, merging up to max_ranges
+    // of them if they can be read from the same replicas.
+    void send(size_t max_ranges) {
+        query::partition_range range = *_next;
+        std::vector<gms::inet_address> live_endpoints = _proxy->get_live_sorted_endpoints(_ks, end_token(range));
+        std::vector<gms::inet_address> filtered_endpoints = filter_for_query(_cl, _ks, live_endpoints);
+        ++_next;
+        size_t merged_ranges = 1;
 
         // getRestrictedRange has broken the queried range into per-[vnode] token ranges, but this doesn't take
         // the replication factor into account. If the intersection of live endpoints for 2 consecutive ranges
         // still meets the CL requirements, then we can merge both ranges into the same RangeSliceCommand.
-        while (i != ranges.end())
+        while (_next != _ranges.end() && merged_ranges < max_ranges)
         {
-            query::partition_range& next_range = *i;
-            std::vector<gms::inet_address> next_endpoints = get_live_sorted_endpoints(ks, end_token(next_range));
-            std::vector<gms::inet_address> next_filtered_endpoints = filter_for_query(cl, ks, next_endpoints);
+            query::partition_range& next_range = *_next;
+            std::vector<gms::inet_address> next_endpoints = _proxy->get_live_sorted_endpoints(_ks, end_token(next_range));
+            std::vector<gms::inet_address> next_filtered_endpoints = filter_for_query(_cl, _ks, next_endpoints);
 
             // Origin has this to say here:
             // *  If the current range right is the min token, we should stop merging because CFS.getRangeSlice
@@ -2216,14 +2411,14 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
                 break;
             }
 
-            std::vector<gms::inet_address> merged = intersection(live_endpoints, next_endpoints);
+            std::vector<gms::inet_address> merged = storage_proxy::intersection(live_endpoints, next_endpoints);
 
             // Check if there is enough endpoint for the merge to be possible.
-            if (!is_sufficient_live_nodes(cl, ks, merged)) {
+            if (!is_sufficient_live_nodes(_cl, _ks, merged)) {
                 break;
             }
 
-            std::vector<gms::inet_address> filtered_merged = filter_for_query(cl, ks, merged);
+            std::vector<gms::inet_address> filtered_merged = filter_for_query(_cl, _ks, merged);
 
             // Estimate whether merging will be a win or not
             if (!locator::i_endpoint_snitch::get_local_snitch_ptr()->is_worth_merging_for_range_query(filtered_merged, filtered_endpoints, next_filtered_endpoints)) {
@@ -2234,32 +2429,66 @@ storage_proxy::query_partition_key_range_concurrent(std::chrono::steady_clock::t
             range = query::partition_range(range.start(), next_range.end());
             live_endpoints = std::move(merged);
             filtered_endpoints = std::move(filtered_merged);
-            ++i;
+            ++_next;
+            ++merged_ranges;
+        }
+        db::assure_sufficient_live_nodes(_cl, _ks, filtered_endpoints);
+
+        auto exec = ::make_shared<range_slice_read_executor>(_schema, _proxy, _cmd, std::move(range), _cl, std::move(filtered_endpoints));
+        _requests.emplace_back(merged_ranges);
+        auto& req = _requests.back();
+        ++_requests_in_flight;
+        _ranges_in_flight += merged_ranges;
+        exec->execute(_timeout).then_wrapped([self = shared_from_this(), exec, &req] (future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+            self->done(req, std::move(f));
+        });
+    }
+
+    void done(request& req, future<foreign_ptr<lw_shared_ptr<query::result>>> f) {
+        --_requests_in_flight;
+        _ranges_in_flight -= req.ranges;
+        if (_finished) {
+            f.ignore_ready_future();
+            return;
+        }
+        try {
+            auto result = f.get0();
+            req.rows = query::result_view::count_rows(*result);
+            req.result = std::move(result);
+        } catch (...) {
+            fail(std::current_exception());
+            return;
+        }
+        _ranges_done += req.ranges;
+        _rows_received += req.rows;
+
+        while (!_requests.empty() && _requests.front().result) {
+            auto& first = _requests.front();
+            _merged_rows += first.rows;
+            _merger(std::move(*first.result));
+            _requests.pop_front();
+        }
+        if (_merged_rows >= _cmd->row_limit) {
+            finish();
+            return;
         }
-        db::assure_sufficient_live_nodes(cl, ks, filtered_endpoints);
-        exec.push_back(::make_shared<range_slice_read_executor>(schema, p, cmd, std::move(range), cl, std::move(filtered_endpoints)));
+        issue();
     }
 
-    query::result_merger merger;
-    merger.reserve(exec.size());
+    void finish() {
+        _finished = true;
+        _done.set_value(_merger.get());
+    }
 
-    auto f = ::map_reduce(exec.begin(), exec.end(), [timeout] (::shared_ptr<abstract_read_executor>& rex) {
-        return rex->execute(timeout);
-    }, std::move(merger));
+    void fail(std::exception_ptr eptr) {
+        _finished = true;
+        _proxy->handle_read_error(eptr);
+        _done.set_exception(std::move(eptr));
+    }
+};
 
-    return f.then([p, exec = std::move(exec), results = std::move(results), i = std::move(i), ranges = std::move(ranges), cl, cmd, concurrency_factor, timeout]
-                   (foreign_ptr<lw_shared_ptr<query::result>>&& result) mutable {
-        results.emplace_back(std::move(result));
-        if (i == ranges.end()) {
-            return make_ready_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(std::move(results));
-        } else {
-            return p->query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, std::move(i), std::move(ranges), concurrency_factor);
-        }
-    }).handle_exception([p] (std::exception_ptr eptr) {
-        p->handle_read_error(eptr);
-        return make_exception_future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>>(eptr);
-    });
-}
+constexpr size_t range_scan::max_requests_in_flight;
+constexpr size_t range_scan::initial_ranges_in_flight;
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
 storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd, query::partition_range&& range, db::consistency_level cl) {
@@ -2281,22 +2510,9 @@ storage_proxy::query_partition_key_range(lw_shared_ptr<query::read_command> cmd,
     // underestimate how many rows we will get per-range in order to increase the likelihood that we'll
     // fetch enough rows in the first round
     result_rows_per_range -= result_rows_per_range * CONCURRENT_SUBREQUESTS_MARGIN;
-    int concurrency_factor = result_rows_per_range == 0.0 ? 1 : std::max(1, std::min(int(ranges.size()), int(std::ceil(cmd->row_limit / result_rows_per_range))));
-
-    std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results;
-    results.reserve(ranges.size()/concurrency_factor + 1);
-
-    return query_partition_key_range_concurrent(timeout, std::move(results), cmd, cl, ranges.begin(), std::move(ranges), concurrency_factor)
-            .then([](std::vector<foreign_ptr<lw_shared_ptr<query::result>>> results) {
-        query::result_merger merger;
-        merger.reserve(results.size());
 
-        for (auto&& r: results) {
-            merger(std::move(r));
-        }
-
-        return merger.get();
-    });
+    auto scan = make_lw_shared<range_scan>(shared_from_this(), schema, ks, cmd, cl, timeout, std::move(ranges), result_rows_per_range);
+    return scan->run();
 }
 
 future<foreign_ptr<lw_shared_ptr<query::result>>>
@@ -2904,6 +3120,14 @@ void storage_proxy::init_messaging_service() {
             });
         });
     });
+    ms.register_read_partial_aggregates([] (const rpc::client_info& cinfo, query::read_command cmd, std::vector<query::partition_range> prs, std::vector<query::aggregate_selector> aggregates) {
+        return do_with(std::move(prs), std::move(aggregates), get_local_shared_storage_proxy(),
+                [&cinfo, cmd = make_lw_shared<query::read_command>(std::move(cmd))] (const std::vector<query::partition_range>& prs, const std::vector<query::aggregate_selector>& aggregates, shared_ptr<storage_proxy>& p) {
+            return get_schema_for_read(cmd->schema_version, net::messaging_service::get_source(cinfo)).then([cmd, &prs, &aggregates, &p] (schema_ptr s) {
+                return p->query_partial_aggregates_locally(std::move(s), cmd, prs, aggregates);
+            });
+        });
+    });
     ms.register_truncate([](sstring ksname, sstring cfname) {
         return do_with(utils::make_joinpoint([] { return db_clock::now();}),
                         [ksname, cfname](auto& tsf) {
@@ -2928,6 +3152,7 @@ void storage_proxy::uninit_messaging_service() {
     ms.unregister_read_data();
     ms.unregister_read_mutation_data();
     ms.unregister_read_digest();
+    ms.unregister_read_partial_aggregates();
     ms.unregister_truncate();
 }
 
@@ -3044,6 +3269,118 @@ storage_proxy::query_mutations_locally(schema_ptr s, lw_shared_ptr<query::read_c
     }
 }
 
+// Replicas aggregate their rows in pages of about this many rows.
+static constexpr uint32_t partial_aggregation_page_rows = 1000;
+
+// Merges the partial aggregates computed by shards or replicas.
+class partial_aggregates_merger {
+    ::shared_ptr<cql3::selection::selection> _selection;
+    std::unique_ptr<cql3::selection::result_set_builder> _builder;
+public:
+    partial_aggregates_merger(database& db, schema_ptr s, const query::read_command& cmd, const std::vector<query::aggregate_selector>& aggregates)
+        : _selection(cql3::selection::selection::for_aggregates(db, std::move(s), aggregates))
+        , _builder(std::make_unique<cql3::selection::result_set_builder>(*_selection, db_clock::now(), cmd.slice.cql_format()))
+    { }
+    void operator()(std::vector<bytes_opt> partials) {
+        _builder->add_partial(partials);
+    }
+    std::vector<bytes_opt> get() {
+        return _builder->build_partial();
+    }
+};
+
+static future<std::vector<bytes_opt>>
+compute_partial_aggregates(database& db, schema_ptr s, const query::read_command& remote_cmd,
+        const std::vector<query::partition_range>& ranges, const std::vector<query::aggregate_selector>& aggregates) {
+    // The command may belong to another shard, so keep a local copy which
+    // lives as long as the scan.
+    auto cmd = make_lw_shared<query::read_command>(remote_cmd);
+    auto selection = cql3::selection::selection::for_aggregates(db, s, aggregates);
+    auto builder = make_lw_shared<cql3::selection::result_set_builder>(*selection, db_clock::now(), cmd->slice.cql_format());
+    auto& cf = db.find_column_family(cmd->cf_id);
+    return cf.query_in_pages(s, cmd, ranges, partial_aggregation_page_rows, [s, cmd, selection, builder] (const query::result& page) {
+        query::result_view::consume(page, cmd->slice, cql3::selection::result_set_builder::visitor(*builder, *s, *selection));
+    }).then([selection, builder] {
+        return builder->build_partial();
+    });
+}
+
+future<std::vector<bytes_opt>>
+storage_proxy::query_partial_aggregates_locally(schema_ptr s, lw_shared_ptr<query::read_command> cmd,
+        const std::vector<query::partition_range>& partition_ranges, const std::vector<query::aggregate_selector>& aggregates) {
+    if (partition_ranges.size() == 1 && partition_ranges[0].is_singular()) {
+        unsigned shard = _db.local().shard_of(partition_ranges[0].start()->value().token());
+        return _db.invoke_on(shard, [cmd, &partition_ranges, &aggregates, gs = global_schema_ptr(s)] (database& db) {
+            return compute_partial_aggregates(db, gs, *cmd, partition_ranges, aggregates);
+        });
+    }
+    // Each shard holds different partitions of the ranges, so each one
+    // computes partial aggregates over all of them.
+    return _db.map_reduce(partial_aggregates_merger(_db.local(), s, *cmd, aggregates),
+            [cmd, &partition_ranges, &aggregates, gs = global_schema_ptr(s)] (database& db) {
+        return compute_partial_aggregates(db, gs, *cmd, partition_ranges, aggregates);
+    });
+}
+
+future<std::vector<bytes_opt>>
+storage_proxy::query_partial_aggregates(schema_ptr s, lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges, db::consistency_level cl,
+        std::vector<query::aggregate_selector> aggregates) {
+    keyspace& ks = _db.local().find_keyspace(s->ks_name());
+    auto timeout_duration = std::chrono::milliseconds(_db.local().get_config().range_request_timeout_in_ms());
+    _stats.partial_aggregate_reads++;
+
+    // Read each vnode range from its closest live replica. Every range is a
+    // request of its own, so that the work a replica does before replying
+    // stays within the request timeout. A replica gets its ranges one at a
+    // time, while replicas work in parallel.
+    std::unordered_map<gms::inet_address, std::vector<query::partition_range>> ranges_by_endpoint;
+    for (auto&& pr : partition_ranges) {
+        std::vector<query::partition_range> ranges;
+        if (pr.is_singular() || ks.get_replication_strategy().get_type() == locator::replication_strategy_type::local) {
+            ranges.emplace_back(std::move(pr));
+        } else {
+            ranges = get_restricted_ranges(ks, *s, std::move(pr));
+        }
+        for (auto&& range : ranges) {
+            std::vector<gms::inet_address> live_endpoints = get_live_sorted_endpoints(ks, end_token(range));
+            std::vector<gms::inet_address> filtered_endpoints = filter_for_query(cl, ks, live_endpoints);
+            db::assure_sufficient_live_nodes(cl, ks, filtered_endpoints);
+            ranges_by_endpoint[filtered_endpoints.front()].emplace_back(std::move(range));
+        }
+    }
+
+    auto p = shared_from_this();
+    return do_with(std::move(ranges_by_endpoint), std::move(aggregates), [p, s, cmd, timeout_duration] (auto& ranges_by_endpoint, auto& aggregates) {
+        return ::map_reduce(ranges_by_endpoint.begin(), ranges_by_endpoint.end(), [p, s, cmd, timeout_duration, &aggregates] (auto& endpoint_and_ranges) {
+            auto ep = endpoint_and_ranges.first;
+            auto& ranges = endpoint_and_ranges.second;
+            return do_with(partial_aggregates_merger(p->_db.local(), s, *cmd, aggregates), std::vector<query::partition_range>(),
+                    [p, s, cmd, timeout_duration, ep, &ranges, &aggregates] (auto& merger, auto& range) {
+                return do_for_each(ranges, [p, s, cmd, timeout_duration, ep, &aggregates, &merger, &range] (const query::partition_range& pr) {
+                    range = { pr };
+                    future<std::vector<bytes_opt>> f = make_ready_future<std::vector<bytes_opt>>();
+                    if (is_me(ep)) {
+                        f = p->query_partial_aggregates_locally(s, cmd, range, aggregates);
+                    } else {
+                        auto timeout = std::chrono::steady_clock::now() + timeout_duration;
+                        auto& ms = net::get_local_messaging_service();
+                        f = ms.send_read_partial_aggregates(net::messaging_service::msg_addr{ep, 0}, timeout, *cmd, range, aggregates);
+                    }
+                    return f.then([&merger] (std::vector<bytes_opt> partials) {
+                        merger(std::move(partials));
+                    });
+                }).then([&merger] {
+                    return merger.get();
+                });
+            });
+        }, partial_aggregates_merger(p->_db.local(), s, *cmd, aggregates));
+    }).handle_exception([p] (std::exception_ptr eptr) {
+        p->handle_read_error(eptr);
+        return make_exception_future<std::vector<bytes_opt>>(eptr);
+    });
+}
+
 future<>
 storage_proxy::stop() {
     uninit_messaging_service();
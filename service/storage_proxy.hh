@@ -55,6 +55,7 @@ namespace service {
 
 class abstract_write_response_handler;
 class abstract_read_executor;
+class range_scan;
 
 class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*implements StorageProxyMBean*/ {
     using clock_type = std::chrono::steady_clock;
@@ -99,6 +100,7 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
         uint64_t reads = 0;
         uint64_t background_reads = 0; // client no longer waits for the read
         uint64_t read_retries = 0; // read is retried with new limit
+        uint64_t partial_aggregate_reads = 0; // aggregates computed on the replicas
     };
 private:
     distributed<database>& _db;
@@ -150,9 +152,6 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     std::vector<query::partition_range> get_restricted_ranges(keyspace& ks, const schema& s, query::partition_range range);
     float estimate_result_rows_per_range(lw_shared_ptr<query::read_command> cmd, keyspace& ks);
     static std::vector<gms::inet_address> intersection(const std::vector<gms::inet_address>& l1, const std::vector<gms::inet_address>& l2);
-    future<std::vector<foreign_ptr<lw_shared_ptr<query::result>>>> query_partition_key_range_concurrent(std::chrono::steady_clock::time_point timeout,
-            std::vector<foreign_ptr<lw_shared_ptr<query::result>>>&& results, lw_shared_ptr<query::read_command> cmd, db::consistency_level cl, std::vector<query::partition_range>::iterator&& i,
-            std::vector<query::partition_range>&& ranges, int concurrency_factor);
 
     future<foreign_ptr<lw_shared_ptr<query::result>>> do_query(schema_ptr,
         lw_shared_ptr<query::read_command> cmd,
@@ -182,6 +181,8 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     future<> mutate_locally(std::vector<mutation> mutations);
 
     future<> mutate_streaming_mutation(const schema_ptr&, const frozen_mutation& m);
+    // All mutations must belong to the table described by the schema
+    future<> mutate_streaming_mutations(const schema_ptr&, const std::vector<frozen_mutation>& ms);
 
     /**
     * Use this method to have these Mutations applied
@@ -230,6 +231,29 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     future<foreign_ptr<lw_shared_ptr<reconcilable_result>>> query_mutations_locally(
         schema_ptr, lw_shared_ptr<query::read_command> cmd, const query::partition_range&);
 
+    /*
+     * Computes the given aggregates over the rows selected by the command.
+     * Each range is read from a single live replica, which aggregates its
+     * rows on all of its shards and returns only the partial states of the
+     * aggregates. The returned partial states of all replicas are merged,
+     * and can be merged into a cql3::selection::result_set_builder.
+     *
+     * Rows of different replicas aren't reconciled, so this is only
+     * correct for consistency levels which block for a single replica.
+     */
+    future<std::vector<bytes_opt>> query_partial_aggregates(schema_ptr,
+        lw_shared_ptr<query::read_command> cmd,
+        std::vector<query::partition_range>&& partition_ranges,
+        db::consistency_level cl,
+        std::vector<query::aggregate_selector> aggregates);
+
+    // Computes the partial states of the aggregates over the rows this
+    // node holds in the ranges.
+    future<std::vector<bytes_opt>> query_partial_aggregates_locally(schema_ptr,
+        lw_shared_ptr<query::read_command> cmd,
+        const std::vector<query::partition_range>& partition_ranges,
+        const std::vector<query::aggregate_selector>& aggregates);
+
     /*
      * Returns mutation_reader for given column family
      * which combines data from all shards.
@@ -245,6 +269,7 @@ class storage_proxy : public seastar::async_sharded_service<storage_proxy> /*imp
     }
 
     friend class abstract_read_executor;
+    friend class range_scan;
     friend class abstract_write_response_handler;
 };
 
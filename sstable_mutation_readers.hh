@@ -30,9 +30,10 @@ class sstable_range_wrapping_reader final : public mutation_reader::impl {
     sstables::mutation_reader _smr;
 public:
     sstable_range_wrapping_reader(lw_shared_ptr<sstables::sstable> sst,
-        schema_ptr s, const query::partition_range& pr, const io_priority_class& pc)
+        schema_ptr s, const query::partition_range& pr, const io_priority_class& pc,
+        bool use_chunk_cache = true)
         : _sst(sst)
-        , _smr(sst->read_range_rows(std::move(s), pr, pc)) {
+        , _smr(sst->read_range_rows(std::move(s), pr, pc, use_chunk_cache)) {
     }
     virtual future<mutation_opt> operator()() override {
         return _smr.read();
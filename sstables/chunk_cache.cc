@@ -0,0 +1,193 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <seastar/core/scollectd.hh>
+
+#include "chunk_cache.hh"
+
+namespace sstables {
+
+chunk_cache_entry::chunk_cache_entry(chunk_cache_entry&& o) noexcept
+    : _file_id(o._file_id)
+    , _offset(o._offset)
+    , _data(std::move(o._data))
+    , _lru_link()
+    , _cache_link()
+{
+    {
+        auto prev = o._lru_link.prev_;
+        o._lru_link.unlink();
+        chunk_cache::lru_type::node_algorithms::link_after(prev, _lru_link.this_ptr());
+    }
+
+    {
+        using container_type = chunk_cache::chunks_type;
+        container_type::node_algorithms::replace_node(o._cache_link.this_ptr(), _cache_link.this_ptr());
+        container_type::node_algorithms::init(o._cache_link.this_ptr());
+    }
+}
+
+chunk_cache& global_chunk_cache() {
+    static thread_local chunk_cache instance(global_cache_tracker());
+    return instance;
+}
+
+chunk_cache::chunk_cache(cache_tracker& tracker)
+    : _tracker(tracker)
+{
+    _tracker.add_tracked_cache(*this);
+    setup_collectd();
+}
+
+chunk_cache::~chunk_cache() {
+    clear();
+    _tracker.remove_tracked_cache(*this);
+}
+
+void chunk_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.bytes)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "total")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _max_size; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "insertions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.insertions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("chunk_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "chunks")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.entries)
+        ),
+    }));
+}
+
+std::experimental::optional<temporary_buffer<char>> chunk_cache::get(uint64_t file_id, uint64_t offset) {
+    if (!_max_size) {
+        return {};
+    }
+    // Copying the chunk out allocates, which must not move it under our feet.
+    logalloc::reclaim_lock rl(_tracker.region());
+    auto i = _chunks.find(chunk_cache_entry::compare::key_type(file_id, offset), chunk_cache_entry::compare());
+    if (i == _chunks.end()) {
+        ++_stats.misses;
+        return {};
+    }
+    ++_stats.hits;
+    _lru.erase(_lru.iterator_to(*i));
+    _lru.push_front(*i);
+    return with_linearized_managed_bytes([&] {
+        bytes_view data = i->_data;
+        return temporary_buffer<char>(reinterpret_cast<const char*>(data.data()), data.size());
+    });
+}
+
+void chunk_cache::put(uint64_t file_id, uint64_t offset, const temporary_buffer<char>& data) {
+    if (data.size() > _max_size) {
+        return;
+    }
+    bytes_view v(reinterpret_cast<const bytes_view::value_type*>(data.get()), data.size());
+    with_allocator(_tracker.allocator(), [&] {
+        _insert_section(_tracker.region(), [&] {
+            auto key = chunk_cache_entry::compare::key_type(file_id, offset);
+            auto i = _chunks.lower_bound(key, chunk_cache_entry::compare());
+            if (i != _chunks.end() && chunk_cache_entry::compare::key(*i) == key) {
+                // Another reader missed on the same chunk concurrently.
+                return;
+            }
+            auto entry = current_allocator().construct<chunk_cache_entry>(file_id, offset, v);
+            _chunks.insert(i, *entry);
+            _lru.push_front(*entry);
+            ++_stats.insertions;
+            ++_stats.entries;
+            _stats.bytes += data.size();
+        });
+        while (_stats.bytes > _max_size) {
+            evict();
+        }
+    });
+}
+
+void chunk_cache::erase(chunk_cache_entry& e) noexcept {
+    --_stats.entries;
+    _stats.bytes -= e._data.size();
+    // Unlinks the entry from both _chunks and _lru.
+    current_deleter<chunk_cache_entry>()(&e);
+}
+
+void chunk_cache::invalidate(uint64_t file_id) {
+    with_allocator(_tracker.allocator(), [&] {
+        auto i = _chunks.lower_bound(chunk_cache_entry::compare::key_type(file_id, 0), chunk_cache_entry::compare());
+        while (i != _chunks.end() && i->_file_id == file_id) {
+            erase(*i++);
+        }
+    });
+}
+
+void chunk_cache::clear() {
+    with_allocator(_tracker.allocator(), [&] {
+        while (!_lru.empty()) {
+            erase(_lru.back());
+        }
+    });
+}
+
+void chunk_cache::set_max_size(size_t size) {
+    _max_size = size;
+    with_allocator(_tracker.allocator(), [&] {
+        while (_stats.bytes > _max_size) {
+            evict();
+        }
+    });
+}
+
+memory::reclaiming_result chunk_cache::evict() noexcept {
+    if (_lru.empty()) {
+        return memory::reclaiming_result::reclaimed_nothing;
+    }
+    erase(_lru.back());
+    ++_stats.evictions;
+    return memory::reclaiming_result::reclaimed_something;
+}
+
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <experimental/optional>
+
+#include "core/temporary_buffer.hh"
+#include "row_cache.hh"
+#include "utils/managed_bytes.hh"
+#include "utils/logalloc.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace sstables {
+
+// An uncompressed chunk of a compressed data file, kept in LSA memory.
+class chunk_cache_entry {
+    using lru_link_type = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
+    using cache_link_type = bi::set_member_hook<bi::link_mode<bi::auto_unlink>>;
+
+    uint64_t _file_id;
+    uint64_t _offset;
+    managed_bytes _data;
+    lru_link_type _lru_link;
+    cache_link_type _cache_link;
+    friend class chunk_cache;
+public:
+    chunk_cache_entry(uint64_t file_id, uint64_t offset, bytes_view data)
+        : _file_id(file_id)
+        , _offset(offset)
+        , _data(data)
+    { }
+    chunk_cache_entry(chunk_cache_entry&&) noexcept;
+
+    struct compare {
+        using key_type = std::pair<uint64_t, uint64_t>;
+        static key_type key(const chunk_cache_entry& e) {
+            return { e._file_id, e._offset };
+        }
+        bool operator()(const chunk_cache_entry& a, const chunk_cache_entry& b) const {
+            return key(a) < key(b);
+        }
+        bool operator()(const key_type& a, const chunk_cache_entry& b) const {
+            return a < key(b);
+        }
+        bool operator()(const chunk_cache_entry& a, const key_type& b) const {
+            return key(a) < b;
+        }
+    };
+};
+
+// Per-shard cache of uncompressed chunks of compressed sstables, which
+// spares reads of hot data the decompression (and, when the whole range is
+// cached, the disk read). Chunks are keyed by the cache id of the sstable
+// and the chunk's offset in the compressed file.
+//
+// The cache has a budget of its own, and lives in the region of the global
+// cache_tracker, which evicts chunks before partitions when memory is needed.
+class chunk_cache final : public tracked_cache {
+public:
+    using lru_type = bi::list<chunk_cache_entry,
+        bi::member_hook<chunk_cache_entry, chunk_cache_entry::lru_link_type, &chunk_cache_entry::_lru_link>,
+        bi::constant_time_size<false>>;
+    using chunks_type = bi::set<chunk_cache_entry,
+        bi::member_hook<chunk_cache_entry, chunk_cache_entry::cache_link_type, &chunk_cache_entry::_cache_link>,
+        bi::constant_time_size<false>,
+        bi::compare<chunk_cache_entry::compare>>;
+
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+private:
+    cache_tracker& _tracker;
+    chunks_type _chunks;
+    lru_type _lru;
+    size_t _max_size = 0;
+    stats _stats;
+    logalloc::allocating_section _insert_section;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+private:
+    void setup_collectd();
+    void erase(chunk_cache_entry&) noexcept;
+public:
+    explicit chunk_cache(cache_tracker&);
+    ~chunk_cache();
+
+    // Returns a copy of the given chunk, if it is cached.
+    std::experimental::optional<temporary_buffer<char>> get(uint64_t file_id, uint64_t offset);
+    void put(uint64_t file_id, uint64_t offset, const temporary_buffer<char>& data);
+    // Drops the chunks of a file which is no longer read.
+    void invalidate(uint64_t file_id);
+    void clear();
+
+    // Maximum memory used for chunks; 0 disables the cache.
+    void set_max_size(size_t size);
+    size_t max_size() const {
+        return _max_size;
+    }
+    const stats& get_stats() const {
+        return _stats;
+    }
+
+    virtual memory::reclaiming_result evict() noexcept override;
+};
+
+// Returns a reference to shard-wide chunk_cache.
+chunk_cache& global_chunk_cache();
+
+}
@@ -39,6 +39,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <functional>
 #include <utility>
 #include <assert.h>
@@ -70,14 +71,29 @@ logging::logger logger("compaction");
 
 class sstable_reader final : public ::mutation_reader::impl {
     shared_sstable _sst;
-    mutation_reader _reader;
+    std::experimental::optional<mutation_reader> _reader;
 public:
     sstable_reader(shared_sstable sst, schema_ptr schema)
             : _sst(std::move(sst))
-            , _reader(_sst->read_rows(schema, service::get_local_compaction_priority()))
+            , _reader(_sst->read_rows(schema, service::get_local_compaction_priority(), false))
+            {}
+    sstable_reader(shared_sstable sst, schema_ptr schema, const query::partition_range& pr)
+            : _sst(std::move(sst))
+            , _reader(_sst->read_range_rows(schema, pr, service::get_local_compaction_priority(), false))
             {}
     virtual future<mutation_opt> operator()() override {
-        return _reader.read();
+        if (!_reader) {
+            return make_ready_future<mutation_opt>();
+        }
+        return _reader->read().then([this] (mutation_opt m) {
+            if (!m) {
+                // Let go of an exhausted sstable, so that it can be deleted
+                // as soon as compaction releases it.
+                _reader = std::experimental::nullopt;
+                _sst = {};
+            }
+            return std::move(m);
+        });
     }
 };
 
@@ -86,13 +102,65 @@ static api::timestamp_type get_max_purgeable_timestamp(schema_ptr schema,
 {
     auto timestamp = api::max_timestamp;
     for (auto&& sst : not_compacted_sstables) {
-        if (sst->filter_has_key(*schema, dk.key())) {
+        if (sst->filter_has_key(*schema, dk)) {
             timestamp = std::min(timestamp, sst->get_stats_metadata().min_timestamp);
         }
     }
     return timestamp;
 }
 
+// Return the subset of compacting sstables which only contain data that
+// can be purged: every cell, marker and tombstone in them expired before
+// gc_before, and nothing in them is newer than any other sstable.
+// Compacting such sstables on their own writes no output at all.
+static std::vector<shared_sstable> get_fully_expired_sstables(column_family& cf,
+        const std::vector<shared_sstable>& compacting, gc_clock::time_point gc_before) {
+    auto gc_before_count = gc_before.time_since_epoch().count();
+    auto is_expired = [gc_before_count] (const shared_sstable& sst) {
+        return int64_t(sst->get_stats_metadata().max_local_deletion_time) < gc_before_count;
+    };
+
+    std::vector<shared_sstable> candidates;
+    for (auto&& sst : compacting) {
+        if (is_expired(sst)) {
+            candidates.push_back(sst);
+        }
+    }
+    if (candidates.empty()) {
+        return candidates;
+    }
+
+    // A candidate may only be dropped if none of its tombstones can shadow
+    // data that survives, so its newest write must be older than the oldest
+    // write of every sstable which is not itself a candidate.
+    // As with get_max_purgeable_timestamp(), memtables aren't taken into account.
+    // FIXME: restrict this to sstables whose token range overlaps the candidate.
+    auto is_candidate = [&candidates] (const shared_sstable& sst) {
+        return std::any_of(candidates.begin(), candidates.end(), [&sst] (const shared_sstable& candidate) {
+            return candidate->generation() == sst->generation();
+        });
+    };
+    auto min_timestamp = api::max_timestamp;
+    for (auto&& sst : *cf.get_sstables() | boost::adaptors::map_values) {
+        if (!is_candidate(sst)) {
+            min_timestamp = std::min(min_timestamp, sst->get_stats_metadata().min_timestamp);
+        }
+    }
+    for (auto&& sst : compacting) {
+        if (!is_candidate(sst)) {
+            min_timestamp = std::min(min_timestamp, sst->get_stats_metadata().min_timestamp);
+        }
+    }
+
+    std::vector<shared_sstable> expired;
+    for (auto&& sst : candidates) {
+        if (sst->get_stats_metadata().max_timestamp < min_timestamp) {
+            expired.push_back(sst);
+        }
+    }
+    return expired;
+}
+
 static bool belongs_to_current_node(const dht::token& t, const std::vector<range<dht::token>>& sorted_owned_ranges) {
     auto low = std::lower_bound(sorted_owned_ranges.begin(), sorted_owned_ranges.end(), t,
             [] (const range<dht::token>& a, const dht::token& b) {
@@ -118,117 +186,226 @@ static void delete_sstables_for_interrupted_compaction(std::vector<shared_sstabl
     }
 }
 
-// compact_sstables compacts the given list of sstables creating one
-// (currently) or more (in the future) new sstables. The new sstables
-// are created using the "sstable_creator" object passed by the caller.
-future<std::vector<shared_sstable>>
-compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::function<shared_sstable()> creator,
-                 uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup) {
-    std::vector<::mutation_reader> readers;
-    uint64_t estimated_partitions = 0;
-    auto ancestors = make_lw_shared<std::vector<unsigned long>>();
-    auto info = make_lw_shared<compaction_info>();
-    auto& cm = cf.get_compaction_manager();
-    sstring sstable_logger_msg = "[";
+// Tracks how far each sub-range of an incremental compaction has sealed
+// its output. Once the sealed output sstables cover all the data of some
+// input sstables, the caller is asked to replace those inputs with the
+// output sealed so far.
+class compaction_progress {
+    struct input {
+        // Disengaged once the sstable was released.
+        shared_sstable sst;
+        dht::decorated_key last;
+        // Indexes of the sub-ranges which the sstable overlaps.
+        std::vector<unsigned> sub_ranges;
+    };
+    struct sub_range_progress {
+        std::experimental::optional<dht::decorated_key> sealed_up_to;
+        bool done = false;
+    };
+    schema_ptr _schema;
+    compaction_release_fn _release;
+    std::vector<input> _inputs;
+    std::vector<sub_range_progress> _sub_ranges;
+    std::vector<shared_sstable> _unpublished;
+private:
+    bool covered(const input& in) const {
+        return std::all_of(in.sub_ranges.begin(), in.sub_ranges.end(), [this, &in] (unsigned i) {
+            auto& p = _sub_ranges[i];
+            return p.done || (p.sealed_up_to && !p.sealed_up_to->less_compare(*_schema, in.last));
+        });
+    }
 
-    info->type = (cleanup) ? compaction_type::Cleanup : compaction_type::Compaction;
-    // register compaction_stats of starting compaction into compaction manager
-    cm.register_compaction(info);
+    void maybe_release() {
+        std::vector<shared_sstable> exhausted;
+        for (auto& in : _inputs) {
+            if (in.sst && covered(in)) {
+                exhausted.push_back(std::move(in.sst));
+                in.sst = {};
+            }
+        }
+        if (exhausted.empty()) {
+            return;
+        }
+        logger.debug("Releasing {} compacted sstables, replaced by {} sealed sstables", exhausted.size(), _unpublished.size());
+        _release(_unpublished, exhausted);
+        _unpublished.clear();
+    }
+public:
+    compaction_progress(schema_ptr s, const std::vector<shared_sstable>& sstables,
+            const std::vector<query::partition_range>& sub_ranges, compaction_release_fn release)
+        : _schema(std::move(s))
+        , _release(std::move(release))
+        , _sub_ranges(sub_ranges.size())
+    {
+        for (auto& sst : sstables) {
+            auto r = query::partition_range::make(dht::ring_position(sst->get_first_decorated_key(*_schema)),
+                dht::ring_position(sst->get_last_decorated_key(*_schema)));
+            std::vector<unsigned> overlapping;
+            for (unsigned i = 0; i < sub_ranges.size(); ++i) {
+                if (r.overlaps(sub_ranges[i], dht::ring_position_comparator(*_schema))) {
+                    overlapping.push_back(i);
+                }
+            }
+            _inputs.push_back(input{sst, sst->get_last_decorated_key(*_schema), std::move(overlapping)});
+        }
+    }
 
-    assert(sstables.size() > 0);
+    // Returns the highest timestamp of tombstones for the key which can be
+    // purged without resurrecting data in inputs which may outlive the output
+    // holding the key: inputs extending beyond the key or into other sub-ranges.
+    api::timestamp_type max_purgeable(const dht::decorated_key& dk) const {
+        auto timestamp = api::max_timestamp;
+        for (auto& in : _inputs) {
+            if (in.sst && (in.sub_ranges.size() > 1 || dk.less_compare(*_schema, in.last))
+                    && in.sst->filter_has_key(*_schema, dk)) {
+                timestamp = std::min(timestamp, in.sst->get_stats_metadata().min_timestamp);
+            }
+        }
+        return timestamp;
+    }
 
-    db::replay_position rp;
+    void on_sealed(unsigned sub_range, shared_sstable sst) {
+        _sub_ranges[sub_range].sealed_up_to = sst->get_last_decorated_key(*_schema);
+        _unpublished.push_back(std::move(sst));
+        maybe_release();
+    }
 
-    auto all_sstables = cf.get_sstables();
-    std::sort(sstables.begin(), sstables.end(), [] (const shared_sstable& x, const shared_sstable& y) {
-        return x->generation() < y->generation();
-    });
-    std::vector<shared_sstable> not_compacted_sstables;
-    boost::set_difference(*all_sstables | boost::adaptors::map_values, sstables,
-        std::back_inserter(not_compacted_sstables), [] (const shared_sstable& x, const shared_sstable& y) {
-            return x->generation() < y->generation();
-        });
+    void on_done(unsigned sub_range) {
+        _sub_ranges[sub_range].done = true;
+    }
 
-    auto schema = cf.schema();
-    for (auto sst : sstables) {
-        // We also capture the sstable, so we keep it alive while the read isn't done
-        readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema));
-        // FIXME: If the sstables have cardinality estimation bitmaps, use that
-        // for a better estimate for the number of partitions in the merged
-        // sstable than just adding up the lengths of individual sstables.
-        estimated_partitions += sst->get_estimated_key_count();
-        info->total_partitions += sst->get_estimated_key_count();
-        // Compacted sstable keeps track of its ancestors.
-        ancestors->push_back(sst->generation());
-        sstable_logger_msg += sprint("%s:level=%d, ", sst->get_filename(), sst->get_sstable_level());
-        info->start_size += sst->data_size();
-        // TODO:
-        // Note that this is not fully correct. Since we might be merging sstables that originated on
-        // another shard (#cpu changed), we might be comparing RP:s with differing shard ids,
-        // which might vary in "comparable" size quite a bit. However, since the worst that happens
-        // is that we might miss a high water mark for the commit log replayer,
-        // this is kind of ok, esp. since we will hopefully not be trying to recover based on
-        // compacted sstables anyway (CL should be clean by then).
-        rp = std::max(rp, sst->get_stats_metadata().position);
+    // Output sstables which haven't been handed over to the caller yet.
+    const std::vector<shared_sstable>& unpublished() const {
+        return _unpublished;
     }
+};
 
-    uint64_t estimated_sstables = std::max(1UL, uint64_t(ceil(double(info->start_size) / max_sstable_size)));
-    uint64_t partitions_per_sstable = ceil(double(estimated_partitions) / estimated_sstables);
+class compacting_reader final : public ::mutation_reader::impl {
+private:
+    schema_ptr _schema;
+    ::mutation_reader _reader;
+    std::vector<shared_sstable> _not_compacted_sstables;
+    gc_clock::time_point _now;
+    std::vector<range<dht::token>> _sorted_owned_ranges;
+    bool _cleanup;
+    lw_shared_ptr<compaction_progress> _progress;
+public:
+    compacting_reader(schema_ptr schema, std::vector<::mutation_reader> readers, std::vector<shared_sstable> not_compacted_sstables,
+            std::vector<range<dht::token>> sorted_owned_ranges, bool cleanup, lw_shared_ptr<compaction_progress> progress)
+        : _schema(std::move(schema))
+        , _reader(make_combined_reader(std::move(readers)))
+        , _not_compacted_sstables(std::move(not_compacted_sstables))
+        , _now(gc_clock::now())
+        , _sorted_owned_ranges(std::move(sorted_owned_ranges))
+        , _cleanup(cleanup)
+        , _progress(std::move(progress))
+    { }
 
-    sstable_logger_msg += "]";
-    info->sstables = sstables.size();
-    info->ks = schema->ks_name();
-    info->cf = schema->cf_name();
-    logger.info("{} {}", (!cleanup) ? "Compacting" : "Cleaning", sstable_logger_msg);
-
-    class compacting_reader final : public ::mutation_reader::impl {
-    private:
-        schema_ptr _schema;
-        ::mutation_reader _reader;
-        std::vector<shared_sstable> _not_compacted_sstables;
-        gc_clock::time_point _now;
-        std::vector<range<dht::token>> _sorted_owned_ranges;
-        bool _cleanup;
-    public:
-        compacting_reader(schema_ptr schema, std::vector<::mutation_reader> readers, std::vector<shared_sstable> not_compacted_sstables,
-                std::vector<range<dht::token>> sorted_owned_ranges, bool cleanup)
-            : _schema(std::move(schema))
-            , _reader(make_combined_reader(std::move(readers)))
-            , _not_compacted_sstables(std::move(not_compacted_sstables))
-            , _now(gc_clock::now())
-            , _sorted_owned_ranges(std::move(sorted_owned_ranges))
-            , _cleanup(cleanup)
-        { }
-
-        virtual future<mutation_opt> operator()() override {
-            return _reader().then([this] (mutation_opt m) {
-                if (!bool(m)) {
-                    return make_ready_future<mutation_opt>(std::move(m));
-                }
-                // Filter out mutation that doesn't belong to current shard.
-                if (dht::shard_of(m->token()) != engine().cpu_id()) {
-                    return operator()();
-                }
-                if (_cleanup && !belongs_to_current_node(m->token(), _sorted_owned_ranges)) {
-                    return operator()();
-                }
-                auto max_purgeable = get_max_purgeable_timestamp(_schema, _not_compacted_sstables, m->decorated_key());
-                m->partition().compact_for_compaction(*_schema, max_purgeable, _now);
-                if (!m->partition().empty()) {
-                    return make_ready_future<mutation_opt>(std::move(m));
-                }
+    virtual future<mutation_opt> operator()() override {
+        return _reader().then([this] (mutation_opt m) {
+            if (!bool(m)) {
+                return make_ready_future<mutation_opt>(std::move(m));
+            }
+            // Filter out mutation that doesn't belong to current shard.
+            if (dht::shard_of(m->token()) != engine().cpu_id()) {
                 return operator()();
-            });
+            }
+            if (_cleanup && !belongs_to_current_node(m->token(), _sorted_owned_ranges)) {
+                return operator()();
+            }
+            auto max_purgeable = get_max_purgeable_timestamp(_schema, _not_compacted_sstables, m->decorated_key());
+            if (_progress) {
+                max_purgeable = std::min(max_purgeable, _progress->max_purgeable(m->decorated_key()));
+            }
+            m->partition().compact_for_compaction(*_schema, max_purgeable, _now);
+            if (!m->partition().empty()) {
+                return make_ready_future<mutation_opt>(std::move(m));
+            }
+            return operator()();
+        });
+    }
+};
+
+struct queue_reader final : public ::mutation_reader::impl {
+    lw_shared_ptr<seastar::pipe_reader<mutation>> pr;
+    queue_reader(lw_shared_ptr<seastar::pipe_reader<mutation>> pr) : pr(std::move(pr)) {}
+    virtual future<mutation_opt> operator()() override {
+        return pr->read().then([] (std::experimental::optional<mutation> m) mutable {
+            return make_ready_future<mutation_opt>(std::move(m));
+        });
+    }
+};
+
+// Inputs of compaction at least twice the column family's
+// compaction_sub_range_size are split into sub-ranges which are compacted
+// concurrently, each sub-range writing its own sstables.
+static constexpr unsigned max_compaction_sub_ranges = 8;
+
+std::vector<query::partition_range>
+get_compaction_sub_ranges(const schema& s, const std::vector<shared_sstable>& sstables, unsigned count) {
+    if (count <= 1) {
+        return { query::partition_range::make_open_ended_both_sides() };
+    }
+
+    auto first = sstables.front()->get_first_decorated_key(s).token();
+    auto last = sstables.front()->get_last_decorated_key(s).token();
+    for (auto& sst : sstables) {
+        first = std::min(first, sst->get_first_decorated_key(s).token());
+        last = std::max(last, sst->get_last_decorated_key(s).token());
+    }
+
+    if (first == last) {
+        return { query::partition_range::make_open_ended_both_sides() };
+    }
+
+    // Halve the sub-ranges as long as that doesn't make more than count.
+    std::vector<dht::token> bounds = { first, last };
+    while ((bounds.size() - 1) * 2 <= count) {
+        std::vector<dht::token> split;
+        for (auto it = bounds.begin(); std::next(it) != bounds.end(); ++it) {
+            split.push_back(*it);
+            split.push_back(dht::global_partitioner().midpoint(*it, *std::next(it)));
         }
-    };
-    std::vector<range<dht::token>> owned_ranges;
-    if (cleanup) {
-        owned_ranges = service::get_local_storage_service().get_local_ranges(schema->ks_name());
+        split.push_back(bounds.back());
+        bounds = std::move(split);
+    }
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    if (bounds.size() < 3) {
+        return { query::partition_range::make_open_ended_both_sides() };
     }
-    auto reader = make_mutation_reader<compacting_reader>(schema, std::move(readers), std::move(not_compacted_sstables),
-        std::move(owned_ranges), cleanup);
 
-    auto start_time = db_clock::now();
+    // The first and last sub-ranges are open ended, the inner bounds are
+    // the positions before all keys of a token.
+    std::vector<query::partition_range> ranges;
+    std::experimental::optional<query::partition_range::bound> start;
+    for (auto it = std::next(bounds.begin()); std::next(it) != bounds.end(); ++it) {
+        query::partition_range::bound end(dht::ring_position::starting_at(*it), false);
+        ranges.emplace_back(start, end);
+        start = query::partition_range::bound(dht::ring_position::starting_at(*it), true);
+    }
+    ranges.emplace_back(start, std::experimental::nullopt);
+    return ranges;
+}
+
+// Compacts the part of the sstables which falls into the given partition
+// range, writing one or more sstables of at most max_sstable_size.
+static future<> compact_sstables_in_range(const std::vector<shared_sstable>& sstables, schema_ptr schema,
+        std::experimental::optional<query::partition_range> pr, std::vector<shared_sstable> not_compacted_sstables,
+        std::vector<range<dht::token>> owned_ranges, bool cleanup, std::function<shared_sstable()> creator,
+        lw_shared_ptr<std::vector<unsigned long>> ancestors, db::replay_position rp, uint64_t max_sstable_size,
+        uint32_t sstable_level, uint64_t partitions_per_sstable, bool backup, lw_shared_ptr<compaction_info> info,
+        lw_shared_ptr<compaction_progress> progress, unsigned sub_range) {
+    std::vector<::mutation_reader> readers;
+    for (auto sst : sstables) {
+        // We also capture the sstable, so we keep it alive while the read isn't done
+        if (pr) {
+            readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema, *pr));
+        } else {
+            readers.emplace_back(make_mutation_reader<sstable_reader>(sst, schema));
+        }
+    }
+    auto reader = make_mutation_reader<compacting_reader>(schema, std::move(readers), std::move(not_compacted_sstables),
+        std::move(owned_ranges), cleanup, progress);
 
     // We use a fixed-sized pipe between the producer fiber (which reads the
     // individual sstables and merges them) and the consumer fiber (which
@@ -260,22 +437,11 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         });
     }).then([output_writer] {});
 
-    struct queue_reader final : public ::mutation_reader::impl {
-        lw_shared_ptr<seastar::pipe_reader<mutation>> pr;
-        queue_reader(lw_shared_ptr<seastar::pipe_reader<mutation>> pr) : pr(std::move(pr)) {}
-        virtual future<mutation_opt> operator()() override {
-            return pr->read().then([] (std::experimental::optional<mutation> m) mutable {
-                return make_ready_future<mutation_opt>(std::move(m));
-            });
-        }
-    };
-
-    bool backup = cf.incremental_backups_enabled();
     // If there is a maximum size for a sstable, it's possible that more than
     // one sstable will be generated for all partitions to be written.
-    future<> write_done = repeat([creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, info, partitions_per_sstable, schema, backup] {
+    future<> write_done = repeat([creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, info, partitions_per_sstable, schema, backup, progress, sub_range] {
         return output_reader->read().then(
-                [creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, info, partitions_per_sstable, schema, backup] (auto mut) {
+                [creator, ancestors, rp, max_sstable_size, sstable_level, output_reader, info, partitions_per_sstable, schema, backup, progress, sub_range] (auto mut) {
             // Check if mutation is available from the pipe for a new sstable to be written. If not, just stop writing.
             if (!mut) {
                 return make_ready_future<stop_iteration>(stop_iteration::yes);
@@ -294,9 +460,12 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
             ::mutation_reader mutation_queue_reader = make_mutation_reader<queue_reader>(output_reader);
 
             auto&& priority = service::get_local_compaction_priority();
-            return newtab->write_components(std::move(mutation_queue_reader), partitions_per_sstable, schema, max_sstable_size, backup, priority).then([newtab, info] {
-                return newtab->open_data().then([newtab, info] {
+            return newtab->write_components(std::move(mutation_queue_reader), partitions_per_sstable, schema, max_sstable_size, backup, priority).then([newtab, info, progress, sub_range] {
+                return newtab->open_data().then([newtab, info, progress, sub_range] {
                     info->end_size += newtab->data_size();
+                    if (progress) {
+                        progress->on_sealed(sub_range, newtab);
+                    }
                     return make_ready_future<stop_iteration>(stop_iteration::no);
                 });
             });
@@ -304,17 +473,13 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
     }).then([output_reader] {});
 
     // Wait for both read_done and write_done fibers to finish.
-    return when_all(std::move(read_done), std::move(write_done)).then([&cm, info] (std::tuple<future<>, future<>> t) {
-        // deregister compaction_stats of finished compaction from compaction manager.
-        cm.deregister_compaction(info);
-
+    return when_all(std::move(read_done), std::move(write_done)).then([progress, sub_range] (std::tuple<future<>, future<>> t) {
         sstring ex;
         try {
             std::get<0>(t).get();
         } catch(compaction_stop_exception& e) {
 
             std::get<1>(t).ignore_ready_future(); // ignore result of write fiber if compaction was asked to stop.
-            delete_sstables_for_interrupted_compaction(info->new_sstables, info->ks, info->cf);
             throw;
         } catch(...) {
 
@@ -328,8 +493,129 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         }
 
         if (ex.size()) {
-            delete_sstables_for_interrupted_compaction(info->new_sstables, info->ks, info->cf);
+            throw std::runtime_error(ex);
+        }
+        if (progress) {
+            progress->on_done(sub_range);
+        }
+    });
+}
+
+// compact_sstables compacts the given list of sstables creating one
+// or more new sstables. The new sstables are created using the
+// "sstable_creator" object passed by the caller.
+future<std::vector<shared_sstable>>
+compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::function<shared_sstable()> creator,
+                 uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup, compaction_release_fn release) {
+    uint64_t estimated_partitions = 0;
+    auto ancestors = make_lw_shared<std::vector<unsigned long>>();
+    auto info = make_lw_shared<compaction_info>();
+    auto& cm = cf.get_compaction_manager();
+    sstring sstable_logger_msg = "[";
+
+    info->type = (cleanup) ? compaction_type::Cleanup : compaction_type::Compaction;
+    // register compaction_stats of starting compaction into compaction manager
+    cm.register_compaction(info);
+
+    assert(sstables.size() > 0);
+
+    db::replay_position rp;
+
+    auto all_sstables = cf.get_sstables();
+    std::sort(sstables.begin(), sstables.end(), [] (const shared_sstable& x, const shared_sstable& y) {
+        return x->generation() < y->generation();
+    });
+    std::vector<shared_sstable> not_compacted_sstables;
+    boost::set_difference(*all_sstables | boost::adaptors::map_values, sstables,
+        std::back_inserter(not_compacted_sstables), [] (const shared_sstable& x, const shared_sstable& y) {
+            return x->generation() < y->generation();
+        });
+
+    auto schema = cf.schema();
+    for (auto sst : sstables) {
+        // FIXME: If the sstables have cardinality estimation bitmaps, use that
+        // for a better estimate for the number of partitions in the merged
+        // sstable than just adding up the lengths of individual sstables.
+        estimated_partitions += sst->get_estimated_key_count();
+        info->total_partitions += sst->get_estimated_key_count();
+        // Compacted sstable keeps track of its ancestors.
+        ancestors->push_back(sst->generation());
+        sstable_logger_msg += sprint("%s:level=%d, ", sst->get_filename(), sst->get_sstable_level());
+        info->start_size += sst->data_size();
+        // TODO:
+        // Note that this is not fully correct. Since we might be merging sstables that originated on
+        // another shard (#cpu changed), we might be comparing RP:s with differing shard ids,
+        // which might vary in "comparable" size quite a bit. However, since the worst that happens
+        // is that we might miss a high water mark for the commit log replayer,
+        // this is kind of ok, esp. since we will hopefully not be trying to recover based on
+        // compacted sstables anyway (CL should be clean by then).
+        rp = std::max(rp, sst->get_stats_metadata().position);
+    }
+
+    auto sub_range_size = cf.compaction_sub_range_size();
+    auto sub_ranges = get_compaction_sub_ranges(*schema, sstables,
+        sub_range_size ? std::min<uint64_t>(max_compaction_sub_ranges, info->start_size / sub_range_size) : 1);
+    uint64_t estimated_sstables = std::max(uint64_t(sub_ranges.size()), uint64_t(ceil(double(info->start_size) / max_sstable_size)));
+    uint64_t partitions_per_sstable = ceil(double(estimated_partitions) / estimated_sstables);
+
+    sstable_logger_msg += "]";
+    info->sstables = sstables.size();
+    info->ks = schema->ks_name();
+    info->cf = schema->cf_name();
+    logger.info("{} {}{}", (!cleanup) ? "Compacting" : "Cleaning", sstable_logger_msg,
+        sub_ranges.size() > 1 ? sprint(" in %d sub-ranges", sub_ranges.size()) : sstring());
+
+    std::vector<range<dht::token>> owned_ranges;
+    if (cleanup) {
+        owned_ranges = service::get_local_storage_service().get_local_ranges(schema->ks_name());
+    }
+
+    auto start_time = db_clock::now();
+
+    lw_shared_ptr<compaction_progress> progress;
+    if (release) {
+        progress = make_lw_shared<compaction_progress>(schema, sstables, sub_ranges, std::move(release));
+    }
+
+    bool backup = cf.incremental_backups_enabled();
+    std::vector<future<>> sub_range_compactions;
+    for (unsigned i = 0; i < sub_ranges.size(); ++i) {
+        // A single sub-range covers everything, so the sstables can be read
+        // sequentially without consulting the index.
+        std::experimental::optional<query::partition_range> pr;
+        if (sub_ranges.size() > 1) {
+            pr = sub_ranges[i];
+        }
+        sub_range_compactions.push_back(compact_sstables_in_range(sstables, schema, std::move(pr), not_compacted_sstables,
+            owned_ranges, cleanup, creator, ancestors, rp, max_sstable_size, sstable_level, partitions_per_sstable, backup, info,
+            progress, i));
+    }
+    // Don't keep the inputs alive past their release.
+    sstables.clear();
+
+    return when_all(sub_range_compactions.begin(), sub_range_compactions.end()).then([&cm, info, progress] (std::vector<future<>> results) {
+        // deregister compaction_stats of finished compaction from compaction manager.
+        cm.deregister_compaction(info);
+
+        std::exception_ptr stop;
+        sstring ex;
+        for (auto& f : results) {
+            try {
+                f.get();
+            } catch (compaction_stop_exception& e) {
+                stop = std::current_exception();
+            } catch (...) {
+                ex += sprint("%s%s", (ex.size() ? ", " : ""), std::current_exception());
+            }
+        }
 
+        if (stop || ex.size()) {
+            // Output sstables which already replaced some inputs must stay.
+            auto new_sstables = progress ? progress->unpublished() : info->new_sstables;
+            delete_sstables_for_interrupted_compaction(new_sstables, info->ks, info->cf);
+            if (stop) {
+                std::rethrow_exception(stop);
+            }
             throw std::runtime_error(ex);
         }
     }).then([start_time, info, cleanup] {
@@ -375,8 +661,12 @@ compact_sstables(std::vector<shared_sstable> sstables, column_family& cf, std::f
         // for example, by adding a reducer method.
         return db::system_keyspace::update_compaction_history(info->ks, info->cf, compacted_at,
                 info->start_size, info->end_size, std::unordered_map<int32_t, int64_t>{});
-    }).then([info] {
-        // Return vector with newly created sstable(s).
+    }).then([info, progress] {
+        // Return vector with newly created sstable(s), leaving out the ones
+        // which were already handed over to release.
+        if (progress) {
+            return progress->unpublished();
+        }
         return std::move(info->new_sstables);
     });
 }
@@ -424,6 +714,30 @@ class major_compaction_strategy : public compaction_strategy_impl {
     }
 };
 
+static std::experimental::optional<sstring> get_value(const std::map<sstring, sstring>& options, const sstring& name) {
+    auto it = options.find(name);
+    if (it == options.end()) {
+        return std::experimental::nullopt;
+    }
+    return it->second;
+}
+
+// All output sstables of a compaction share the same ancestors, and together
+// form a run of non-overlapping sstables. Strategies count a run as a single
+// sstable, so that the fragments written by an incremental compaction don't
+// qualify for being compacted with each other.
+static unsigned count_sstable_runs(const std::vector<shared_sstable>& sstables) {
+    std::set<std::vector<uint32_t>> runs;
+    unsigned count = 0;
+    for (auto& sst : sstables) {
+        auto ancestors = sst->ancestors();
+        if (ancestors.empty() || runs.insert(std::move(ancestors)).second) {
+            count++;
+        }
+    }
+    return count;
+}
+
 class size_tiered_compaction_strategy_options {
     static constexpr uint64_t DEFAULT_MIN_SSTABLE_SIZE = 50L * 1024L * 1024L;
     static constexpr double DEFAULT_BUCKET_LOW = 0.5;
@@ -438,14 +752,6 @@ class size_tiered_compaction_strategy_options {
     double bucket_low = DEFAULT_BUCKET_LOW;
     double bucket_high = DEFAULT_BUCKET_HIGH;
     double cold_reads_to_omit =  DEFAULT_COLD_READS_TO_OMIT;
-
-    static std::experimental::optional<sstring> get_value(const std::map<sstring, sstring>& options, const sstring& name) {
-        auto it = options.find(name);
-        if (it == options.end()) {
-            return std::experimental::nullopt;
-        }
-        return it->second;
-    }
 public:
     size_tiered_compaction_strategy_options(const std::map<sstring, sstring>& options) {
         using namespace cql3::statements;
@@ -517,8 +823,8 @@ class size_tiered_compaction_strategy_options {
 class size_tiered_compaction_strategy : public compaction_strategy_impl {
     size_tiered_compaction_strategy_options _options;
 
-    // Return a list of pair of shared_sstable and its respective size.
-    std::vector<std::pair<sstables::shared_sstable, uint64_t>> create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables);
+    // Return a list of pair of sstable run and its respective size.
+    std::vector<std::pair<std::vector<sstables::shared_sstable>, uint64_t>> create_run_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables);
 
     // Group files of similar size into buckets.
     std::vector<std::vector<sstables::shared_sstable>> get_buckets(const std::vector<sstables::shared_sstable>& sstables, unsigned max_threshold);
@@ -527,7 +833,7 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
     std::vector<sstables::shared_sstable>
     most_interesting_bucket(std::vector<std::vector<sstables::shared_sstable>> buckets, unsigned min_threshold, unsigned max_threshold);
 
-    // Return the average size of a given list of sstables.
+    // Return the average size of the runs in a given list of sstables.
     uint64_t avg_size(std::vector<sstables::shared_sstable>& sstables) {
         assert(sstables.size() > 0); // this should never fail
         uint64_t n = 0;
@@ -537,7 +843,7 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
             n += sstable->data_size();
         }
 
-        return n / sstables.size();
+        return n / count_sstable_runs(sstables);
     }
 public:
     size_tiered_compaction_strategy() = default;
@@ -547,59 +853,74 @@ class size_tiered_compaction_strategy : public compaction_strategy_impl {
     virtual compaction_descriptor get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) override;
 
     friend std::vector<sstables::shared_sstable> size_tiered_most_interesting_bucket(lw_shared_ptr<sstable_list>);
+    friend class time_window_compaction_strategy;
 
     virtual compaction_strategy_type type() const {
         return compaction_strategy_type::size_tiered;
     }
 };
 
-std::vector<std::pair<sstables::shared_sstable, uint64_t>>
-size_tiered_compaction_strategy::create_sstable_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables) {
+std::vector<std::pair<std::vector<sstables::shared_sstable>, uint64_t>>
+size_tiered_compaction_strategy::create_run_and_length_pairs(const std::vector<sstables::shared_sstable>& sstables) {
 
-    std::vector<std::pair<sstables::shared_sstable, uint64_t>> sstable_length_pairs;
-    sstable_length_pairs.reserve(sstables.size());
+    std::vector<std::pair<std::vector<sstables::shared_sstable>, uint64_t>> run_length_pairs;
+    run_length_pairs.reserve(sstables.size());
 
-    for(auto& sstable : sstables) {
+    // sstables belonging to a run are bucketed together, by the size of the whole run.
+    std::map<std::vector<uint32_t>, size_t> run_index;
+    for (auto& sstable : sstables) {
         auto sstable_size = sstable->data_size();
         assert(sstable_size != 0);
-
-        sstable_length_pairs.emplace_back(sstable, sstable_size);
+        auto ancestors = sstable->ancestors();
+        if (ancestors.empty()) {
+            run_length_pairs.emplace_back(std::vector<sstables::shared_sstable>{sstable}, sstable_size);
+            continue;
+        }
+        auto it = run_index.emplace(std::move(ancestors), run_length_pairs.size()).first;
+        if (it->second == run_length_pairs.size()) {
+            run_length_pairs.emplace_back(std::vector<sstables::shared_sstable>(), 0);
+        }
+        auto& run = run_length_pairs[it->second];
+        run.first.push_back(sstable);
+        run.second += sstable_size;
     }
 
-    return sstable_length_pairs;
+    return run_length_pairs;
 }
 
 std::vector<std::vector<sstables::shared_sstable>>
 size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_sstable>& sstables, unsigned max_threshold) {
-    // sstables sorted by size of its data file.
-    auto sorted_sstables = create_sstable_and_length_pairs(sstables);
+    // sstable runs sorted by the size of their data files.
+    auto sorted_runs = create_run_and_length_pairs(sstables);
 
-    std::sort(sorted_sstables.begin(), sorted_sstables.end(), [] (auto& i, auto& j) {
+    std::sort(sorted_runs.begin(), sorted_runs.end(), [] (auto& i, auto& j) {
         return i.second < j.second;
     });
 
-    std::map<size_t, std::vector<sstables::shared_sstable>> buckets;
+    // Each bucket holds the number of runs it was built from, followed by their sstables.
+    std::map<size_t, std::pair<unsigned, std::vector<sstables::shared_sstable>>> buckets;
 
     bool found;
-    for (auto& pair : sorted_sstables) {
+    for (auto& pair : sorted_runs) {
         found = false;
         size_t size = pair.second;
 
-        // look for a bucket containing similar-sized files:
+        // look for a bucket containing similar-sized runs:
         // group in the same bucket if it's w/in 50% of the average for this bucket,
-        // or this file and the bucket are all considered "small" (less than `minSSTableSize`)
+        // or this run and the bucket are all considered "small" (less than `minSSTableSize`)
         for (auto& entry : buckets) {
-            std::vector<sstables::shared_sstable> bucket = entry.second;
+            auto bucket = entry.second;
             size_t old_average_size = entry.first;
 
             if (((size > (old_average_size * _options.bucket_low) && size < (old_average_size * _options.bucket_high))
                 || (size < _options.min_sstable_size && old_average_size < _options.min_sstable_size))
-                && (bucket.size() < max_threshold))
+                && (bucket.first < max_threshold))
             {
-                size_t total_size = bucket.size() * old_average_size;
-                size_t new_average_size = (total_size + size) / (bucket.size() + 1);
+                size_t total_size = bucket.first * old_average_size;
+                size_t new_average_size = (total_size + size) / (bucket.first + 1);
 
-                bucket.push_back(pair.first);
+                bucket.first++;
+                boost::copy(pair.first, std::back_inserter(bucket.second));
                 buckets.erase(old_average_size);
                 buckets.insert({ new_average_size, std::move(bucket) });
 
@@ -610,9 +931,7 @@ size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_
 
         // no similar bucket found; put it in a new one
         if (!found) {
-            std::vector<sstables::shared_sstable> new_bucket;
-            new_bucket.push_back(pair.first);
-            buckets.insert({ size, std::move(new_bucket) });
+            buckets.insert({ size, { 1, std::move(pair.first) } });
         }
     }
 
@@ -620,7 +939,7 @@ size_tiered_compaction_strategy::get_buckets(const std::vector<sstables::shared_
     bucket_list.reserve(buckets.size());
 
     for (auto& entry : buckets) {
-        bucket_list.push_back(std::move(entry.second));
+        bucket_list.push_back(std::move(entry.second.second));
     }
 
     return bucket_list;
@@ -639,7 +958,8 @@ size_tiered_compaction_strategy::most_interesting_bucket(std::vector<std::vector
         // FIXME: the coldest sstables will be trimmed to meet the threshold, so we must add support to this feature
         // by converting SizeTieredCompactionStrategy::trimToThresholdWithHotness.
         // By the time being, we will only compact buckets that meet the threshold.
-        if (bucket.size() >= min_threshold && bucket.size() <= max_threshold) {
+        auto runs = count_sstable_runs(bucket);
+        if (runs >= min_threshold && runs <= max_threshold) {
             auto avg = avg_size(bucket);
             pruned_buckets_and_hotness.push_back({ std::move(bucket), avg });
         }
@@ -698,6 +1018,157 @@ std::vector<sstables::shared_sstable> size_tiered_most_interesting_bucket(lw_sha
     return most_interesting;
 }
 
+class time_window_compaction_strategy_options {
+    static constexpr long DEFAULT_COMPACTION_WINDOW_SIZE = 1;
+    const sstring COMPACTION_WINDOW_UNIT_KEY = "compaction_window_unit";
+    const sstring COMPACTION_WINDOW_SIZE_KEY = "compaction_window_size";
+    const sstring TIMESTAMP_RESOLUTION_KEY = "timestamp_resolution";
+
+    // Width of a time window, in microseconds since the epoch.
+    api::timestamp_type window_size = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::hours(24)).count();
+    // Multiplier converting client supplied timestamps to microseconds.
+    api::timestamp_type timestamp_multiplier = 1;
+
+    static std::chrono::microseconds window_unit(const sstring& unit) {
+        if (unit == "MINUTES") {
+            return std::chrono::minutes(1);
+        } else if (unit == "HOURS") {
+            return std::chrono::hours(1);
+        } else if (unit == "DAYS") {
+            return std::chrono::hours(24);
+        }
+        throw exceptions::configuration_exception(sprint("Invalid compaction_window_unit '%s', expected MINUTES, HOURS or DAYS", unit));
+    }
+
+    static api::timestamp_type multiplier_of(const sstring& resolution) {
+        if (resolution == "MICROSECONDS") {
+            return 1;
+        } else if (resolution == "MILLISECONDS") {
+            return 1000;
+        } else if (resolution == "SECONDS") {
+            return 1000 * 1000;
+        }
+        throw exceptions::configuration_exception(sprint("Invalid timestamp_resolution '%s', expected MICROSECONDS, MILLISECONDS or SECONDS", resolution));
+    }
+public:
+    time_window_compaction_strategy_options(const std::map<sstring, sstring>& options) {
+        using namespace cql3::statements;
+
+        auto tmp_value = get_value(options, COMPACTION_WINDOW_UNIT_KEY);
+        auto unit = window_unit(tmp_value ? *tmp_value : "DAYS");
+
+        tmp_value = get_value(options, COMPACTION_WINDOW_SIZE_KEY);
+        auto size = property_definitions::to_long(COMPACTION_WINDOW_SIZE_KEY, tmp_value, DEFAULT_COMPACTION_WINDOW_SIZE);
+        if (size <= 0) {
+            throw exceptions::configuration_exception(sprint("%s value (%d) must be greater than 0", COMPACTION_WINDOW_SIZE_KEY, size));
+        }
+        window_size = unit.count() * size;
+
+        tmp_value = get_value(options, TIMESTAMP_RESOLUTION_KEY);
+        timestamp_multiplier = multiplier_of(tmp_value ? *tmp_value : "MICROSECONDS");
+    }
+
+    time_window_compaction_strategy_options() = default;
+
+    friend class time_window_compaction_strategy;
+};
+
+//
+// Time window compaction strategy is meant for time series data.
+// sstables are grouped into windows of fixed width according to the newest
+// write they contain, and sstables are only ever compacted with others of
+// the same window. Older windows are compacted down to a single sstable, the
+// newest window (the one still receiving writes) is compacted size-tiered.
+// sstables whose data is entirely expired are compacted on their own first,
+// which drops them without writing anything out.
+//
+class time_window_compaction_strategy : public compaction_strategy_impl {
+    time_window_compaction_strategy_options _options;
+    size_tiered_compaction_strategy _stcs;
+public:
+    time_window_compaction_strategy() = default;
+    time_window_compaction_strategy(const std::map<sstring, sstring>& options)
+        : _options(options) {}
+
+    virtual compaction_descriptor get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) override;
+
+    // Return the lower bound of the window the given timestamp belongs to.
+    api::timestamp_type get_window_lower_bound(api::timestamp_type timestamp) const {
+        auto ts = timestamp * _options.timestamp_multiplier;
+        auto lower_bound = ts - ts % _options.window_size;
+        if (ts < 0 && lower_bound != ts) {
+            lower_bound -= _options.window_size;
+        }
+        return lower_bound;
+    }
+
+    // Group sstables by the window of their max timestamp, newest window first.
+    std::map<api::timestamp_type, std::vector<sstables::shared_sstable>, std::greater<api::timestamp_type>>
+    get_buckets(const std::vector<sstables::shared_sstable>& sstables) const {
+        std::map<api::timestamp_type, std::vector<sstables::shared_sstable>, std::greater<api::timestamp_type>> buckets;
+        for (auto& sst : sstables) {
+            buckets[get_window_lower_bound(sst->get_stats_metadata().max_timestamp)].push_back(sst);
+        }
+        return buckets;
+    }
+
+    virtual compaction_strategy_type type() const {
+        return compaction_strategy_type::time_window;
+    }
+};
+
+compaction_descriptor time_window_compaction_strategy::get_sstables_for_compaction(column_family& cfs, std::vector<sstables::shared_sstable> candidates) {
+    int min_threshold = cfs.schema()->min_compaction_threshold();
+    int max_threshold = cfs.schema()->max_compaction_threshold();
+
+    auto expired = get_fully_expired_sstables(cfs, candidates, gc_clock::now() - cfs.schema()->gc_grace_seconds());
+    if (!expired.empty()) {
+        logger.debug("time_window: Dropping {} fully expired sstables", expired.size());
+        return sstables::compaction_descriptor(std::move(expired));
+    }
+
+    auto buckets = get_buckets(candidates);
+    if (buckets.empty()) {
+        return sstables::compaction_descriptor();
+    }
+
+    // The newest window is still being written to, so it is compacted
+    // size-tiered to avoid rewriting the whole window on every flush.
+    auto newest = buckets.begin();
+    if (newest->second.size() >= unsigned(min_threshold)) {
+        auto stcs_buckets = _stcs.get_buckets(newest->second, max_threshold);
+        auto most_interesting = _stcs.most_interesting_bucket(std::move(stcs_buckets), min_threshold, max_threshold);
+        if (!most_interesting.empty()) {
+            logger.debug("time_window: Compacting {} out of {} sstables in the newest window", most_interesting.size(), newest->second.size());
+            return sstables::compaction_descriptor(std::move(most_interesting));
+        }
+    }
+
+    // Older windows no longer receive writes; merge each of them into a
+    // single sstable, smallest runs first if the window is too large.
+    for (auto it = std::next(newest); it != buckets.end(); ++it) {
+        auto& bucket = it->second;
+        if (count_sstable_runs(bucket) < 2) {
+            continue;
+        }
+        if (count_sstable_runs(bucket) > unsigned(max_threshold)) {
+            auto runs = _stcs.create_run_and_length_pairs(bucket);
+            std::sort(runs.begin(), runs.end(), [] (auto& x, auto& y) {
+                return x.second < y.second;
+            });
+            runs.resize(max_threshold);
+            bucket.clear();
+            for (auto& run : runs) {
+                boost::copy(run.first, std::back_inserter(bucket));
+            }
+        }
+        logger.debug("time_window: Compacting {} sstables of window {}", bucket.size(), it->first);
+        return sstables::compaction_descriptor(std::move(bucket));
+    }
+
+    return sstables::compaction_descriptor();
+}
+
 class leveled_compaction_strategy : public compaction_strategy_impl {
     // FIXME: User may choose to change this value; add support.
     static constexpr uint32_t max_sstable_size_in_mb = 160;
@@ -758,6 +1229,9 @@ compaction_strategy make_compaction_strategy(compaction_strategy_type strategy,
     case compaction_strategy_type::leveled:
         impl = make_shared<leveled_compaction_strategy>(leveled_compaction_strategy());
         break;
+    case compaction_strategy_type::time_window:
+        impl = make_shared<time_window_compaction_strategy>(time_window_compaction_strategy(options));
+        break;
     default:
         throw std::runtime_error("strategy not supported");
     }
@@ -92,6 +92,12 @@ namespace sstables {
         }
     };
 
+    // Called by compact_sstables() with the output sstables sealed since the
+    // previous call and the input sstables whose data they now fully cover.
+    // The callee is expected to atomically replace the latter with the former.
+    using compaction_release_fn = std::function<void (const std::vector<shared_sstable>& sealed,
+            const std::vector<shared_sstable>& exhausted)>;
+
     // Compact a list of N sstables into M sstables.
     // Returns a vector with newly created sstables(s).
     //
@@ -103,9 +109,21 @@ namespace sstables {
     // If cleanup is true, mutation that doesn't belong to current node will be
     // cleaned up, log messages will inform the user that compact_sstables runs for
     // cleaning operation, and compaction history will not be updated.
+    // If release is given, compaction is incremental: input sstables are handed
+    // to release as soon as sealed output covers them, and only the output not
+    // handed over yet is returned.
     future<std::vector<shared_sstable>> compact_sstables(std::vector<shared_sstable> sstables,
             column_family& cf, std::function<shared_sstable()> creator,
-            uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup = false);
+            uint64_t max_sstable_size, uint32_t sstable_level, bool cleanup = false,
+            compaction_release_fn release = {});
+
+    // Splits the token range covered by the sstables into up to count disjoint
+    // partition ranges, which compact_sstables() compacts concurrently. Bounds
+    // fall on tokens, so sstables written for different sub-ranges never overlap.
+    // A single range covering everything is returned if the sstables don't
+    // span more than one token.
+    std::vector<query::partition_range>
+    get_compaction_sub_ranges(const schema& s, const std::vector<shared_sstable>& sstables, unsigned count);
 
     // Return the most interesting bucket applying the size-tiered strategy.
     // NOTE: currently used for purposes of testing. May also be used by leveled compaction strategy.
@@ -65,13 +65,12 @@ void compaction_manager::task_start(lw_shared_ptr<compaction_manager::task>& tas
                 }
 
                 sstables::compaction_descriptor descriptor;
-                // Created to erase sstables from _compacting_sstables after compaction finishes.
-                std::vector<sstables::shared_sstable> sstables_to_compact;
-                sstables_to_compact.reserve(descriptor.sstables.size());
 
-                auto keep_track_of_compacting_sstables = [this, &sstables_to_compact, &descriptor] {
+                auto keep_track_of_compacting_sstables = [this, task, &descriptor] {
+                    // Used to erase sstables from _compacting_sstables after compaction finishes.
+                    task->compacting_sstables.reserve(descriptor.sstables.size());
                     for (auto& sst : descriptor.sstables) {
-                        sstables_to_compact.push_back(sst);
+                        task->compacting_sstables.push_back(sst);
                         _compacting_sstables.insert(sst);
                     }
                 };
@@ -120,11 +119,12 @@ void compaction_manager::task_start(lw_shared_ptr<compaction_manager::task>& tas
                     task->compacting_cf = nullptr;
 
                     return make_ready_future<>();
-                }).finally([this, sstables_to_compact = std::move(sstables_to_compact)] {
+                }).finally([this, task] {
                     // Remove compacted sstables from the set of compacting sstables.
-                    for (auto& sst : sstables_to_compact) {
+                    for (auto& sst : task->compacting_sstables) {
                         _compacting_sstables.erase(sst);
                     }
+                    task->compacting_sstables.clear();
                     _stats.active_tasks--;
                 });
             });
@@ -290,6 +290,16 @@ void compaction_manager::submit(column_family* cf) {
     signal_less_busy_task();
 }
 
+void compaction_manager::release_compacting_sstables(const std::vector<sstables::shared_sstable>& sstables) {
+    for (auto& sst : sstables) {
+        _compacting_sstables.erase(sst);
+        for (auto& task : _tasks) {
+            auto& compacting = task->compacting_sstables;
+            compacting.erase(std::remove(compacting.begin(), compacting.end(), sst), compacting.end());
+        }
+    }
+}
+
 future<> compaction_manager::perform_cleanup(column_family* cf) {
     if (!can_submit()) {
         throw std::runtime_error("cleanup request failed: compaction manager is either stopped or wasn't properly initialized");
@@ -53,6 +53,8 @@ class compaction_manager {
         exponential_backoff_retry compaction_retry = exponential_backoff_retry(std::chrono::seconds(5), std::chrono::seconds(300));
         // CF being currently compacted.
         column_family* compacting_cf = nullptr;
+        // Inputs of the ongoing compaction which weren't released yet.
+        std::vector<sstables::shared_sstable> compacting_sstables;
         bool stopping = false;
         bool cleanup = false;
     };
@@ -110,6 +112,10 @@ class compaction_manager {
     // Submit a column family to be compacted.
     void submit(column_family* cf);
 
+    // Called by incremental compaction once it released the given inputs,
+    // which are then no longer kept alive until the compaction finishes.
+    void release_compacting_sstables(const std::vector<sstables::shared_sstable>& sstables);
+
     // Submit a column family to be cleaned up and wait for its termination.
     future<> perform_cleanup(column_family* cf);
 
@@ -21,52 +21,72 @@
 
 #include <stdexcept>
 #include <cstdlib>
+#include <algorithm>
+#include <thread>
 
 #include <seastar/core/align.hh>
 #include <seastar/core/unaligned.hh>
 #include <seastar/core/fstream.hh>
 
 #include "compress.hh"
+#include "chunk_cache.hh"
 
 #include <lz4.h>
 #include <zlib.h>
 #include <snappy-c.h>
+#include <zstd.h>
+#include <zdict.h>
 
 #include "unimplemented.hh"
 
 namespace sstables {
 
+// The compressors we know, by the name recorded in CompressionInfo.db.
+struct compressor_entry {
+    compressor type;
+    const char* name;
+    uncompress_func* uncompress;
+    compress_func* compress;
+    compress_max_size_func* compress_max_size;
+};
+
+static const compressor_entry compressors[] = {
+    { compressor::lz4, "LZ4Compressor", uncompress_lz4, compress_lz4, compress_max_size_lz4 },
+    { compressor::snappy, "SnappyCompressor", uncompress_snappy, compress_snappy, compress_max_size_snappy },
+    { compressor::deflate, "DeflateCompressor", uncompress_deflate, compress_deflate, compress_max_size_deflate },
+    { compressor::zstd, "ZstdCompressor", uncompress_zstd, compress_zstd, compress_max_size_zstd },
+};
+
 void compression::update(uint64_t compressed_file_length) {
     // FIXME: also process _compression.options (just for crc-check frequency)
-     if (name.value == "LZ4Compressor") {
-         _uncompress = uncompress_lz4;
-     } else if (name.value == "SnappyCompressor") {
-         _uncompress = uncompress_snappy;
-     } else if (name.value == "DeflateCompressor") {
-         _uncompress = uncompress_deflate;
-     } else {
-         throw std::runtime_error("unsupported compression type");
-     }
-
-     _compressed_file_length = compressed_file_length;
+    auto it = std::find_if(std::begin(compressors), std::end(compressors), [this] (const compressor_entry& e) {
+        return name.value == to_bytes(e.name);
+    });
+    if (it == std::end(compressors)) {
+        throw std::runtime_error("unsupported compression type");
+    }
+    _uncompress = it->uncompress;
+
+    _compressed_file_length = compressed_file_length;
 }
 
 void compression::set_compressor(compressor c) {
-     if (c == compressor::lz4) {
-         _compress = compress_lz4;
-         _compress_max_size = compress_max_size_lz4;
-         name.value = "LZ4Compressor";
-     } else if (c == compressor::snappy) {
-         _compress = compress_snappy;
-         _compress_max_size = compress_max_size_snappy;
-         name.value = "SnappyCompressor";
-     } else if (c == compressor::deflate) {
-         _compress = compress_deflate;
-         _compress_max_size = compress_max_size_deflate;
-         name.value = "DeflateCompressor";
-     } else {
-         throw std::runtime_error("unsupported compressor type");
-     }
+    auto it = std::find_if(std::begin(compressors), std::end(compressors), [c] (const compressor_entry& e) {
+        return e.type == c;
+    });
+    if (it == std::end(compressors)) {
+        throw std::runtime_error("unsupported compressor type");
+    }
+    _compress = it->compress;
+    _compress_max_size = it->compress_max_size;
+    name.value = to_bytes(it->name);
+}
+
+future<> compression::train_dictionary(const std::vector<temporary_buffer<char>>& samples) {
+    return compression_dictionary::train(samples, _dictionary_training_size).then([this] (auto dictionary) {
+        _dictionary = std::move(dictionary);
+        _dictionary_training_size = 0;
+    });
 }
 
 compression::chunk_and_offset
@@ -217,16 +237,168 @@ size_t compress_max_size_snappy(size_t input_len) {
     return snappy_max_compressed_length(input_len);
 }
 
+// zstd's default level; higher levels cost more CPU at write time than the
+// space they save is worth for sstables which will be compacted again.
+static constexpr int zstd_compression_level = 3;
+
+struct zstd_cctx_deleter {
+    void operator()(ZSTD_CCtx* ctx) const { ZSTD_freeCCtx(ctx); }
+};
+
+struct zstd_dctx_deleter {
+    void operator()(ZSTD_DCtx* ctx) const { ZSTD_freeDCtx(ctx); }
+};
+
+// Contexts hold the compressor's working memory, so reuse one per shard
+// instead of allocating it for every chunk.
+static ZSTD_CCtx* zstd_cctx() {
+    static thread_local std::unique_ptr<ZSTD_CCtx, zstd_cctx_deleter> ctx;
+    if (!ctx) {
+        ctx.reset(ZSTD_createCCtx());
+        if (!ctx) {
+            throw std::bad_alloc();
+        }
+    }
+    return ctx.get();
+}
+
+static ZSTD_DCtx* zstd_dctx() {
+    static thread_local std::unique_ptr<ZSTD_DCtx, zstd_dctx_deleter> ctx;
+    if (!ctx) {
+        ctx.reset(ZSTD_createDCtx());
+        if (!ctx) {
+            throw std::bad_alloc();
+        }
+    }
+    return ctx.get();
+}
+
+size_t uncompress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len) {
+    auto ret = ZSTD_decompressDCtx(zstd_dctx(), output, output_len, input, input_len);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd uncompression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_zstd(const char* input, size_t input_len,
+        char* output, size_t output_len) {
+    auto ret = ZSTD_compressCCtx(zstd_cctx(), output, output_len, input, input_len, zstd_compression_level);
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd compression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compress_max_size_zstd(size_t input_len) {
+    return ZSTD_compressBound(input_len);
+}
+
+namespace sstables {
+
+void compression_dictionary::cdict_deleter::operator()(ZSTD_CDict_s* d) const {
+    ZSTD_freeCDict(d);
+}
+
+void compression_dictionary::ddict_deleter::operator()(ZSTD_DDict_s* d) const {
+    ZSTD_freeDDict(d);
+}
+
+compression_dictionary::compression_dictionary(bytes data)
+        : _data(std::move(data))
+        , _cdict(ZSTD_createCDict(_data.begin(), _data.size(), zstd_compression_level))
+        , _ddict(ZSTD_createDDict(_data.begin(), _data.size())) {
+    if (!_cdict || !_ddict) {
+        throw std::runtime_error("zstd dictionary creation failure");
+    }
+}
+
+// State shared with the thread training a dictionary. The reactor keeps
+// it alive until the thread signals it is done.
+struct dictionary_training {
+    std::vector<char> buf;
+    std::vector<size_t> sizes;
+    bytes dict;
+    size_t ret = 0;
+    readable_eventfd done;
+    std::thread thread;
+
+    explicit dictionary_training(size_t max_size) : dict(bytes::initialized_later(), max_size) {}
+};
+
+future<lw_shared_ptr<const compression_dictionary>>
+compression_dictionary::train(const std::vector<temporary_buffer<char>>& samples, size_t max_size) {
+    auto t = std::make_unique<dictionary_training>(max_size);
+    // The trainer wants all samples laid out back to back.
+    for (auto&& s : samples) {
+        if (t->buf.size() + s.size() > max_sample_size) {
+            break;
+        }
+        t->buf.insert(t->buf.end(), s.begin(), s.end());
+        t->sizes.push_back(s.size());
+    }
+    // Training doesn't yield, so it runs on a thread of its own rather than
+    // stall the reactor.
+    auto training = t.get();
+    t->thread = std::thread([training, done = t->done.write_side()] () mutable {
+        training->ret = ZDICT_trainFromBuffer(training->dict.begin(), training->dict.size(),
+                training->buf.data(), training->sizes.data(), training->sizes.size());
+        done.signal(1);
+    });
+    return do_with(std::move(t), [] (auto& t) {
+        return t->done.wait().then([&t] (size_t) {
+            t->thread.join();
+            if (ZDICT_isError(t->ret)) {
+                return lw_shared_ptr<const compression_dictionary>();
+            }
+            return make_lw_shared<const compression_dictionary>(bytes(t->dict.begin(), t->ret));
+        });
+    });
+}
+
+size_t compression_dictionary::compress(const char* input, size_t input_len, char* output, size_t output_len) const {
+    auto ret = ZSTD_compress_usingCDict(zstd_cctx(), output, output_len, input, input_len, _cdict.get());
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd compression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+size_t compression_dictionary::uncompress(const char* input, size_t input_len, char* output, size_t output_len) const {
+    auto ret = ZSTD_decompress_usingDDict(zstd_dctx(), output, output_len, input, input_len, _ddict.get());
+    if (ZSTD_isError(ret)) {
+        throw std::runtime_error(sprint("zstd uncompression failure: %s", ZSTD_getErrorName(ret)));
+    }
+    return ret;
+}
+
+}
+
 class compressed_file_data_source_impl : public data_source_impl {
-    input_stream<char> _input_stream;
+    file _file;
+    file_input_stream_options _options;
+    // Opened on the first chunk which isn't cached, so that reads served
+    // from the chunk cache alone do not touch the disk.
+    std::experimental::optional<input_stream<char>> _input_stream;
+    // Compressed file offset the open _input_stream will read next.
+    uint64_t _stream_pos = 0;
     sstables::compression* _compression_metadata;
     uint64_t _pos;
     uint64_t _beg_pos;
     uint64_t _end_pos;
+    // Compressed byte range covering [_beg_pos, _end_pos).
+    uint64_t _stream_end = 0;
+    // Chunks are looked up and kept in the chunk cache under this id, if
+    // not 0.
+    uint64_t _cache_id;
 public:
     compressed_file_data_source_impl(file f, sstables::compression* cm,
-                uint64_t pos, size_t len, file_input_stream_options options)
-            : _compression_metadata(cm)
+                uint64_t pos, size_t len, file_input_stream_options options, bool use_chunk_cache)
+            : _file(std::move(f))
+            , _options(std::move(options))
+            , _compression_metadata(cm)
+            , _cache_id(use_chunk_cache ? cm->chunk_cache_id() : 0)
     {
         _beg_pos = pos;
         if (pos > _compression_metadata->data_len) {
@@ -245,12 +417,8 @@ class compressed_file_data_source_impl : public data_source_impl {
         // _beg_pos and _end_pos specify positions in the compressed stream.
         // We need to translate them into a range of uncompressed chunks,
         // and open a file_input_stream to read that range.
-        auto start = _compression_metadata->locate(_beg_pos);
         auto end = _compression_metadata->locate(_end_pos - 1);
-        _input_stream = make_file_input_stream(std::move(f),
-                start.chunk_start,
-                end.chunk_start + end.chunk_len - start.chunk_start,
-                std::move(options));
+        _stream_end = end.chunk_start + end.chunk_len;
         _pos = _beg_pos;
     }
     virtual future<temporary_buffer<char>> get() override {
@@ -263,8 +431,24 @@ class compressed_file_data_source_impl : public data_source_impl {
         if (_pos != _beg_pos && addr.offset != 0) {
             throw std::runtime_error("compressed reader out of sync");
         }
-        return _input_stream.read_exactly(addr.chunk_len).
-            then([this, addr](temporary_buffer<char> buf) {
+        auto cache_id = _cache_id;
+        if (cache_id) {
+            auto cached = sstables::global_chunk_cache().get(cache_id, addr.chunk_start);
+            if (cached) {
+                return make_ready_future<temporary_buffer<char>>(consume(std::move(*cached), addr));
+            }
+        }
+        // Chunks served from the cache leave the stream behind; rather than
+        // read and drop them, reopen it where the missing chunk starts.
+        if (!_input_stream || _stream_pos != addr.chunk_start) {
+            _input_stream = make_file_input_stream(_file,
+                    addr.chunk_start,
+                    _stream_end - addr.chunk_start,
+                    _options);
+        }
+        _stream_pos = addr.chunk_start + addr.chunk_len;
+        return _input_stream->read_exactly(addr.chunk_len).
+            then([this, addr, cache_id](temporary_buffer<char> buf) {
                 // The last 4 bytes of the chunk are the adler32 checksum
                 // of the rest of the (compressed) chunk.
                 auto compressed_len = addr.chunk_len - 4;
@@ -286,26 +470,33 @@ class compressed_file_data_source_impl : public data_source_impl {
                         buf.get(), compressed_len,
                         out.get_write(), out.size());
                 out.trim(len);
-                out.trim_front(addr.offset);
-                _pos += out.size();
-                return out;
+                if (cache_id) {
+                    sstables::global_chunk_cache().put(cache_id, addr.chunk_start, out);
+                }
+                return consume(std::move(out), addr);
         });
     }
+private:
+    temporary_buffer<char> consume(temporary_buffer<char> chunk, const sstables::compression::chunk_and_offset& addr) {
+        chunk.trim_front(addr.offset);
+        _pos += chunk.size();
+        return chunk;
+    }
 };
 
 class compressed_file_data_source : public data_source {
 public:
     compressed_file_data_source(file f, sstables::compression* cm,
-            uint64_t offset, size_t len, file_input_stream_options options)
+            uint64_t offset, size_t len, file_input_stream_options options, bool use_chunk_cache)
         : data_source(std::make_unique<compressed_file_data_source_impl>(
-                std::move(f), cm, offset, len, std::move(options)))
+                std::move(f), cm, offset, len, std::move(options), use_chunk_cache))
         {}
 };
 
 input_stream<char> make_compressed_file_input_stream(
         file f, sstables::compression* cm, uint64_t offset, size_t len,
-        file_input_stream_options options)
+        file_input_stream_options options, bool use_chunk_cache)
 {
     return input_stream<char>(compressed_file_data_source(
-            std::move(f), cm, offset, len, std::move(options)));
+            std::move(f), cm, offset, len, std::move(options), use_chunk_cache));
 }
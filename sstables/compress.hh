@@ -36,6 +36,9 @@
 // Cassandra supports three different compression algorithms for the chunks,
 // LZ4, Snappy, and Deflate - the default (and therefore most important) is
 // LZ4. Each compressor is an implementation of the "compressor" class.
+// We additionally support zstd, optionally with a dictionary trained on the
+// table's own data (see compression_dictionary below), which lets the small
+// chunks of tables with small rows compress nearly as well as large ones.
 //
 // Each compressed chunk is followed by a 4-byte checksum of the compressed
 // data, using the Adler32 algorithm. In Cassandra, there is a parameter
@@ -43,10 +46,12 @@
 // of us verifying the checksum of each chunk we read.
 //
 // This implementation does not cache the compressed disk blocks (which
-// are read using O_DIRECT), nor uncompressed data. We intend to cache high-
-// level Cassandra rows, not disk blocks.
+// are read using O_DIRECT). Uncompressed chunks are kept in the per-shard
+// chunk_cache, so that repeated reads of hot data in a file which has a
+// cache id do not uncompress the same chunk again.
 
 #include <vector>
+#include <memory>
 #include <cstdint>
 #include <zlib.h>
 
@@ -68,6 +73,7 @@ typedef size_t uncompress_func(const char* input, size_t input_len,
 uncompress_func uncompress_lz4;
 uncompress_func uncompress_snappy;
 uncompress_func uncompress_deflate;
+uncompress_func uncompress_zstd;
 
 typedef size_t compress_func(const char* input, size_t input_len,
         char* output, size_t output_len);
@@ -75,12 +81,14 @@ typedef size_t compress_func(const char* input, size_t input_len,
 compress_func compress_lz4;
 compress_func compress_snappy;
 compress_func compress_deflate;
+compress_func compress_zstd;
 
 typedef size_t compress_max_size_func(size_t input_len);
 
 compress_max_size_func compress_max_size_lz4;
 compress_max_size_func compress_max_size_snappy;
 compress_max_size_func compress_max_size_deflate;
+compress_max_size_func compress_max_size_zstd;
 
 inline uint32_t init_checksum_adler32() {
     return adler32(0, Z_NULL, 0);
@@ -102,8 +110,46 @@ inline uint32_t checksum_adler32_combine(uint32_t adler1, uint32_t adler2, size_
     return adler32_combine(adler1, adler2, input_len2);
 }
 
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
 namespace sstables {
 
+// A zstd dictionary, trained on sample chunks of a column family's data.
+// Each sstable compressed with a dictionary stores it in its
+// CompressionDictionary component, so it can always be read on its own;
+// the column family merely hands the dictionary of its latest sstable to
+// the next ones it writes, so that small flushes need not train their own.
+class compression_dictionary {
+    struct cdict_deleter {
+        void operator()(ZSTD_CDict_s* d) const;
+    };
+    struct ddict_deleter {
+        void operator()(ZSTD_DDict_s* d) const;
+    };
+    bytes _data;
+    std::unique_ptr<ZSTD_CDict_s, cdict_deleter> _cdict;
+    std::unique_ptr<ZSTD_DDict_s, ddict_deleter> _ddict;
+public:
+    // Training takes a time which grows with the size of the samples, so
+    // only this many bytes of them are trained on.
+    static constexpr size_t max_sample_size = 1 << 20;
+
+    explicit compression_dictionary(bytes data);
+
+    // Returns a dictionary of at most max_size bytes trained on samples, or
+    // a null pointer if the samples are too few or too uniform to train one.
+    // Training runs on a separate thread; samples are copied before it starts.
+    static future<lw_shared_ptr<const compression_dictionary>> train(
+            const std::vector<temporary_buffer<char>>& samples, size_t max_size);
+
+    const bytes& data() const {
+        return _data;
+    }
+    size_t compress(const char* input, size_t input_len, char* output, size_t output_len) const;
+    size_t uncompress(const char* input, size_t input_len, char* output, size_t output_len) const;
+};
+
 struct compression {
     disk_string<uint16_t> name;
     disk_array<uint32_t, option> options;
@@ -123,9 +169,42 @@ struct compression {
     // Variables *not* found in the "Compression Info" file (added by update()):
     uint64_t _compressed_file_length;
     uint32_t _full_checksum;
+    // Kept in the CompressionDictionary component rather than in here.
+    lw_shared_ptr<const compression_dictionary> _dictionary;
+    // When non-zero, the writer trains a dictionary of this size before
+    // compressing the first chunk.
+    size_t _dictionary_training_size = 0;
+    // Identifies the file's chunks in the chunk_cache; 0 if not cached.
+    uint64_t _chunk_cache_id = 0;
 public:
     // Set the compressor algorithm, please check the definition of enum compressor.
     void set_compressor(compressor c);
+    // Compress and uncompress chunks with the given dictionary; it must have
+    // been trained for the compressor set above (currently only zstd).
+    void set_dictionary(lw_shared_ptr<const compression_dictionary> d) {
+        _dictionary = std::move(d);
+    }
+    const lw_shared_ptr<const compression_dictionary>& dictionary() const {
+        return _dictionary;
+    }
+    void set_dictionary_training_size(size_t size) {
+        _dictionary_training_size = size;
+    }
+    size_t dictionary_training_size() const {
+        return _dictionary_training_size;
+    }
+    bool needs_dictionary() const {
+        return _dictionary_training_size && !_dictionary;
+    }
+    void set_chunk_cache_id(uint64_t id) {
+        _chunk_cache_id = id;
+    }
+    uint64_t chunk_cache_id() const {
+        return _chunk_cache_id;
+    }
+    // Trains a dictionary on the given chunks and uses it for the rest of
+    // the file. Chunks are compressed without one if training fails.
+    future<> train_dictionary(const std::vector<temporary_buffer<char>>& samples);
     // After changing _compression, update() must be called to update
     // additional variables depending on it.
     void update(uint64_t compressed_file_length);
@@ -177,6 +256,9 @@ struct compression {
         if (!_uncompress) {
             throw std::runtime_error("uncompress is not supported");
         }
+        if (_dictionary) {
+            return _dictionary->uncompress(input, input_len, output, output_len);
+        }
         return _uncompress(input, input_len, output, output_len);
     }
     size_t compress(
@@ -185,6 +267,9 @@ struct compression {
         if (!_compress) {
             throw std::runtime_error("compress is not supported");
         }
+        if (_dictionary) {
+            return _dictionary->compress(input, input_len, output, output_len);
+        }
         return _compress(input, input_len, output, output_len);
     }
     size_t compress_max_size(size_t input_len) const {
@@ -201,5 +286,9 @@ struct compression {
 // are open streams on it. This should happen naturally on a higher level -
 // as long as we have *sstables* work in progress, we need to keep the whole
 // sstable alive, and the compression metadata is only a part of it.
+//
+// Readers which go through the data once, like compaction and streaming,
+// should pass use_chunk_cache = false, so as not to evict hot chunks.
 input_stream<char> make_compressed_file_input_stream(
-        file f, sstables::compression *cm, uint64_t offset, size_t len, class file_input_stream_options options);
+        file f, sstables::compression *cm, uint64_t offset, size_t len, class file_input_stream_options options,
+        bool use_chunk_cache = true);
@@ -43,7 +43,12 @@ future<> sstable::read_filter(const io_priority_class& pc) {
         return this->read_simple<sstable::component_type::Filter>(filter, pc).then([this, &filter] {
             large_bitset bs(filter.buckets.elements.size() * 64);
             bs.load(filter.buckets.elements.begin(), filter.buckets.elements.end());
-            _filter = utils::filter::create_filter(filter.hashes, std::move(bs));
+            auto format = utils::filter_format::classic;
+            if (filter.hashes & sstables::filter::blocked_format_flag) {
+                format = utils::filter_format::blocked;
+            }
+            auto hashes = filter.hashes & ~sstables::filter::blocked_format_flag;
+            _filter = utils::filter::create_filter(hashes, std::move(bs), format);
         }).then([this] {
             return io_check([&] {
                 return engine().file_size(this->filename(sstable::component_type::Filter));
@@ -59,12 +64,16 @@ void sstable::write_filter(const io_priority_class& pc) {
         return;
     }
 
-    auto f = static_cast<utils::filter::murmur3_bloom_filter *>(_filter.get());
+    auto f = static_cast<utils::filter::bloom_filter *>(_filter.get());
 
     auto&& bs = f->bits();
     std::deque<uint64_t> v(align_up(bs.size(), size_t(64)) / 64);
     bs.save(v.begin());
-    auto filter = sstables::filter(f->num_hashes(), std::move(v));
+    uint32_t hashes = f->num_hashes();
+    if (f->format() == utils::filter_format::blocked) {
+        hashes |= sstables::filter::blocked_format_flag;
+    }
+    auto filter = sstables::filter(hashes, std::move(v));
     write_simple<sstable::component_type::Filter>(filter, pc);
 }
 
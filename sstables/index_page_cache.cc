@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <seastar/core/scollectd.hh>
+
+#include "index_page_cache.hh"
+
+namespace sstables {
+
+index_page_cache& global_index_page_cache() {
+    static thread_local index_page_cache instance;
+    return instance;
+}
+
+index_page_cache::index_page_cache()
+    : _reclaimer([this] { return reclaim(); })
+{
+    setup_collectd();
+}
+
+index_page_cache::~index_page_cache() {
+    _lru.clear();
+}
+
+void index_page_cache::setup_collectd() {
+    _collectd_registrations = std::make_unique<scollectd::registrations>(scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "bytes", "used")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.bytes)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "hits")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.hits)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "misses")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.misses)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", "evictions")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _stats.evictions)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("index_page_cache"
+                , scollectd::per_cpu_plugin_instance
+                , "objects", "pages")
+                , scollectd::make_typed(scollectd::data_type::GAUGE, _stats.entries)
+        ),
+    }));
+}
+
+size_t index_page_cache::page_size(const index_list& il) {
+    size_t size = sizeof(index_list) + il.capacity() * sizeof(index_entry);
+    for (auto&& ie : il) {
+        size += ie.get_key_bytes().size() + ie.get_promoted_index_bytes().size();
+    }
+    return size;
+}
+
+index_page_ptr index_page_cache::get(uint64_t sstable_id, uint64_t summary_idx) {
+    if (!_max_size) {
+        return {};
+    }
+    auto i = _pages.find(key_type(sstable_id, summary_idx));
+    if (i == _pages.end()) {
+        ++_stats.misses;
+        return {};
+    }
+    ++_stats.hits;
+    _lru.erase(_lru.iterator_to(i->second));
+    _lru.push_front(i->second);
+    return i->second.page;
+}
+
+void index_page_cache::put(uint64_t sstable_id, uint64_t summary_idx, index_page_ptr page) {
+    auto size = page_size(*page);
+    if (size > _max_size) {
+        return;
+    }
+    auto r = _pages.emplace(key_type(sstable_id, summary_idx), entry{{}, key_type(sstable_id, summary_idx), std::move(page), size});
+    if (!r.second) {
+        // Another reader missed on the same page concurrently.
+        return;
+    }
+    _lru.push_front(r.first->second);
+    ++_stats.entries;
+    _stats.bytes += size;
+    evict_to_fit();
+}
+
+void index_page_cache::erase(std::map<key_type, entry>::iterator i) {
+    --_stats.entries;
+    _stats.bytes -= i->second.size;
+    // Unlinks the entry from _lru.
+    _pages.erase(i);
+}
+
+void index_page_cache::evict_lru() {
+    auto& e = _lru.back();
+    erase(_pages.find(e.key));
+    ++_stats.evictions;
+}
+
+void index_page_cache::evict_to_fit() {
+    while (_stats.bytes > _max_size) {
+        evict_lru();
+    }
+}
+
+// Under memory pressure, gives back up to reclaim_batch bytes at a time;
+// the cache refills from hot pages once the pressure is gone.
+memory::reclaiming_result index_page_cache::reclaim() {
+    static constexpr size_t reclaim_batch = 1 << 20;
+    if (_lru.empty()) {
+        return memory::reclaiming_result::reclaimed_nothing;
+    }
+    auto target = _stats.bytes > reclaim_batch ? _stats.bytes - reclaim_batch : 0;
+    while (!_lru.empty() && _stats.bytes > target) {
+        evict_lru();
+    }
+    return memory::reclaiming_result::reclaimed_something;
+}
+
+void index_page_cache::invalidate(uint64_t sstable_id) {
+    auto i = _pages.lower_bound(key_type(sstable_id, 0));
+    while (i != _pages.end() && i->first.first == sstable_id) {
+        erase(i++);
+    }
+}
+
+void index_page_cache::set_max_size(size_t size) {
+    _max_size = size;
+    evict_to_fit();
+}
+
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <boost/intrusive/list.hpp>
+
+#include "core/shared_ptr.hh"
+#include "core/memory.hh"
+#include "sstables.hh"
+
+namespace scollectd {
+
+struct registrations;
+
+}
+
+namespace sstables {
+
+// Per-shard cache of parsed Index.db pages, i.e. the index entries between
+// two consecutive summary entries, so that point reads of hot sstables
+// binary-search entries in memory instead of reading and parsing the page
+// again. Pages are keyed by the sstable's cache id and summary index, and
+// evicted in LRU order once they use more than the cache's budget.
+// Pages are shared with the readers using them, so eviction never
+// invalidates a page under a reader's feet.
+// Pages live in standard memory, so the cache registers a reclaimer which
+// evicts them, least recently used first, when the shard runs low on it.
+class index_page_cache {
+    using key_type = std::pair<uint64_t, uint64_t>;
+    struct entry {
+        boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> lru_link;
+        key_type key;
+        index_page_ptr page;
+        size_t size;
+    };
+    using lru_type = boost::intrusive::list<entry,
+        boost::intrusive::member_hook<entry, decltype(entry::lru_link), &entry::lru_link>,
+        boost::intrusive::constant_time_size<false>>;
+public:
+    struct stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+private:
+    std::map<key_type, entry> _pages;
+    lru_type _lru;
+    size_t _max_size = 0;
+    stats _stats;
+    std::unique_ptr<scollectd::registrations> _collectd_registrations;
+    memory::reclaimer _reclaimer;
+private:
+    void setup_collectd();
+    void erase(std::map<key_type, entry>::iterator);
+    void evict_lru();
+    void evict_to_fit();
+    memory::reclaiming_result reclaim();
+    static size_t page_size(const index_list&);
+public:
+    index_page_cache();
+    ~index_page_cache();
+
+    // Returns the page, or a null pointer if it is not cached.
+    index_page_ptr get(uint64_t sstable_id, uint64_t summary_idx);
+    // The page is charged for the size of its entries, so their keys and
+    // promoted indexes must not share larger buffers.
+    void put(uint64_t sstable_id, uint64_t summary_idx, index_page_ptr page);
+    // Drops the pages of an sstable which is no longer read.
+    void invalidate(uint64_t sstable_id);
+
+    // Maximum memory used for pages; 0 disables the cache.
+    void set_max_size(size_t size);
+    size_t max_size() const {
+        return _max_size;
+    }
+    const stats& get_stats() const {
+        return _stats;
+    }
+};
+
+// Returns a reference to shard-wide index_page_cache.
+index_page_cache& global_index_page_cache();
+
+}
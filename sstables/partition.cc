@@ -100,6 +100,7 @@ class mp_row_consumer : public row_consumer {
     schema_ptr _schema;
     key_view _key;
     const io_priority_class* _pc = nullptr;
+    bool _use_chunk_cache = true;
     std::function<future<> (mutation&& m)> _mutation_to_subscription;
 
     struct column {
@@ -259,9 +260,10 @@ class mp_row_consumer : public row_consumer {
             , mut(mutation(partition_key::from_exploded(*_schema, key.explode(*_schema)), _schema))
     { }
 
-    mp_row_consumer(const schema_ptr _schema, const io_priority_class& pc)
+    mp_row_consumer(const schema_ptr _schema, const io_priority_class& pc, bool use_chunk_cache = true)
             : _schema(_schema)
             , _pc(&pc)
+            , _use_chunk_cache(use_chunk_cache)
     { }
 
     mp_row_consumer(const schema_ptr _schema, std::function<future<> (mutation&& m)> sub_fn,
@@ -419,6 +421,9 @@ class mp_row_consumer : public row_consumer {
         assert (_pc != nullptr);
         return *_pc;
     }
+    virtual bool use_chunk_cache() override {
+        return _use_chunk_cache;
+    }
 };
 
 static int adjust_binary_search_index(int idx) {
@@ -448,40 +453,65 @@ future<uint64_t> sstables::sstable::data_end_position(uint64_t summary_idx, cons
         return make_ready_future<uint64_t>(data_size());
     }
 
-    return read_indexes(summary_idx + 1, pc).then([] (auto next_il) {
-        return next_il.front().position();
+    return read_index_page(summary_idx + 1, pc).then([] (index_page_ptr next_il) {
+        return next_il->front().position();
     });
 }
 
-future<mutation_opt>
-sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const io_priority_class& pc) {
-
-    assert(schema);
+future<std::experimental::optional<sstables::sstable::index_entry_ref>>
+sstables::sstable::find_index_entry(const sstables::key& key, const io_priority_class& pc) {
+    using ret_type = std::experimental::optional<index_entry_ref>;
 
     if (!filter_has_key(key)) {
-        return make_ready_future<mutation_opt>();
+        return make_ready_future<ret_type>();
     }
+    return find_index_entry(key, dht::global_partitioner().get_token(key_view(key)), pc);
+}
 
-    auto& partitioner = dht::global_partitioner();
-    auto token = partitioner.get_token(key_view(key));
+future<std::experimental::optional<sstables::sstable::index_entry_ref>>
+sstables::sstable::find_index_entry(const sstables::key& key, const dht::token& token, const io_priority_class& pc) {
+    using ret_type = std::experimental::optional<index_entry_ref>;
 
     auto& summary = _summary;
     auto summary_idx = adjust_binary_search_index(binary_search(summary.entries, key, token));
     if (summary_idx < 0) {
         _filter_tracker.add_false_positive();
-        return make_ready_future<mutation_opt>();
+        return make_ready_future<ret_type>();
     }
 
-    return read_indexes(summary_idx, pc).then([this, schema, &key, token, summary_idx, &pc] (auto index_list) {
-        auto index_idx = this->binary_search(index_list, key, token);
+    return read_index_page(summary_idx, pc).then([this, &key, token, summary_idx] (index_page_ptr page) {
+        auto index_idx = this->binary_search(*page, key, token);
         if (index_idx < 0) {
             _filter_tracker.add_false_positive();
-            return make_ready_future<mutation_opt>();
+            return ret_type();
         }
         _filter_tracker.add_true_positive();
+        return ret_type(index_entry_ref{std::move(page), uint64_t(summary_idx), index_idx});
+    });
+}
+
+future<mutation_opt>
+sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const io_priority_class& pc) {
+    return read_row_at(std::move(schema), key, find_index_entry(key, pc), pc);
+}
 
-        auto position = index_list[index_idx].position();
-        return this->data_end_position(summary_idx, index_idx, index_list, pc).then([&key, schema, this, position, &pc] (uint64_t end) {
+future<mutation_opt>
+sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const dht::token& token, const io_priority_class& pc) {
+    return read_row_at(std::move(schema), key, find_index_entry(key, token, pc), pc);
+}
+
+future<mutation_opt>
+sstables::sstable::read_row_at(schema_ptr schema, const sstables::key& key,
+        future<std::experimental::optional<index_entry_ref>> entry, const io_priority_class& pc) {
+
+    assert(schema);
+
+    return entry.then([this, schema, &key, &pc] (std::experimental::optional<index_entry_ref> ref) {
+        if (!ref) {
+            return make_ready_future<mutation_opt>();
+        }
+        auto position = ref->entry().position();
+        return this->data_end_position(ref->summary_idx, ref->index_idx, *ref->page, pc).then([&key, schema, this, position, &pc] (uint64_t end) {
             return do_with(mp_row_consumer(key, schema, pc), [this, position, end] (auto& c) {
                 return this->data_consume_rows_at_once(c, position, end).then([&c] {
                     return make_ready_future<mutation_opt>(std::move(c.mut));
@@ -491,6 +521,140 @@ sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const i
     });
 }
 
+// A block of a partition's promoted index: the atoms whose names fall into
+// [first_name, last_name], stored at [offset, offset + width) relative to
+// the start of the partition.
+struct promoted_index_block {
+    bytes_view first_name;
+    bytes_view last_name;
+    uint64_t offset;
+    uint64_t width;
+};
+
+// Parses the promoted index stored in an index entry. The blocks refer to
+// the entry's buffer, so they must not outlive it.
+static std::vector<promoted_index_block> parse_promoted_index(bytes_view v) {
+    std::vector<promoted_index_block> blocks;
+    if (v.empty()) {
+        return blocks;
+    }
+    // The partition's deletion time is in the partition header as well.
+    read_simple<uint32_t>(v);
+    read_simple<uint64_t>(v);
+    auto count = read_simple<uint32_t>(v);
+    blocks.reserve(count);
+    while (count--) {
+        promoted_index_block b;
+        b.first_name = read_simple_bytes(v, read_simple<uint16_t>(v));
+        b.last_name = read_simple_bytes(v, read_simple<uint16_t>(v));
+        b.offset = read_simple<uint64_t>(v);
+        b.width = read_simple<uint64_t>(v);
+        blocks.push_back(b);
+    }
+    return blocks;
+}
+
+// Returns the clustering prefix of a column name in the promoted index.
+// The static row sorts before any clustering key, so it maps to the empty
+// prefix; so do prefixes which compare equal to every clustering key.
+static clustering_key_prefix clustering_prefix_of(const schema& s, bytes_view name) {
+    if (!s.is_compound()) {
+        return clustering_key_prefix::from_exploded(s, { to_bytes(name) });
+    }
+    if (name.size() >= 2 && name[0] == bytes::value_type(0xff) && name[1] == bytes::value_type(0xff)) {
+        return clustering_key_prefix::from_exploded(s, std::vector<bytes>());
+    }
+    auto components = composite_view(name).explode();
+    components.resize(std::min(components.size(), s.clustering_key_size()));
+    return clustering_key_prefix::from_exploded(s, components);
+}
+
+// Returns the [start, end) extents of the data file holding the partition
+// at the given position which may hold rows from ck_ranges. The first block
+// always is, as it starts with the static row and the range tombstones.
+// Blocks are matched against the ranges in prefix-equality order, so a
+// block is only skipped if it certainly holds no row from the ranges; the
+// direction of the query doesn't matter.
+static std::vector<std::pair<uint64_t, uint64_t>>
+promoted_index_extents(const schema& s, uint64_t position, const std::vector<promoted_index_block>& blocks,
+        const query::clustering_row_ranges& ck_ranges) {
+    clustering_key_prefix::prefix_equality_less_compare less(s);
+    std::vector<std::pair<uint64_t, uint64_t>> extents;
+    extents.emplace_back(position, position + blocks.front().offset + blocks.front().width);
+    for (auto&& b : boost::make_iterator_range(std::next(blocks.begin()), blocks.end())) {
+        auto first = clustering_prefix_of(s, b.first_name);
+        auto last = clustering_prefix_of(s, b.last_name);
+        auto overlaps = std::any_of(ck_ranges.begin(), ck_ranges.end(), [&] (const query::clustering_range& r) {
+            return !(r.start() && less(last, r.start()->value()))
+                && !(r.end() && less(r.end()->value(), first));
+        });
+        if (!overlaps) {
+            continue;
+        }
+        auto start = position + b.offset;
+        if (extents.back().second == start) {
+            extents.back().second += b.width;
+        } else {
+            extents.emplace_back(start, start + b.width);
+        }
+    }
+    return extents;
+}
+
+future<mutation_opt>
+sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const query::clustering_row_ranges& ck_ranges,
+        const io_priority_class& pc) {
+    return read_row_at(std::move(schema), key, ck_ranges, find_index_entry(key, pc), pc);
+}
+
+future<mutation_opt>
+sstables::sstable::read_row(schema_ptr schema, const sstables::key& key, const dht::token& token,
+        const query::clustering_row_ranges& ck_ranges, const io_priority_class& pc) {
+    return read_row_at(std::move(schema), key, ck_ranges, find_index_entry(key, token, pc), pc);
+}
+
+future<mutation_opt>
+sstables::sstable::read_row_at(schema_ptr schema, const sstables::key& key, const query::clustering_row_ranges& ck_ranges,
+        future<std::experimental::optional<index_entry_ref>> entry, const io_priority_class& pc) {
+    if (!schema->clustering_key_size()) {
+        return read_row_at(std::move(schema), key, std::move(entry), pc);
+    }
+    return entry.then([this, schema, &key, &ck_ranges, &pc] (std::experimental::optional<index_entry_ref> ref) {
+        if (!ref) {
+            return make_ready_future<mutation_opt>();
+        }
+        auto position = ref->entry().position();
+        auto blocks = parse_promoted_index(ref->entry().get_promoted_index_bytes());
+        if (blocks.size() < 2) {
+            return this->data_end_position(ref->summary_idx, ref->index_idx, *ref->page, pc).then([&key, schema, this, position, &pc] (uint64_t end) {
+                return do_with(mp_row_consumer(key, schema, pc), [this, position, end] (auto& c) {
+                    return this->data_consume_rows_at_once(c, position, end).then([&c] {
+                        return make_ready_future<mutation_opt>(std::move(c.mut));
+                    });
+                });
+            });
+        }
+        auto extents = promoted_index_extents(*schema, position, blocks, ck_ranges);
+        return do_with(mp_row_consumer(key, schema, pc), [this, extents = std::move(extents)] (auto& c) mutable {
+            return this->data_consume_row_extents(c, std::move(extents)).then([&c] {
+                return make_ready_future<mutation_opt>(std::move(c.mut));
+            });
+        });
+    });
+}
+
+future<bool> sstables::sstable::has_promoted_index(const sstables::key& key, const io_priority_class& pc) {
+    return find_index_entry(key, pc).then([] (std::experimental::optional<index_entry_ref> ref) {
+        return ref && !ref->entry().get_promoted_index_bytes().empty();
+    });
+}
+
+future<bool> sstables::sstable::has_promoted_index(const sstables::key& key, const dht::token& token, const io_priority_class& pc) {
+    return find_index_entry(key, token, pc).then([] (std::experimental::optional<index_entry_ref> ref) {
+        return ref && !ref->entry().get_promoted_index_bytes().empty();
+    });
+}
+
 class mutation_reader::impl {
 private:
     mp_row_consumer _consumer;
@@ -498,19 +662,20 @@ class mutation_reader::impl {
     std::function<future<data_consume_context> ()> _get_context;
 public:
     impl(sstable& sst, schema_ptr schema, uint64_t start, uint64_t end,
-         const io_priority_class &pc)
-        : _consumer(schema, pc)
+         const io_priority_class &pc, bool use_chunk_cache)
+        : _consumer(schema, pc, use_chunk_cache)
         , _get_context([&sst, this, start, end] {
             return make_ready_future<data_consume_context>(sst.data_consume_rows(_consumer, start, end));
         }) { }
     impl(sstable& sst, schema_ptr schema,
-         const io_priority_class &pc)
-        : _consumer(schema, pc)
+         const io_priority_class &pc, bool use_chunk_cache)
+        : _consumer(schema, pc, use_chunk_cache)
         , _get_context([this, &sst] {
             return make_ready_future<data_consume_context>(sst.data_consume_rows(_consumer));
         }) { }
-    impl(sstable& sst, schema_ptr schema, std::function<future<uint64_t>()> start, std::function<future<uint64_t>()> end, const io_priority_class& pc)
-        : _consumer(schema, pc)
+    impl(sstable& sst, schema_ptr schema, std::function<future<uint64_t>()> start, std::function<future<uint64_t>()> end,
+         const io_priority_class& pc, bool use_chunk_cache)
+        : _consumer(schema, pc, use_chunk_cache)
         , _get_context([this, &sst, start = std::move(start), end = std::move(end)] () {
             return start().then([this, &sst, end = std::move(end)] (uint64_t start) {
                 return end().then([this, &sst, start] (uint64_t end) {
@@ -560,8 +725,8 @@ future<mutation_opt> mutation_reader::read() {
     return _pimpl->read();
 }
 
-mutation_reader sstable::read_rows(schema_ptr schema, const io_priority_class& pc) {
-    return std::make_unique<mutation_reader::impl>(*this, schema, pc);
+mutation_reader sstable::read_rows(schema_ptr schema, const io_priority_class& pc, bool use_chunk_cache) {
+    return std::make_unique<mutation_reader::impl>(*this, schema, pc, use_chunk_cache);
 }
 
 // Less-comparator for lookups in the partition index.
@@ -611,9 +776,9 @@ future<uint64_t> sstable::lower_bound(schema_ptr s, const dht::ring_position& po
 
     --summary_idx;
 
-    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_list il) {
-        auto i = std::lower_bound(il.begin(), il.end(), pos, index_comparator(*s));
-        if (i == il.end()) {
+    return read_index_page(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_page_ptr il) {
+        auto i = std::lower_bound(il->begin(), il->end(), pos, index_comparator(*s));
+        if (i == il->end()) {
             return this->data_end_position(summary_idx, pc);
         }
         return make_ready_future<uint64_t>(i->position());
@@ -630,9 +795,9 @@ future<uint64_t> sstable::upper_bound(schema_ptr s, const dht::ring_position& po
 
     --summary_idx;
 
-    return read_indexes(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_list il) {
-        auto i = std::upper_bound(il.begin(), il.end(), pos, index_comparator(*s));
-        if (i == il.end()) {
+    return read_index_page(summary_idx, pc).then([this, s, pos, summary_idx, &pc] (index_page_ptr il) {
+        auto i = std::upper_bound(il->begin(), il->end(), pos, index_comparator(*s));
+        if (i == il->end()) {
             return this->data_end_position(summary_idx, pc);
         }
         return make_ready_future<uint64_t>(i->position());
@@ -640,18 +805,19 @@ future<uint64_t> sstable::upper_bound(schema_ptr s, const dht::ring_position& po
 }
 
 mutation_reader sstable::read_range_rows(schema_ptr schema,
-        const dht::token& min_token, const dht::token& max_token, const io_priority_class& pc) {
+        const dht::token& min_token, const dht::token& max_token, const io_priority_class& pc, bool use_chunk_cache) {
     if (max_token < min_token) {
         return std::make_unique<mutation_reader::impl>();
     }
     return read_range_rows(std::move(schema),
         query::range<dht::ring_position>::make(
             dht::ring_position::starting_at(min_token),
-            dht::ring_position::ending_at(max_token)), pc);
+            dht::ring_position::ending_at(max_token)), pc, use_chunk_cache);
 }
 
 mutation_reader
-sstable::read_range_rows(schema_ptr schema, const query::partition_range& range, const io_priority_class& pc) {
+sstable::read_range_rows(schema_ptr schema, const query::partition_range& range, const io_priority_class& pc,
+        bool use_chunk_cache) {
     if (query::is_wrap_around(range, *schema)) {
         fail(unimplemented::cause::WRAP_AROUND);
     }
@@ -671,14 +837,14 @@ sstable::read_range_rows(schema_ptr schema, const query::partition_range& range,
     };
 
     return std::make_unique<mutation_reader::impl>(
-        *this, std::move(schema), std::move(start), std::move(end), pc);
+        *this, std::move(schema), std::move(start), std::move(end), pc, use_chunk_cache);
 }
 
 
 class key_reader final : public ::key_reader::impl {
     schema_ptr _s;
     shared_sstable _sst;
-    index_list _bucket;
+    index_page_ptr _bucket;
     int64_t _current_bucket_id;
     int64_t _end_bucket_id;
     int64_t _begin_bucket_id;
@@ -738,23 +904,24 @@ class key_reader final : public ::key_reader::impl {
 future<dht::decorated_key_opt> key_reader::operator()()
 {
     if (_position_in_bucket < _end_of_bucket) {
-        auto& ie = _bucket[_position_in_bucket++];
+        auto& ie = (*_bucket)[_position_in_bucket++];
         return make_ready_future<dht::decorated_key_opt>(decorate(ie));
     }
     if (_current_bucket_id == _end_bucket_id) {
         return make_ready_future<dht::decorated_key_opt>();
     }
-    return _sst->read_indexes(++_current_bucket_id, _pc).then([this] (index_list il) mutable {
+    return _sst->read_index_page(++_current_bucket_id, _pc).then([this] (index_page_ptr il) mutable {
         _bucket = std::move(il);
+        auto& bucket = *_bucket;
 
         if (_range.start() && _current_bucket_id == _begin_bucket_id) {
             index_list::const_iterator pos;
             if (_range.start()->is_inclusive()) {
-                pos = std::lower_bound(_bucket.begin(), _bucket.end(), _range.start()->value(), index_comparator(*_s));
+                pos = std::lower_bound(bucket.begin(), bucket.end(), _range.start()->value(), index_comparator(*_s));
             } else {
-                pos = std::upper_bound(_bucket.begin(), _bucket.end(), _range.start()->value(), index_comparator(*_s));
+                pos = std::upper_bound(bucket.begin(), bucket.end(), _range.start()->value(), index_comparator(*_s));
             }
-            _position_in_bucket = std::distance(_bucket.cbegin(), pos);
+            _position_in_bucket = std::distance(bucket.cbegin(), pos);
         } else {
             _position_in_bucket = 0;
         }
@@ -762,13 +929,13 @@ future<dht::decorated_key_opt> key_reader::operator()()
         if (_range.end() && _current_bucket_id == _end_bucket_id) {
             index_list::const_iterator pos;
             if (_range.end()->is_inclusive()) {
-                pos = std::upper_bound(_bucket.begin(), _bucket.end(), _range.end()->value(), index_comparator(*_s));
+                pos = std::upper_bound(bucket.begin(), bucket.end(), _range.end()->value(), index_comparator(*_s));
             } else {
-                pos = std::lower_bound(_bucket.begin(), _bucket.end(), _range.end()->value(), index_comparator(*_s));
+                pos = std::lower_bound(bucket.begin(), bucket.end(), _range.end()->value(), index_comparator(*_s));
             }
-            _end_of_bucket = std::distance(_bucket.cbegin(), pos);
+            _end_of_bucket = std::distance(bucket.cbegin(), pos);
         } else {
-            _end_of_bucket = _bucket.size();
+            _end_of_bucket = bucket.size();
         }
 
         return operator()();
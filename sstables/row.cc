@@ -21,6 +21,7 @@
 
 #include "sstables.hh"
 #include "consumer.hh"
+#include <boost/range/irange.hpp>
 
 namespace sstables {
 
@@ -367,7 +368,7 @@ data_consume_context sstable::data_consume_rows(
     // consumer to stop at exactly the same place, and forces the consumer
     // to maintain its own byte count.
     return std::make_unique<data_consume_context::impl>(
-            consumer, data_stream(start, end - start, consumer.io_priority()), end - start);
+            consumer, data_stream(start, end - start, consumer.io_priority(), consumer.use_chunk_cache()), end - start);
 }
 
 data_consume_context sstable::data_consume_rows(row_consumer& consumer) {
@@ -376,7 +377,7 @@ data_consume_context sstable::data_consume_rows(row_consumer& consumer) {
 
 future<> sstable::data_consume_rows_at_once(row_consumer& consumer,
         uint64_t start, uint64_t end) {
-    return data_read(start, end - start, consumer.io_priority()).then([&consumer]
+    return data_read(start, end - start, consumer.io_priority(), consumer.use_chunk_cache()).then([&consumer]
                                                (temporary_buffer<char> buf) {
         data_consume_rows_context ctx(consumer, input_stream<char>(), -1);
         ctx.process(buf);
@@ -384,4 +385,48 @@ future<> sstable::data_consume_rows_at_once(row_consumer& consumer,
     });
 }
 
+// The extents are read, in parallel, in rounds of at most this many bytes,
+// so that a slice of a huge partition isn't read into memory all at once.
+static constexpr uint64_t max_row_extents_read_size = 1 << 20;
+
+future<> sstable::data_consume_row_extents(row_consumer& consumer,
+        std::vector<std::pair<uint64_t, uint64_t>> extents) {
+    // The consumer is fed continuous data, so extents can be split anywhere.
+    std::vector<std::pair<uint64_t, uint64_t>> chunks;
+    for (auto& e : extents) {
+        for (auto pos = e.first; pos < e.second; pos += max_row_extents_read_size) {
+            chunks.emplace_back(pos, std::min(pos + max_row_extents_read_size, e.second));
+        }
+    }
+    return do_with(std::move(chunks), std::make_unique<data_consume_rows_context>(consumer, input_stream<char>(), -1), size_t(0),
+            [this, &consumer] (auto& chunks, auto& ctx, size_t& next) {
+        return do_until([&chunks, &next] { return next == chunks.size(); }, [this, &consumer, &chunks, &ctx, &next] {
+            auto begin = next;
+            uint64_t size = 0;
+            while (next < chunks.size() && (next == begin || size + chunks[next].second - chunks[next].first <= max_row_extents_read_size)) {
+                size += chunks[next].second - chunks[next].first;
+                ++next;
+            }
+            return do_with(std::vector<temporary_buffer<char>>(next - begin), [this, &consumer, &chunks, &ctx, begin, end = next] (auto& buffers) {
+                return parallel_for_each(boost::irange<size_t>(begin, end), [this, &consumer, &chunks, &buffers, begin] (size_t i) {
+                    auto& c = chunks[i];
+                    return this->data_read(c.first, c.second - c.first, consumer.io_priority(), consumer.use_chunk_cache()).then([&buffers, i, begin] (temporary_buffer<char> buf) {
+                        buffers[i - begin] = std::move(buf);
+                    });
+                }).then([&ctx, &buffers] {
+                    for (auto& buf : buffers) {
+                        ctx->process(buf);
+                    }
+                });
+            });
+        }).then([&ctx] {
+            // The extents hold whole atoms, but not the end of row marker.
+            temporary_buffer<char> end_of_row(sizeof(int16_t));
+            std::fill(end_of_row.get_write(), end_of_row.get_write() + end_of_row.size(), 0);
+            ctx->process(end_of_row);
+            ctx->verify_end_state();
+        });
+    });
+}
+
 }
@@ -83,5 +83,12 @@ class row_consumer {
     // Under which priority class to place I/O coming from this consumer
     virtual const io_priority_class& io_priority() = 0;
 
+    // Whether the data read for this consumer should go through the chunk
+    // cache. Readers which go through the data only once, like compaction
+    // and streaming, turn it off so as not to evict chunks queries reuse.
+    virtual bool use_chunk_cache() {
+        return true;
+    }
+
     virtual ~row_consumer() { }
 };
@@ -35,6 +35,8 @@
 #include "types.hh"
 #include "sstables.hh"
 #include "compress.hh"
+#include "chunk_cache.hh"
+#include "index_page_cache.hh"
 #include "unimplemented.hh"
 #include "index_reader.hh"
 #include "remove.hh"
@@ -66,6 +68,8 @@ future<file> new_sstable_component_file(disk_error_signal_type& signal, sstring
 }
 
 thread_local std::unordered_map<sstring, std::unordered_set<unsigned>> sstable::_shards_agreeing_to_remove_sstable;
+thread_local size_t sstable::_column_index_size = 64 * 1024;
+thread_local utils::filter_format sstable::_filter_format = utils::filter_format::classic;
 
 static utils::phased_barrier& background_jobs() {
     static thread_local utils::phased_barrier gate;
@@ -153,6 +157,7 @@ std::unordered_map<sstable::component_type, sstring, enum_hash<sstable::componen
     { component_type::Filter, "Filter.db" },
     { component_type::Statistics, "Statistics.db" },
     { component_type::TemporaryTOC, TEMPORARY_TOC_SUFFIX },
+    { component_type::CompressionDictionary, "CompressionDictionary.db" },
 };
 
 // This assumes that the mappings are small enough, and called unfrequent
@@ -739,7 +744,7 @@ future<> sstable::read_toc() {
 
 }
 
-void sstable::generate_toc(compressor c, double filter_fp_chance) {
+void sstable::generate_toc(const compression_parameters& cp, double filter_fp_chance) {
     // Creating table of components.
     _components.insert(component_type::TOC);
     _components.insert(component_type::Statistics);
@@ -750,11 +755,14 @@ void sstable::generate_toc(compressor c, double filter_fp_chance) {
     if (filter_fp_chance != 1.0) {
         _components.insert(component_type::Filter);
     }
-    if (c == compressor::none) {
+    if (cp.get_compressor() == compressor::none) {
         _components.insert(component_type::CRC);
     } else {
         _components.insert(component_type::CompressionInfo);
     }
+    if (cp.get_compressor() == compressor::zstd && cp.zstd_dictionary_size()) {
+        _components.insert(component_type::CompressionDictionary);
+    }
 }
 
 void sstable::write_toc(const io_priority_class& pc) {
@@ -881,6 +889,50 @@ future<index_list> sstable::read_indexes(uint64_t summary_idx, const io_priority
     });
 }
 
+// Parsed index entries share the buffers the index was read into, which
+// would stay pinned for as long as the page is cached. Copy the keys and
+// promoted indexes of a page into a buffer of their own instead.
+static index_list compact_index_page(const index_list& il) {
+    size_t size = 0;
+    for (auto& ie : il) {
+        size += ie.get_key_bytes().size() + ie.get_promoted_index_bytes().size();
+    }
+    temporary_buffer<char> buf(size);
+    size_t pos = 0;
+    auto copy = [&buf, &pos] (bytes_view v) {
+        std::copy_n(reinterpret_cast<const char*>(v.data()), v.size(), buf.get_write() + pos);
+        auto b = buf.share(pos, v.size());
+        pos += v.size();
+        return b;
+    };
+    index_list compacted;
+    compacted.reserve(il.size());
+    for (auto& ie : il) {
+        auto key = copy(ie.get_key_bytes());
+        auto promoted_index = copy(ie.get_promoted_index_bytes());
+        compacted.emplace_back(std::move(key), ie.position(), std::move(promoted_index));
+    }
+    return compacted;
+}
+
+future<index_page_ptr> sstable::read_index_page(uint64_t summary_idx, const io_priority_class& pc) {
+    auto& cache = global_index_page_cache();
+    if (_cache_id) {
+        if (auto page = cache.get(_cache_id, summary_idx)) {
+            return make_ready_future<index_page_ptr>(std::move(page));
+        }
+    }
+    return read_indexes(summary_idx, pc).then([this, summary_idx, &cache] (index_list il) {
+        // Only a page which may be kept is worth compacting.
+        if (!_cache_id || !cache.max_size()) {
+            return make_lw_shared<const index_list>(std::move(il));
+        }
+        auto page = make_lw_shared<const index_list>(compact_index_page(il));
+        cache.put(_cache_id, summary_idx, page);
+        return page;
+    });
+}
+
 template <sstable::component_type Type, typename T>
 future<> sstable::read_simple(T& component, const io_priority_class& pc) {
 
@@ -939,6 +991,33 @@ void sstable::write_compression(const io_priority_class& pc) {
     write_simple<component_type::CompressionInfo>(_compression, pc);
 }
 
+future<> sstable::read_compression_dictionary(const io_priority_class& pc) {
+    if (!has_component(sstable::component_type::CompressionDictionary)) {
+        return make_ready_future<>();
+    }
+
+    auto dict = make_lw_shared<disk_string<uint32_t>>();
+    return read_simple<component_type::CompressionDictionary>(*dict, pc).then([this, dict] {
+        // An empty dictionary means training failed, and the chunks were
+        // compressed without one.
+        if (!dict->value.empty()) {
+            _compression.set_dictionary(make_lw_shared<const compression_dictionary>(std::move(dict->value)));
+        }
+    });
+}
+
+void sstable::write_compression_dictionary(const io_priority_class& pc) {
+    if (!has_component(sstable::component_type::CompressionDictionary)) {
+        return;
+    }
+
+    disk_string<uint32_t> dict;
+    if (_compression.dictionary()) {
+        dict.value = _compression.dictionary()->data();
+    }
+    write_simple<component_type::CompressionDictionary>(dict, pc);
+}
+
 future<> sstable::read_statistics(const io_priority_class& pc) {
     return read_simple<component_type::Statistics>(_statistics, pc);
 }
@@ -947,7 +1026,17 @@ void sstable::write_statistics(const io_priority_class& pc) {
     write_simple<component_type::Statistics>(_statistics, pc);
 }
 
+// Generations would not do as cache ids, as they repeat across column families.
+static uint64_t new_cache_id() {
+    // 0 is never returned, so that it can stand for "not cached".
+    static thread_local uint64_t next_id = 0;
+    return ++next_id;
+}
+
 future<> sstable::open_data() {
+    if (!_cache_id) {
+        _cache_id = new_cache_id();
+    }
     return when_all(open_checked_file_dma(sstable_read_error, filename(component_type::Index), open_flags::ro),
                     open_checked_file_dma(sstable_read_error, filename(component_type::Data), open_flags::ro))
                     .then([this] (auto files) {
@@ -956,6 +1045,7 @@ future<> sstable::open_data() {
         return _data_file.size().then([this] (auto size) {
             if (this->has_component(sstable::component_type::CompressionInfo)) {
                 _compression.update(size);
+                _compression.set_chunk_cache_id(_cache_id);
             } else {
                 _data_file_size = size;
             }
@@ -998,6 +1088,8 @@ future<> sstable::load() {
         return read_statistics(default_priority_class());
     }).then([this] {
         return read_compression(default_priority_class());
+    }).then([this] {
+        return read_compression_dictionary(default_priority_class());
     }).then([this] {
         return read_filter(default_priority_class());
     }).then([this] {;
@@ -1069,6 +1161,7 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t deletion_time = cell.deletion_time().time_since_epoch().count();
 
         _c_stats.tombstone_histogram.update(deletion_time);
+        _c_stats.update_max_local_deletion_time(deletion_time);
 
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (cell.is_live_and_has_ttl()) {
@@ -1079,6 +1172,8 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         uint32_t expiration = cell.expiry().time_since_epoch().count();
         disk_string_view<uint32_t> cell_value { cell.value() };
 
+        _c_stats.update_max_local_deletion_time(expiration);
+
         write(out, mask, ttl, expiration, timestamp, cell_value);
     } else {
         // regular cell
@@ -1086,6 +1181,8 @@ void sstable::write_cell(file_writer& out, atomic_cell_view cell) {
         column_mask mask = column_mask::none;
         disk_string_view<uint32_t> cell_value { cell.value() };
 
+        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
+
         write(out, mask, timestamp, cell_value);
     }
 }
@@ -1109,15 +1206,18 @@ void sstable::write_row_marker(file_writer& out, const rows_entry& clustered_row
         uint32_t deletion_time = marker.deletion_time().time_since_epoch().count();
 
         _c_stats.tombstone_histogram.update(deletion_time);
+        _c_stats.update_max_local_deletion_time(deletion_time);
 
         write(out, mask, timestamp, deletion_time_size, deletion_time);
     } else if (marker.is_expiring()) {
         column_mask mask = column_mask::expiration;
         uint32_t ttl = marker.ttl().count();
         uint32_t expiration = marker.expiry().time_since_epoch().count();
+        _c_stats.update_max_local_deletion_time(expiration);
         write(out, mask, ttl, expiration, timestamp, value_length);
     } else {
         column_mask mask = column_mask::none;
+        _c_stats.update_max_local_deletion_time(std::numeric_limits<int>::max());
         write(out, mask, timestamp, value_length);
     }
 }
@@ -1136,6 +1236,7 @@ void sstable::write_range_tombstone(file_writer& out, const composite& clusterin
 
     update_cell_stats(_c_stats, timestamp);
     _c_stats.tombstone_histogram.update(deletion_time);
+    _c_stats.update_max_local_deletion_time(deletion_time);
 
     write(out, deletion_time, timestamp);
 }
@@ -1211,11 +1312,109 @@ void sstable::write_static_row(file_writer& out, const schema& schema, const row
     });
 }
 
-static void write_index_entry(file_writer& out, disk_string_view<uint16_t>& key, uint64_t pos) {
-    // FIXME: support promoted indexes.
-    uint32_t promoted_index_size = 0;
+// Returns the name bounding the atoms under a clustering prefix, i.e. the
+// prefix ended with the given marker.
+template <typename ClusteringElement>
+static bytes prefix_name(const schema& schema, const ClusteringElement& prefix, composite_marker m) {
+    if (!schema.is_compound()) {
+        auto components = prefix.explode(schema);
+        return components.empty() ? bytes() : std::move(components.front());
+    }
+    auto c = composite::from_clustering_element(schema, prefix);
+    bytes name(bytes_view(c).begin(), c.size());
+    if (!name.empty()) {
+        name.back() = bytes::value_type(m);
+    }
+    return name;
+}
+
+// Builds the promoted index of a partition while it is written: the atoms
+// are split in blocks of at least column_index_size bytes, each holding
+// whole rows, so that reads can skip to the blocks they need. Names are
+// only computed for the ends of blocks, so the atoms of a block have to
+// be written in clustering order; range tombstones are written before the
+// rows, so the caller ends the block between the two with end_block().
+class promoted_index_builder {
+    struct block {
+        bytes first_name;
+        bytes last_name;
+        uint64_t offset;
+        uint64_t width;
+    };
+    uint64_t _partition_start;
+    size_t _block_size;
+    std::vector<block> _blocks;
+    bool _block_open = false;
+    std::function<bytes ()> _last_name;
+public:
+    promoted_index_builder(uint64_t partition_start, size_t block_size)
+        : _partition_start(partition_start)
+        , _block_size(block_size)
+    { }
+
+    // To be called before writing the atoms of a row, the static row or a
+    // range tombstone, at data file offset pos.
+    template <typename Func>
+    void start_row(uint64_t pos, Func&& first_name) {
+        if (!_block_open) {
+            _blocks.push_back({ first_name(), bytes(), pos - _partition_start, 0 });
+            _block_open = true;
+        }
+    }
+
+    // To be called after the atoms were written, up to data file offset pos.
+    // last_name must remain callable until finish().
+    void end_row(uint64_t pos, std::function<bytes ()> last_name) {
+        auto& b = _blocks.back();
+        b.width = pos - _partition_start - b.offset;
+        if (b.width >= _block_size) {
+            b.last_name = last_name();
+            _block_open = false;
+        } else {
+            _last_name = std::move(last_name);
+        }
+    }
+
+    // Ends the current block, if any, so the next row starts a new one.
+    void end_block() {
+        if (_block_open) {
+            _blocks.back().last_name = _last_name();
+            _block_open = false;
+        }
+    }
+
+    void finish() {
+        end_block();
+        _last_name = {};
+    }
 
-    write(out, key, pos, promoted_index_size);
+    void write(file_writer& out, deletion_time d) {
+        // Like Origin, don't bother with an index of a single block.
+        if (_blocks.size() < 2) {
+            uint32_t promoted_index_size = 0;
+            sstables::write(out, promoted_index_size);
+            return;
+        }
+        uint32_t promoted_index_size = sizeof(d.local_deletion_time) + sizeof(d.marked_for_delete_at) + sizeof(uint32_t);
+        for (auto& b : _blocks) {
+            promoted_index_size += 2 * sizeof(uint16_t) + b.first_name.size() + b.last_name.size() + 2 * sizeof(uint64_t);
+        }
+        uint32_t count = _blocks.size();
+        sstables::write(out, promoted_index_size, d, count);
+        for (auto& b : _blocks) {
+            disk_string_view<uint16_t> first_name;
+            first_name.value = bytes_view(b.first_name);
+            disk_string_view<uint16_t> last_name;
+            last_name.value = bytes_view(b.last_name);
+            sstables::write(out, first_name, last_name, b.offset, b.width);
+        }
+    }
+};
+
+static void write_index_entry(file_writer& out, disk_string_view<uint16_t>& key, uint64_t pos,
+        promoted_index_builder& promoted_index, const deletion_time& d) {
+    write(out, key, pos);
+    promoted_index.write(out, d);
 }
 
 static void prepare_summary(summary& s, uint64_t expected_partition_count, const schema& schema) {
@@ -1269,6 +1468,13 @@ static void prepare_compression(compression& c, const schema& schema) {
     // defaults to 1.0.
     c.options.elements.push_back({"crc_check_chance", "1.0"});
     c.init_full_checksum();
+    if (cp.get_compressor() == compressor::zstd && cp.zstd_dictionary_size()) {
+        // Train our own dictionary, unless we were handed one.
+        c.set_dictionary_training_size(c.dictionary() ? 0 : cp.zstd_dictionary_size());
+    } else {
+        c.set_dictionary({});
+        c.set_dictionary_training_size(0);
+    }
 }
 
 static void maybe_add_summary_entry(summary& s, bytes_view key, uint64_t offset) {
@@ -1323,10 +1529,10 @@ void sstable::do_write_components(::mutation_reader mr,
     file_output_stream_options options;
     options.buffer_size = sstable_buffer_size;
     options.io_priority_class = pc;
-    auto index = make_shared<file_writer>(_index_file, std::move(options));
+    auto index = make_shared<file_writer>(make_write_behind_file_output_stream(_index_file, std::move(options)));
 
     auto filter_fp_chance = schema->bloom_filter_fp_chance();
-    _filter = utils::i_filter::get_filter(estimated_partitions, filter_fp_chance);
+    _filter = utils::i_filter::get_filter(estimated_partitions, filter_fp_chance, _filter_format);
 
     prepare_summary(_summary, estimated_partitions, *schema);
 
@@ -1349,15 +1555,12 @@ void sstable::do_write_components(::mutation_reader mr,
         auto partition_key = key::from_partition_key(*schema, mut->key());
 
         maybe_add_summary_entry(_summary, bytes_view(partition_key), index->offset());
-        _filter->add(bytes_view(partition_key));
+        _filter->add(mut->decorated_key().key_hash(*schema));
         _collector.add_key(bytes_view(partition_key));
 
         auto p_key = disk_string_view<uint16_t>();
         p_key.value = bytes_view(partition_key);
 
-        // Write index file entry from partition key into index file.
-        write_index_entry(*index, p_key, out.offset());
-
         // Write partition key into data file.
         write(out, p_key);
 
@@ -1379,22 +1582,48 @@ void sstable::do_write_components(::mutation_reader mr,
         }
         write(out, d);
 
+        promoted_index_builder promoted_index(_c_stats.start_offset, _column_index_size);
         auto& partition = mut->partition();
         auto& static_row = partition.static_row();
 
-        write_static_row(out, *schema, static_row);
+        if (!static_row.empty()) {
+            auto static_name = [&schema] {
+                return to_bytes(bytes_view(composite::static_prefix(*schema)));
+            };
+            promoted_index.start_row(out.offset(), static_name);
+            write_static_row(out, *schema, static_row);
+            promoted_index.end_row(out.offset(), static_name);
+        }
         for (const auto& rt: partition.row_tombstones()) {
             auto prefix = composite::from_clustering_element(*schema, rt.prefix());
+            promoted_index.start_row(out.offset(), [&] {
+                return prefix_name(*schema, rt.prefix(), composite_marker::start_range);
+            });
             write_range_tombstone(out, prefix, {}, rt.t());
+            promoted_index.end_row(out.offset(), [&schema, &rt] {
+                return prefix_name(*schema, rt.prefix(), composite_marker::end_range);
+            });
         }
+        // The rows start over from the lowest clustering key.
+        promoted_index.end_block();
 
         // Write all CQL rows from a given mutation partition.
         for (auto& clustered_row: partition.clustered_rows()) {
+            promoted_index.start_row(out.offset(), [&] {
+                return prefix_name(*schema, clustered_row.key(), composite_marker::none);
+            });
             write_clustered_row(out, *schema, clustered_row);
+            promoted_index.end_row(out.offset(), [&schema, &clustered_row] {
+                return prefix_name(*schema, clustered_row.key(), composite_marker::end_range);
+            });
         }
         int16_t end_of_row = 0;
         write(out, end_of_row);
 
+        // Write index file entry, with the promoted index, into index file.
+        promoted_index.finish();
+        write_index_entry(*index, p_key, _c_stats.start_offset, promoted_index, d);
+
         // compute size of the current row.
         _c_stats.row_size = out.offset() - _c_stats.start_offset;
         // update is about merging column_stats with the data being stored by collector.
@@ -1441,6 +1670,7 @@ void sstable::prepare_write_components(::mutation_reader mr, uint64_t estimated_
         write_crc(filename(sstable::component_type::CRC), w->finalize_checksum());
     } else {
         file_output_stream_options options;
+        options.buffer_size = sstable_buffer_size;
         options.io_priority_class = pc;
 
         prepare_compression(_compression, *schema);
@@ -1462,15 +1692,23 @@ future<> sstable::write_components(memtable& mt, bool backup, const io_priority_
 future<> sstable::write_components(::mutation_reader mr,
         uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size, bool backup, const io_priority_class& pc) {
     return seastar::async([this, mr = std::move(mr), estimated_partitions, schema = std::move(schema), max_sstable_size, backup, &pc] () mutable {
-        generate_toc(schema->get_compressor_params().get_compressor(), schema->bloom_filter_fp_chance());
+        generate_toc(schema->get_compressor_params(), schema->bloom_filter_fp_chance());
         write_toc(pc);
         create_data().get();
         prepare_write_components(std::move(mr), estimated_partitions, std::move(schema), max_sstable_size, pc);
-        write_summary(pc);
-        write_filter(pc);
-        write_statistics(pc);
-        // NOTE: write_compression means maybe_write_compression.
-        write_compression(pc);
+        // The remaining components were built along with Data and are
+        // independent of each other, so write them concurrently.
+        std::vector<std::function<void ()>> writers = {
+            [this, &pc] { write_summary(pc); },
+            [this, &pc] { write_filter(pc); },
+            [this, &pc] { write_statistics(pc); },
+            // NOTE: write_compression means maybe_write_compression.
+            [this, &pc] { write_compression(pc); },
+            [this, &pc] { write_compression_dictionary(pc); },
+        };
+        parallel_for_each(writers, [] (std::function<void ()>& w) {
+            return seastar::async(w);
+        }).get();
         seal_sstable();
 
         if (backup) {
@@ -1623,36 +1861,51 @@ sstable::component_type sstable::component_from_sstring(sstring &s) {
     return reverse_map(s, _component_map);
 }
 
+const sstring& sstable::component_to_sstring(component_type c) {
+    return _component_map.at(c);
+}
+
+const sstring& sstable::version_to_sstring(version_types v) {
+    return _version_string.at(v);
+}
+
+const sstring& sstable::format_to_sstring(format_types f) {
+    return _format_string.at(f);
+}
+
 // NOTE: Prefer using data_stream() if you know the byte position at which the
 // read will stop. Knowing the end allows data_stream() to use a large a read-
 // ahead buffer before reaching the end, but not over-read at the end, so
 // data_stream() is more efficient than data_stream_at().
-input_stream<char> sstable::data_stream_at(uint64_t pos, uint64_t buf_size, const io_priority_class& pc) {
+input_stream<char> sstable::data_stream_at(uint64_t pos, uint64_t buf_size, const io_priority_class& pc,
+        bool use_chunk_cache) {
     file_input_stream_options options;
     options.buffer_size = buf_size;
     options.io_priority_class = pc;
     if (_compression) {
         return make_compressed_file_input_stream(_data_file, &_compression,
-                pos, _compression.data_len - pos, std::move(options));
+                pos, _compression.data_len - pos, std::move(options), use_chunk_cache);
     } else {
         return make_file_input_stream(_data_file, pos, std::move(options));
     }
 }
 
-input_stream<char> sstable::data_stream(uint64_t pos, size_t len, const io_priority_class& pc) {
+input_stream<char> sstable::data_stream(uint64_t pos, size_t len, const io_priority_class& pc,
+        bool use_chunk_cache) {
     file_input_stream_options options;
     options.buffer_size = sstable_buffer_size;
     options.io_priority_class = pc;
     if (_compression) {
         return make_compressed_file_input_stream(_data_file, &_compression,
-                pos, len, std::move(options));
+                pos, len, std::move(options), use_chunk_cache);
     } else {
         return make_file_input_stream(_data_file, pos, len, std::move(options));
     }
 }
 
-future<temporary_buffer<char>> sstable::data_read(uint64_t pos, size_t len, const io_priority_class& pc) {
-    return do_with(data_stream(pos, len, pc), [len] (auto& stream) {
+future<temporary_buffer<char>> sstable::data_read(uint64_t pos, size_t len, const io_priority_class& pc,
+        bool use_chunk_cache) {
+    return do_with(data_stream(pos, len, pc, use_chunk_cache), [len] (auto& stream) {
         return stream.read_exactly(len);
     });
 }
@@ -1729,6 +1982,10 @@ int sstable::compare_by_max_timestamp(const sstable& other) const {
 }
 
 sstable::~sstable() {
+    if (_cache_id) {
+        global_chunk_cache().invalidate(_cache_id);
+        global_index_page_cache().invalidate(_cache_id);
+    }
     if (_index_file) {
         _index_file.close().handle_exception([save = _index_file, op = background_jobs().start()] (auto ep) {
             sstlog.warn("sstable close index_file failed: {}", ep);
@@ -110,6 +110,7 @@ class mutation_reader {
 class key;
 
 using index_list = std::vector<index_entry>;
+using index_page_ptr = lw_shared_ptr<const index_list>;
 
 class sstable {
 public:
@@ -124,6 +125,7 @@ class sstable {
         Filter,
         Statistics,
         TemporaryTOC,
+        CompressionDictionary,
     };
     enum class version_types { ka, la };
     enum class format_types { big };
@@ -152,6 +154,12 @@ class sstable {
     // object lives until then (e.g., using the do_with() idiom).
     future<> data_consume_rows_at_once(row_consumer& consumer, uint64_t pos, uint64_t end);
 
+    // Like data_consume_rows_at_once(), for a single partition stored in
+    // several [start, end) extents of the data file: the first one must begin
+    // with the partition's header, and together they must hold whole atoms,
+    // but not the end of row marker. The extents are read in parallel.
+    future<> data_consume_row_extents(row_consumer& consumer, std::vector<std::pair<uint64_t, uint64_t>> extents);
+
 
     // data_consume_rows() iterates over rows in the data file from
     // a particular range, feeding them into the consumer. The iteration is
@@ -177,6 +185,9 @@ class sstable {
     static component_type component_from_sstring(sstring& s);
     static version_types version_from_sstring(sstring& s);
     static format_types format_from_sstring(sstring& s);
+    static const sstring& component_to_sstring(component_type c);
+    static const sstring& version_to_sstring(version_types v);
+    static const sstring& format_to_sstring(format_types f);
     static const sstring filename(sstring dir, sstring ks, sstring cf, version_types version, int64_t generation,
                                   format_types format, component_type component);
     // WARNING: it should only be called to remove components of a sstable with
@@ -193,8 +204,54 @@ class sstable {
         return _generation;
     }
 
+    version_types get_version() const {
+        return _version;
+    }
+
+    format_types get_format() const {
+        return _format;
+    }
+
+    // Components listed in the TOC, including the TOC itself.
+    std::vector<component_type> all_components() const {
+        return std::vector<component_type>(_components.begin(), _components.end());
+    }
+
     future<mutation_opt> read_row(schema_ptr schema, const key& k,
                                   const io_priority_class& pc = default_priority_class());
+
+    // Like read_row(), but the returned partition is only guaranteed to hold
+    // the rows falling into ck_ranges, besides its static row and tombstones.
+    // If the partition has a promoted index, only the blocks which may hold
+    // such rows are read.
+    future<mutation_opt> read_row(schema_ptr schema, const key& k, const query::clustering_row_ranges& ck_ranges,
+                                  const io_priority_class& pc = default_priority_class());
+
+    // Returns true if the partition is present and has a promoted index,
+    // i.e. spans more than one block of column_index_size bytes.
+    future<bool> has_promoted_index(const key& k, const io_priority_class& pc = default_priority_class());
+
+    // Like read_row() and has_promoted_index(), for a key the caller already
+    // found in the filter by its hash (see filter_has_key(const utils::hashed_key&)), and whose
+    // token it knows, so that the key is neither hashed nor probed again.
+    future<mutation_opt> read_row(schema_ptr schema, const key& k, const dht::token& token,
+                                  const io_priority_class& pc = default_priority_class());
+    future<mutation_opt> read_row(schema_ptr schema, const key& k, const dht::token& token,
+                                  const query::clustering_row_ranges& ck_ranges,
+                                  const io_priority_class& pc = default_priority_class());
+    future<bool> has_promoted_index(const key& k, const dht::token& token,
+                                    const io_priority_class& pc = default_priority_class());
+
+    // Sets the granularity of the promoted index of sstables written on this
+    // shard, see column_index_size_in_kb.
+    static void set_column_index_size(size_t size) {
+        _column_index_size = size;
+    }
+
+    // Sets the layout of the bloom filters of sstables written on this shard.
+    static void set_filter_format(utils::filter_format format) {
+        _filter_format = format;
+    }
     /**
      * @param schema a schema_ptr object describing this table
      * @param min the minimum token we want to search for (inclusive)
@@ -204,11 +261,12 @@ class sstable {
      */
     mutation_reader read_range_rows(schema_ptr schema,
             const dht::token& min, const dht::token& max,
-            const io_priority_class& pc = default_priority_class());
+            const io_priority_class& pc = default_priority_class(), bool use_chunk_cache = true);
 
     // Returns a mutation_reader for given range of partitions
     mutation_reader read_range_rows(schema_ptr schema, const query::partition_range& range,
-                                    const io_priority_class& pc = default_priority_class());
+                                    const io_priority_class& pc = default_priority_class(),
+                                    bool use_chunk_cache = true);
 
     // read_rows() returns each of the rows in the sstable, in sequence,
     // converted to a "mutation" data structure.
@@ -221,7 +279,11 @@ class sstable {
     // The caller must ensure (e.g., using do_with()) that the context object,
     // as well as the sstable, remains alive as long as a read() is in
     // progress (i.e., returned a future which hasn't completed yet).
-    mutation_reader read_rows(schema_ptr schema, const io_priority_class& pc = default_priority_class());
+    //
+    // Readers which go through the rows only once, like compaction and
+    // streaming, should pass use_chunk_cache = false.
+    mutation_reader read_rows(schema_ptr schema, const io_priority_class& pc = default_priority_class(),
+                              bool use_chunk_cache = true);
 
     // Write sstable components from a memtable.
     future<> write_components(memtable& mt, bool backup = false,
@@ -264,6 +326,16 @@ class sstable {
         _shared = false;
     }
 
+    // Compress the data file with the given dictionary, instead of training
+    // a new one, if the schema asks for a zstd dictionary. Must be called
+    // before write_components().
+    void set_compression_dictionary(lw_shared_ptr<const compression_dictionary> d) {
+        _compression.set_dictionary(std::move(d));
+    }
+    const lw_shared_ptr<const compression_dictionary>& get_compression_dictionary() const {
+        return _compression.dictionary();
+    }
+
     uint64_t data_size() const;
     uint64_t index_size() const {
         return _index_file_size;
@@ -334,6 +406,8 @@ class sstable {
     { }
 
     size_t sstable_buffer_size = 128*1024;
+    static thread_local size_t _column_index_size;
+    static thread_local utils::filter_format _filter_format;
 
     void do_write_components(::mutation_reader mr,
             uint64_t estimated_partitions, schema_ptr schema, uint64_t max_sstable_size,
@@ -350,6 +424,9 @@ class sstable {
     std::unordered_set<component_type, enum_hash<component_type>> _components;
 
     bool _shared = true;  // across shards; safe default
+    // Identifies this sstable's data in shard-local caches (see
+    // chunk_cache and index_page_cache); assigned when the data is opened.
+    uint64_t _cache_id = 0;
     compression _compression;
     utils::filter_ptr _filter;
     summary _summary;
@@ -388,13 +465,16 @@ class sstable {
     template <sstable::component_type Type, typename T>
     void write_simple(T& comp, const io_priority_class& pc);
 
-    void generate_toc(compressor c, double filter_fp_chance);
+    void generate_toc(const compression_parameters& cp, double filter_fp_chance);
     void write_toc(const io_priority_class& pc);
     void seal_sstable();
 
     future<> read_compression(const io_priority_class& pc);
     void write_compression(const io_priority_class& pc);
 
+    future<> read_compression_dictionary(const io_priority_class& pc);
+    void write_compression_dictionary(const io_priority_class& pc);
+
     future<> read_filter(const io_priority_class& pc);
 
     void write_filter(const io_priority_class& pc);
@@ -412,8 +492,32 @@ class sstable {
     future<> create_data();
 
     future<index_list> read_indexes(uint64_t summary_idx, const io_priority_class& pc);
+    // Like read_indexes(), but served from the index_page_cache if possible.
+    future<index_page_ptr> read_index_page(uint64_t summary_idx, const io_priority_class& pc);
+
+    struct index_entry_ref {
+        index_page_ptr page;
+        uint64_t summary_idx;
+        int index_idx;
 
-    input_stream<char> data_stream_at(uint64_t pos, uint64_t buf_size, const io_priority_class& pc);
+        const index_entry& entry() const {
+            return (*page)[index_idx];
+        }
+    };
+    // Looks the key up in the summary and the index; returns a disengaged
+    // optional if the key is not in this sstable.
+    future<std::experimental::optional<index_entry_ref>> find_index_entry(const key& k, const io_priority_class& pc);
+    // Like find_index_entry(), for a key already found in the filter.
+    future<std::experimental::optional<index_entry_ref>> find_index_entry(const key& k, const dht::token& token,
+            const io_priority_class& pc);
+    // Read the partition at the index entry, once it is found.
+    future<mutation_opt> read_row_at(schema_ptr schema, const key& k,
+            future<std::experimental::optional<index_entry_ref>> entry, const io_priority_class& pc);
+    future<mutation_opt> read_row_at(schema_ptr schema, const key& k, const query::clustering_row_ranges& ck_ranges,
+            future<std::experimental::optional<index_entry_ref>> entry, const io_priority_class& pc);
+
+    input_stream<char> data_stream_at(uint64_t pos, uint64_t buf_size, const io_priority_class& pc,
+            bool use_chunk_cache = true);
 
     // Return an input_stream which reads exactly the specified byte range
     // from the data file (after uncompression, if the file is compressed).
@@ -423,7 +527,8 @@ class sstable {
     // of bytes to be read using this stream, we can make better choices
     // about the buffer size to read, and where exactly to stop reading
     // (even when a large buffer size is used).
-    input_stream<char> data_stream(uint64_t pos, size_t len, const io_priority_class& pc);
+    input_stream<char> data_stream(uint64_t pos, size_t len, const io_priority_class& pc,
+            bool use_chunk_cache = true);
 
     // Read exactly the specific byte range from the data file (after
     // uncompression, if the file is compressed). This can be used to read
@@ -431,7 +536,8 @@ class sstable {
     // determined using the index file).
     // This function is intended (and optimized for) random access, not
     // for iteration through all the rows.
-    future<temporary_buffer<char>> data_read(uint64_t pos, size_t len, const io_priority_class& pc);
+    future<temporary_buffer<char>> data_read(uint64_t pos, size_t len, const io_priority_class& pc,
+            bool use_chunk_cache = true);
 
     future<uint64_t> data_end_position(uint64_t summary_idx, uint64_t index_idx, const index_list& il, const io_priority_class& pc);
 
@@ -462,9 +568,7 @@ class sstable {
 
     future<summary_entry&> read_summary_entry(size_t i);
 
-    // FIXME: pending on Bloom filter implementation
-    bool filter_has_key(const key& key) { return _filter->is_present(bytes_view(key)); }
-    bool filter_has_key(const schema& s, const dht::decorated_key& dk) { return filter_has_key(key::from_partition_key(s, dk._key)); }
+    bool filter_has_key(const schema& s, const dht::decorated_key& dk) { return filter_has_key(dk.key_hash(s)); }
 
     // NOTE: functions used to generate sstable components.
     void write_row_marker(file_writer& out, const rows_entry& clustered_row, const composite& clustering_key);
@@ -478,6 +582,12 @@ class sstable {
 public:
     future<> read_toc();
 
+    bool filter_has_key(const key& key) { return _filter->is_present(bytes_view(key)); }
+
+    // Probes the filter with an already computed hash of the key, so that a
+    // key can be looked up in many sstables while hashing it once.
+    bool filter_has_key(const utils::hashed_key& hash) { return _filter->is_present(hash); }
+
     bool filter_has_key(const schema& s, partition_key_view key) {
         return filter_has_key(key::from_partition_key(s, key));
     }
@@ -524,6 +634,17 @@ class sstable {
         return s;
     }
 
+    // Returns the generations of the sstables this one was compacted from,
+    // or an empty vector if that isn't known.
+    std::vector<uint32_t> ancestors() const {
+        auto entry = _statistics.contents.find(metadata_type::Compaction);
+        if (entry == _statistics.contents.end() || !entry->second) {
+            return {};
+        }
+        auto& elements = static_cast<const compaction_metadata *>(entry->second.get())->ancestors.elements;
+        return std::vector<uint32_t>(elements.begin(), elements.end());
+    }
+
     uint32_t get_sstable_level() const {
         return get_stats_metadata().sstable_level;
     }
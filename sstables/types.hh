@@ -46,6 +46,9 @@ struct option {
 };
 
 struct filter {
+    // Set in hashes for filters in the blocked layout, which only we can read.
+    static constexpr uint32_t blocked_format_flag = 1u << 31;
+
     uint32_t hashes;
     disk_array<uint32_t, uint64_t> buckets;
 
@@ -75,6 +78,10 @@ class index_entry {
         return _position;
     }
 
+    bytes_view get_promoted_index_bytes() const {
+        return bytes_view(reinterpret_cast<const bytes::value_type *>(_promoted_index.get()), _promoted_index.size());
+    }
+
     index_entry(temporary_buffer<char>&& key, uint64_t position, temporary_buffer<char>&& promoted_index)
         : _key(std::move(key)), _position(position), _promoted_index(std::move(promoted_index)) {}
 
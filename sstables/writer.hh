@@ -23,9 +23,14 @@
 
 #include "core/iostream.hh"
 #include "core/fstream.hh"
+#include "core/future-util.hh"
+#include "core/semaphore.hh"
+#include "core/align.hh"
 #include "types.hh"
 #include "compress.hh"
 
+#include <malloc.h>
+
 namespace sstables {
 
 class file_writer {
@@ -60,6 +65,182 @@ class file_writer {
     }
 };
 
+// A data sink which keeps several DMA writes in flight, so that the disk
+// works on the previous buffers while the next ones are being serialized,
+// compressed and checksummed. Data is staged into aligned buffers of
+// options.buffer_size bytes; the file is padded to the alignment and
+// truncated back to the size of the data when closed.
+// Like the commitlog does for its segments, the file is extended ahead of
+// the writes, a chunk at a time, so that the writes in flight don't append
+// past the end of the file, which the filesystem would serialize.
+class write_behind_data_sink_impl : public data_sink_impl {
+    static constexpr size_t alignment = 4096;
+public:
+    static constexpr uint64_t truncate_ahead = 32 << 20;
+private:
+
+    // Shared with the writes in flight, which may outlive the sink if it is
+    // destroyed without being closed.
+    struct state {
+        file f;
+        io_priority_class pc;
+        semaphore writes;
+        std::exception_ptr error;
+
+        state(file f, io_priority_class pc, unsigned max_writes_in_flight)
+            : f(std::move(f)), pc(pc), writes(max_writes_in_flight) {}
+    };
+    lw_shared_ptr<state> _state;
+    unsigned _max_writes_in_flight;
+    size_t _buffer_size;
+    temporary_buffer<char> _staging;
+    size_t _staged = 0;
+    // File position of the staging buffer.
+    uint64_t _pos = 0;
+    // Size the file was extended to.
+    uint64_t _file_size = 0;
+
+    static temporary_buffer<char> allocate(size_t size) {
+        auto p = ::memalign(alignment, size);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return temporary_buffer<char>(static_cast<char*>(p), size, make_free_deleter(p));
+    }
+
+    static future<> write_fully(lw_shared_ptr<state> st, uint64_t pos, temporary_buffer<char> buf) {
+        auto written = make_lw_shared<size_t>(0);
+        auto p = buf.get();
+        auto size = buf.size();
+        return repeat([st, pos, p, size, written] {
+            return st->f.dma_write(pos + *written, p + *written, size - *written, st->pc).then([size, written] (size_t n) {
+                *written += n;
+                if (*written == size) {
+                    return stop_iteration::yes;
+                }
+                // Partial write; retry from the last aligned position.
+                *written = align_down(*written, alignment);
+                return stop_iteration::no;
+            });
+        }).finally([buf = std::move(buf)] {});
+    }
+
+    // Extends the file past end, if it doesn't already reach it. The writes
+    // in flight are all below the current size.
+    future<> extend(uint64_t end) {
+        if (end <= _file_size) {
+            return make_ready_future<>();
+        }
+        _file_size = align_up(end, truncate_ahead);
+        return _state->f.truncate(_file_size);
+    }
+
+    // Starts writing buf at the next position, waiting only for a write to
+    // complete if there are too many in flight.
+    future<> submit(temporary_buffer<char> buf) {
+        return _state->writes.wait().then([this, buf = std::move(buf)] () mutable {
+            auto st = _state;
+            if (st->error) {
+                st->writes.signal();
+                return make_exception_future<>(st->error);
+            }
+            auto pos = _pos;
+            _pos += buf.size();
+            return extend(_pos).then_wrapped([st, pos, buf = std::move(buf)] (future<> f) mutable {
+                try {
+                    f.get();
+                } catch (...) {
+                    st->error = std::current_exception();
+                    st->writes.signal();
+                    throw;
+                }
+                write_fully(st, pos, std::move(buf)).then_wrapped([st] (future<> f) {
+                    try {
+                        f.get();
+                    } catch (...) {
+                        st->error = std::current_exception();
+                    }
+                    st->writes.signal();
+                });
+            });
+        });
+    }
+public:
+    write_behind_data_sink_impl(file f, file_output_stream_options options, unsigned max_writes_in_flight)
+            : _state(make_lw_shared<state>(std::move(f), options.io_priority_class, max_writes_in_flight))
+            , _max_writes_in_flight(max_writes_in_flight)
+            , _buffer_size(align_up(size_t(options.buffer_size), alignment)) {}
+
+    future<> put(net::packet data) { abort(); }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        if (!_staged && buf.size() == _buffer_size && (reinterpret_cast<uintptr_t>(buf.get()) & (alignment - 1)) == 0) {
+            return submit(std::move(buf));
+        }
+        return do_with(std::move(buf), [this] (temporary_buffer<char>& buf) {
+            return repeat([this, &buf] {
+                if (buf.empty()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                if (!_staged) {
+                    _staging = allocate(_buffer_size);
+                }
+                auto n = std::min(_buffer_size - _staged, buf.size());
+                std::copy_n(buf.get(), n, _staging.get_write() + _staged);
+                _staged += n;
+                buf.trim_front(n);
+                if (_staged < _buffer_size) {
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
+                }
+                _staged = 0;
+                return submit(std::move(_staging)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    virtual future<> close() override {
+        auto size = _pos + _staged;
+        auto f = make_ready_future<>();
+        if (_staged) {
+            auto aligned = align_up(_staged, alignment);
+            std::fill(_staging.get_write() + _staged, _staging.get_write() + aligned, 0);
+            _staging.trim(aligned);
+            _staged = 0;
+            f = submit(std::move(_staging));
+        }
+        return f.then([this] {
+            return _state->writes.wait(_max_writes_in_flight);
+        }).then([this, size] {
+            if (_state->error) {
+                return make_exception_future<>(_state->error);
+            }
+            // Drops the padding of the last buffer, and what the file was
+            // extended by past it.
+            return _state->f.truncate(size);
+        }).then([this] {
+            return _state->f.flush();
+        }).then([this] {
+            return _state->f.close();
+        });
+    }
+};
+
+class write_behind_data_sink : public data_sink {
+public:
+    write_behind_data_sink(file f, file_output_stream_options options, unsigned max_writes_in_flight)
+        : data_sink(std::make_unique<write_behind_data_sink_impl>(std::move(f), std::move(options), max_writes_in_flight)) {}
+};
+
+static constexpr unsigned default_max_writes_in_flight = 4;
+
+inline
+output_stream<char> make_write_behind_file_output_stream(file f, file_output_stream_options options,
+        unsigned max_writes_in_flight = default_max_writes_in_flight) {
+    auto buffer_size = options.buffer_size;
+    return output_stream<char>(write_behind_data_sink(std::move(f), std::move(options), max_writes_in_flight), buffer_size, true);
+}
+
 output_stream<char> make_checksummed_file_output_stream(file f, struct checksum& cinfo, uint32_t& full_file_checksum, bool checksum_file, file_output_stream_options options);
 
 class checksummed_file_writer : public file_writer {
@@ -92,7 +273,7 @@ class checksummed_file_data_sink_impl : public data_sink_impl {
     bool _checksum_file;
 public:
     checksummed_file_data_sink_impl(file f, struct checksum& c, uint32_t& full_file_checksum, bool checksum_file, file_output_stream_options options)
-            : _out(make_file_output_stream(std::move(f), std::move(options)))
+            : _out(make_write_behind_file_output_stream(std::move(f), std::move(options)))
             , _c(c)
             , _full_checksum(full_file_checksum)
             , _checksum_file(checksum_file)
@@ -140,17 +321,45 @@ output_stream<char> make_checksummed_file_output_stream(file f, struct checksum&
 // compressed_file_data_sink_impl works as a filter for a file output stream,
 // where the buffer flushed will be compressed and its checksum computed, then
 // the result passed to a regular output stream.
+//
+// It is handed a batch of chunks at a time. Since compressing a batch can
+// take a while, it yields to the reactor whenever it has been running for
+// more than compression_task_quota().
 class compressed_file_data_sink_impl : public data_sink_impl {
+    using clock_type = std::chrono::steady_clock;
+    static clock_type::duration compression_task_quota() {
+        return std::chrono::microseconds(500);
+    }
+
     output_stream<char> _out;
     sstables::compression* _compression_metadata;
     size_t _pos = 0;
-public:
-    compressed_file_data_sink_impl(file f, sstables::compression* cm, file_output_stream_options options)
-            : _out(make_file_output_stream(std::move(f), options))
-            , _compression_metadata(cm) {}
+    // Chunks held back until there are enough of them to train a dictionary.
+    std::vector<temporary_buffer<char>> _pending;
+    size_t _pending_size = 0;
 
-    future<> put(net::packet data) { abort(); }
-    virtual future<> put(temporary_buffer<char> buf) override {
+    // zstd suggests training on about a hundred times the dictionary size;
+    // cap it, since training time grows with the samples.
+    static constexpr size_t dictionary_sample_factor = 100;
+
+    size_t dictionary_sample_size() const {
+        return std::min(_compression_metadata->dictionary_training_size() * dictionary_sample_factor,
+                sstables::compression_dictionary::max_sample_size);
+    }
+
+    future<> flush_pending() {
+        auto pending = std::move(_pending);
+        _pending_size = 0;
+        return do_with(std::move(pending), [this] (std::vector<temporary_buffer<char>>& pending) {
+            return _compression_metadata->train_dictionary(pending).then([this, &pending] {
+                return do_for_each(pending, [this] (temporary_buffer<char>& buf) {
+                    return write_chunk(std::move(buf));
+                });
+            });
+        });
+    }
+
+    future<> write_chunk(temporary_buffer<char> buf) {
         auto output_len = _compression_metadata->compress_max_size(buf.size());
         // account space for checksum that goes after compressed data.
         temporary_buffer<char> compressed(output_len + 4);
@@ -180,8 +389,51 @@ class compressed_file_data_sink_impl : public data_sink_impl {
         auto f = _out.write(compressed.get(), compressed.size());
         return f.then([compressed = std::move(compressed)] {});
     }
+public:
+    future<> put_chunk(temporary_buffer<char> buf) {
+        if (!_compression_metadata->needs_dictionary()) {
+            return write_chunk(std::move(buf));
+        }
+        _pending_size += buf.size();
+        _pending.push_back(std::move(buf));
+        if (_pending_size < dictionary_sample_size()) {
+            return make_ready_future<>();
+        }
+        return flush_pending();
+    }
+public:
+    compressed_file_data_sink_impl(file f, sstables::compression* cm, file_output_stream_options options)
+            : _out(make_write_behind_file_output_stream(std::move(f), options))
+            , _compression_metadata(cm) {}
+
+    future<> put(net::packet data) { abort(); }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        auto chunk_len = _compression_metadata->uncompressed_chunk_length();
+        return do_with(std::move(buf), clock_type::now(), [this, chunk_len] (temporary_buffer<char>& buf, clock_type::time_point& start) {
+            return repeat([this, chunk_len, &buf, &start] {
+                if (buf.empty()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto len = std::min(size_t(chunk_len), buf.size());
+                auto chunk = buf.share(0, len);
+                buf.trim_front(len);
+                return put_chunk(std::move(chunk)).then([&start] {
+                    if (clock_type::now() - start < compression_task_quota()) {
+                        return make_ready_future<stop_iteration>(stop_iteration::no);
+                    }
+                    return later().then([&start] {
+                        start = clock_type::now();
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        });
+    }
     virtual future<> close() {
-        return _out.close();
+        auto f = _compression_metadata->needs_dictionary() ? flush_pending() : make_ready_future<>();
+        return f.then([this] {
+            return _out.close();
+        });
     }
 };
 
@@ -193,10 +445,11 @@ class compressed_file_data_sink : public data_sink {
 };
 
 static inline output_stream<char> make_compressed_file_output_stream(file f, file_output_stream_options options, sstables::compression* cm) {
-    // buffer of output stream is set to chunk length, because flush must
-    // happen every time a chunk was filled up.
-    options.buffer_size = cm->uncompressed_chunk_length();
-    return output_stream<char>(compressed_file_data_sink(std::move(f), cm, options), options.buffer_size, true);
+    // buffer of output stream is set to a multiple of the chunk length,
+    // because flush must happen every time a batch of chunks was filled up.
+    size_t chunk_len = cm->uncompressed_chunk_length();
+    auto batch_size = std::max(chunk_len, align_down(size_t(options.buffer_size), chunk_len));
+    return output_stream<char>(compressed_file_data_sink(std::move(f), cm, options), batch_size, true);
 }
 
 }
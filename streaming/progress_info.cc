@@ -42,8 +42,8 @@ namespace streaming {
 
 std::ostream& operator<<(std::ostream& os, const progress_info& x) {
     sstring dir = x.dir == progress_info::direction::OUT ? "sent to " : "received from ";
-    return os << sprint("%s %ld/(%f\%) %s %s", x.file_name, x.current_bytes,
-            x.current_bytes * 100 / x.total_bytes, dir, x.peer);
+    return os << sprint("%s %ld/(%f\%) %s %s at %.1f MB/s", x.file_name, x.current_bytes,
+            x.current_bytes * 100 / x.total_bytes, dir, x.peer, x.bytes_per_second / (1024 * 1024));
 }
 
 }
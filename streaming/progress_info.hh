@@ -59,14 +59,17 @@ class progress_info {
     direction dir;
     long current_bytes;
     long total_bytes;
+    // Average transfer rate since the session started
+    double bytes_per_second = 0;
 
     progress_info() = default;
-    progress_info(inet_address _peer, sstring _file_name, direction _dir, long _current_bytes, long _total_bytes)
+    progress_info(inet_address _peer, sstring _file_name, direction _dir, long _current_bytes, long _total_bytes, double _bytes_per_second = 0)
         : peer(_peer)
         , file_name(_file_name)
         , dir(_dir)
         , current_bytes(_current_bytes)
-        , total_bytes(_total_bytes) {
+        , total_bytes(_total_bytes)
+        , bytes_per_second(_bytes_per_second) {
     }
 
     /**
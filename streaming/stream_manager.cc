@@ -41,6 +41,7 @@
 #include "streaming/stream_result_future.hh"
 #include "log.hh"
 #include "streaming/stream_session_state.hh"
+#include "streaming/stream_sstable_files.hh"
 
 namespace streaming {
 
@@ -98,10 +99,22 @@ void stream_manager::remove_stream(UUID plan_id) {
     sslog.debug("stream_manager: removing plan_id={}", plan_id);
     _initiated_streams.erase(plan_id);
     _receiving_streams.erase(plan_id);
-    // FIXME: Do not ignore the future
-    remove_progress_on_all_shards(plan_id).handle_exception([plan_id] (auto ep) {
-        sslog.info("stream_manager: Fail to remove progress for plan_id={}: {}", plan_id, ep);
-    });
+    // The cleanups run in the background, in the gate which stop() waits for.
+    try {
+        with_gate(_background, [plan_id] {
+            return remove_progress_on_all_shards(plan_id).handle_exception([plan_id] (auto ep) {
+                sslog.info("stream_manager: Fail to remove progress for plan_id={}: {}", plan_id, ep);
+            }).then([plan_id] {
+                return smp::invoke_on_all([plan_id] {
+                    return abort_received_sstables(plan_id);
+                });
+            }).handle_exception([plan_id] (auto ep) {
+                sslog.info("stream_manager: Fail to remove incomplete sstables for plan_id={}: {}", plan_id, ep);
+            });
+        });
+    } catch (seastar::gate_closed_exception&) {
+        sslog.debug("stream_manager: stopped, not cleaning up plan_id={}", plan_id);
+    }
 }
 
 void stream_manager::show_streams() {
@@ -143,6 +156,26 @@ future<> stream_manager::update_all_progress_info() {
     });
 }
 
+lw_shared_ptr<semaphore> stream_manager::mutation_batch_window(gms::inet_address peer, size_t window_size) {
+    auto it = _mutation_batch_windows.find(peer);
+    if (it == _mutation_batch_windows.end()) {
+        it = _mutation_batch_windows.emplace(peer, make_lw_shared<semaphore>(std::max<size_t>(window_size, 1))).first;
+    }
+    return it->second;
+}
+
+std::experimental::optional<bool> stream_manager::mutation_batch_supported(gms::inet_address peer) const {
+    auto it = _mutation_batch_supported.find(peer);
+    if (it == _mutation_batch_supported.end()) {
+        return std::experimental::nullopt;
+    }
+    return it->second;
+}
+
+void stream_manager::set_mutation_batch_supported(gms::inet_address peer, bool supported) {
+    _mutation_batch_supported[peer] = supported;
+}
+
 void stream_manager::remove_progress(UUID plan_id) {
     _stream_bytes.erase(plan_id);
 }
@@ -224,6 +257,9 @@ void stream_manager::fail_sessions(inet_address endpoint) {
             }
         }
     }
+    _mutation_batch_windows.erase(endpoint);
+    // The peer may come back running another version.
+    _mutation_batch_supported.erase(endpoint);
 }
 
 void stream_manager::on_remove(inet_address endpoint) {
@@ -46,7 +46,9 @@
 #include "gms/endpoint_state.hh"
 #include "gms/application_state.hh"
 #include <seastar/core/semaphore.hh>
+#include <seastar/core/gate.hh>
 #include <map>
+#include <experimental/optional>
 
 namespace streaming {
 
@@ -94,9 +96,24 @@ class stream_manager : public gms::i_endpoint_state_change_subscriber, public en
     std::unordered_map<UUID, shared_ptr<stream_result_future>> _receiving_streams;
     std::unordered_map<UUID, std::unordered_map<gms::inet_address, stream_bytes>> _stream_bytes;
     semaphore _mutation_send_limiter{256};
+    // Bounds the number of mutation batches in flight to each peer
+    std::unordered_map<gms::inet_address, lw_shared_ptr<semaphore>> _mutation_batch_windows;
+    // Whether peers accept STREAM_MUTATION_BATCH. Peers we haven't sent a
+    // batch to yet are missing.
+    std::unordered_map<gms::inet_address, bool> _mutation_batch_supported;
+    // Cleanups of removed streams still running.
+    seastar::gate _background;
 public:
     semaphore& mutation_send_limiter() { return _mutation_send_limiter; }
 
+    // The window is created with window_size units on first use. Callers
+    // hold on to the returned pointer until their batches are acknowledged,
+    // so it stays valid even if the peer is removed meanwhile.
+    lw_shared_ptr<semaphore> mutation_batch_window(gms::inet_address peer, size_t window_size);
+
+    std::experimental::optional<bool> mutation_batch_supported(gms::inet_address peer) const;
+    void set_mutation_batch_supported(gms::inet_address peer, bool supported);
+
     void register_sending(shared_ptr<stream_result_future> result);
 
     void register_receiving(shared_ptr<stream_result_future> result);
@@ -121,7 +138,7 @@ class stream_manager : public gms::i_endpoint_state_change_subscriber, public en
     void show_streams();
 
     future<> stop() {
-        return make_ready_future<>();
+        return _background.close();
     }
 
     void update_progress(UUID cf_id, gms::inet_address peer, progress_info::direction dir, size_t fm_size);
@@ -58,6 +58,7 @@
 #include "service/priority_manager.hh"
 #include "query-request.hh"
 #include "schema_registry.hh"
+#include "streaming/stream_sstable_files.hh"
 
 namespace streaming {
 
@@ -145,6 +146,78 @@ void stream_session::init_messaging_service_handler() {
             });
         });
     });
+    ms().register_stream_mutation_batch([] (const rpc::client_info& cinfo, UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id) {
+        auto from = net::messaging_service::get_source(cinfo);
+        return do_with(std::move(fms), [plan_id, from] (const auto& fms) {
+            if (fms.empty()) {
+                return make_ready_future<>();
+            }
+            size_t bytes = 0;
+            for (auto& fm : fms) {
+                bytes += fm.representation().size();
+            }
+            get_local_stream_manager().update_progress(plan_id, from.addr, progress_info::direction::IN, bytes);
+            // The sender fills a batch from a single table reader, so all
+            // mutations share the table and schema version.
+            auto& first = fms.front();
+            for (auto& fm : fms) {
+                if (fm.column_family_id() != first.column_family_id() || fm.schema_version() != first.schema_version()) {
+                    return make_exception_future<>(std::runtime_error(sprint("[Stream #%s] STREAM_MUTATION_BATCH from %s mixes tables or schema versions", plan_id, from.addr)));
+                }
+            }
+            return service::get_schema_for_write(first.schema_version(), from).then([plan_id, from, &fms] (schema_ptr s) {
+                auto cf_id = fms.front().column_family_id();
+                sslog.debug("[Stream #{}] GOT STREAM_MUTATION_BATCH from {}: cf_id={}, mutations={}", plan_id, from.addr, cf_id, fms.size());
+
+                auto& db = service::get_local_storage_proxy().get_db().local();
+                if (!db.column_family_exists(cf_id)) {
+                    sslog.warn("[Stream #{}] STREAM_MUTATION_BATCH from {}: cf_id={} is missing, assume the table is dropped",
+                                plan_id, from.addr, cf_id);
+                    return make_ready_future<>();
+                }
+                return service::get_storage_proxy().local().mutate_streaming_mutations(std::move(s), fms).then_wrapped([plan_id, cf_id, from] (auto&& f) {
+                    try {
+                        f.get();
+                    } catch (no_such_column_family) {
+                        sslog.warn("[Stream #{}] STREAM_MUTATION_BATCH from {}: cf_id={} is missing, assume the table is dropped",
+                                plan_id, from.addr, cf_id);
+                    }
+                    return make_ready_future<>();
+                });
+            });
+        });
+    });
+    ms().register_stream_sstable_begin([] (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id, sstring version, sstring format,
+            std::vector<sstring> components, unsigned src_shard_count, unsigned dst_cpu_id) {
+        auto from = net::messaging_service::get_source(cinfo);
+        if (src_shard_count != smp::count) {
+            // Partitions of a sender shard's sstable would be spread over
+            // several of our shards.
+            sslog.debug("[Stream #{}] STREAM_SSTABLE_BEGIN from {}: sender has {} shards, we have {}, refusing sstable files",
+                    plan_id, from.addr, src_shard_count, smp::count);
+            return make_ready_future<int64_t>(-1);
+        }
+        return smp::submit_to(dst_cpu_id, [plan_id, cf_id, version = std::move(version), format = std::move(format),
+                components = std::move(components)] () mutable {
+            return receive_sstable_begin(plan_id, cf_id, std::move(version), std::move(format), std::move(components));
+        });
+    });
+    ms().register_stream_sstable_chunk([] (const rpc::client_info& cinfo, UUID plan_id, int64_t generation, unsigned component,
+            uint64_t offset, bytes data, unsigned dst_cpu_id) {
+        auto from = net::messaging_service::get_source(cinfo);
+        get_local_stream_manager().update_progress(plan_id, from.addr, progress_info::direction::IN, data.size());
+        return smp::submit_to(dst_cpu_id, [plan_id, generation, component, offset, data = std::move(data)] () mutable {
+            return receive_sstable_chunk(plan_id, generation, component, offset, std::move(data));
+        });
+    });
+    ms().register_stream_sstable_end([] (const rpc::client_info& cinfo, UUID plan_id, UUID cf_id, int64_t generation,
+            std::vector<uint64_t> sizes, unsigned dst_cpu_id) {
+        auto from = net::messaging_service::get_source(cinfo);
+        sslog.debug("[Stream #{}] GOT STREAM_SSTABLE_END from {}: cf_id={}, generation={}", plan_id, from.addr, cf_id, generation);
+        return smp::submit_to(dst_cpu_id, [plan_id, cf_id, generation, sizes = std::move(sizes)] () mutable {
+            return receive_sstable_end(plan_id, cf_id, generation, std::move(sizes));
+        });
+    });
     ms().register_stream_mutation_done([] (const rpc::client_info& cinfo, UUID plan_id, std::vector<range<dht::token>> ranges, UUID cf_id, unsigned dst_cpu_id) {
         const auto& from = cinfo.retrieve_auxiliary<gms::inet_address>("baddr");
         return smp::submit_to(dst_cpu_id, [ranges = std::move(ranges), plan_id, cf_id, from] () mutable {
@@ -505,7 +578,7 @@ void stream_session::init(shared_ptr<stream_result_future> stream_result_) {
            sslog.info("[Stream #{}] keep alive timer callback fails with peer {}: {}", plan_id, peer, ep);
         });
     });
-    _last_stream_progress = lowres_clock::now();
+    _start_time = _last_stream_progress = lowres_clock::now();
     start_keep_alive_timer();
 }
 
@@ -519,14 +592,18 @@ sstring stream_session::description() {
 
 future<> stream_session::update_progress() {
     return get_local_stream_manager().get_progress_on_all_shards(plan_id(), peer).then([this] (auto sbytes) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(lowres_clock::now() - _start_time).count();
+        auto rate = [elapsed] (int64_t bytes) {
+            return elapsed > 0 ? bytes / elapsed : 0.0;
+        };
         auto bytes_sent = sbytes.bytes_sent;
         if (bytes_sent > 0) {
-            auto tx = progress_info(this->peer, "txnofile", progress_info::direction::OUT, bytes_sent, bytes_sent);
+            auto tx = progress_info(this->peer, "txnofile", progress_info::direction::OUT, bytes_sent, bytes_sent, rate(bytes_sent));
             _session_info.update_progress(std::move(tx));
         }
         auto bytes_received = sbytes.bytes_received;
         if (bytes_received > 0) {
-            auto rx = progress_info(this->peer, "rxnofile", progress_info::direction::IN, bytes_received, bytes_received);
+            auto rx = progress_info(this->peer, "rxnofile", progress_info::direction::IN, bytes_received, bytes_received, rate(bytes_received));
             _session_info.update_progress(std::move(rx));
         }
     });
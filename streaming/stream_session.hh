@@ -182,6 +182,7 @@ class stream_session : public enable_shared_from_this<stream_session> {
     timer<lowres_clock> _keep_alive;
     stream_bytes _last_stream_bytes;
     lowres_clock::time_point _last_stream_progress;
+    lowres_clock::time_point _start_time;
 
     session_info _session_info;
 public:
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.hh"
+#include "streaming/stream_sstable_files.hh"
+#include "streaming/stream_manager.hh"
+#include "database.hh"
+#include "sstables/sstables.hh"
+#include "service/storage_proxy.hh"
+#include "service/priority_manager.hh"
+#include "checked-file-impl.hh"
+#include "disk-error-handler.hh"
+#include "core/fstream.hh"
+#include "core/thread.hh"
+#include "core/gate.hh"
+#include "core/semaphore.hh"
+#include <core/align.hh>
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm_ext/push_back.hpp>
+
+namespace streaming {
+
+extern logging::logger sslog;
+
+using component_type = sstables::sstable::component_type;
+
+// Chunks are aligned so that the receiver can write them with DMA at their
+// offset, in any order.
+static constexpr size_t sstable_chunk_size = 128 * 1024;
+static constexpr size_t sstable_chunk_alignment = 4096;
+static constexpr size_t sstable_chunks_in_flight = 4;
+
+// True if every partition of sst belongs to the current shard and lies in
+// one of the ranges.
+static bool covered_by(const schema& s, const sstables::sstable& sst, const std::vector<range<dht::token>>& ranges) {
+    auto first = sst.get_first_decorated_key(s).token();
+    auto last = sst.get_last_decorated_key(s).token();
+    // shard_of() is monotonic in the token, so if the first and last
+    // partitions are ours, so is everything in between.
+    auto me = engine().cpu_id();
+    if (dht::shard_of(first) != me || dht::shard_of(last) != me) {
+        return false;
+    }
+    auto sst_range = range<dht::token>::make(first, last);
+    return std::any_of(ranges.begin(), ranges.end(), [&] (const range<dht::token>& r) {
+        return r.contains(sst_range, dht::token_comparator());
+    });
+}
+
+struct chunk_window {
+    semaphore slots{sstable_chunks_in_flight};
+    std::exception_ptr error;
+};
+
+// Must run in a thread. Returns false if the peer does not take the sstable.
+static bool send_sstable(const schema& s, const sstables::shared_sstable& sst, utils::UUID plan_id, utils::UUID cf_id,
+        net::messaging_service::msg_addr id) {
+    auto& ms = net::get_local_messaging_service();
+    auto src_cpu_id = engine().cpu_id();
+    std::vector<component_type> components;
+    std::vector<sstring> names;
+    for (auto c : sst->all_components()) {
+        // The receiver writes its own TOC once everything else is on disk.
+        if (c == component_type::TOC) {
+            continue;
+        }
+        components.push_back(c);
+        names.push_back(sstables::sstable::component_to_sstring(c));
+    }
+
+    sslog.debug("[Stream #{}] SEND STREAM_SSTABLE_BEGIN to {}, cf_id={}, sstable={}", plan_id, id, cf_id, sst->get_filename());
+    auto generation = ms.send_stream_sstable_begin(id, plan_id, cf_id,
+            sstables::sstable::version_to_sstring(sst->get_version()),
+            sstables::sstable::format_to_sstring(sst->get_format()),
+            std::move(names), smp::count, src_cpu_id).get0();
+    if (generation < 0) {
+        return false;
+    }
+
+    std::vector<uint64_t> sizes;
+    auto& pc = service::get_local_streaming_read_priority();
+    for (unsigned i = 0; i < components.size(); i++) {
+        auto name = sstables::sstable::filename(sst->get_dir(), s.ks_name(), s.cf_name(), sst->get_version(),
+                sst->generation(), sst->get_format(), components[i]);
+        auto f = open_checked_file_dma(sstable_read_error, name, open_flags::ro).get0();
+        auto size = f.size().get0();
+        file_input_stream_options options;
+        options.buffer_size = sstable_chunk_size;
+        options.io_priority_class = pc;
+        auto in = make_file_input_stream(std::move(f), 0, size, std::move(options));
+        auto window = make_lw_shared<chunk_window>();
+        uint64_t offset = 0;
+        while (offset < size && !window->error) {
+            auto len = std::min<uint64_t>(sstable_chunk_size, size - offset);
+            auto buf = in.read_exactly(len).get0();
+            if (buf.size() != len) {
+                in.close().get();
+                throw std::runtime_error(sprint("%s: short read at offset %d", name, offset));
+            }
+            window->slots.wait().get();
+            auto data = bytes(reinterpret_cast<const int8_t*>(buf.get()), buf.size());
+            ms.send_stream_sstable_chunk(id, plan_id, generation, i, offset, std::move(data), src_cpu_id).then_wrapped([window, plan_id, id, len] (future<> f) {
+                try {
+                    f.get();
+                    get_local_stream_manager().update_progress(plan_id, id.addr, progress_info::direction::OUT, len);
+                } catch (...) {
+                    window->error = std::current_exception();
+                }
+                window->slots.signal();
+            });
+            offset += len;
+        }
+        window->slots.wait(sstable_chunks_in_flight).get();
+        in.close().get();
+        if (window->error) {
+            std::rethrow_exception(window->error);
+        }
+        sizes.push_back(size);
+    }
+
+    sslog.debug("[Stream #{}] SEND STREAM_SSTABLE_END to {}, cf_id={}, generation={}", plan_id, id, cf_id, generation);
+    ms.send_stream_sstable_end(id, plan_id, cf_id, generation, std::move(sizes), src_cpu_id).get();
+    return true;
+}
+
+future<std::unordered_set<int64_t>> send_sstable_files(database& db, utils::UUID plan_id, utils::UUID cf_id,
+        net::messaging_service::msg_addr id, std::vector<range<dht::token>> ranges) {
+    auto& cf = db.find_column_family(cf_id);
+    auto s = cf.schema();
+    std::vector<sstables::shared_sstable> candidates;
+    for (auto& sst : *cf.get_sstables() | boost::adaptors::map_values) {
+        if (covered_by(*s, *sst, ranges)) {
+            candidates.push_back(sst);
+        }
+    }
+    if (candidates.empty()) {
+        return make_ready_future<std::unordered_set<int64_t>>();
+    }
+    // The candidates are held until they are sent, so compaction cannot
+    // remove their files meanwhile.
+    return seastar::async([s, plan_id, cf_id, id, candidates = std::move(candidates)] {
+        std::unordered_set<int64_t> sent;
+        for (auto& sst : candidates) {
+            try {
+                if (!send_sstable(*s, sst, plan_id, cf_id, id)) {
+                    sslog.info("[Stream #{}] {} does not take whole sstables, streaming mutations instead", plan_id, id.addr);
+                    break;
+                }
+                sent.insert(sst->generation());
+            } catch (...) {
+                sslog.warn("[Stream #{}] Fail to send sstable {} to {}, streaming mutations instead: {}",
+                        plan_id, sst->get_filename(), id, std::current_exception());
+                break;
+            }
+        }
+        sslog.debug("[Stream #{}] Sent {} of {} sstables as files to {}, cf_id={}", plan_id, sent.size(), candidates.size(), id, cf_id);
+        return sent;
+    });
+}
+
+struct received_sstable {
+    sstring ks;
+    sstring cf;
+    sstring dir;
+    sstables::sstable::version_types version;
+    sstables::sstable::format_types format;
+    int64_t generation;
+    std::vector<component_type> components;
+    std::vector<file> files;
+    bool files_closed = false;
+    seastar::gate writes;
+
+    sstring filename(component_type c) const {
+        return sstables::sstable::filename(dir, ks, cf, version, generation, format, c);
+    }
+};
+
+// Sstables being received on this shard, by plan and generation
+static thread_local std::unordered_map<utils::UUID, std::unordered_map<int64_t, lw_shared_ptr<received_sstable>>> received_sstables;
+
+// Removes the files of an sstable which was not sealed.
+static future<> discard(lw_shared_ptr<received_sstable> r) {
+    return seastar::async([r] {
+        if (!r->files_closed) {
+            for (auto& f : r->files) {
+                f.close().handle_exception([] (auto ep) {}).get();
+            }
+        }
+        if (file_exists(r->filename(component_type::TemporaryTOC)).get0()) {
+            sstables::sstable::remove_sstable_with_temp_toc(r->ks, r->cf, r->dir, r->generation, r->version, r->format).get();
+        }
+    });
+}
+
+static lw_shared_ptr<received_sstable> take_received_sstable(utils::UUID plan_id, int64_t generation) {
+    auto it = received_sstables.find(plan_id);
+    if (it != received_sstables.end()) {
+        auto sst_it = it->second.find(generation);
+        if (sst_it != it->second.end()) {
+            auto r = sst_it->second;
+            it->second.erase(sst_it);
+            if (it->second.empty()) {
+                received_sstables.erase(it);
+            }
+            return r;
+        }
+    }
+    throw std::runtime_error(sprint("[Stream #%s] No sstable of generation %d is being received", plan_id, generation));
+}
+
+future<int64_t> receive_sstable_begin(utils::UUID plan_id, utils::UUID cf_id, sstring version, sstring format,
+        std::vector<sstring> components) {
+    auto& cf = service::get_local_storage_proxy().get_db().local().find_column_family(cf_id);
+    auto r = make_lw_shared<received_sstable>();
+    r->ks = cf.schema()->ks_name();
+    r->cf = cf.schema()->cf_name();
+    r->dir = cf.dir();
+    r->version = sstables::sstable::version_from_sstring(version);
+    r->format = sstables::sstable::format_from_sstring(format);
+    for (auto& name : components) {
+        auto c = sstables::sstable::component_from_sstring(name);
+        if (c == component_type::TOC || c == component_type::TemporaryTOC) {
+            throw std::runtime_error(sprint("[Stream #%s] Unexpected component %s in a streamed sstable", plan_id, name));
+        }
+        r->components.push_back(c);
+    }
+    r->generation = cf.new_sstable_generation();
+    return seastar::async([r] {
+        // Like sstable::create_links(), write the temporary TOC first, so
+        // that boot removes the sstable if we never get to seal it.
+        sstring toc;
+        for (auto c : r->components) {
+            toc += sstables::sstable::component_to_sstring(c) + "\n";
+        }
+        toc += sstables::sstable::component_to_sstring(component_type::TOC) + "\n";
+        auto f = open_checked_file_dma(sstable_write_error, r->filename(component_type::TemporaryTOC),
+                open_flags::wo | open_flags::create | open_flags::exclusive).get0();
+        file_output_stream_options options;
+        options.buffer_size = 4096;
+        auto out = make_file_output_stream(std::move(f), std::move(options));
+        out.write(toc).get();
+        out.flush().get();
+        out.close().get();
+        sstable_write_io_check(sync_directory, r->dir).get();
+
+        for (auto c : r->components) {
+            r->files.push_back(open_checked_file_dma(sstable_write_error, r->filename(c),
+                    open_flags::wo | open_flags::create | open_flags::exclusive).get0());
+        }
+    }).then_wrapped([plan_id, r] (future<> f) {
+        try {
+            f.get();
+        } catch (...) {
+            auto ep = std::current_exception();
+            return discard(r).then_wrapped([ep] (future<> f) {
+                f.ignore_ready_future();
+                return make_exception_future<int64_t>(ep);
+            });
+        }
+        received_sstables[plan_id].emplace(r->generation, r);
+        sslog.debug("[Stream #{}] Receiving sstable {}", plan_id, r->filename(component_type::Data));
+        return make_ready_future<int64_t>(r->generation);
+    });
+}
+
+future<> receive_sstable_chunk(utils::UUID plan_id, int64_t generation, unsigned component, uint64_t offset, bytes data) {
+    auto it = received_sstables.find(plan_id);
+    if (it == received_sstables.end() || !it->second.count(generation)) {
+        throw std::runtime_error(sprint("[Stream #%s] No sstable of generation %d is being received", plan_id, generation));
+    }
+    auto r = it->second.at(generation);
+    if (component >= r->files.size() || offset % sstable_chunk_alignment) {
+        throw std::runtime_error(sprint("[Stream #%s] Bad chunk for sstable of generation %d: component %d, offset %d",
+                plan_id, generation, component, offset));
+    }
+    return with_gate(r->writes, [r, component, offset, data = std::move(data)] {
+        // The last chunk of a file is padded here and truncated at the end.
+        auto len = align_up(data.size(), sstable_chunk_alignment);
+        auto buf = allocate_aligned_buffer<char>(len, sstable_chunk_alignment);
+        auto p = buf.get();
+        std::copy_n(data.begin(), data.size(), p);
+        std::fill(p + data.size(), p + len, 0);
+        return r->files[component].dma_write(offset, p, len, service::get_local_streaming_write_priority()).then(
+                [buf = std::move(buf), len, offset] (size_t written) {
+            if (written != len) {
+                throw std::runtime_error(sprint("Short write of a streamed sstable chunk at offset %d: %d of %d bytes", offset, written, len));
+            }
+        });
+    });
+}
+
+future<> receive_sstable_end(utils::UUID plan_id, utils::UUID cf_id, int64_t generation, std::vector<uint64_t> sizes) {
+    auto r = take_received_sstable(plan_id, generation);
+    return r->writes.close().then([r, sizes = std::move(sizes)] {
+        return seastar::async([r, sizes = std::move(sizes)] {
+            if (sizes.size() != r->files.size()) {
+                throw std::runtime_error(sprint("Streamed sstable of generation %d has %d components, got %d sizes",
+                        r->generation, r->files.size(), sizes.size()));
+            }
+            for (unsigned i = 0; i < r->files.size(); i++) {
+                r->files[i].truncate(sizes[i]).get();
+                r->files[i].flush().get();
+            }
+            r->files_closed = true;
+            for (auto& f : r->files) {
+                f.close().get();
+            }
+            sstable_write_io_check(sync_directory, r->dir).get();
+            sstable_write_io_check([&] {
+                return engine().rename_file(r->filename(component_type::TemporaryTOC), r->filename(component_type::TOC));
+            }).get();
+            sstable_write_io_check(sync_directory, r->dir).get();
+        }).handle_exception([r] (auto ep) {
+            return discard(r).then_wrapped([ep] (future<> f) {
+                f.ignore_ready_future();
+                return make_exception_future<>(ep);
+            });
+        });
+    }).then([plan_id, cf_id, r] {
+        sslog.debug("[Stream #{}] Loading received sstable {}", plan_id, r->filename(component_type::Data));
+        auto& cf = service::get_local_storage_proxy().get_db().local().find_column_family(cf_id);
+        std::vector<sstables::entry_descriptor> new_tables;
+        new_tables.emplace_back(r->ks, r->cf, r->version, r->generation, r->format, component_type::TOC);
+        return cf.load_new_sstables(std::move(new_tables));
+    });
+}
+
+future<> abort_received_sstables(utils::UUID plan_id) {
+    auto it = received_sstables.find(plan_id);
+    if (it == received_sstables.end()) {
+        return make_ready_future<>();
+    }
+    std::vector<lw_shared_ptr<received_sstable>> pending;
+    boost::push_back(pending, it->second | boost::adaptors::map_values);
+    received_sstables.erase(it);
+    return parallel_for_each(pending, [plan_id] (lw_shared_ptr<received_sstable> r) {
+        sslog.info("[Stream #{}] Removing incomplete streamed sstable {}", plan_id, r->filename(component_type::Data));
+        return r->writes.close().then([r] {
+            return discard(r);
+        });
+    });
+}
+
+} // namespace streaming
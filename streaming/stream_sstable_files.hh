@@ -0,0 +1,64 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "core/future.hh"
+#include "core/sstring.hh"
+#include "utils/UUID.hh"
+#include "message/messaging_service.hh"
+#include "dht/i_partitioner.hh"
+#include "range.hh"
+#include "bytes.hh"
+#include <unordered_set>
+#include <vector>
+
+class database;
+
+namespace streaming {
+
+// Whole-sstable streaming.
+//
+// An sstable which lies entirely inside the ranges being transferred, and
+// whose partitions all belong to the sending shard, is sent as its
+// component files rather than decoded into mutations. The receiver writes
+// the files under a temporary TOC, seals them and loads the sstable on
+// the same shard with column_family::load_new_sstables(). This only works
+// if both nodes have the same number of shards, which the receiver checks.
+
+// Sends the sstables of the table on the current shard which are fully
+// covered by ranges. Returns the generations of those the peer loaded;
+// all other data must still be streamed as mutations.
+future<std::unordered_set<int64_t>> send_sstable_files(database& db, utils::UUID plan_id, utils::UUID cf_id,
+        net::messaging_service::msg_addr id, std::vector<range<dht::token>> ranges);
+
+// Receiving side. All calls for one sstable run on the shard which will
+// own it.
+future<int64_t> receive_sstable_begin(utils::UUID plan_id, utils::UUID cf_id, sstring version, sstring format,
+        std::vector<sstring> components);
+future<> receive_sstable_chunk(utils::UUID plan_id, int64_t generation, unsigned component, uint64_t offset, bytes data);
+future<> receive_sstable_end(utils::UUID plan_id, utils::UUID cf_id, int64_t generation, std::vector<uint64_t> sizes);
+
+// Removes the sstables of the plan on the current shard which were not
+// completely received.
+future<> abort_received_sstables(utils::UUID plan_id);
+
+} // namespace streaming
@@ -41,6 +41,7 @@
 #include "streaming/stream_transfer_task.hh"
 #include "streaming/stream_session.hh"
 #include "streaming/stream_manager.hh"
+#include "streaming/stream_sstable_files.hh"
 #include "mutation_reader.hh"
 #include "frozen_mutation.hh"
 #include "mutation.hh"
@@ -48,6 +49,7 @@
 #include "range.hh"
 #include "dht/i_partitioner.hh"
 #include "service/priority_manager.hh"
+#include "db/config.hh"
 #include <boost/range/irange.hpp>
 
 namespace streaming {
@@ -70,8 +72,17 @@ struct send_info {
     net::messaging_service::msg_addr id;
     uint32_t dst_cpu_id;
     size_t mutations_nr{0};
+    // Number of messages sent, each signals mutations_done once
+    size_t sends_nr{0};
     semaphore mutations_done{0};
     bool error_logged = false;
+    // Zero means one STREAM_MUTATION per partition
+    size_t batch_size_limit;
+    std::vector<frozen_mutation> batch;
+    size_t batch_bytes{0};
+    lw_shared_ptr<semaphore> window;
+    // Sstables already sent as files, which the reader must skip
+    lw_shared_ptr<const std::unordered_set<int64_t>> sent_sstables;
     send_info(database& db_, utils::UUID plan_id_, utils::UUID cf_id_,
               query::partition_range pr_, net::messaging_service::msg_addr id_,
               uint32_t dst_cpu_id_)
@@ -80,11 +91,20 @@ struct send_info {
         , cf_id(cf_id_)
         , pr(pr_)
         , id(id_)
-        , dst_cpu_id(dst_cpu_id_) {
+        , dst_cpu_id(dst_cpu_id_)
+        , batch_size_limit(size_t(db_.get_config().stream_mutation_batch_size_in_kb()) * 1024) {
+        auto supported = get_local_stream_manager().mutation_batch_supported(id.addr);
+        if (supported && !*supported) {
+            batch_size_limit = 0;
+        }
+        if (batch_size_limit) {
+            window = get_local_stream_manager().mutation_batch_window(id.addr, db_.get_config().stream_mutation_window());
+        }
     }
 };
 
 future<stop_iteration> do_send_mutations(auto si, auto fm) {
+    si->sends_nr++;
     return get_local_stream_manager().mutation_send_limiter().wait().then([si, fm = std::move(fm)] () mutable {
         sslog.debug("[Stream #{}] SEND STREAM_MUTATION to {}, cf_id={}", si->plan_id, si->id, si->cf_id);
         auto fm_size = fm.representation().size();
@@ -107,23 +127,103 @@ future<stop_iteration> do_send_mutations(auto si, auto fm) {
     });
 }
 
+// Sends the mutations of a batch one at a time, to peers which don't
+// know STREAM_MUTATION_BATCH yet.
+static future<> send_mutations_one_by_one(net::messaging_service::msg_addr id, utils::UUID plan_id,
+        lw_shared_ptr<std::vector<frozen_mutation>> fms, unsigned dst_cpu_id) {
+    return do_for_each(*fms, [id, plan_id, fms, dst_cpu_id] (frozen_mutation& fm) {
+        return net::get_local_messaging_service().send_stream_mutation(id, plan_id, std::move(fm), dst_cpu_id);
+    });
+}
+
+future<> send_mutation_batch(net::messaging_service::msg_addr id, utils::UUID plan_id, std::vector<frozen_mutation> fms, unsigned dst_cpu_id) {
+    auto supported = get_local_stream_manager().mutation_batch_supported(id.addr);
+    if (supported && *supported) {
+        return net::get_local_messaging_service().send_stream_mutation_batch(id, plan_id, std::move(fms), dst_cpu_id);
+    }
+    auto batch = make_lw_shared<std::vector<frozen_mutation>>(std::move(fms));
+    if (supported) {
+        return send_mutations_one_by_one(id, plan_id, std::move(batch), dst_cpu_id);
+    }
+    // Until the peer is known to accept batches, keep the mutations around
+    // so that they can be resent one at a time.
+    return net::get_local_messaging_service().send_stream_mutation_batch(id, plan_id, *batch, dst_cpu_id).then([id] {
+        get_local_stream_manager().set_mutation_batch_supported(id.addr, true);
+    }).handle_exception([id, plan_id, batch, dst_cpu_id] (std::exception_ptr ep) {
+        try {
+            std::rethrow_exception(ep);
+        } catch (rpc::unknown_verb_error&) {
+            sslog.info("[Stream #{}] Node {} doesn't support STREAM_MUTATION_BATCH, sending mutations one at a time", plan_id, id.addr);
+            get_local_stream_manager().set_mutation_batch_supported(id.addr, false);
+            return send_mutations_one_by_one(id, plan_id, batch, dst_cpu_id);
+        }
+    });
+}
+
+// Sends the accumulated batch once a slot in the peer's window is free.
+// Returns as soon as the batch is on its way, so the next batch is read
+// while up to stream_mutation_window batches are in flight.
+future<stop_iteration> do_send_mutation_batch(auto si) {
+    auto fms = std::exchange(si->batch, {});
+    auto bytes = std::exchange(si->batch_bytes, 0);
+    si->sends_nr++;
+    return si->window->wait().then([si, fms = std::move(fms), bytes] () mutable {
+        sslog.debug("[Stream #{}] SEND STREAM_MUTATION_BATCH to {}, cf_id={}, mutations={}, bytes={}",
+                si->plan_id, si->id, si->cf_id, fms.size(), bytes);
+        send_mutation_batch(si->id, si->plan_id, std::move(fms), si->dst_cpu_id).then([si, bytes] {
+            sslog.debug("[Stream #{}] GOT STREAM_MUTATION_BATCH Reply from {}", si->plan_id, si->id.addr);
+            if (get_local_stream_manager().mutation_batch_supported(si->id.addr) == false) {
+                // Don't bother batching for an old peer.
+                si->batch_size_limit = 0;
+            }
+            get_local_stream_manager().update_progress(si->plan_id, si->id.addr, progress_info::direction::OUT, bytes);
+            si->mutations_done.signal();
+        }).handle_exception([si] (auto ep) {
+            if (!si->error_logged) {
+                si->error_logged = true;
+                sslog.error("[Stream #{}] stream_transfer_task: Fail to send STREAM_MUTATION_BATCH to {}: {}", si->plan_id, si->id, ep);
+            }
+            si->mutations_done.broken();
+        }).finally([window = si->window] {
+            window->signal();
+        });
+        return stop_iteration::no;
+    });
+}
+
 future<> send_mutations(auto si) {
     auto& cf = si->db.find_column_family(si->cf_id);
     auto& priority = service::get_local_streaming_read_priority();
-    return do_with(cf.make_reader(cf.schema(), si->pr, priority), [si] (auto& reader) {
+    auto reader = si->sent_sstables && !si->sent_sstables->empty()
+            ? cf.make_streaming_reader(cf.schema(), si->pr, *si->sent_sstables, priority)
+            : cf.make_reader(cf.schema(), si->pr, priority);
+    return do_with(std::move(reader), [si] (auto& reader) {
         return repeat([si, &reader] () {
             return reader().then([si] (auto mopt) {
                 if (mopt && si->db.column_family_exists(si->cf_id)) {
                     si->mutations_nr++;
                     auto fm = frozen_mutation(*mopt);
-                    return do_send_mutations(si, std::move(fm));
+                    if (!si->batch_size_limit) {
+                        return do_send_mutations(si, std::move(fm));
+                    }
+                    si->batch_bytes += fm.representation().size();
+                    si->batch.push_back(std::move(fm));
+                    if (si->batch_bytes >= si->batch_size_limit) {
+                        return do_send_mutation_batch(si);
+                    }
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
                 } else {
                     return make_ready_future<stop_iteration>(stop_iteration::yes);
                 }
             });
         });
     }).then([si] {
-        return si->mutations_done.wait(si->mutations_nr);
+        if (si->batch.empty()) {
+            return make_ready_future<>();
+        }
+        return do_send_mutation_batch(si).discard_result();
+    }).then([si] {
+        return si->mutations_done.wait(si->sends_nr);
     });
 }
 
@@ -132,21 +232,33 @@ void stream_transfer_task::start() {
     auto cf_id = this->cf_id;
     auto id = net::messaging_service::msg_addr{session->peer, session->dst_cpu_id};
     sslog.debug("[Stream #{}] stream_transfer_task: cf_id={}", plan_id, cf_id);
-    parallel_for_each(_ranges.begin(), _ranges.end(), [this, plan_id, cf_id, id] (auto range) {
-        unsigned shard_begin = range.start() ? dht::shard_of(range.start()->value()) : 0;
-        unsigned shard_end = range.end() ? dht::shard_of(range.end()->value()) + 1 : smp::count;
-        auto cf_id = this->cf_id;
+    auto shards = boost::irange<unsigned>(0, smp::count);
+    parallel_for_each(shards.begin(), shards.end(), [this, plan_id, cf_id, id] (unsigned shard) {
+        std::vector<range<dht::token>> ranges;
+        for (auto& range : _ranges) {
+            unsigned shard_begin = range.start() ? dht::shard_of(range.start()->value()) : 0;
+            unsigned shard_end = range.end() ? dht::shard_of(range.end()->value()) + 1 : smp::count;
+            if (shard >= shard_begin && shard < shard_end) {
+                ranges.push_back(range);
+            }
+        }
+        if (ranges.empty()) {
+            return make_ready_future<>();
+        }
         auto dst_cpu_id = this->session->dst_cpu_id;
-        auto pr = query::to_partition_range(range);
-        auto shard_range = boost::irange<unsigned>(shard_begin, shard_end);
-        sslog.debug("[Stream #{}] stream_transfer_task: cf_id={}, shard_begin={} shard_end={}", plan_id, cf_id, shard_begin, shard_end);
-        return parallel_for_each(shard_range.begin(), shard_range.end(),
-                [this, plan_id, cf_id, id, dst_cpu_id, pr] (unsigned shard) {
-            sslog.debug("[Stream #{}] stream_transfer_task: cf_id={}, invoke_on shard={}", plan_id, cf_id, shard);
-            return this->session->get_db().invoke_on(shard, [plan_id, cf_id, id, dst_cpu_id, pr] (database& db) {
-                // Send mutations on related shards, do not capture this
-                auto si = make_lw_shared<send_info>(db, plan_id, cf_id, pr, id, dst_cpu_id);
-                return send_mutations(si);
+        sslog.debug("[Stream #{}] stream_transfer_task: cf_id={}, invoke_on shard={}, nr_ranges={}", plan_id, cf_id, shard, ranges.size());
+        return this->session->get_db().invoke_on(shard, [plan_id, cf_id, id, dst_cpu_id, ranges = std::move(ranges)] (database& db) {
+            // Send sstables and mutations on related shards, do not capture this
+            auto sent = db.get_config().stream_whole_sstables()
+                    ? send_sstable_files(db, plan_id, cf_id, id, ranges)
+                    : make_ready_future<std::unordered_set<int64_t>>();
+            return sent.then([&db, plan_id, cf_id, id, dst_cpu_id, ranges] (std::unordered_set<int64_t> sent_sstables) {
+                auto sent = make_lw_shared<const std::unordered_set<int64_t>>(std::move(sent_sstables));
+                return parallel_for_each(ranges.begin(), ranges.end(), [&db, plan_id, cf_id, id, dst_cpu_id, sent] (auto range) {
+                    auto si = make_lw_shared<send_info>(db, plan_id, cf_id, query::to_partition_range(range), id, dst_cpu_id);
+                    si->sent_sstables = sent;
+                    return send_mutations(si);
+                });
             });
         });
     }).then([this, plan_id, cf_id, id] {
@@ -42,6 +42,8 @@
 #include "streaming/stream_task.hh"
 #include "streaming/stream_detail.hh"
 #include "sstables/sstables.hh"
+#include "message/messaging_service.hh"
+#include "frozen_mutation.hh"
 #include <map>
 #include <seastar/core/semaphore.hh>
 
@@ -79,4 +81,11 @@ class stream_transfer_task : public stream_task {
     void start();
 };
 
+// Sends a batch of mutations of one table to the peer with
+// STREAM_MUTATION_BATCH, or one at a time with STREAM_MUTATION if the peer
+// doesn't know the former yet. What the peer accepts is learned from the
+// first batch, and remembered by the stream manager.
+future<> send_mutation_batch(net::messaging_service::msg_addr id, utils::UUID plan_id,
+        std::vector<frozen_mutation> fms, unsigned dst_cpu_id);
+
 } // namespace streaming
@@ -66,8 +66,12 @@ boost_tests = [
     'memtable_test',
     'mutation_query_test',
     'snitch_reset_test',
+    'dynamic_snitch_test',
     'auth_test',
     'idl_test',
+    'repair_test',
+    'histogram_test',
+    'cql_compression_test',
 ]
 
 other_tests = [
@@ -35,6 +35,7 @@
 #include "core/scollectd_api.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
+#include "core/thread.hh"
 #include "utils/UUID_gen.hh"
 #include "tmpdir.hh"
 #include "db/commitlog/commitlog.hh"
@@ -429,6 +430,65 @@ SEASTAR_TEST_CASE(test_commitlog_chunk_corruption){
         });
 }
 
+SEASTAR_TEST_CASE(test_commitlog_reuse_segments){
+    commitlog::config cfg;
+    cfg.commitlog_segment_size_in_mb = 1;
+    cfg.commitlog_total_space_in_mb = 64 * smp::count;
+    return cl_test(cfg, [](commitlog& log) {
+        return seastar::async([&log] {
+            auto uuid = utils::UUID_gen::get_time_UUID();
+            sstring tmp(sstring::initialized_later(), 64 * 1024);
+            std::fill(tmp.begin(), tmp.end(), 'a');
+            auto write = [&log, uuid, &tmp] {
+                return log.add_mutation(uuid, tmp.size(), [&tmp](db::commitlog::output& dst) {
+                    dst.write(tmp.begin(), tmp.end());
+                }).get0();
+            };
+
+            std::set<segment_id_type> ids;
+            replay_position last;
+            while (ids.size() < 3) {
+                last = write();
+                ids.insert(last.id);
+            }
+            log.sync_all_segments().get();
+            log.discard_completed_segments(uuid, last);
+            BOOST_REQUIRE(log.get_num_segments_destroyed() > 0);
+            auto old_ids = ids;
+
+            // Overwrite the old data with entries of another content, until
+            // we have written to a recycled segment.
+            std::fill(tmp.begin(), tmp.end(), 'b');
+            size_t written = 0;
+            while (log.get_num_segments_recycled() == 0 || ids.size() < 10) {
+                last = write();
+                ids.insert(last.id);
+                ++written;
+            }
+            BOOST_REQUIRE(log.get_num_segments_recycled() > 0);
+            log.sync_all_segments().get();
+
+            // Stale data past the new entries must neither be replayed nor be
+            // reported as corruption.
+            size_t read = 0;
+            for (auto& seg : log.get_active_segment_names()) {
+                auto id = commitlog::descriptor(seg).id;
+                // The segment holding the last old entry may still be active.
+                auto old = old_ids.count(id) > 0;
+                auto s = db::commitlog::read_log_file(seg, [&read, id, old](temporary_buffer<char> buf, db::replay_position rp) {
+                    BOOST_REQUIRE_EQUAL(rp.id, id);
+                    auto c = old && buf.size() && buf[0] == 'a' ? 'a' : 'b';
+                    BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [c](char x) { return x == c; }));
+                    read += c == 'b';
+                    return make_ready_future<>();
+                }).get0();
+                s->done().get();
+            }
+            BOOST_REQUIRE_EQUAL(read, written);
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_commitlog_counters) {
     auto count_cl_counters = []() -> size_t {
         auto ids = scollectd::get_collectd_ids();
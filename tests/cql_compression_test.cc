@@ -0,0 +1,93 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "transport/server.hh"
+#include "exceptions/exceptions.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using transport::cql_compression;
+
+static const cql_compression compressions[] = { cql_compression::lz4, cql_compression::snappy };
+
+// A body compressible enough to be sent compressed.
+static sstring make_body(size_t size) {
+    sstring body(sstring::initialized_later(), size);
+    for (size_t i = 0; i < size; i++) {
+        body[i] = 'a' + (i / 7) % 5;
+    }
+    return body;
+}
+
+BOOST_AUTO_TEST_CASE(test_compressed_bodies_round_trip) {
+    for (auto c : compressions) {
+        for (size_t size : { size_t(0), size_t(1), size_t(4096), size_t(1 << 20) }) {
+            auto body = make_body(size);
+            auto compressed = transport::compress_frame_body(c, body.data(), body.size());
+            if (size == 4096) {
+                BOOST_REQUIRE_LT(compressed.size(), body.size());
+            }
+            BOOST_REQUIRE_EQUAL(transport::uncompressed_frame_body_length(c, compressed.get(), compressed.size()), size);
+            auto decompressed = transport::decompress_frame_body(c, compressed.get(), compressed.size());
+            BOOST_REQUIRE_EQUAL(sstring(decompressed.get(), decompressed.size()), body);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_uncompressed_length_from_header) {
+    // A request is charged for its decompressed size before the rest of
+    // its body is read.
+    for (auto c : compressions) {
+        auto body = make_body(300000);
+        auto compressed = transport::compress_frame_body(c, body.data(), body.size());
+        BOOST_REQUIRE_GE(compressed.size(), transport::compressed_frame_body_header_size);
+        BOOST_REQUIRE_EQUAL(transport::uncompressed_frame_body_length(c, compressed.get(), transport::compressed_frame_body_header_size), body.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_lz4_body_starts_with_big_endian_length) {
+    auto body = make_body(0x10203);
+    auto compressed = transport::compress_frame_body(cql_compression::lz4, body.data(), body.size());
+    BOOST_REQUIRE_EQUAL(compressed[0], 0x00);
+    BOOST_REQUIRE_EQUAL(compressed[1], 0x01);
+    BOOST_REQUIRE_EQUAL(compressed[2], 0x02);
+    BOOST_REQUIRE_EQUAL(compressed[3], 0x03);
+}
+
+BOOST_AUTO_TEST_CASE(test_malformed_bodies_are_rejected) {
+    for (auto c : compressions) {
+        auto body = make_body(4096);
+        auto compressed = transport::compress_frame_body(c, body.data(), body.size());
+        BOOST_REQUIRE_THROW(transport::decompress_frame_body(c, compressed.get(), compressed.size() / 2), exceptions::protocol_exception);
+    }
+    const char garbage[] = "\xff\xff\xff\xff\xff\xff";
+    BOOST_REQUIRE_THROW(transport::decompress_frame_body(cql_compression::lz4, garbage, 3), exceptions::protocol_exception);
+    BOOST_REQUIRE_THROW(transport::decompress_frame_body(cql_compression::snappy, garbage, sizeof(garbage) - 1), exceptions::protocol_exception);
+    BOOST_REQUIRE_THROW(transport::decompress_frame_body(cql_compression::none, garbage, sizeof(garbage) - 1), exceptions::protocol_exception);
+}
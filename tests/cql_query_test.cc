@@ -24,6 +24,7 @@
 #include <boost/range/irange.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
+#include <boost/range/algorithm_ext/is_sorted.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 
@@ -34,7 +35,19 @@
 #include "core/future-util.hh"
 #include "core/sleep.hh"
 #include "transport/messages/result_message.hh"
+#include "cql3/query_options.hh"
+#include "service/pager/paging_state.hh"
+#include "service/storage_proxy.hh"
 #include "utils/big_decimal.hh"
+#include "utils/fb_utilities.hh"
+#include "repair/repair.hh"
+#include "streaming/stream_sstable_files.hh"
+#include "streaming/stream_manager.hh"
+#include "streaming/stream_transfer_task.hh"
+#include "message/messaging_service.hh"
+#include "sstables/sstables.hh"
+#include "core/fstream.hh"
+#include "core/thread.hh"
 
 #include "disk-error-handler.hh"
 
@@ -2166,3 +2179,456 @@ SEASTAR_TEST_CASE(test_alter_table_validation) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_aggregates_on_replicas) {
+    db::config cfg;
+    cfg.aggregate_push_down = true;
+
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table ta (p int, c int, s int static, v int, PRIMARY KEY (p, c));").get();
+            for (int p = 0; p < 50; ++p) {
+                for (int c = 0; c < 4; ++c) {
+                    e.execute_cql(sprint("insert into ta (p, c, v) values (%d, %d, %d);", p, c, p * 4 + c)).get();
+                }
+            }
+            // A partition with only a static row counts as one row.
+            e.execute_cql("insert into ta (p, s) values (50, 1);").get();
+
+            // Every query below must have been aggregated on the replicas,
+            // not by the coordinator over the rows.
+            auto& stats = service::get_local_storage_proxy().get_stats();
+            auto reads_before = stats.partial_aggregate_reads;
+
+            auto msg = e.execute_cql("select count(*), count(v), sum(v), avg(v), min(v), max(v) from ta;").get0();
+            assert_that(msg).is_rows().with_rows({
+                { long_type->decompose(int64_t(201)), long_type->decompose(int64_t(200)), int32_type->decompose(19900),
+                  int32_type->decompose(99), int32_type->decompose(0), int32_type->decompose(199) },
+            });
+
+            msg = e.execute_cql("select count(*), sum(v) from ta where p in (1, 2);").get0();
+            assert_that(msg).is_rows().with_rows({
+                { long_type->decompose(int64_t(8)), int32_type->decompose(60) },
+            });
+
+            msg = e.execute_cql("select count(*), avg(v) from ta where p = 3 and c > 1;").get0();
+            assert_that(msg).is_rows().with_rows({
+                { long_type->decompose(int64_t(2)), int32_type->decompose(14) },
+            });
+
+            msg = e.execute_cql("select count(*), max(v) from ta where p = 60;").get0();
+            assert_that(msg).is_rows().with_rows({
+                { long_type->decompose(int64_t(0)), {} },
+            });
+
+            BOOST_REQUIRE_EQUAL(stats.partial_aggregate_reads, reads_before + 4);
+        });
+    }, cfg);
+}
+
+// Pages through the results of a query, passing the paging state on the way
+// clients do, and returns the first column of all rows.
+static std::vector<int32_t> fetch_all_pages(cql_test_env& e, sstring query, int32_t page_size,
+        std::function<void ()> between_pages = [] {}) {
+    std::vector<int32_t> values;
+    ::shared_ptr<service::pager::paging_state> state;
+    do {
+        auto qo = std::make_unique<cql3::query_options>(db::consistency_level::ONE, std::experimental::nullopt,
+                std::vector<bytes_view_opt>{}, false,
+                cql3::query_options::specific_options{page_size, state, {}, api::missing_timestamp},
+                cql_serialization_format::latest());
+        auto msg = e.execute_cql(query, std::move(qo)).get0();
+        auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+        BOOST_REQUIRE(rows);
+        BOOST_REQUIRE_LE(rows->rs().rows().size(), size_t(page_size));
+        for (auto&& row : rows->rs().rows()) {
+            values.push_back(value_cast<int32_t>(int32_type->deserialize(*row[0])));
+        }
+        auto next = rows->rs().get_metadata().paging_state();
+        state = next ? service::pager::paging_state::deserialize(next->serialize()) : nullptr;
+        between_pages();
+    } while (state);
+    return values;
+}
+
+SEASTAR_TEST_CASE(test_paging_resumes_suspended_readers) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tp (p int, c int, v int, PRIMARY KEY (p, c));").get();
+            for (int p = 0; p < 10; ++p) {
+                for (int c = 0; c < 10; ++c) {
+                    e.execute_cql(sprint("insert into tp (p, c, v) values (%d, %d, %d);", p, c, p * 10 + c)).get();
+                }
+            }
+            auto querier_stats = [&e] {
+                using stats = querier_cache::stats;
+                return e.db().map_reduce0([] (database& db) {
+                    return db.get_querier_cache().get_stats();
+                }, stats(), [] (stats a, const stats& b) {
+                    a.hits += b.hits;
+                    a.misses += b.misses;
+                    a.drops += b.drops;
+                    return a;
+                }).get0();
+            };
+            auto all_values = boost::copy_range<std::vector<int32_t>>(boost::irange(0, 100));
+
+            // Partitions are returned in token order, rows in clustering order.
+            auto values = fetch_all_pages(e, "select v from tp;", 7);
+            boost::sort(values);
+            BOOST_REQUIRE(values == all_values);
+            BOOST_REQUIRE_GT(querier_stats().hits, 0);
+
+            values = fetch_all_pages(e, "select v from tp where p = 3;", 3);
+            BOOST_REQUIRE(values == boost::copy_range<std::vector<int32_t>>(boost::irange(30, 40)));
+
+            // Flushing memtables changes the data readers read, so suspended
+            // readers are evicted at once, and the query creates new ones.
+            auto before = querier_stats();
+            values = fetch_all_pages(e, "select v from tp;", 7, [&e] {
+                e.db().invoke_on_all([] (database& db) {
+                    return db.flush_all_memtables();
+                }).get();
+                e.execute_cql("insert into tp (p, c, v) values (100, 0, 1000);").get();
+            });
+            BOOST_REQUIRE_GT(querier_stats().misses, before.misses);
+            BOOST_REQUIRE_EQUAL(querier_stats().drops, before.drops);
+            // The row inserted while paging may be returned, but only once.
+            boost::sort(values);
+            if (values.back() == 1000) {
+                values.pop_back();
+            }
+            BOOST_REQUIRE(values == all_values);
+
+            // Rows written while paging, after the rows the previous pages
+            // returned, are seen by the next pages: suspended readers read
+            // ahead, so they can't be resumed once anything was written.
+            auto update_last_rows = [&e, first = true] () mutable {
+                if (!first) {
+                    return;
+                }
+                first = false;
+                for (int p = 0; p < 10; ++p) {
+                    e.execute_cql(sprint("update tp set v = -1 where p = %d and c = 9;", p)).get();
+                }
+            };
+            auto updated_values = boost::copy_range<std::vector<int32_t>>(all_values
+                    | boost::adaptors::filtered([] (int32_t v) { return v % 10 != 9; }));
+            updated_values.insert(updated_values.begin(), 10, -1);
+            before = querier_stats();
+            values = fetch_all_pages(e, "select v from tp;", 7, update_last_rows);
+            boost::sort(values);
+            BOOST_REQUIRE(values == updated_values);
+            BOOST_REQUIRE_GT(querier_stats().drops, before.drops);
+
+            e.execute_cql("update tp set v = 39 where p = 3 and c = 9;").get();
+            values = fetch_all_pages(e, "select v from tp where p = 3;", 3, [&e, first = true] () mutable {
+                if (first) {
+                    first = false;
+                    e.execute_cql("update tp set v = -1 where p = 3 and c = 9;").get();
+                }
+            });
+            auto expected = boost::copy_range<std::vector<int32_t>>(boost::irange(30, 39));
+            expected.push_back(-1);
+            BOOST_REQUIRE(values == expected);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_range_scan_token_order) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tr (p int primary key, v int);").get();
+            for (int p = 0; p < 200; ++p) {
+                e.execute_cql(sprint("insert into tr (p, v) values (%d, %d);", p, p)).get();
+            }
+            auto scan = [&e] (sstring query) {
+                auto msg = e.execute_cql(query).get0();
+                auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+                BOOST_REQUIRE(rows);
+                std::vector<std::pair<int64_t, int32_t>> tokens_and_keys;
+                for (auto&& row : rows->rs().rows()) {
+                    tokens_and_keys.emplace_back(value_cast<int64_t>(long_type->deserialize(*row[0])),
+                                                 value_cast<int32_t>(int32_type->deserialize(*row[1])));
+                }
+                return tokens_and_keys;
+            };
+
+            auto all = scan("select token(p), p from tr;");
+            BOOST_REQUIRE_EQUAL(all.size(), 200);
+            BOOST_REQUIRE(boost::is_sorted(all));
+
+            // Sub-ranges after the ones holding the first rows may complete
+            // first, but the rows are still the first ones in token order.
+            for (auto limit : {1, 17, 150}) {
+                auto first = scan(sprint("select token(p), p from tr limit %d;", limit));
+                BOOST_REQUIRE(first == std::vector<std::pair<int64_t, int32_t>>(all.begin(), all.begin() + limit));
+            }
+        });
+    });
+}
+
+static unsigned stream_mutations_received;
+
+// A node which doesn't know STREAM_MUTATION_BATCH gets the mutations of a
+// batch one at a time, with STREAM_MUTATION. The test node registers no
+// streaming handler but the latter.
+SEASTAR_TEST_CASE(test_stream_mutation_batch_falls_back_for_old_peers) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            streaming::get_stream_manager().start().get();
+            stream_mutations_received = 0;
+            net::get_messaging_service().invoke_on_all([] (auto& ms) {
+                ms.register_stream_mutation([] (const rpc::client_info& cinfo, utils::UUID plan_id, frozen_mutation fm, unsigned dst_cpu_id) {
+                    return smp::submit_to(0, [] {
+                        ++stream_mutations_received;
+                    });
+                });
+            }).get();
+
+            e.execute_cql("create table tsm (p int primary key, v int);").get();
+            auto s = e.local_db().find_schema("ks", "tsm");
+            auto make_batch = [s] (int n) {
+                std::vector<frozen_mutation> fms;
+                for (int i = 0; i < n; i++) {
+                    mutation m(partition_key::from_single_value(*s, int32_type->decompose(i)), s);
+                    m.set_clustered_cell(clustering_key::make_empty(*s), "v", data_value(i), api::new_timestamp());
+                    fms.push_back(freeze(m));
+                }
+                return fms;
+            };
+            net::msg_addr peer{utils::fb_utilities::get_broadcast_address()};
+            auto plan_id = utils::make_random_uuid();
+
+            streaming::send_mutation_batch(peer, plan_id, make_batch(3), 0).get();
+            BOOST_REQUIRE_EQUAL(stream_mutations_received, 3);
+            auto supported = streaming::get_local_stream_manager().mutation_batch_supported(peer.addr);
+            BOOST_REQUIRE(supported && !*supported);
+
+            // Now known to be old, the peer isn't sent batches anymore.
+            streaming::send_mutation_batch(peer, plan_id, make_batch(2), 0).get();
+            BOOST_REQUIRE_EQUAL(stream_mutations_received, 5);
+
+            streaming::get_stream_manager().stop().get();
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_repair_rows_are_readable_once_flushed) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table trr (p int, c int, v int, primary key (p, c));").get();
+            e.execute_cql("insert into trr (p, c, v) values (1, 1, 1);").get();
+            // Move the partition to an sstable, and read it into the cache.
+            e.db().invoke_on_all([] (database& db) {
+                return db.flush_all_memtables();
+            }).get();
+            auto msg = e.execute_cql("select c, v from trr where p = 1;").get0();
+            assert_that(msg).is_rows().with_size(1);
+
+            auto s = e.local_db().find_schema("ks", "trr");
+            auto pk = partition_key::from_single_value(*s, int32_type->decompose(1));
+            mutation m(pk, s);
+            m.set_clustered_cell(clustering_key::from_single_value(*s, int32_type->decompose(2)), "v", data_value(2), api::new_timestamp());
+            m.set_clustered_cell(clustering_key::from_single_value(*s, int32_type->decompose(3)), "v", data_value(3), api::new_timestamp());
+            std::vector<frozen_mutation> fms{freeze(m)};
+            repair_apply_rows(e.db(), fms, net::msg_addr{utils::fb_utilities::get_broadcast_address()}).get();
+            auto everything = ::range<dht::token>::make_open_ended_both_sides();
+            repair_flush_rows(e.db(), "ks", "trr", everything).get();
+
+            msg = e.execute_cql("select c, v from trr where p = 1;").get0();
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(1), int32_type->decompose(1)},
+                {int32_type->decompose(2), int32_type->decompose(2)},
+                {int32_type->decompose(3), int32_type->decompose(3)},
+            });
+
+            // Only the selected rows are read for a peer.
+            std::vector<repair_partition_rows> rows{{pk, false, {clustering_key::from_single_value(*s, int32_type->decompose(3))}}};
+            auto got = repair_get_rows(e.db(), "ks", "trr", rows).get0();
+            BOOST_REQUIRE_EQUAL(got.size(), 1);
+            auto got_m = got[0].unfreeze(s);
+            BOOST_REQUIRE_EQUAL(std::distance(got_m.partition().clustered_rows().begin(), got_m.partition().clustered_rows().end()), 1);
+            BOOST_REQUIRE(got_m.partition().partition_tombstone() == tombstone());
+
+            // A wide partition is cut short, and continued after the last
+            // row of the previous window.
+            auto hashes = repair_row_hashes(e.db(), "ks", "trr", everything, 3).get0();
+            BOOST_REQUIRE_EQUAL(hashes.size(), 1);
+            BOOST_REQUIRE_EQUAL(hashes[0].rows.size(), 2);
+            repair_row_position after{pk, hashes[0].rows.back().key};
+            auto rest = repair_row_hashes(e.db(), "ks", "trr", everything, 3, after).get0();
+            BOOST_REQUIRE_EQUAL(rest.size(), 1);
+            BOOST_REQUIRE(rest[0].partition_hash == partition_checksum());
+            BOOST_REQUIRE_EQUAL(rest[0].rows.size(), 1);
+            BOOST_REQUIRE(rest[0].rows[0].key.equal(*s, clustering_key::from_single_value(*s, int32_type->decompose(3))));
+        });
+    });
+}
+
+// Feeds the files of sst to the receiving side of whole-sstable streaming
+// for the table cf_id, in chunks like the sender does. Must run in a thread,
+// on the shard owning sst. Returns the generation of the received sstable.
+static int64_t receive_sstable_files(const schema& s, sstables::shared_sstable sst, utils::UUID plan_id, utils::UUID cf_id) {
+    std::vector<sstables::sstable::component_type> components;
+    std::vector<sstring> names;
+    for (auto c : sst->all_components()) {
+        if (c == sstables::sstable::component_type::TOC) {
+            continue;
+        }
+        components.push_back(c);
+        names.push_back(sstables::sstable::component_to_sstring(c));
+    }
+    auto generation = streaming::receive_sstable_begin(plan_id, cf_id,
+            sstables::sstable::version_to_sstring(sst->get_version()),
+            sstables::sstable::format_to_sstring(sst->get_format()), std::move(names)).get0();
+    std::vector<uint64_t> sizes;
+    for (unsigned i = 0; i < components.size(); i++) {
+        auto name = sstables::sstable::filename(sst->get_dir(), s.ks_name(), s.cf_name(), sst->get_version(),
+                sst->generation(), sst->get_format(), components[i]);
+        auto f = open_file_dma(name, open_flags::ro).get0();
+        auto size = f.size().get0();
+        auto in = make_file_input_stream(std::move(f));
+        uint64_t offset = 0;
+        while (offset < size) {
+            auto len = std::min<uint64_t>(128 * 1024, size - offset);
+            auto buf = in.read_exactly(len).get0();
+            BOOST_REQUIRE_EQUAL(buf.size(), len);
+            streaming::receive_sstable_chunk(plan_id, generation, i, offset,
+                    bytes(reinterpret_cast<const int8_t*>(buf.get()), buf.size())).get();
+            offset += len;
+        }
+        in.close().get();
+        sizes.push_back(size);
+    }
+    streaming::receive_sstable_end(plan_id, cf_id, generation, std::move(sizes)).get();
+    return generation;
+}
+
+SEASTAR_TEST_CASE(test_streamed_sstable_files_are_loaded) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tss_src (p int, c int, v int, primary key (p, c));").get();
+            e.execute_cql("create table tss_dst (p int, c int, v int, primary key (p, c));").get();
+            e.execute_cql("insert into tss_src (p, c, v) values (1, 2, 2);").get();
+            e.execute_cql("insert into tss_dst (p, c, v) values (1, 1, 1);").get();
+            e.db().invoke_on_all([] (database& db) {
+                return db.flush_all_memtables();
+            }).get();
+            // Read the destination partition into the cache.
+            auto msg = e.execute_cql("select c, v from tss_dst where p = 1;").get0();
+            assert_that(msg).is_rows().with_size(1);
+
+            auto s = e.local_db().find_schema("ks", "tss_src");
+            auto dst_id = e.local_db().find_schema("ks", "tss_dst")->id();
+            auto pk = partition_key::from_single_value(*s, int32_type->decompose(1));
+            auto shard = dht::shard_of(dht::global_partitioner().decorate_key(*s, pk).token());
+            e.db().invoke_on(shard, [s, dst_id] (database& db) {
+                return seastar::async([&db, s, dst_id] {
+                    auto& src = db.find_column_family(s->id());
+                    auto ssts = *src.get_sstables();
+                    BOOST_REQUIRE_EQUAL(ssts.size(), 1);
+                    auto sst = ssts.begin()->second;
+                    // Levels are meaningless on the receiver.
+                    sst->mutate_sstable_level(3).get();
+                    auto generation = receive_sstable_files(*s, sst, utils::make_random_uuid(), dst_id);
+
+                    auto dst = db.find_column_family(dst_id).get_sstables();
+                    auto it = dst->find(generation);
+                    BOOST_REQUIRE(it != dst->end());
+                    BOOST_REQUIRE_EQUAL(it->second->get_sstable_level(), 0);
+                });
+            }).get();
+
+            // The cached partition must not hide the rows of the new sstable.
+            msg = e.execute_cql("select c, v from tss_dst where p = 1;").get0();
+            assert_that(msg).is_rows().with_rows({
+                {int32_type->decompose(1), int32_type->decompose(1)},
+                {int32_type->decompose(2), int32_type->decompose(2)},
+            });
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_incomplete_streamed_sstable_files_are_removed) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tsi (p int primary key, v int);").get();
+            auto s = e.local_db().find_schema("ks", "tsi");
+            auto& cf = e.local_db().find_column_family(s);
+            auto version = sstables::sstable::version_types::ka;
+            auto format = sstables::sstable::format_types::big;
+            auto filename = [&] (int64_t generation, sstables::sstable::component_type c) {
+                return sstables::sstable::filename(cf.dir(), "ks", "tsi", version, generation, format, c);
+            };
+            std::vector<sstring> components{"Data.db", "Index.db"};
+            auto plan_id = utils::make_random_uuid();
+
+            // An sstable which does not seal is removed at once.
+            auto generation = streaming::receive_sstable_begin(plan_id, s->id(), sstables::sstable::version_to_sstring(version),
+                    sstables::sstable::format_to_sstring(format), components).get0();
+            BOOST_REQUIRE(file_exists(filename(generation, sstables::sstable::component_type::TemporaryTOC)).get0());
+            BOOST_REQUIRE_THROW(streaming::receive_sstable_end(plan_id, s->id(), generation, {}).get(), std::runtime_error);
+            BOOST_REQUIRE(!file_exists(filename(generation, sstables::sstable::component_type::TemporaryTOC)).get0());
+            BOOST_REQUIRE(!file_exists(filename(generation, sstables::sstable::component_type::Data)).get0());
+            BOOST_REQUIRE(!file_exists(filename(generation, sstables::sstable::component_type::TOC)).get0());
+
+            // So are those still being received when the plan fails.
+            generation = streaming::receive_sstable_begin(plan_id, s->id(), sstables::sstable::version_to_sstring(version),
+                    sstables::sstable::format_to_sstring(format), components).get0();
+            streaming::receive_sstable_chunk(plan_id, generation, 0, 0, bytes(bytes::initialized_later(), 100)).get();
+            streaming::abort_received_sstables(plan_id).get();
+            BOOST_REQUIRE(!file_exists(filename(generation, sstables::sstable::component_type::TemporaryTOC)).get0());
+            BOOST_REQUIRE(!file_exists(filename(generation, sstables::sstable::component_type::Data)).get0());
+            BOOST_REQUIRE_THROW(streaming::receive_sstable_chunk(plan_id, generation, 0, 4096, bytes()), std::runtime_error);
+            BOOST_REQUIRE(cf.get_sstables()->empty());
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_sstable_files_fall_back_to_mutations) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tsf (p int primary key, v int);").get();
+            e.execute_cql("insert into tsf (p, v) values (1, 1);").get();
+            e.db().invoke_on_all([] (database& db) {
+                return db.flush_all_memtables();
+            }).get();
+            auto s = e.local_db().find_schema("ks", "tsf");
+            auto pk = partition_key::from_single_value(*s, int32_type->decompose(1));
+            auto shard = dht::shard_of(dht::global_partitioner().decorate_key(*s, pk).token());
+            // Nothing listens on the peer, so no sstable is sent as files and
+            // the caller must stream all of them as mutations.
+            auto sent = e.db().invoke_on(shard, [id = s->id()] (database& db) {
+                std::vector<range<dht::token>> ranges{range<dht::token>::make_open_ended_both_sides()};
+                return streaming::send_sstable_files(db, utils::make_random_uuid(), id,
+                        net::messaging_service::msg_addr{gms::inet_address("127.0.0.2"), 0}, std::move(ranges));
+            }).get0();
+            BOOST_REQUIRE(sent.empty());
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_partition_key_bind_indices) {
+    return do_with_cql_env([] (auto& e) {
+        return seastar::async([&e] {
+            e.execute_cql("create table tpk (a int, b int, c int, v int, primary key ((a, b), c));").get();
+            auto indices = [&e] (sstring query) {
+                auto id = e.prepare(std::move(query)).get0();
+                return e.local_qp().get_prepared(id)->partition_key_bind_indices;
+            };
+            using v = std::vector<uint16_t>;
+            // In partition key component order, wherever the markers are.
+            BOOST_REQUIRE(indices("select * from tpk where a = ? and b = ?;") == v({0, 1}));
+            BOOST_REQUIRE(indices("select * from tpk where c = ? and b = ? and a = ?;") == v({2, 1}));
+            BOOST_REQUIRE(indices("insert into tpk (v, c, b, a) values (?, ?, ?, ?);") == v({3, 2}));
+            BOOST_REQUIRE(indices("update tpk set v = ? where a = ? and b = ? and c = ?;") == v({1, 2}));
+            // Part of the key is not bound.
+            BOOST_REQUIRE(indices("update tpk set v = ? where a = ? and b = 1 and c = ?;").empty());
+            // A key column bound twice, or to a list, has no single value.
+            BOOST_REQUIRE(indices("select * from tpk where a in (?, ?) and b = ?;").empty());
+            BOOST_REQUIRE(indices("select * from tpk where a = ? and b in (?, ?);").empty());
+            BOOST_REQUIRE(indices("select * from tpk where a in ? and b = ?;").empty());
+        });
+    });
+}
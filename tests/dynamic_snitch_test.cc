@@ -0,0 +1,112 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include "locator/dynamic_snitch.hh"
+#include "locator/simple_snitch.hh"
+#include "tests/test-utils.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using namespace locator;
+using inet_address = gms::inet_address;
+
+static const inet_address a("127.0.0.2");
+static const inet_address b("127.0.0.3");
+static const inet_address c("127.0.0.4");
+static const inet_address d("127.0.0.5");
+
+// Runs func in a thread with a started dynamic snitch over the simple
+// snitch, which keeps the replica order.
+template <typename Func>
+static future<> with_dynamic_snitch(Func func) {
+    utils::fb_utilities::set_broadcast_address(gms::inet_address("127.0.0.1"));
+    return seastar::async([func = std::move(func)] {
+        dynamic_snitch_config cfg;
+        cfg.enabled = true;
+        cfg.update_interval = std::chrono::milliseconds(1);
+        cfg.reset_interval = std::chrono::hours(1);
+        cfg.badness_threshold = 0.1;
+        dynamic_snitch snitch(std::make_unique<simple_snitch>(), cfg);
+        snitch.start().get();
+        try {
+            func(snitch);
+        } catch (...) {
+            snitch.stop().get();
+            throw;
+        }
+        snitch.stop().get();
+    });
+}
+
+static void receive_timings(dynamic_snitch& snitch, std::vector<std::pair<inet_address, int>> latencies_us) {
+    for (auto&& l : latencies_us) {
+        snitch.receive_timing(l.first, std::chrono::microseconds(l.second));
+    }
+    // Let the scores be recomputed.
+    sleep(std::chrono::milliseconds(20)).get();
+}
+
+static std::vector<inet_address> sorted(dynamic_snitch& snitch, inet_address address, std::vector<inet_address> addresses) {
+    snitch.sort_by_proximity(address, addresses);
+    return addresses;
+}
+
+SEASTAR_TEST_CASE(test_dynamic_snitch_sorts_by_score_past_badness_threshold) {
+    return with_dynamic_snitch([] (dynamic_snitch& snitch) {
+        auto me = utils::fb_utilities::get_broadcast_address();
+        receive_timings(snitch, {{a, 1000}, {b, 100}, {c, 100}});
+        BOOST_REQUIRE(sorted(snitch, me, {a, b, c}) == std::vector<inet_address>({b, c, a}));
+        // Only the local node's view is known.
+        BOOST_REQUIRE(sorted(snitch, d, {a, b, c}) == std::vector<inet_address>({a, b, c}));
+    });
+}
+
+SEASTAR_TEST_CASE(test_dynamic_snitch_keeps_order_within_badness_threshold) {
+    return with_dynamic_snitch([] (dynamic_snitch& snitch) {
+        auto me = utils::fb_utilities::get_broadcast_address();
+        // Scores are 0.95, 0.91 and 1: no endpoint is more than 10% worse
+        // than the best score for its position.
+        receive_timings(snitch, {{a, 1050}, {b, 1000}, {c, 1100}});
+        BOOST_REQUIRE(sorted(snitch, me, {a, b, c}) == std::vector<inet_address>({a, b, c}));
+        // The average latency of a grows to 3000us: scores are 1, 0.33 and
+        // 0.37.
+        receive_timings(snitch, {{a, 20550}});
+        BOOST_REQUIRE(sorted(snitch, me, {a, b, c}) == std::vector<inet_address>({b, c, a}));
+    });
+}
+
+SEASTAR_TEST_CASE(test_dynamic_snitch_endpoints_without_samples_are_neutral) {
+    return with_dynamic_snitch([] (dynamic_snitch& snitch) {
+        auto me = utils::fb_utilities::get_broadcast_address();
+        receive_timings(snitch, {{a, 1000}, {b, 100}});
+        BOOST_REQUIRE_CLOSE(snitch.get_score(d), (1.0 + 0.1) / 2, 0.001);
+        BOOST_REQUIRE(sorted(snitch, me, {a, d, b}) == std::vector<inet_address>({b, d, a}));
+        BOOST_REQUIRE(sorted(snitch, me, {d, b}) == std::vector<inet_address>({b, d}));
+    });
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "utils/histogram.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+using namespace std::chrono_literals;
+
+BOOST_AUTO_TEST_CASE(test_decaying_histogram_percentiles) {
+    utils::decaying_histogram h;
+    BOOST_REQUIRE_EQUAL(h.count(), 0);
+    BOOST_REQUIRE(h.percentile(0.99) == 0s);
+
+    auto now = utils::decaying_histogram::clock::now();
+    for (int i = 0; i < 99; ++i) {
+        h.mark(1ms, now);
+    }
+    h.mark(100ms, now);
+    BOOST_REQUIRE_EQUAL(h.count(), 100);
+
+    // Buckets are accurate to within 25%.
+    auto p50 = h.percentile(0.5);
+    BOOST_REQUIRE(p50 >= 1ms && p50 <= 1250us);
+    auto p99 = h.percentile(0.99);
+    BOOST_REQUIRE(p99 >= 1ms && p99 <= 1250us);
+    auto max = h.percentile(1);
+    BOOST_REQUIRE(max >= 100ms && max <= 125ms);
+
+    // Latencies beyond the range are clamped.
+    h.mark(1h, now);
+    BOOST_REQUIRE(h.percentile(1) == utils::decaying_histogram::max_latency());
+}
+
+BOOST_AUTO_TEST_CASE(test_decaying_histogram_decay) {
+    utils::decaying_histogram h;
+    auto now = utils::decaying_histogram::clock::now();
+    auto half_life = utils::decaying_histogram::half_life();
+    for (int i = 0; i < 1000; ++i) {
+        h.mark(100ms, now);
+    }
+
+    // After a half-life, old samples weigh half as much.
+    now += half_life;
+    for (int i = 0; i < 1000; ++i) {
+        h.mark(1ms, now);
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 1500);
+    BOOST_REQUIRE(h.percentile(0.5) <= 1250us);
+    BOOST_REQUIRE(h.percentile(0.9) >= 100ms);
+
+    // Long enough later, the old samples are gone.
+    now += 20 * half_life;
+    h.mark(1ms, now);
+    BOOST_REQUIRE_EQUAL(h.count(), 1);
+    BOOST_REQUIRE(h.percentile(1) <= 1250us);
+}
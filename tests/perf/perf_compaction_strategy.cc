@@ -0,0 +1,141 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <core/distributed.hh>
+#include <core/app-template.hh>
+#include <core/sstring.hh>
+#include <core/thread.hh>
+
+#include <boost/range/adaptor/map.hpp>
+#include <boost/range/algorithm/copy.hpp>
+
+#include "database.hh"
+#include "log.hh"
+#include "schema_builder.hh"
+#include "sstables/compaction.hh"
+#include "sstables/compaction_manager.hh"
+#include "tests/tmpdir.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+// Simulates a time series workload: every flush produces an sstable with
+// timestamps later than the previous one. Compaction is run to completion
+// after each flush, and the amount of data written by compaction is compared
+// with the amount of data written by flushes.
+
+static uint64_t total_data_size(column_family& cf) {
+    uint64_t size = 0;
+    for (auto&& sst : *cf.get_sstables() | boost::adaptors::map_values) {
+        size += sst->data_size();
+    }
+    return size;
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("debug", "enable debug logging")
+        ("flushes", bpo::value<unsigned>()->default_value(200), "number of memtables flushed")
+        ("flushes-per-window", bpo::value<unsigned>()->default_value(12), "number of flushes per hour-long time window")
+        ("partitions", bpo::value<unsigned>()->default_value(1000), "number of partitions written per flush")
+        ("cell-size", bpo::value<unsigned>()->default_value(64), "cell size in bytes");
+
+    return app.run(argc, argv, [&app] {
+        if (app.configuration().count("debug")) {
+            logging::logger_registry().set_all_loggers_level(logging::log_level::debug);
+        }
+
+        return seastar::async([&] {
+            unsigned flushes = app.configuration()["flushes"].as<unsigned>();
+            unsigned flushes_per_window = app.configuration()["flushes-per-window"].as<unsigned>();
+            unsigned partitions = app.configuration()["partitions"].as<unsigned>();
+            unsigned cell_size = app.configuration()["cell-size"].as<unsigned>();
+            auto window = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::hours(1)).count();
+
+            for (auto strategy : { sstables::compaction_strategy_type::size_tiered, sstables::compaction_strategy_type::time_window }) {
+                auto s = schema_builder("ks", "cf")
+                    .with_column("pk", bytes_type, column_kind::partition_key)
+                    .with_column("ck", long_type, column_kind::clustering_key)
+                    .with_column("v", bytes_type, column_kind::regular_column)
+                    .set_compaction_strategy(strategy)
+                    .set_compaction_strategy_options({{"compaction_window_unit", "HOURS"}, {"compaction_window_size", "1"}})
+                    .build();
+
+                tmpdir tmp;
+                compaction_manager cm;
+                column_family::config cfg;
+                cfg.datadir = tmp.path;
+                cfg.enable_disk_writes = true;
+                cfg.enable_cache = false;
+                cfg.enable_commitlog = false;
+                cfg.enable_incremental_backups = false;
+                column_family cf(s, cfg, column_family::no_commitlog(), cm);
+                cf.start();
+                cf.mark_ready_for_writes();
+
+                uint64_t ingested = 0;
+                uint64_t rewritten = 0;
+                api::timestamp_type ts = 0;
+
+                for (unsigned i = 0; i < flushes; ++i) {
+                    for (unsigned j = 0; j < partitions; ++j) {
+                        mutation m(partition_key::from_single_value(*s, to_bytes(sprint("key%d", j))), s);
+                        auto ck = clustering_key::from_single_value(*s, long_type->decompose(int64_t(ts)));
+                        m.set_clustered_cell(ck, "v", data_value(bytes(bytes::initialized_later(), cell_size)), ts);
+                        cf.apply(m);
+                    }
+                    ts += window / flushes_per_window;
+
+                    auto before = total_data_size(cf);
+                    cf.flush().get();
+                    ingested += total_data_size(cf) - before;
+
+                    while (true) {
+                        std::vector<sstables::shared_sstable> candidates;
+                        boost::copy(*cf.get_sstables() | boost::adaptors::map_values, std::back_inserter(candidates));
+                        auto descriptor = cf.get_compaction_strategy().get_sstables_for_compaction(cf, std::move(candidates));
+                        if (descriptor.sstables.empty()) {
+                            break;
+                        }
+                        uint64_t input = 0;
+                        for (auto&& sst : descriptor.sstables) {
+                            input += sst->data_size();
+                        }
+                        auto before = total_data_size(cf);
+                        cf.compact_sstables(std::move(descriptor)).get();
+                        rewritten += total_data_size(cf) - (before - input);
+                    }
+                }
+
+                std::cout << sstables::compaction_strategy::name(strategy) << ": "
+                          << ingested << " bytes ingested, " << rewritten << " bytes rewritten by compaction, "
+                          << double(rewritten) / ingested << " bytes rewritten per byte ingested, "
+                          << cf.sstables_count() << " sstables left\n";
+
+                cf.stop().get();
+            }
+        });
+    });
+}
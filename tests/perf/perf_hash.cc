@@ -20,6 +20,7 @@
  */
 
 #include "utils/murmur_hash.hh"
+#include "utils/bloom_filter.hh"
 #include "tests/perf/perf.hh"
 
 #include "disk-error-handler.hh"
@@ -53,5 +54,58 @@ int main(int argc, char* argv[]) {
         sink += dst[1];
     });
 
+    // A read probes the filters of all the sstables of a table.
+    const int nr_filters = 40;
+    const int keys_per_filter = 100000;
+    auto make_key = [] (int i) {
+        return to_bytes("key" + to_sstring(i));
+    };
+    auto make_filters = [&] (utils::filter_format format) {
+        std::vector<utils::filter_ptr> filters;
+        for (int f = 0; f < nr_filters; ++f) {
+            filters.push_back(utils::i_filter::get_filter(keys_per_filter, 0.01, format));
+            for (int i = 0; i < keys_per_filter; ++i) {
+                filters.back()->add(bytes_view(make_key(f * keys_per_filter + i)));
+            }
+        }
+        return filters;
+    };
+    auto classic = make_filters(utils::filter_format::classic);
+    auto blocked = make_filters(utils::filter_format::blocked);
+
+    // Keys present in one of the filters, as read keys usually are.
+    std::vector<bytes> keys;
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back(make_key(i * (nr_filters * keys_per_filter / 1000)));
+    }
+    size_t next = 0;
+
+    std::cout << "Timing filter probes, hashing for each filter...\n";
+
+    time_it([&] {
+        auto& key = keys[next++ % keys.size()];
+        for (auto& f : classic) {
+            sink += f->is_present(bytes_view(key));
+        }
+    });
+
+    std::cout << "Timing filter probes, hashing once...\n";
+
+    time_it([&] {
+        auto hash = utils::make_hashed_key(keys[next++ % keys.size()]);
+        for (auto& f : classic) {
+            sink += f->is_present(hash);
+        }
+    });
+
+    std::cout << "Timing blocked filter probes, hashing once...\n";
+
+    time_it([&] {
+        auto hash = utils::make_hashed_key(keys[next++ % keys.size()]);
+        for (auto& f : blocked) {
+            sink += f->is_present(hash);
+        }
+    });
+
     black_hole = sink;
 }
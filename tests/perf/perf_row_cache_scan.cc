@@ -0,0 +1,99 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <core/distributed.hh>
+#include <core/app-template.hh>
+#include <core/sstring.hh>
+#include <core/thread.hh>
+
+#include "utils/managed_bytes.hh"
+#include "utils/logalloc.hh"
+#include "row_cache.hh"
+#include "log.hh"
+#include "schema_builder.hh"
+#include "memtable.hh"
+#include "tests/perf/perf.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+static
+dht::decorated_key new_key(schema_ptr s) {
+    static thread_local int next = 0;
+    return dht::global_partitioner().decorate_key(*s,
+        partition_key::from_single_value(*s, to_bytes(sprint("key%d", next++))));
+}
+
+static
+void scan(row_cache& cache, schema_ptr s) {
+    auto reader = cache.make_reader(s, query::full_partition_range);
+    while (reader().get0()) {}
+}
+
+int main(int argc, char** argv) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("debug", "enable debug logging")
+        ("partitions", bpo::value<unsigned>()->default_value(10000), "number of partitions")
+        ("cell-size", bpo::value<unsigned>()->default_value(64), "cell size in bytes");
+
+    return app.run(argc, argv, [&app] {
+        if (app.configuration().count("debug")) {
+            logging::logger_registry().set_all_loggers_level(logging::log_level::debug);
+        }
+
+        return seastar::async([&] {
+            auto s = schema_builder("ks", "cf")
+                .with_column("pk", bytes_type, column_kind::partition_key)
+                .with_column("v", bytes_type, column_kind::regular_column)
+                .build();
+
+            size_t partitions = app.configuration()["partitions"].as<unsigned>();
+            size_t cell_size = app.configuration()["cell-size"].as<unsigned>();
+
+            // Underlying data source, stands in for sstables.
+            auto underlying = make_lw_shared<memtable>(s);
+            for (unsigned i = 0; i < partitions; ++i) {
+                mutation m(new_key(s), s);
+                m.set_clustered_cell(clustering_key::make_empty(*s), "v", data_value(bytes(bytes::initialized_later(), cell_size)), 1);
+                underlying->apply(m);
+            }
+
+            for (bool continuity : { false, true }) {
+                cache_tracker tracker;
+                row_cache cache(s, underlying->as_data_source(), underlying->as_key_source(), tracker);
+                cache.set_continuity_tracking(continuity);
+
+                // Warm up, all partitions are cached after this.
+                scan(cache, s);
+
+                std::cout << "Timing full scans of " << partitions << " partitions, continuity tracking "
+                          << (continuity ? "on" : "off") << "...\n";
+                time_it([&] {
+                    scan(cache, s);
+                }, 5, 1);
+            }
+        });
+    });
+}
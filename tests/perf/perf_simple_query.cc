@@ -22,6 +22,11 @@
 #include <boost/range/irange.hpp>
 #include "tests/cql_test_env.hh"
 #include "tests/perf/perf.hh"
+#include "transport/server.hh"
+#include "cql3/query_options.hh"
+#include "service/pager/paging_state.hh"
+#include "database.hh"
+#include "db/config.hh"
 #include "core/app-template.hh"
 
 #include "disk-error-handler.hh"
@@ -56,6 +61,12 @@ struct test_config {
     unsigned concurrency;
     bool query_single_key;
     unsigned duration_in_seconds;
+    bool measure_response_copies;
+    // If non-zero, reads scan the whole table in pages of that many rows.
+    int32_t page_size;
+    // If non-zero, every partition is written to that many sstables, which
+    // point reads have to merge.
+    unsigned sstables;
 };
 
 std::ostream& operator<<(std::ostream& os, const test_config::run_mode& m) {
@@ -71,21 +82,137 @@ std::ostream& operator<<(std::ostream& os, const test_config& cfg) {
            << ", concurrency=" << cfg.concurrency
            << ", mode=" << cfg.mode
            << ", query_single_key=" << (cfg.query_single_key ? "yes" : "no")
+           << ", measure_response_copies=" << (cfg.measure_response_copies ? "yes" : "no")
+           << ", page_size=" << cfg.page_size
+           << ", sstables=" << cfg.sstables
            << "}";
 }
 
-future<> test_read(cql_test_env& env, test_config& cfg) {
-    std::cout << "Creating " << cfg.partitions << " partitions..." << std::endl;
-    auto partitions = boost::irange(0, (int)cfg.partitions);
-    return do_for_each(partitions.begin(), partitions.end(), [&env](int sequence) {
-        return execute_update_for_key(env, make_key(sequence));
-    }).then([&env] {
-        return env.prepare("select \"C0\", \"C1\", \"C2\", \"C3\", \"C4\" from cf where \"KEY\" = ?");
-    }).then([&env, &cfg](auto id) {
+static thread_local uint64_t responses_serialized;
+static thread_local uint64_t response_bytes_copied;
+
+// Serializes a read result the way the CQL server would send it, counting the
+// bytes copied on the way.
+static void serialize_response(shared_ptr<transport::messages::result_message> msg) {
+    ++responses_serialized;
+    response_bytes_copied += transport::cql_server::result_bytes_copied(4, msg);
+}
+
+future<> report_response_copies() {
+    using totals = std::pair<uint64_t, uint64_t>;
+    return map_reduce(boost::irange(0u, smp::count), [] (unsigned shard) {
+        return smp::submit_to(shard, [] {
+            return totals(responses_serialized, response_bytes_copied);
+        });
+    }, totals(0, 0), [] (totals a, totals b) {
+        return totals(a.first + b.first, a.second + b.second);
+    }).then([] (totals t) {
+        if (t.first) {
+            std::cout << sprint("%.2f", (double)t.second / t.first) << " bytes copied per response\n";
+        }
+    });
+}
+
+// Reads the whole table page by page, passing the paging state from one page
+// to the next the way clients do.
+static future<> scan_in_pages(cql_test_env& env, int32_t page_size) {
+    return do_with(::shared_ptr<service::pager::paging_state>(), [&env, page_size] (auto& state) {
+        return repeat([&env, page_size, &state] {
+            auto qo = std::make_unique<cql3::query_options>(db::consistency_level::ONE, std::experimental::nullopt,
+                    std::vector<bytes_view_opt>{}, false,
+                    cql3::query_options::specific_options{page_size, state, {}, api::missing_timestamp},
+                    cql_serialization_format::latest());
+            return env.execute_cql("select \"C0\", \"C1\", \"C2\", \"C3\", \"C4\" from cf;", std::move(qo)).then([&state] (auto msg) {
+                auto rows = dynamic_pointer_cast<transport::messages::result_message::rows>(msg);
+                auto next = rows->rs().get_metadata().paging_state();
+                state = next ? service::pager::paging_state::deserialize(next->serialize()) : nullptr;
+                return state ? stop_iteration::no : stop_iteration::yes;
+            });
+        });
+    });
+}
+
+future<> report_querier_cache_stats(cql_test_env& env) {
+    using stats = querier_cache::stats;
+    return env.db().map_reduce0([] (database& db) {
+        return db.get_querier_cache().get_stats();
+    }, stats(), [] (stats a, const stats& b) {
+        a.hits += b.hits;
+        a.misses += b.misses;
+        a.drops += b.drops;
+        a.evictions += b.evictions;
+        return a;
+    }).then([] (stats s) {
+        auto lookups = s.hits + s.misses;
+        std::cout << "suspended readers: " << s.hits << " resumed, " << s.misses << " missed, "
+                  << s.drops << " dropped, " << s.evictions << " evicted";
+        if (lookups) {
+            std::cout << sprint(" (hit rate %.1f%%)", 100.0 * s.hits / lookups);
+        }
+        std::cout << "\n";
+    });
+}
+
+future<> test_paged_read(cql_test_env& env, test_config& cfg) {
+    return time_parallel([&env, &cfg] {
+        return scan_in_pages(env, cfg.page_size);
+    }, cfg.concurrency, cfg.duration_in_seconds).then([&env] {
+        return report_querier_cache_stats(env);
+    });
+}
+
+future<> test_point_read(cql_test_env& env, test_config& cfg) {
+    return env.prepare("select \"C0\", \"C1\", \"C2\", \"C3\", \"C4\" from cf where \"KEY\" = ?").then([&env, &cfg](auto id) {
         return time_parallel([&env, &cfg, id] {
             bytes key = make_key(cfg.query_single_key ? 0 : std::rand() % cfg.partitions);
-            return env.execute_prepared(id, {{std::move(key)}}).discard_result();
+            auto f = env.execute_prepared(id, {{std::move(key)}});
+            if (cfg.measure_response_copies) {
+                return f.then([] (auto msg) {
+                    serialize_response(msg);
+                });
+            }
+            return f.discard_result();
         }, cfg.concurrency, cfg.duration_in_seconds);
+    }).then([&cfg] {
+        if (cfg.measure_response_copies) {
+            return report_response_copies();
+        }
+        return make_ready_future<>();
+    });
+}
+
+static future<> populate(cql_test_env& env, test_config& cfg) {
+    auto partitions = boost::irange(0, (int)cfg.partitions);
+    return do_for_each(partitions.begin(), partitions.end(), [&env](int sequence) {
+        return execute_update_for_key(env, make_key(sequence));
+    });
+}
+
+future<> test_read(cql_test_env& env, test_config& cfg) {
+    std::cout << "Creating " << cfg.partitions << " partitions..." << std::endl;
+    auto f = make_ready_future<>();
+    if (!cfg.sstables) {
+        f = populate(env, cfg);
+    } else {
+        // Keep compaction from merging the sstables back together.
+        f = env.db().invoke_on_all([] (database& db) {
+            db.find_column_family("ks", "cf").set_compaction_strategy(sstables::compaction_strategy_type::null);
+        }).then([&env, &cfg] {
+            auto rounds = boost::irange(0u, cfg.sstables);
+            return do_for_each(rounds.begin(), rounds.end(), [&env, &cfg] (unsigned) {
+                return populate(env, cfg).then([&env] {
+                    return env.db().invoke_on_all([] (database& db) {
+                        return db.flush_all_memtables();
+                    });
+                });
+            });
+        });
+    }
+    return f.then([&env, &cfg] {
+        if (cfg.page_size) {
+            return test_paged_read(env, cfg);
+        }
+        return test_point_read(env, cfg);
     });
 }
 
@@ -133,9 +260,16 @@ int main(int argc, char** argv) {
         ("write", "test write path instead of read path")
         ("duration", bpo::value<unsigned>()->default_value(5), "test duration in seconds")
         ("query-single-key", "test write path instead of read path")
+        ("measure-response-copies", "serialize read results as CQL responses and report bytes copied per response")
+        ("page-size", bpo::value<int32_t>()->default_value(0), "if non-zero, test paged scans of the whole table with pages of that many rows")
+        ("sstables", bpo::value<unsigned>()->default_value(0), "if non-zero, write every partition to that many sstables and read with the cache disabled")
         ("concurrency", bpo::value<unsigned>()->default_value(100), "workers per core");
 
     return app.run(argc, argv, [&app] {
+        db::config db_cfg;
+        if (app.configuration()["sstables"].as<unsigned>()) {
+            db_cfg.enable_cache = false;
+        }
         return do_with_cql_env([&app] (auto&& env) {
             auto cfg = make_lw_shared<test_config>();
             cfg->partitions = app.configuration()["partitions"].as<unsigned>();
@@ -143,7 +277,10 @@ int main(int argc, char** argv) {
             cfg->concurrency = app.configuration()["concurrency"].as<unsigned>();
             cfg->mode = app.configuration().count("write") ? test_config::run_mode::write : test_config::run_mode::read;
             cfg->query_single_key = app.configuration().count("query-single-key");
+            cfg->measure_response_copies = app.configuration().count("measure-response-copies");
+            cfg->page_size = app.configuration()["page-size"].as<int32_t>();
+            cfg->sstables = app.configuration()["sstables"].as<unsigned>();
             return do_test(env, *cfg).finally([cfg] {});
-        });
+        }, db_cfg);
     });
 }
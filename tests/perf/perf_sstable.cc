@@ -23,6 +23,7 @@
 #include <core/distributed.hh>
 #include <core/app-template.hh>
 #include <core/sstring.hh>
+#include <core/thread.hh>
 #include <random>
 #include "perf_sstable.hh"
 
@@ -44,6 +45,23 @@ future<> test_write(distributed<test_env>& dt) {
     });
 }
 
+// Reports the flush throughput, in MB of Data written per second, and the
+// longest reactor stall seen during each flush.
+future<> test_flush(distributed<test_env>& dt) {
+    return dt.invoke_on_all([] (test_env &t) {
+        t.fill_memtable();
+    }).then([&dt] {
+        return dt.invoke_on_all([] (test_env& t) {
+            auto idx = boost::irange(0u, iterations);
+            return do_for_each(idx.begin(), idx.end(), [&t] (unsigned i) {
+                return t.flush_memtable_measuring_stalls(i).then([] (test_env::flush_stats stats) {
+                    std::cout << sprint("shard %d: %.2f MB/s, max reactor stall %.3f ms\n", engine().cpu_id(), stats.mb_per_sec, stats.max_stall_ms);
+                });
+            });
+        });
+    });
+}
+
 future<> test_index_read(distributed<test_env>& dt) {
     return time_runs(iterations, parallelism, dt, &test_env::read_all_indexes);
 }
@@ -52,11 +70,94 @@ future<> test_sequential_read(distributed<test_env>& dt) {
     return time_runs(iterations, parallelism, dt, &test_env::read_sequential_partitions);
 }
 
+static size_t dictionary_size = 16 << 10;
+
+// Splits data into chunks the way the compressed sstable writer does,
+// compresses and uncompresses them all, and reports the throughput of each
+// and the ratio of compressed to uncompressed bytes.
+static void test_compression_of(const temporary_buffer<char>& data, compressor c, size_t chunk_len, size_t dict_size) {
+    compression cm;
+    cm.set_compressor(c);
+    cm.update(0);
+    auto name = sstring(reinterpret_cast<const char*>(cm.name.value.begin()), cm.name.value.size());
+
+    std::vector<temporary_buffer<char>> chunks;
+    for (size_t pos = 0; pos < data.size(); pos += chunk_len) {
+        chunks.push_back(data.share(pos, std::min(chunk_len, data.size() - pos)));
+    }
+    if (dict_size) {
+        // Train on as many chunks as the writer would hold back.
+        std::vector<temporary_buffer<char>> samples;
+        size_t sampled = 0;
+        for (auto& chunk : chunks) {
+            if (sampled >= std::min<size_t>(dict_size * 100, compression_dictionary::max_sample_size)) {
+                break;
+            }
+            samples.push_back(chunk.share());
+            sampled += chunk.size();
+        }
+        cm.set_dictionary_training_size(dict_size);
+        cm.train_dictionary(samples).get();
+        if (!cm.dictionary()) {
+            std::cout << sprint("%-18s %8d KB: dictionary training failed\n", name, chunk_len >> 10);
+            return;
+        }
+    }
+
+    std::vector<temporary_buffer<char>> compressed;
+    size_t compressed_bytes = 0;
+    auto start = test_env::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        compressed.clear();
+        compressed_bytes = 0;
+        for (auto& chunk : chunks) {
+            auto max_len = cm.compress_max_size(chunk.size());
+            temporary_buffer<char> out(max_len);
+            out.trim(cm.compress(chunk.get(), chunk.size(), out.get_write(), max_len));
+            compressed_bytes += out.size();
+            compressed.push_back(std::move(out));
+        }
+    }
+    auto compress_duration = std::chrono::duration<double>(test_env::now() - start).count();
+
+    temporary_buffer<char> out(chunk_len);
+    start = test_env::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        for (auto& chunk : compressed) {
+            cm.uncompress(chunk.get(), chunk.size(), out.get_write(), out.size());
+        }
+    }
+    auto uncompress_duration = std::chrono::duration<double>(test_env::now() - start).count();
+
+    auto mb = double(data.size()) * iterations / (1 << 20);
+    std::cout << sprint("%-18s %8d KB %8d KB %12.2f %12.2f %8.3f\n", name, chunk_len >> 10, dict_size >> 10,
+            mb / compress_duration, mb / uncompress_duration, double(compressed_bytes) / data.size());
+}
+
+future<> test_compression(distributed<test_env>& dt) {
+    return dt.local().data_file_contents().then([] (temporary_buffer<char> data) {
+        return seastar::async([data = std::move(data)] {
+            std::cout << sprint("Compressing %d bytes of sstable data, %d iterations\n", data.size(), iterations);
+            std::cout << sprint("%-18s %11s %11s %12s %12s %8s\n", "compressor", "chunk_len", "dictionary", "compress MB/s", "uncomp. MB/s", "ratio");
+            for (size_t chunk_len : { 4 << 10, 16 << 10, 64 << 10 }) {
+                for (auto c : { compressor::lz4, compressor::snappy, compressor::deflate, compressor::zstd }) {
+                    test_compression_of(data, c, chunk_len, 0);
+                }
+                if (dictionary_size) {
+                    test_compression_of(data, compressor::zstd, chunk_len, dictionary_size);
+                }
+            }
+        });
+    });
+}
+
 enum class test_modes {
     sequential_read,
     index_read,
     write,
     index_write,
+    compression,
+    flush,
 };
 
 static std::unordered_map<sstring, test_modes> test_mode = {
@@ -64,6 +165,8 @@ static std::unordered_map<sstring, test_modes> test_mode = {
     {"index_read", test_modes::index_read },
     {"write", test_modes::write },
     {"index_write", test_modes::index_write },
+    {"compression", test_modes::compression },
+    {"flush", test_modes::flush },
 };
 
 int main(int argc, char** argv) {
@@ -77,7 +180,8 @@ int main(int argc, char** argv) {
         ("key_size", bpo::value<unsigned>()->default_value(128), "size of partition key")
         ("num_columns", bpo::value<unsigned>()->default_value(5), "number of columns per row")
         ("column_size", bpo::value<unsigned>()->default_value(64), "size in bytes for each column")
-        ("mode", bpo::value<sstring>()->default_value("index_write"), "one of: random_read, sequential_read, index_read, write, index_write (default)")
+        ("dictionary_size", bpo::value<unsigned>()->default_value(16), "size of the zstd dictionary trained in compression mode, in KB; 0 to skip")
+        ("mode", bpo::value<sstring>()->default_value("index_write"), "one of: random_read, sequential_read, index_read, write, index_write (default), compression, flush")
         ("testdir", bpo::value<sstring>()->default_value("/var/lib/scylla/perf-tests"), "directory in which to store the sstables");
 
     return app.run_deprecated(argc, argv, [&app] {
@@ -86,6 +190,7 @@ int main(int argc, char** argv) {
         auto cfg = test_env::conf();
         iterations = app.configuration()["iterations"].as<unsigned>();
         parallelism = app.configuration()["parallelism"].as<unsigned>();
+        dictionary_size = app.configuration()["dictionary_size"].as<unsigned>() << 10;
         cfg.partitions = app.configuration()["partitions"].as<unsigned>();
         cfg.key_size = app.configuration()["key_size"].as<unsigned>();
         cfg.buffer_size = app.configuration()["buffer_size"].as<unsigned>() << 10;
@@ -113,8 +218,11 @@ int main(int argc, char** argv) {
                         throw;
                     }
                 });
-            } else if ((mode == test_modes::index_write) || (mode == test_modes::write)) {
+            } else if ((mode == test_modes::index_write) || (mode == test_modes::write) || (mode == test_modes::flush)) {
                 return test_setup::create_empty_test_dir(dir);
+            } else if (mode == test_modes::compression) {
+                test->local().fill_memtable();
+                return make_ready_future<>();
             } else {
                 throw std::invalid_argument("Invalid mode");
             }
@@ -125,6 +233,10 @@ int main(int argc, char** argv) {
                 return test_sequential_read(*test).then([test] {});
             } else if ((mode == test_modes::index_write) || (mode == test_modes::write)) {
                 return test_write(*test).then([test] {});
+            } else if (mode == test_modes::compression) {
+                return test_compression(*test).then([test] {});
+            } else if (mode == test_modes::flush) {
+                return test_flush(*test).then([test] {});
             } else {
                 throw std::invalid_argument("Invalid mode");
             }
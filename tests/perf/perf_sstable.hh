@@ -137,6 +137,55 @@ class test_env {
         });
     }
 
+    struct flush_stats {
+        double mb_per_sec;
+        double max_stall_ms;
+    };
+
+    // Flushes the memtable while a timer due every 100us measures how late
+    // it fires, i.e. for how long the flush kept the reactor from running
+    // anything else.
+    future<flush_stats> flush_memtable_measuring_stalls(int idx) {
+        using namespace std::chrono;
+        struct probe {
+            timer<> t;
+            clk::time_point last = clk::now();
+            clk::duration max_stall = clk::duration(0);
+        };
+        auto period = microseconds(100);
+        auto p = make_lw_shared<probe>();
+        p->t.set_callback([p, period] {
+            auto n = now();
+            p->max_stall = std::max(p->max_stall, clk::duration(n - p->last - period));
+            p->last = n;
+        });
+        p->t.arm_periodic(period);
+        auto start = now();
+        return test_setup::create_empty_test_dir(dir()).then([this, idx] {
+            auto sst = sstables::test::make_test_sstable(_cfg.buffer_size, "ks", "cf", dir(), idx, sstable::version_types::ka, sstable::format_types::big);
+            return sst->write_components(*_mt).then([sst] {});
+        }).then([this, idx, p, start] {
+            auto duration = duration_cast<std::chrono::duration<double>>(now() - start).count();
+            p->t.cancel();
+            auto data = sstable::filename(dir(), "ks", "cf", sstable::version_types::ka, idx, sstable::format_types::big, sstable::component_type::Data);
+            return engine().file_size(data).then([p, duration] (uint64_t size) {
+                auto stall = duration_cast<std::chrono::duration<double, std::milli>>(p->max_stall).count();
+                return flush_stats{ size / duration / (1 << 20), stall };
+            });
+        });
+    }
+
+    // Flushes the memtable to an uncompressed sstable and returns the
+    // contents of its data file, as input for the compression benchmark.
+    future<temporary_buffer<char>> data_file_contents() {
+        return flush_memtable(0).then([this] (double) {
+            auto sst = make_lw_shared<sstable>("ks", "cf", dir(), 0, sstable::version_types::ka, sstable::format_types::big);
+            return sst->load().then([sst] {
+                return test(sst).data_read(0, sst->data_size());
+            });
+        });
+    }
+
     future<double> read_all_indexes(int idx) {
         return do_with(test(_sst[0]), [] (auto& sst) {
             auto start = test_env::now();
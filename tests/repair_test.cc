@@ -0,0 +1,340 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/unit_test.hpp>
+
+#include "repair/repair.hh"
+#include "schema_builder.hh"
+
+#include "disk-error-handler.hh"
+
+thread_local disk_error_signal_type commit_error;
+thread_local disk_error_signal_type general_disk_error;
+
+static partition_checksum make_checksum(uint8_t seed) {
+    std::array<uint8_t, 32> digest{};
+    for (size_t i = 0; i < digest.size(); i++) {
+        digest[i] = seed * (i + 1);
+    }
+    return partition_checksum(digest);
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_tree_root_is_sum_of_leaves) {
+    repair_hash_tree tree(3);
+    BOOST_REQUIRE_EQUAL(tree.leaf_count(), 8);
+    BOOST_REQUIRE_EQUAL(tree.depth(), 3);
+
+    partition_checksum sum;
+    for (size_t i = 0; i < 8; i++) {
+        tree.add(i, make_checksum(i + 1));
+        sum.add(make_checksum(i + 1));
+    }
+    BOOST_REQUIRE(tree.root() == sum);
+
+    repair_hash_tree rebuilt(tree.leaves());
+    BOOST_REQUIRE_EQUAL(rebuilt.depth(), 3);
+    BOOST_REQUIRE(rebuilt.root() == sum);
+    BOOST_REQUIRE(rebuilt.differing_leaves(tree).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_tree_add_tree) {
+    repair_hash_tree a(2), b(2), all(2);
+    a.add(0, make_checksum(1));
+    b.add(3, make_checksum(2));
+    all.add(0, make_checksum(1));
+    all.add(3, make_checksum(2));
+    a.add(b);
+    BOOST_REQUIRE(a.root() == all.root());
+    BOOST_REQUIRE(a.differing_leaves(all).empty());
+
+    BOOST_REQUIRE_THROW(a.add(repair_hash_tree(3)), std::invalid_argument);
+    BOOST_REQUIRE_THROW(repair_hash_tree(std::vector<partition_checksum>(3)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_hash_tree_differing_leaves) {
+    repair_hash_tree a(4), b(4);
+    for (size_t i = 0; i < 16; i++) {
+        a.add(i, make_checksum(i + 1));
+        b.add(i, make_checksum(i + 1));
+    }
+    b.add(13, make_checksum(100));
+    b.add(2, make_checksum(101));
+    b.add(3, make_checksum(102));
+
+    BOOST_REQUIRE(a.root() != b.root());
+    BOOST_REQUIRE((a.differing_leaves(b) == std::vector<size_t>{2, 3, 13}));
+    BOOST_REQUIRE((b.differing_leaves(a) == std::vector<size_t>{2, 3, 13}));
+}
+
+static schema_ptr make_schema() {
+    return schema_builder("ks", "cf")
+        .with_column("pk", int32_type, column_kind::partition_key)
+        .with_column("ck", int32_type, column_kind::clustering_key)
+        .with_column("v", int32_type)
+        .build();
+}
+
+// Returns n partition keys in ring order.
+static std::vector<partition_key> make_keys(schema_ptr s, int n) {
+    std::vector<dht::decorated_key> dks;
+    for (int i = 0; i < n; i++) {
+        dks.push_back(dht::global_partitioner().decorate_key(*s, partition_key::from_single_value(*s, int32_type->decompose(i))));
+    }
+    std::sort(dks.begin(), dks.end(), dht::decorated_key::less_comparator(s));
+    std::vector<partition_key> keys;
+    for (auto& dk : dks) {
+        keys.push_back(dk._key);
+    }
+    return keys;
+}
+
+static clustering_key make_ck(const schema& s, int i) {
+    return clustering_key::from_single_value(s, int32_type->decompose(i));
+}
+
+static repair_partition_hashes make_hashes(const schema& s, const partition_key& key, uint8_t partition_seed,
+        std::vector<std::pair<int, uint8_t>> rows) {
+    repair_partition_hashes ret{key, make_checksum(partition_seed), {}};
+    for (auto& r : rows) {
+        ret.rows.push_back(repair_row_hash{make_ck(s, r.first), make_checksum(r.second)});
+    }
+    return ret;
+}
+
+static repair_partition_rows make_rows(const schema& s, const partition_key& key, bool partition_level, std::vector<int> rows) {
+    repair_partition_rows ret{key, partition_level, {}};
+    for (auto r : rows) {
+        ret.rows.push_back(make_ck(s, r));
+    }
+    return ret;
+}
+
+static void require_rows(const schema& s, const repair_partition_rows& actual, const repair_partition_rows& expected) {
+    BOOST_REQUIRE(actual.key.equal(s, expected.key));
+    BOOST_REQUIRE_EQUAL(actual.partition_level, expected.partition_level);
+    BOOST_REQUIRE_EQUAL(actual.rows.size(), expected.rows.size());
+    for (size_t i = 0; i < actual.rows.size(); i++) {
+        BOOST_REQUIRE(actual.rows[i].equal(s, expected.rows[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_diff_rows) {
+    auto s = make_schema();
+    auto keys = make_keys(s, 4);
+
+    // keys[0] and keys[3] are on both replicas, keys[1] only on the local
+    // one and keys[2] only on the remote one.
+    std::vector<repair_partition_hashes> local = {
+        make_hashes(*s, keys[0], 1, {{1, 1}, {2, 2}, {4, 4}}),
+        make_hashes(*s, keys[1], 1, {{1, 1}}),
+        make_hashes(*s, keys[3], 1, {{1, 1}}),
+    };
+    std::vector<repair_partition_hashes> remote = {
+        make_hashes(*s, keys[0], 1, {{2, 3}, {3, 3}, {4, 4}}),
+        make_hashes(*s, keys[2], 1, {{5, 5}, {6, 6}}),
+        make_hashes(*s, keys[3], 2, {{1, 1}}),
+    };
+
+    auto diff = repair_diff_rows(*s, local, remote);
+    auto& to_send = diff.first;
+    auto& to_fetch = diff.second;
+
+    BOOST_REQUIRE_EQUAL(to_send.size(), 3);
+    require_rows(*s, to_send[0], make_rows(*s, keys[0], false, {1, 2}));
+    require_rows(*s, to_send[1], make_rows(*s, keys[1], true, {1}));
+    require_rows(*s, to_send[2], make_rows(*s, keys[3], true, {}));
+    BOOST_REQUIRE_EQUAL(repair_count_rows(to_send), 5);
+
+    BOOST_REQUIRE_EQUAL(to_fetch.size(), 3);
+    require_rows(*s, to_fetch[0], make_rows(*s, keys[0], false, {2, 3}));
+    require_rows(*s, to_fetch[1], make_rows(*s, keys[2], true, {5, 6}));
+    require_rows(*s, to_fetch[2], make_rows(*s, keys[3], true, {}));
+
+    auto same = repair_diff_rows(*s, local, local);
+    BOOST_REQUIRE(same.first.empty());
+    BOOST_REQUIRE(same.second.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_split_rows) {
+    auto s = make_schema();
+    auto keys = make_keys(s, 3);
+
+    std::vector<repair_partition_rows> rows = {
+        make_rows(*s, keys[0], true, {1, 2, 3, 4, 5}),
+        make_rows(*s, keys[1], false, {1, 2}),
+        make_rows(*s, keys[2], true, {}),
+    };
+    auto batches = repair_split_rows(rows, 3);
+
+    BOOST_REQUIRE_EQUAL(batches.size(), 3);
+    BOOST_REQUIRE_EQUAL(batches[0].size(), 1);
+    require_rows(*s, batches[0][0], make_rows(*s, keys[0], true, {1, 2}));
+    BOOST_REQUIRE_EQUAL(batches[1].size(), 1);
+    require_rows(*s, batches[1][0], make_rows(*s, keys[0], false, {3, 4, 5}));
+    BOOST_REQUIRE_EQUAL(batches[2].size(), 2);
+    require_rows(*s, batches[2][0], make_rows(*s, keys[1], false, {1, 2}));
+    require_rows(*s, batches[2][1], make_rows(*s, keys[2], true, {}));
+    for (auto& batch : batches) {
+        BOOST_REQUIRE_LE(repair_count_rows(batch), 3);
+    }
+
+    // Even a single row per batch keeps the partition-level part apart.
+    auto singles = repair_split_rows({make_rows(*s, keys[0], true, {1, 2})}, 1);
+    BOOST_REQUIRE_EQUAL(singles.size(), 3);
+    require_rows(*s, singles[0][0], make_rows(*s, keys[0], true, {}));
+    require_rows(*s, singles[1][0], make_rows(*s, keys[0], false, {1}));
+    require_rows(*s, singles[2][0], make_rows(*s, keys[0], false, {2}));
+
+    BOOST_REQUIRE(repair_split_rows({}, 3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_trim_row_hashes) {
+    auto s = make_schema();
+    auto keys = make_keys(s, 4);
+    auto all = [&] {
+        std::vector<repair_partition_hashes> ret;
+        for (auto& key : keys) {
+            ret.push_back(make_hashes(*s, key, 1, {{1, 1}}));
+        }
+        return ret;
+    };
+    auto require_end = [&] (const std::experimental::optional<repair_row_position>& end,
+            const partition_key& key, std::experimental::optional<int> row) {
+        BOOST_REQUIRE(end);
+        BOOST_REQUIRE(end->key.equal(*s, key));
+        BOOST_REQUIRE_EQUAL(bool(end->row), bool(row));
+        if (row) {
+            BOOST_REQUIRE(end->row->equal(*s, make_ck(*s, *row)));
+        }
+    };
+
+    // Both sides hold the whole window.
+    auto local = all();
+    auto remote = all();
+    BOOST_REQUIRE(!repair_trim_row_hashes(*s, local, remote, 100));
+    BOOST_REQUIRE_EQUAL(local.size(), 4);
+    BOOST_REQUIRE_EQUAL(remote.size(), 4);
+
+    // Ours was cut short, the peer's, asked up to our last token, wasn't.
+    local = all();
+    local.resize(2);
+    remote = all();
+    remote.resize(1);
+    auto end = repair_trim_row_hashes(*s, local, remote, 4);
+    require_end(end, keys[1], 1);
+    BOOST_REQUIRE_EQUAL(local.size(), 2);
+
+    // The peer's was cut short before ours, so ours is trimmed to match.
+    local = all();
+    remote = all();
+    remote.resize(2);
+    end = repair_trim_row_hashes(*s, local, remote, 4);
+    require_end(end, keys[1], 1);
+    BOOST_REQUIRE_EQUAL(local.size(), 2);
+    BOOST_REQUIRE(local.back().key.equal(*s, keys[1]));
+
+    // Ours was cut in the middle of a wide partition, which the peer has
+    // more rows of: the rest is left to the next window.
+    local = { make_hashes(*s, keys[0], 1, {{1, 1}, {2, 2}, {3, 3}}) };
+    remote = { make_hashes(*s, keys[0], 1, {{1, 1}, {2, 2}, {3, 3}, {4, 4}, {5, 5}}) };
+    end = repair_trim_row_hashes(*s, local, remote, 4);
+    require_end(end, keys[0], 3);
+    BOOST_REQUIRE_EQUAL(local.size(), 1);
+    BOOST_REQUIRE_EQUAL(local[0].rows.size(), 3);
+    BOOST_REQUIRE_EQUAL(remote.size(), 1);
+    BOOST_REQUIRE_EQUAL(remote[0].rows.size(), 3);
+    BOOST_REQUIRE(remote[0].rows.back().key.equal(*s, make_ck(*s, 3)));
+
+    // Ours was cut right after the partition-level part.
+    local = { make_hashes(*s, keys[0], 1, {}) };
+    remote = { make_hashes(*s, keys[0], 1, {{1, 1}, {2, 2}}), make_hashes(*s, keys[1], 1, {}) };
+    end = repair_trim_row_hashes(*s, local, remote, 1);
+    require_end(end, keys[0], {});
+    BOOST_REQUIRE_EQUAL(remote.size(), 1);
+    BOOST_REQUIRE(remote[0].rows.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_parallelism_grows_while_it_pays) {
+    repair_parallelism_policy policy(100);
+    BOOST_REQUIRE_EQUAL(policy.limit(), 16);
+    repair_parallelism_policy::sample s;
+    // Not all permits were used: nothing to gain.
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 16);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 10), 20);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 20), 25);
+    // Growing did not speed repair up: hold once, then try again.
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 20), 25);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 20), 31);
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_parallelism_is_capped) {
+    BOOST_REQUIRE_EQUAL(repair_parallelism_policy(4).limit(), 4);
+    BOOST_REQUIRE_EQUAL(repair_parallelism_policy(0).limit(), 1);
+
+    repair_parallelism_policy policy(18);
+    repair_parallelism_policy::sample s;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 10), 18);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 20), 18);
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_parallelism_shrinks_under_memory_pressure) {
+    repair_parallelism_policy policy(100);
+    repair_parallelism_policy::sample s;
+    s.memory_pressure = 0.95;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 10), 8);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 20), 4);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 30), 2);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 40), 1);
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 50), 1);
+    s.memory_pressure = 0.5;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, true, 60), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_repair_parallelism_shrinks_when_foreground_latency_grows) {
+    repair_parallelism_policy policy(100);
+    repair_parallelism_policy::sample s;
+    // The first sample only starts latency tracking.
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 16);
+    // 64 requests of 100us each set the baseline.
+    s.latency_sum += 64 * 100;
+    s.latency_count += 64;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 16);
+    // Up to twice the baseline is fine.
+    s.latency_sum += 64 * 150;
+    s.latency_count += 64;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 16);
+    s.latency_sum += 64 * 300;
+    s.latency_count += 64;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 8);
+    // Too few requests to tell.
+    s.latency_sum += 10 * 1000;
+    s.latency_count += 10;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 8);
+
+    // After repair was idle, the first sample only restarts tracking.
+    policy.idle();
+    s.latency_sum += 64 * 1000;
+    s.latency_count += 64;
+    BOOST_REQUIRE_EQUAL(policy.adjust(s, false, 10), 8);
+}
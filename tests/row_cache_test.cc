@@ -731,3 +731,96 @@ SEASTAR_TEST_CASE(test_invalidate_works_with_wrap_arounds) {
         verify_does_not_have(cache, ring[7].decorated_key());
     });
 }
+
+SEASTAR_TEST_CASE(test_scan_of_continuous_range_does_not_go_to_underlying) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> ring = make_ring(s, 4);
+        for (auto&& m : ring) {
+            mt->apply(m);
+        }
+
+        unsigned underlying_reads = 0;
+        auto data_source = mt->as_data_source();
+        auto keys = mt->as_key_source();
+
+        cache_tracker tracker;
+        row_cache cache(s, mutation_source([&] (schema_ptr s, const query::partition_range& range) {
+            ++underlying_reads;
+            return data_source(s, range);
+        }), key_source([&] (const query::partition_range& range) {
+            ++underlying_reads;
+            return keys(range);
+        }), tracker);
+
+        auto verify_scan = [&] {
+            assert_that(cache.make_reader(s, query::full_partition_range))
+                .produces(ring[0])
+                .produces(ring[1])
+                .produces(ring[2])
+                .produces(ring[3])
+                .produces_end_of_stream();
+        };
+
+        verify_scan();
+        BOOST_REQUIRE(underlying_reads > 0);
+
+        underlying_reads = 0;
+        verify_scan();
+        BOOST_REQUIRE_EQUAL(underlying_reads, 0);
+
+        // Invalidated partition breaks continuity of the range it was in.
+        cache.invalidate(ring[2].decorated_key());
+        verify_scan();
+        BOOST_REQUIRE(underlying_reads > 0);
+
+        underlying_reads = 0;
+        verify_scan();
+        BOOST_REQUIRE_EQUAL(underlying_reads, 0);
+
+        cache.set_continuity_tracking(false);
+        verify_scan();
+        BOOST_REQUIRE(underlying_reads > 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_start_bounded_scan_does_not_mark_preceding_range_continuous) {
+    return seastar::async([] {
+        auto s = make_schema();
+        auto mt = make_lw_shared<memtable>(s);
+
+        std::vector<mutation> ring = make_ring(s, 4);
+        for (auto&& m : ring) {
+            mt->apply(m);
+        }
+
+        cache_tracker tracker;
+        row_cache cache(s, mt->as_data_source(), mt->as_key_source(), tracker);
+
+        auto verify_full_scan = [&] {
+            assert_that(cache.make_reader(s, query::full_partition_range))
+                .produces(ring[0])
+                .produces(ring[1])
+                .produces(ring[2])
+                .produces(ring[3])
+                .produces_end_of_stream();
+        };
+
+        // Nothing follows the last partition, but the partitions before it
+        // were not looked at.
+        auto after_last = query::partition_range::make_starting_with({ring[3].ring_position(), false});
+        assert_that(cache.make_reader(s, after_last))
+            .produces_end_of_stream();
+        verify_full_scan();
+
+        cache.clear();
+        auto from_third = query::partition_range::make_starting_with({ring[2].ring_position(), true});
+        assert_that(cache.make_reader(s, from_third))
+            .produces(ring[2])
+            .produces(ring[3])
+            .produces_end_of_stream();
+        verify_full_scan();
+    });
+}
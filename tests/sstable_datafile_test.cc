@@ -25,6 +25,8 @@
 #include "sstables/sstables.hh"
 #include "sstables/key.hh"
 #include "sstables/compress.hh"
+#include "sstables/chunk_cache.hh"
+#include "sstables/index_page_cache.hh"
 #include "sstables/compaction.hh"
 #include "tests/test-utils.hh"
 #include "schema.hh"
@@ -35,10 +37,14 @@
 #include "sstable_test.hh"
 #include "core/seastar.hh"
 #include "core/do_with.hh"
+#include <seastar/util/defer.hh>
 #include "sstables/compaction_manager.hh"
 #include "tmpdir.hh"
 #include "dht/i_partitioner.hh"
 #include "range.hh"
+#include <boost/range/algorithm/count_if.hpp>
+#include <boost/range/algorithm/sort.hpp>
+#include <boost/range/algorithm/equal.hpp>
 
 #include <stdio.h>
 #include <ftw.h>
@@ -907,6 +913,298 @@ SEASTAR_TEST_CASE(datafile_generation_15) {
     return sstable_compression_test(compressor::deflate, 15);
 }
 
+SEASTAR_TEST_CASE(datafile_generation_53) {
+    return sstable_compression_test(compressor::zstd, 53);
+}
+
+SEASTAR_TEST_CASE(zstd_dictionary_is_trained_and_reused) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            auto builder = schema_builder("tests", "zstd_dictionary")
+                .with_column("id", utf8_type, column_kind::partition_key)
+                .with_column("value", utf8_type);
+            builder.set_compressor_params(compression_parameters({
+                { compression_parameters::SSTABLE_COMPRESSION, "ZstdCompressor" },
+                { compression_parameters::CHUNK_LENGTH_KB, "4" },
+                { compression_parameters::ZSTD_DICTIONARY_SIZE_KB, "16" },
+            }));
+            auto s = builder.build();
+            auto& value_col = *s->get_column_definition("value");
+
+            auto make_mutation = [&] (unsigned i) {
+                mutation m(partition_key::from_exploded(*s, {to_bytes(sprint("key%d", i))}), s);
+                m.set_clustered_cell(clustering_key::make_empty(*s), value_col,
+                    atomic_cell::make_live(0, utf8_type->decompose(sstring(sprint("{\"user\": %d, \"status\": \"active\"}", i)))));
+                return m;
+            };
+            auto make_memtable = [&] (unsigned first, unsigned count) {
+                auto mt = make_lw_shared<memtable>(s);
+                for (unsigned i = first; i < first + count; ++i) {
+                    mt->apply(make_mutation(i));
+                }
+                return mt;
+            };
+
+            // Enough small rows for the writer to train a dictionary on.
+            auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 54, la, big);
+            sst->write_components(*make_memtable(0, 20000)).get();
+            auto sstp = reusable_sst("tests/sstables/tests-temporary", 54).get0();
+            BOOST_REQUIRE(sstables::test(sstp).get_components().count(sstable::component_type::CompressionDictionary));
+            auto dict = sstp->get_compression_dictionary();
+            BOOST_REQUIRE(dict);
+
+            // An sstable handed the dictionary stores it instead of training its own.
+            auto sst2 = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 55, la, big);
+            sst2->set_compression_dictionary(dict);
+            sst2->write_components(*make_memtable(20000, 100)).get();
+            auto sstp2 = reusable_sst("tests/sstables/tests-temporary", 55).get0();
+            BOOST_REQUIRE(sstp2->get_compression_dictionary());
+            BOOST_REQUIRE(sstp2->get_compression_dictionary()->data() == dict->data());
+
+            for (auto&& p : { std::make_pair(sstp, 42u), std::make_pair(sstp2, 20042u) }) {
+                auto expected = make_mutation(p.second);
+                auto k = sstables::key::from_partition_key(*s, expected.key());
+                auto m = p.first->read_row(s, k).get0();
+                BOOST_REQUIRE(m);
+                BOOST_REQUIRE(*m == expected);
+            }
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(compressed_chunks_are_cached) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            auto& cc = global_chunk_cache();
+            cc.set_max_size(1 << 20);
+            auto disable_cache = defer([&cc] { cc.set_max_size(0); });
+
+            auto builder = schema_builder("tests", "chunk_cache")
+                .with_column("id", utf8_type, column_kind::partition_key)
+                .with_column("value", utf8_type);
+            builder.set_compressor_params(compressor::lz4);
+            auto s = builder.build();
+
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            m.set_clustered_cell(clustering_key::make_empty(*s), *s->get_column_definition("value"),
+                atomic_cell::make_live(0, utf8_type->decompose(sstring("value1"))));
+            auto mt = make_lw_shared<memtable>(s);
+            mt->apply(m);
+
+            auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 56, la, big);
+            sst->write_components(*mt).get();
+            auto sstp = reusable_sst("tests/sstables/tests-temporary", 56).get0();
+            auto key = sstables::key::from_partition_key(*s, m.key());
+
+            auto before = cc.get_stats();
+            // Readers which opt out, like compaction and streaming, bypass the cache.
+            auto m0 = sstp->read_rows(s, default_priority_class(), false).read().get0();
+            BOOST_REQUIRE(m0 && *m0 == m);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().misses, before.misses);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().entries, before.entries);
+
+            auto m1 = sstp->read_row(s, key).get0();
+            BOOST_REQUIRE(m1 && *m1 == m);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().misses, before.misses + 1);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().entries, before.entries + 1);
+
+            auto m2 = sstp->read_row(s, key).get0();
+            BOOST_REQUIRE(m2 && *m2 == m);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().hits, before.hits + 1);
+            BOOST_REQUIRE_EQUAL(cc.get_stats().misses, before.misses + 1);
+
+            // Chunks of an sstable go away with it.
+            sstp = {};
+            BOOST_REQUIRE_EQUAL(cc.get_stats().entries, before.entries);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(index_pages_are_cached) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            auto& ic = global_index_page_cache();
+            ic.set_max_size(1 << 20);
+            auto disable_cache = defer([&ic] { ic.set_max_size(0); });
+
+            auto s = uncompressed_schema();
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            m.set_clustered_cell(clustering_key::make_empty(*s), to_bytes("col2"), 1, api::max_timestamp);
+            auto mt = make_lw_shared<memtable>(s);
+            mt->apply(m);
+
+            auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 57, la, big);
+            sst->write_components(*mt).get();
+            auto sstp = reusable_sst("tests/sstables/tests-temporary", 57).get0();
+            auto key = sstables::key::from_partition_key(*s, m.key());
+
+            auto before = ic.get_stats();
+            auto m1 = sstp->read_row(s, key).get0();
+            BOOST_REQUIRE(m1 && *m1 == m);
+            BOOST_REQUIRE_EQUAL(ic.get_stats().misses, before.misses + 1);
+            BOOST_REQUIRE_EQUAL(ic.get_stats().entries, before.entries + 1);
+
+            auto m2 = sstp->read_row(s, key).get0();
+            BOOST_REQUIRE(m2 && *m2 == m);
+            BOOST_REQUIRE_EQUAL(ic.get_stats().hits, before.hits + 1);
+            BOOST_REQUIRE_EQUAL(ic.get_stats().misses, before.misses + 1);
+
+            // Pages of an sstable go away with it.
+            sstp = {};
+            BOOST_REQUIRE_EQUAL(ic.get_stats().entries, before.entries);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(promoted_index_limits_reads_to_ranges) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            sstable::set_column_index_size(1024);
+            auto restore_column_index_size = defer([] { sstable::set_column_index_size(64 * 1024); });
+
+            auto s = schema_builder("tests", "promoted_index")
+                .with_column("pk", utf8_type, column_kind::partition_key)
+                .with_column("ck", int32_type, column_kind::clustering_key)
+                .with_column("s", int32_type, column_kind::static_column)
+                .with_column("value", utf8_type)
+                .build();
+            auto ck = [&s] (int32_t i) {
+                return clustering_key::from_exploded(*s, {int32_type->decompose(i)});
+            };
+
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            m.set_static_cell(*s->get_column_definition("s"), atomic_cell::make_live(0, int32_type->decompose(7)));
+            for (int32_t i = 0; i < 1000; ++i) {
+                m.set_clustered_cell(ck(i), *s->get_column_definition("value"),
+                    atomic_cell::make_live(0, utf8_type->decompose(sstring(100, 'x'))));
+            }
+            auto mt = make_lw_shared<memtable>(s);
+            mt->apply(m);
+
+            auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 58, la, big);
+            sst->write_components(*mt).get();
+            auto sstp = reusable_sst("tests/sstables/tests-temporary", 58).get0();
+            auto key = sstables::key::from_partition_key(*s, m.key());
+            BOOST_REQUIRE(sstp->has_promoted_index(key).get0());
+
+            // Ranges given in reversed order, as in reversed queries.
+            query::clustering_row_ranges ranges = {
+                query::clustering_range::make_starting_with({ck(995), false}),
+                query::clustering_range::make({ck(500), true}, {ck(510), false}),
+            };
+            auto sliced = sstp->read_row(s, key, ranges).get0();
+            BOOST_REQUIRE(sliced);
+            auto& rows = sliced->partition().clustered_rows();
+            BOOST_REQUIRE_LT(std::distance(rows.begin(), rows.end()), 100);
+            BOOST_REQUIRE(sliced->partition().static_row() == m.partition().static_row());
+            for (auto&& r : ranges) {
+                auto expected = m.partition().range(*s, r);
+                auto actual = sliced->partition().range(*s, r);
+                BOOST_REQUIRE(boost::equal(expected, actual, [&s] (const rows_entry& a, const rows_entry& b) {
+                    return a.equal(*s, b);
+                }));
+            }
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(filter_formats_are_written_and_read) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            auto s = uncompressed_schema();
+            auto mt = make_lw_shared<memtable>(s);
+            std::vector<dht::decorated_key> keys;
+            for (int i = 0; i < 1000; ++i) {
+                auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+                mutation m(key, s);
+                m.set_clustered_cell(clustering_key::make_empty(*s), to_bytes("col2"), i, api::max_timestamp);
+                keys.push_back(m.decorated_key());
+                mt->apply(std::move(m));
+            }
+
+            auto restore_format = defer([] { sstable::set_filter_format(utils::filter_format::classic); });
+            int64_t generation = 59;
+            for (auto format : { utils::filter_format::blocked, utils::filter_format::classic }) {
+                sstable::set_filter_format(format);
+                auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", generation, la, big);
+                sst->write_components(*mt).get();
+                auto sstp = reusable_sst("tests/sstables/tests-temporary", generation++).get0();
+                size_t absent = 0;
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    // Hashed by the partitioner, and from the serialized key.
+                    BOOST_REQUIRE(sstp->filter_has_key(*s, keys[i]));
+                    BOOST_REQUIRE(sstp->filter_has_key(sstables::key::from_partition_key(*s, keys[i].key())));
+                    auto other = partition_key::from_exploded(*s, {to_bytes("other" + to_sstring(i))});
+                    absent += !sstp->filter_has_key(*s, dht::global_partitioner().decorate_key(*s, other));
+                }
+                // The default false positive chance is 0.01.
+                BOOST_REQUIRE_GT(absent, keys.size() * 9 / 10);
+            }
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(promoted_index_blocks_bound_range_tombstones_and_rows) {
+    return test_setup::do_with_test_directory([] {
+        return seastar::async([] {
+            sstable::set_column_index_size(1024);
+            auto restore_column_index_size = defer([] { sstable::set_column_index_size(64 * 1024); });
+
+            auto s = schema_builder("tests", "promoted_index_tombstones")
+                .with_column("pk", utf8_type, column_kind::partition_key)
+                .with_column("ck1", int32_type, column_kind::clustering_key)
+                .with_column("ck2", int32_type, column_kind::clustering_key)
+                .with_column("value", utf8_type)
+                .build();
+            auto prefix = [&s] (int32_t i) {
+                return clustering_key_prefix::from_exploded(*s, {int32_type->decompose(i)});
+            };
+            auto ck = [&s] (int32_t i) {
+                return clustering_key::from_exploded(*s, {int32_type->decompose(i), int32_type->decompose(0)});
+            };
+
+            // The range tombstones, written first, cover the highest keys,
+            // and fill more than one block.
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            for (int32_t i = 900; i < 1000; ++i) {
+                m.partition().apply_row_tombstone(*s, prefix(i), tombstone(1, gc_clock::now()));
+            }
+            for (int32_t i = 0; i < 1000; ++i) {
+                m.set_clustered_cell(ck(i), *s->get_column_definition("value"),
+                    atomic_cell::make_live(0, utf8_type->decompose(sstring(100, 'x'))));
+            }
+            auto mt = make_lw_shared<memtable>(s);
+            mt->apply(m);
+
+            auto sst = make_lw_shared<sstable>("ks", "cf", "tests/sstables/tests-temporary", 59, la, big);
+            sst->write_components(*mt).get();
+            auto sstp = reusable_sst("tests/sstables/tests-temporary", 59).get0();
+            auto key = sstables::key::from_partition_key(*s, m.key());
+            BOOST_REQUIRE(sstp->has_promoted_index(key).get0());
+
+            query::clustering_row_ranges ranges = {
+                query::clustering_range::make({prefix(0), true}, {prefix(5), false}),
+                query::clustering_range::make({prefix(950), true}, {prefix(960), false}),
+            };
+            auto sliced = sstp->read_row(s, key, ranges).get0();
+            BOOST_REQUIRE(sliced);
+            auto& rows = sliced->partition().clustered_rows();
+            BOOST_REQUIRE_LT(std::distance(rows.begin(), rows.end()), 100);
+            for (auto&& r : ranges) {
+                auto expected = m.partition().range(*s, r);
+                auto actual = sliced->partition().range(*s, r);
+                BOOST_REQUIRE(boost::equal(expected, actual, [&s] (const rows_entry& a, const rows_entry& b) {
+                    return a.equal(*s, b);
+                }));
+                for (auto&& e : expected) {
+                    BOOST_REQUIRE(sliced->partition().range_tombstone_for_row(*s, e.key())
+                        == m.partition().range_tombstone_for_row(*s, e.key()));
+                }
+            }
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(datafile_generation_16) {
     return test_setup::do_with_test_directory([] {
         auto s = uncompressed_schema();
@@ -2289,3 +2587,492 @@ SEASTAR_TEST_CASE(sstable_rewrite) {
         }).then([sst, mt, s] {});
     });
 }
+
+static void add_sstable_for_time_window_test(lw_shared_ptr<column_family>& cf, int64_t gen, uint64_t fake_data_size,
+        int64_t min_timestamp, int64_t max_timestamp, uint32_t max_local_deletion_time = std::numeric_limits<int32_t>::max()) {
+    auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+    sstables::test(sst).set_values_for_time_window_strategy(fake_data_size, min_timestamp, max_timestamp, max_local_deletion_time);
+    assert(sst->data_size() == fake_data_size);
+    assert(sst->get_stats_metadata().max_timestamp == max_timestamp);
+    column_family_test(cf).add_sstable(std::move(*sst));
+}
+
+static std::set<int64_t> generations_of(const std::vector<shared_sstable>& sstables) {
+    std::set<int64_t> generations;
+    for (auto& sst : sstables) {
+        generations.insert(sst->generation());
+    }
+    return generations;
+}
+
+static lw_shared_ptr<column_family> make_column_family_for_time_window_test(compaction_manager& cm, gc_clock::duration gc_grace) {
+    auto builder = schema_builder("tests", "time_window")
+        .with_column("id", utf8_type, column_kind::partition_key)
+        .with_column("value", int32_type);
+    builder.set_gc_grace_seconds(std::chrono::duration_cast<std::chrono::seconds>(gc_grace).count());
+    auto cf = make_lw_shared<column_family>(builder.build(), column_family::config(), column_family::no_commitlog(), cm);
+    cf->mark_ready_for_writes();
+    return cf;
+}
+
+static const int64_t one_hour = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::hours(1)).count();
+
+SEASTAR_TEST_CASE(time_window_strategy_compacts_within_window) {
+    compaction_manager cm;
+    auto cf = make_column_family_for_time_window_test(cm, std::chrono::hours(24 * 10));
+    auto cs = make_compaction_strategy(compaction_strategy_type::time_window,
+        {{"compaction_window_unit", "HOURS"}, {"compaction_window_size", "1"}});
+    BOOST_REQUIRE(cs.name() == "TimeWindowCompactionStrategy");
+
+    // Three sstables in an old window, one alone in a second old window and
+    // two in the newest window, which isn't enough for size-tiered to kick in.
+    add_sstable_for_time_window_test(cf, 1, 1000, 0, one_hour / 4);
+    add_sstable_for_time_window_test(cf, 2, 1000, one_hour / 4, one_hour / 2);
+    add_sstable_for_time_window_test(cf, 3, 5000, one_hour / 2, one_hour - 1);
+    add_sstable_for_time_window_test(cf, 4, 1000, one_hour, one_hour + 10);
+    add_sstable_for_time_window_test(cf, 5, 1000, 5 * one_hour, 5 * one_hour + 10);
+    add_sstable_for_time_window_test(cf, 6, 1000, 5 * one_hour + 10, 5 * one_hour + 20);
+
+    auto descriptor = cs.get_sstables_for_compaction(*cf, get_candidates_for_leveled_strategy(*cf));
+    BOOST_REQUIRE(generations_of(descriptor.sstables) == std::set<int64_t>({1, 2, 3}));
+
+    // Once the old window is down to a single sstable there is nothing left to do.
+    cf = make_column_family_for_time_window_test(cm, std::chrono::hours(24 * 10));
+    add_sstable_for_time_window_test(cf, 1, 1000, 0, one_hour / 4);
+    add_sstable_for_time_window_test(cf, 4, 1000, one_hour, one_hour + 10);
+    add_sstable_for_time_window_test(cf, 5, 1000, 5 * one_hour, 5 * one_hour + 10);
+    descriptor = cs.get_sstables_for_compaction(*cf, get_candidates_for_leveled_strategy(*cf));
+    BOOST_REQUIRE(descriptor.sstables.empty());
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(time_window_strategy_newest_window_is_size_tiered) {
+    compaction_manager cm;
+    auto cf = make_column_family_for_time_window_test(cm, std::chrono::hours(24 * 10));
+    auto cs = make_compaction_strategy(compaction_strategy_type::time_window,
+        {{"compaction_window_unit", "HOURS"}, {"compaction_window_size", "2"}});
+
+    add_sstable_for_time_window_test(cf, 1, 1000, 0, 10);
+    add_sstable_for_time_window_test(cf, 2, 1000, 10, 20);
+    for (auto gen = 3; gen < 3 + DEFAULT_MIN_COMPACTION_THRESHOLD; gen++) {
+        add_sstable_for_time_window_test(cf, gen, 1000, 4 * one_hour + gen, 5 * one_hour + gen);
+    }
+
+    // The newest window is preferred, and sstables of other windows are left alone.
+    auto descriptor = cs.get_sstables_for_compaction(*cf, get_candidates_for_leveled_strategy(*cf));
+    BOOST_REQUIRE(descriptor.sstables.size() == size_t(DEFAULT_MIN_COMPACTION_THRESHOLD));
+    for (auto& sst : descriptor.sstables) {
+        BOOST_REQUIRE(sst->generation() >= 3);
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(time_window_strategy_drops_expired_sstables) {
+    compaction_manager cm;
+    auto cf = make_column_family_for_time_window_test(cm, std::chrono::seconds(0));
+    auto cs = make_compaction_strategy(compaction_strategy_type::time_window, {});
+    uint32_t expired = (gc_clock::now() - std::chrono::hours(1)).time_since_epoch().count();
+
+    // sstable 1 only has expired data older than anything else in the column family.
+    add_sstable_for_time_window_test(cf, 1, 1000, 0, one_hour, expired);
+    add_sstable_for_time_window_test(cf, 2, 1000, 2 * one_hour, 3 * one_hour);
+    auto descriptor = cs.get_sstables_for_compaction(*cf, get_candidates_for_leveled_strategy(*cf));
+    BOOST_REQUIRE(generations_of(descriptor.sstables) == std::set<int64_t>({1}));
+
+    // sstable 3 holds data that sstable 1 may shadow, so sstable 1 has to be kept.
+    add_sstable_for_time_window_test(cf, 3, 1000, one_hour / 2, 3 * one_hour);
+    descriptor = cs.get_sstables_for_compaction(*cf, get_candidates_for_leveled_strategy(*cf));
+    BOOST_REQUIRE(descriptor.sstables.empty());
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(fully_expired_sstable_is_not_rewritten) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto builder = schema_builder("tests", "expired")
+        .with_column("id", utf8_type, column_kind::partition_key)
+        .with_column("value", int32_type);
+    builder.set_gc_grace_seconds(0);
+    auto s = builder.build();
+    const column_definition& col = *s->get_column_definition("value");
+    auto expiry = gc_clock::now() - std::chrono::seconds(10);
+
+    auto expired_mt = make_lw_shared<memtable>(s);
+    mutation m1(partition_key::from_exploded(*s, {to_bytes("alpha")}), s);
+    m1.partition().apply(tombstone(api::new_timestamp(), expiry));
+    m1.set_clustered_cell(clustering_key::make_empty(*s), col,
+        atomic_cell::make_live(api::new_timestamp(), int32_type->decompose(1), expiry, std::chrono::seconds(1)));
+    expired_mt->apply(std::move(m1));
+
+    auto live_mt = make_lw_shared<memtable>(s);
+    mutation m2(partition_key::from_exploded(*s, {to_bytes("beta")}), s);
+    m2.set_clustered_cell(clustering_key::make_empty(*s), col, make_atomic_cell(int32_type->decompose(1)));
+    live_mt->apply(std::move(m2));
+
+    return seastar::async([s, expired_mt, live_mt, expiry] {
+        auto tmp = make_lw_shared<tmpdir>();
+        auto expired_sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 1, la, big);
+        expired_sst->write_components(*expired_mt).get();
+        expired_sst->open_data().get();
+        auto live_sst = make_lw_shared<sstable>("ks", "cf", tmp->path, 2, la, big);
+        live_sst->write_components(*live_mt).get();
+        live_sst->open_data().get();
+
+        BOOST_REQUIRE(expired_sst->get_stats_metadata().max_local_deletion_time == uint32_t(expiry.time_since_epoch().count()));
+        BOOST_REQUIRE(live_sst->get_stats_metadata().max_local_deletion_time == uint32_t(std::numeric_limits<int32_t>::max()));
+
+        compaction_manager cm;
+        auto cf = make_lw_shared<column_family>(s, column_family::config(), column_family::no_commitlog(), cm);
+        cf->mark_ready_for_writes();
+        column_family_test(cf).add_sstable(std::move(*live_sst));
+
+        auto created = make_lw_shared<unsigned>(0);
+        auto create = [tmp, created] {
+            ++*created;
+            return make_lw_shared<sstable>("ks", "cf", tmp->path, 3, la, big);
+        };
+        auto new_sstables = sstables::compact_sstables({ expired_sst }, *cf, create, std::numeric_limits<uint64_t>::max(), 0).get0();
+        BOOST_REQUIRE(new_sstables.empty());
+        BOOST_REQUIRE(*created == 0);
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_sub_ranges_partition_the_input) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+    return seastar::async([s] {
+        auto tmp = make_lw_shared<tmpdir>();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("c1")});
+
+        std::vector<shared_sstable> sstables;
+        std::vector<dht::decorated_key> keys;
+        for (auto generation : { 1, 2 }) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = generation; i < 200; i += 2) {
+                auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+                keys.push_back(dht::global_partitioner().decorate_key(*s, key));
+                mutation m(key, s);
+                m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            sstables.push_back(sst);
+        }
+
+        BOOST_REQUIRE(get_compaction_sub_ranges(*s, sstables, 1).size() == 1);
+
+        auto ranges = get_compaction_sub_ranges(*s, sstables, 4);
+        BOOST_REQUIRE(ranges.size() > 1);
+        BOOST_REQUIRE(ranges.size() <= 4);
+        for (auto count : { 2, 3, 5, 7 }) {
+            auto n = get_compaction_sub_ranges(*s, sstables, count).size();
+            BOOST_REQUIRE(n > 1);
+            BOOST_REQUIRE(n <= unsigned(count));
+        }
+
+        // Every key belongs to exactly one sub-range.
+        for (auto& dk : keys) {
+            auto owners = boost::count_if(ranges, [&] (const query::partition_range& r) {
+                return r.contains(dht::ring_position(dk), dht::ring_position_comparator(*s));
+            });
+            BOOST_REQUIRE(owners == 1);
+        }
+
+        // Reading the sstables sub-range by sub-range returns every partition once.
+        size_t partitions = 0;
+        for (auto& r : ranges) {
+            for (auto& sst : sstables) {
+                auto reader = sst->read_range_rows(s, r);
+                while (reader.read().get0()) {
+                    ++partitions;
+                }
+            }
+        }
+        BOOST_REQUIRE(partitions == keys.size());
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_sub_ranges_of_a_single_token) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+    return seastar::async([s] {
+        auto tmp = make_lw_shared<tmpdir>();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("c1")});
+
+        std::vector<shared_sstable> sstables;
+        for (auto generation : { 1, 2 }) {
+            auto mt = make_lw_shared<memtable>(s);
+            mutation m(partition_key::from_exploded(*s, {to_bytes("key1")}), s);
+            m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(generation)));
+            mt->apply(std::move(m));
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            sstables.push_back(sst);
+        }
+
+        auto ranges = get_compaction_sub_ranges(*s, sstables, 8);
+        BOOST_REQUIRE(ranges.size() == 1);
+        BOOST_REQUIRE(!ranges.front().start() && !ranges.front().end());
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_of_sub_ranges_runs_concurrently) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto s = make_lw_shared(schema({}, some_keyspace, some_column_family,
+        {{"p1", utf8_type}}, {{"c1", utf8_type}}, {{"r1", int32_type}}, {}, utf8_type));
+
+    return seastar::async([s] {
+        auto tmp = make_lw_shared<tmpdir>();
+        const column_definition& r1_col = *s->get_column_definition("r1");
+        auto c_key = clustering_key::from_exploded(*s, {to_bytes("c1")});
+
+        std::vector<shared_sstable> sstables;
+        size_t keys = 0;
+        for (auto generation : { 1, 2 }) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = generation; i < 200; i += 2) {
+                mutation m(partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))}), s);
+                m.set_clustered_cell(c_key, r1_col, make_atomic_cell(int32_type->decompose(i)));
+                mt->apply(std::move(m));
+                ++keys;
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            sstables.push_back(sst);
+        }
+
+        // Any input is large enough to be split in the most sub-ranges.
+        column_family::config cfg;
+        cfg.compaction_sub_range_size = 1;
+        compaction_manager cm;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), cm);
+        cf->mark_ready_for_writes();
+
+        auto gen = make_lw_shared<unsigned long>(3);
+        auto create = [tmp, gen] {
+            return make_lw_shared<sstable>("ks", "cf", tmp->path, (*gen)++, la, big);
+        };
+        auto new_sstables = sstables::compact_sstables(sstables, *cf, create, std::numeric_limits<uint64_t>::max(), 0).get0();
+
+        // Each sub-range wrote its own sstable, and they don't overlap.
+        BOOST_REQUIRE(new_sstables.size() > 1);
+        boost::sort(new_sstables, [&s] (const shared_sstable& a, const shared_sstable& b) {
+            return a->get_first_decorated_key(*s).less_compare(*s, b->get_first_decorated_key(*s));
+        });
+        for (size_t i = 1; i < new_sstables.size(); ++i) {
+            BOOST_REQUIRE(new_sstables[i - 1]->get_last_decorated_key(*s).token() < new_sstables[i]->get_first_decorated_key(*s).token());
+        }
+
+        size_t partitions = 0;
+        for (auto& sst : new_sstables) {
+            auto reader = sst->read_rows(s);
+            while (reader.read().get0()) {
+                ++partitions;
+            }
+        }
+        BOOST_REQUIRE(partitions == keys);
+    });
+}
+
+SEASTAR_TEST_CASE(incremental_compaction_releases_exhausted_inputs) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto builder = schema_builder("tests", "incremental")
+        .with_column("id", utf8_type, column_kind::partition_key)
+        .with_column("value", int32_type);
+    builder.set_gc_grace_seconds(0);
+    auto s = builder.build();
+
+    return seastar::async([s] {
+        auto tmp = make_lw_shared<tmpdir>();
+        const column_definition& col = *s->get_column_definition("value");
+
+        std::vector<dht::decorated_key> keys;
+        for (auto i = 0; i < 20; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            keys.push_back(dht::global_partitioner().decorate_key(*s, key));
+        }
+        boost::sort(keys, [&s] (const dht::decorated_key& a, const dht::decorated_key& b) {
+            return a.less_compare(*s, b);
+        });
+
+        auto write = [&] (unsigned long generation, std::function<void (memtable&)> populate) {
+            auto mt = make_lw_shared<memtable>(s);
+            populate(*mt);
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            return sst;
+        };
+        auto live_row = [&] (memtable& mt, const dht::decorated_key& dk, api::timestamp_type ts) {
+            mutation m(dk.key(), s);
+            m.set_clustered_cell(clustering_key::make_empty(*s), col, atomic_cell::make_live(ts, int32_type->decompose(1)));
+            mt.apply(std::move(m));
+        };
+
+        // The first sstable holds the lower half of the keys plus a tombstone
+        // for a key whose data lives in the second sstable, which holds the
+        // upper half of the keys.
+        auto& shadowed = keys[10];
+        auto tomb = tombstone(2, gc_clock::now() - std::chrono::seconds(10));
+        auto lower = write(1, [&] (memtable& mt) {
+            for (auto i = 0; i < 10; i++) {
+                live_row(mt, keys[i], 1);
+            }
+            mutation m(shadowed.key(), s);
+            m.partition().apply(tomb);
+            mt.apply(std::move(m));
+        });
+        auto upper = write(2, [&] (memtable& mt) {
+            for (auto i = 10; i < 20; i++) {
+                live_row(mt, keys[i], 1);
+            }
+        });
+
+        compaction_manager cm;
+        auto cf = make_lw_shared<column_family>(s, column_family::config(), column_family::no_commitlog(), cm);
+        cf->mark_ready_for_writes();
+
+        auto gen = make_lw_shared<unsigned long>(3);
+        auto create = [tmp, gen] {
+            return make_lw_shared<sstable>("ks", "cf", tmp->path, (*gen)++, la, big);
+        };
+        std::vector<std::vector<int64_t>> released;
+        std::vector<shared_sstable> published;
+        auto release = [&] (const std::vector<shared_sstable>& sealed, const std::vector<shared_sstable>& exhausted) {
+            boost::copy(sealed, std::back_inserter(published));
+            released.push_back({});
+            for (auto& sst : exhausted) {
+                released.back().push_back(sst->generation());
+            }
+        };
+
+        // Every output sstable gets a single partition.
+        auto remaining = sstables::compact_sstables({ lower, upper }, *cf, create, 1, 0, false, release).get0();
+
+        // The lower sstable was released on its own, before the upper one.
+        BOOST_REQUIRE(released.size() == 2);
+        BOOST_REQUIRE(released[0] == std::vector<int64_t>({1}));
+        BOOST_REQUIRE(released[1] == std::vector<int64_t>({2}));
+        BOOST_REQUIRE(remaining.empty());
+        BOOST_REQUIRE(published.size() == keys.size());
+
+        // The tombstone is kept, since the upper sstable may have outlived
+        // the output holding it.
+        auto found = false;
+        for (auto& sst : published) {
+            auto reader = make_lw_shared(sstable_reader(sst, s));
+            while (auto m = (*reader)().get0()) {
+                if (m->decorated_key().equal(*s, shadowed)) {
+                    BOOST_REQUIRE(m->partition().partition_tombstone() == tomb);
+                    found = true;
+                }
+            }
+        }
+        BOOST_REQUIRE(found);
+    });
+}
+
+SEASTAR_TEST_CASE(compaction_manager_deletes_released_inputs_early) {
+    BOOST_REQUIRE(smp::count == 1);
+    auto s = schema_builder("tests", "incremental")
+        .with_column("id", utf8_type, column_kind::partition_key)
+        .with_column("value", int32_type)
+        .build();
+
+    return seastar::async([s] {
+        auto tmp = make_lw_shared<tmpdir>();
+        const column_definition& col = *s->get_column_definition("value");
+
+        std::vector<dht::decorated_key> keys;
+        for (auto i = 0; i < 200; i++) {
+            auto key = partition_key::from_exploded(*s, {to_bytes("key" + to_sstring(i))});
+            keys.push_back(dht::global_partitioner().decorate_key(*s, key));
+        }
+        boost::sort(keys, [&s] (const dht::decorated_key& a, const dht::decorated_key& b) {
+            return a.less_compare(*s, b);
+        });
+
+        auto cm = make_lw_shared<compaction_manager>();
+        cm->start();
+
+        column_family::config cfg;
+        cfg.datadir = tmp->path;
+        cfg.enable_commitlog = false;
+        cfg.enable_incremental_backups = false;
+        // Every output sstable gets a single partition.
+        cfg.compaction_fragment_size = 1;
+        auto cf = make_lw_shared<column_family>(s, cfg, column_family::no_commitlog(), *cm);
+        cf->start();
+        cf->mark_ready_for_writes();
+        cf->set_compaction_strategy(sstables::compaction_strategy_type::size_tiered);
+
+        // Four sstables of the same size, each with a quarter of the keys in
+        // token order, so that the first is exhausted long before the rest.
+        for (unsigned long generation = 1; generation <= 4; generation++) {
+            auto mt = make_lw_shared<memtable>(s);
+            for (auto i = (generation - 1) * 50; i < generation * 50; i++) {
+                mutation m(keys[i].key(), s);
+                m.set_clustered_cell(clustering_key::make_empty(*s), col, make_atomic_cell(int32_type->decompose(1)));
+                mt->apply(std::move(m));
+            }
+            auto sst = make_lw_shared<sstable>("ks", "cf", tmp->path, generation, la, big);
+            sst->write_components(*mt).get();
+            sst->load().get();
+            column_family_test(cf).add_sstable(std::move(*sst));
+        }
+        auto first = sstable::filename(tmp->path, "ks", "cf", la, 1, big, sstable::component_type::Data);
+        auto last = sstable::filename(tmp->path, "ks", "cf", la, 4, big, sstable::component_type::Data);
+
+        cf->trigger_compaction();
+        auto deleted_early = false;
+        while (!cm->get_stats().completed_tasks) {
+            if (!file_exists(first).get0()) {
+                // The last input is still being read.
+                BOOST_REQUIRE(file_exists(last).get0());
+                deleted_early = true;
+                break;
+            }
+            later().get();
+        }
+        BOOST_REQUIRE(deleted_early);
+
+        cm->remove(&*cf).get();
+        cm->stop().get();
+    });
+}
+
+SEASTAR_TEST_CASE(size_tiered_buckets_are_capped_by_runs) {
+    // A run of 40 fragments, written by an incremental compaction, and three
+    // sstables of a similar total size. The run counts once towards the
+    // compaction thresholds, so all four of them are compacted together.
+    std::vector<sstables::shared_sstable> sstables;
+    unsigned long gen = 1;
+    for (; gen <= 40; gen++) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+        sstables::test(sst).set_values_for_size_tiered_strategy(1024 * 1024, {100, 101});
+        sstables.push_back(std::move(sst));
+    }
+    for (; gen <= 43; gen++) {
+        auto sst = make_lw_shared<sstable>("ks", "cf", "", gen, la, big);
+        sstables::test(sst).set_values_for_size_tiered_strategy(40 * 1024 * 1024, {});
+        sstables.push_back(std::move(sst));
+    }
+
+    auto sstables_to_compact = size_tiered_most_interesting_bucket(create_sstable_list(sstables));
+    BOOST_REQUIRE(sstables_to_compact.size() == 43);
+
+    // Three runs alone are still below the minimum threshold.
+    sstables.pop_back();
+    sstables_to_compact = size_tiered_most_interesting_bucket(create_sstable_list(sstables));
+    BOOST_REQUIRE(sstables_to_compact.empty());
+    return make_ready_future<>();
+}
@@ -28,6 +28,7 @@
 #include "core/align.hh"
 #include "core/do_with.hh"
 #include "core/sleep.hh"
+#include "core/thread.hh"
 #include "sstables/sstables.hh"
 #include "sstables/key.hh"
 #include "tests/test-utils.hh"
@@ -297,6 +298,35 @@ SEASTAR_TEST_CASE(check_toc_func) {
     }).then([tmp] {});
 }
 
+// The write-behind sink extends the file ahead of its writes, and when
+// closed truncates it back to the data, which drops the padding of the last
+// buffer too.
+SEASTAR_TEST_CASE(write_behind_sink_truncates_to_data) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto name = tmp.path + "/data";
+        auto f = open_file_dma(name, open_flags::wo | open_flags::create | open_flags::truncate).get0();
+        file_output_stream_options options;
+        options.buffer_size = 4096;
+        auto out = make_write_behind_file_output_stream(f, options);
+        std::vector<char> data(3 * 4096 + 100);
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = i % 251;
+        }
+        out.write(data.data(), 4096).get();
+        out.flush().get();
+        uint64_t chunk = write_behind_data_sink_impl::truncate_ahead;
+        BOOST_REQUIRE_EQUAL(file_size(name).get0(), chunk);
+        out.write(data.data() + 4096, data.size() - 4096).get();
+        out.close().get();
+
+        BOOST_REQUIRE_EQUAL(file_size(name).get0(), data.size());
+        auto ret = read_file(name).get0();
+        BOOST_REQUIRE_EQUAL(ret.second, data.size());
+        BOOST_REQUIRE(::memcmp(ret.first.get(), data.data(), data.size()) == 0);
+    });
+}
+
 SEASTAR_TEST_CASE(uncompressed_random_access_read) {
     return reusable_sst("tests/sstables/uncompressed", 1).then([] (auto sstp) {
         // note: it's important to pass on a shared copy of sstp to prevent its
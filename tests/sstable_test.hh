@@ -134,6 +134,25 @@ class test {
         _sst->_summary.first_key.value = bytes(reinterpret_cast<const signed char*>(first_key.c_str()), first_key.size());
         _sst->_summary.last_key.value = bytes(reinterpret_cast<const signed char*>(last_key.c_str()), last_key.size());
     }
+
+    // Used to create synthetic fragments of an sstable run for testing size-tiered compaction strategy.
+    void set_values_for_size_tiered_strategy(uint64_t fake_data_size, std::vector<uint32_t> ancestors) {
+        _sst->_data_file_size = fake_data_size;
+        compaction_metadata cm = {};
+        cm.ancestors.elements = std::deque<uint32_t>(ancestors.begin(), ancestors.end());
+        _sst->_statistics.contents[metadata_type::Compaction] = std::make_unique<compaction_metadata>(std::move(cm));
+    }
+
+    void set_values_for_time_window_strategy(uint64_t fake_data_size, int64_t min_timestamp, int64_t max_timestamp,
+            uint32_t max_local_deletion_time) {
+        _sst->_data_file_size = fake_data_size;
+        // Create a synthetic stats metadata
+        stats_metadata stats = {};
+        stats.min_timestamp = min_timestamp;
+        stats.max_timestamp = max_timestamp;
+        stats.max_local_deletion_time = max_local_deletion_time;
+        _sst->_statistics.contents[metadata_type::Stats] = std::make_unique<stats_metadata>(std::move(stats));
+    }
 };
 
 inline future<sstable_ptr> reusable_sst(sstring dir, unsigned long generation) {
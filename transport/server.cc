@@ -27,6 +27,8 @@
 #include <boost/assign.hpp>
 #include <boost/locale/encoding_utf.hpp>
 #include <boost/range/adaptor/sliced.hpp>
+#include <boost/range/algorithm/max_element.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 
 #include "cql3/statements/batch_statement.hh"
 #include "service/migration_manager.hh"
@@ -44,16 +46,101 @@
 #include "service/query_state.hh"
 #include "service/client_state.hh"
 #include "exceptions/exceptions.hh"
+#include "bytes_ostream.hh"
 
 #include "auth/authenticator.hh"
 
 #include <cassert>
 #include <string>
 
+#include <lz4.h>
+#include <snappy-c.h>
+
 namespace transport {
 
 static logging::logger logger("cql_server");
 
+static constexpr uint8_t frame_flag_compression = 0x01;
+
+// Response bodies smaller than this are sent uncompressed: compressing them
+// saves little, and could even make them bigger.
+static constexpr size_t min_compressed_body_size = 512;
+
+temporary_buffer<char> compress_frame_body(cql_compression compression, const char* data, size_t size) {
+    temporary_buffer<char> ret;
+    switch (compression) {
+    case cql_compression::lz4: {
+        ret = temporary_buffer<char>(LZ4_COMPRESSBOUND(size) + 4);
+        auto p = reinterpret_cast<uint8_t*>(ret.get_write());
+        p[0] = size >> 24;
+        p[1] = size >> 16;
+        p[2] = size >> 8;
+        p[3] = size;
+        auto compressed_size = LZ4_compress(data, ret.get_write() + 4, size);
+        if (compressed_size == 0) {
+            throw std::runtime_error("LZ4 compression failure");
+        }
+        ret.trim(compressed_size + 4);
+        break;
+    }
+    case cql_compression::snappy: {
+        size_t compressed_size = snappy_max_compressed_length(size);
+        ret = temporary_buffer<char>(compressed_size);
+        if (snappy_compress(data, size, ret.get_write(), &compressed_size) != SNAPPY_OK) {
+            throw std::runtime_error("Snappy compression failure");
+        }
+        ret.trim(compressed_size);
+        break;
+    }
+    case cql_compression::none:
+        throw std::invalid_argument("no compression algorithm given");
+    }
+    return ret;
+}
+
+size_t uncompressed_frame_body_length(cql_compression compression, const char* data, size_t size) {
+    switch (compression) {
+    case cql_compression::lz4: {
+        if (size < 4) {
+            throw exceptions::protocol_exception("truncated LZ4 compressed frame");
+        }
+        auto p = reinterpret_cast<const uint8_t*>(data);
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    case cql_compression::snappy: {
+        size_t length;
+        if (snappy_uncompressed_length(data, size, &length) != SNAPPY_OK) {
+            throw exceptions::protocol_exception("Snappy decompression failure");
+        }
+        return length;
+    }
+    case cql_compression::none:
+        break;
+    }
+    throw exceptions::protocol_exception("Received a compressed frame, but no compression was negotiated in STARTUP");
+}
+
+temporary_buffer<char> decompress_frame_body(cql_compression compression, const char* data, size_t size) {
+    auto length = uncompressed_frame_body_length(compression, data, size);
+    temporary_buffer<char> ret(length);
+    switch (compression) {
+    case cql_compression::lz4:
+        if (length && LZ4_decompress_safe(data + 4, ret.get_write(), size - 4, length) != int(length)) {
+            throw exceptions::protocol_exception("LZ4 decompression failure");
+        }
+        break;
+    case cql_compression::snappy:
+        if (snappy_uncompress(data, size, ret.get_write(), &length) != SNAPPY_OK) {
+            throw exceptions::protocol_exception("Snappy decompression failure");
+        }
+        ret.trim(length);
+        break;
+    case cql_compression::none:
+        break;
+    }
+    return ret;
+}
+
 struct cql_frame_error : std::exception {
     const char* what() const throw () override {
         return "bad cql binary frame";
@@ -80,6 +167,26 @@ enum class cql_binary_opcode : uint8_t {
     AUTH_SUCCESS   = 16,
 };
 
+enum class options_flag {
+    VALUES,
+    SKIP_METADATA,
+    PAGE_SIZE,
+    PAGING_STATE,
+    SERIAL_CONSISTENCY,
+    TIMESTAMP,
+    NAMES_FOR_VALUES
+};
+
+using options_flag_enum = super_enum<options_flag,
+    options_flag::VALUES,
+    options_flag::SKIP_METADATA,
+    options_flag::PAGE_SIZE,
+    options_flag::PAGING_STATE,
+    options_flag::SERIAL_CONSISTENCY,
+    options_flag::TIMESTAMP,
+    options_flag::NAMES_FOR_VALUES
+>;
+
 inline db::consistency_level wire_to_consistency(int16_t v)
 {
      switch (v) {
@@ -172,6 +279,8 @@ cql_load_balance parse_load_balance(sstring value)
         return cql_load_balance::none;
     } else if (value == "round-robin") {
         return cql_load_balance::round_robin;
+    } else if (value == "token-aware") {
+        return cql_load_balance::token_aware;
     } else {
         throw std::invalid_argument("Unknown load balancing algorithm: " + value);
     }
@@ -180,13 +289,21 @@ cql_load_balance parse_load_balance(sstring value)
 class cql_server::response {
     int16_t           _stream;
     cql_binary_opcode _opcode;
-    std::vector<char> _body;
+    // The body is built in place in a chain of fragments, and handed to the
+    // output stream as is, without flattening.
+    bytes_ostream     _body;
+    // Bytes copied on the way to the wire, counted where they are copied:
+    // the strings and values written into _body, the frame header, and the
+    // body again if it is linearized for compression.
+    size_t            _bytes_copied = 0;
 public:
     response(int16_t stream, cql_binary_opcode opcode)
         : _stream{stream}
         , _opcode{opcode}
     { }
-    scattered_message<char> make_message(uint8_t version);
+    // If compression is set and worthwhile, the body is sent compressed, and
+    // compressed_size is set to its compressed size; otherwise to 0.
+    scattered_message<char> make_message(uint8_t version, cql_compression compression, size_t& compressed_size);
     void serialize(const event::schema_change& event, uint8_t version);
     void write_byte(uint8_t b);
     void write_int(int32_t n);
@@ -195,24 +312,38 @@ class cql_server::response {
     void write_string(const sstring& s);
     void write_long_string(const sstring& s);
     void write_uuid(utils::UUID uuid);
-    void write_string_list(std::vector<sstring> string_list);
-    void write_bytes(bytes b);
-    void write_short_bytes(bytes b);
-    void write_option(std::pair<int16_t, data_value> opt);
-    void write_option_list(std::vector<std::pair<int16_t, data_value>> opt_list);
+    void write_string_list(const std::vector<sstring>& string_list);
+    void write_bytes(bytes_view b);
+    void write_short_bytes(bytes_view b);
+    void write_option(const std::pair<int16_t, data_value>& opt);
+    void write_option_list(const std::vector<std::pair<int16_t, data_value>>& opt_list);
     void write_inet(ipv4_addr inet);
     void write_consistency(db::consistency_level c);
-    void write_string_map(std::map<sstring, sstring> string_map);
-    void write_string_multimap(std::multimap<sstring, sstring> string_map);
-    void write_value(bytes_opt value);
+    void write_string_map(const std::map<sstring, sstring>& string_map);
+    void write_string_multimap(const std::multimap<sstring, sstring>& string_map);
+    void write_value(bytes_view_opt value);
+    void write_value(const bytes_opt& value);
     void write(const cql3::metadata& m);
-    future<> output(output_stream<char>& out, uint8_t version);
 
     cql_binary_opcode opcode() const {
         return _opcode;
     }
+    size_t body_size() const {
+        return _body.size();
+    }
+    size_t bytes_copied() const {
+        return _bytes_copied;
+    }
 private:
-    sstring make_frame(uint8_t version, size_t length);
+    void copy_into_body(const char* data, size_t size) {
+        _bytes_copied += size;
+        _body.write(data, size);
+    }
+    void copy_into_body(bytes_view b) {
+        copy_into_body(reinterpret_cast<const char*>(b.data()), b.size());
+    }
+    temporary_buffer<char> compress_body(cql_compression compression);
+    sstring make_frame(uint8_t version, size_t length, uint8_t flags = 0);
 };
 
 cql_server::cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp, cql_load_balance lb)
@@ -248,6 +379,22 @@ cql_server::setup_collectd() {
             scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
                     "queue_length", "requests_blocked_memory"),
             scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _memory_available.waiters(); })),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "compressed_request_bytes"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.request_compressed_bytes)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "uncompressed_request_bytes"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.request_uncompressed_bytes)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "compressed_response_bytes"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.response_compressed_bytes)),
+        scollectd::add_polled_metric(
+            scollectd::type_instance_id("transport", scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "uncompressed_response_bytes"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, _compression_stats.response_uncompressed_bytes)),
     };
 }
 
@@ -550,31 +697,37 @@ future<> cql_server::connection::process_request() {
         }
 
         auto& f = *maybe_frame;
-
-        // FIXME: compression
-        if (f.flags & 0x01) {
-            throw std::runtime_error("CQL frame compression is not supported");
-        }
+        bool compressed = f.flags & frame_flag_compression;
 
         auto op = f.opcode;
         auto stream = f.stream;
-        auto mem_estimate = f.length * 2 + 8000; // Allow for extra copies and bookkeeping
-
-        if (mem_estimate > _server._max_request_size) {
-            throw exceptions::invalid_request_exception(sprint(
-                    "request size too large (frame size %d; estimate %d; allowed %d",
-                    f.length, mem_estimate, _server._max_request_size));
-        }
-
-        return with_semaphore(_server._memory_available, mem_estimate, [this, length = f.length, op, stream] {
-          return _read_buf.read_exactly(length).then([this, op, stream] (temporary_buffer<char> buf) {
+        auto length = f.length;
+        // A compressed body is charged for its decompressed size as well,
+        // which its header tells.
+        auto header = compressed ? read_compressed_body_header(length) : make_ready_future<temporary_buffer<char>>();
+        return header.then([this, op, stream, length, compressed] (temporary_buffer<char> header) {
+          size_t uncompressed_length = compressed ? uncompressed_frame_body_length(_compression, header.get(), header.size()) : 0;
+          auto mem_estimate = length * 2 + uncompressed_length + 8000; // Allow for extra copies and bookkeeping
+
+          if (mem_estimate > _server._max_request_size) {
+              throw exceptions::invalid_request_exception(sprint(
+                      "request size too large (frame size %d; uncompressed size %d; estimate %d; allowed %d",
+                      length, uncompressed_length, mem_estimate, _server._max_request_size));
+          }
+
+          return with_semaphore(_server._memory_available, mem_estimate, [this, length, op, stream, compressed, header = std::move(header)] () mutable {
+          auto rest = length - header.size();
+          return _read_buf.read_exactly(rest).then([this, op, stream, compressed, header = std::move(header)] (temporary_buffer<char> buf) mutable {
+            if (compressed) {
+                buf = decompress_body(std::move(header), std::move(buf));
+            }
 
             ++_server._requests_served;
             ++_server._requests_serving;
 
             with_gate(_pending_requests_gate, [this, op, stream, buf = std::move(buf)] () mutable {
                 auto bv = bytes_view{reinterpret_cast<const int8_t*>(buf.begin()), buf.size()};
-                auto cpu = pick_request_cpu();
+                auto cpu = pick_request_cpu(static_cast<cql_binary_opcode>(op), bv);
                 return smp::submit_to(cpu, [this, bv = std::move(bv), op, stream, client_state = _client_state] () mutable {
                     return this->process_request_one(bv, op, stream, std::move(client_state)).then([] (auto&& response) {
                         return std::make_pair(make_foreign(response.first), response.second);
@@ -591,21 +744,108 @@ future<> cql_server::connection::process_request() {
 
             return make_ready_future<>();
           });
+          });
         });
     });
 }
 
-unsigned cql_server::connection::pick_request_cpu()
+unsigned cql_server::connection::pick_request_cpu(cql_binary_opcode op, bytes_view buf)
 {
     if (_server._lb == cql_load_balance::round_robin) {
         return _request_cpu++ % smp::count;
     }
+    if (_server._lb == cql_load_balance::token_aware && op == cql_binary_opcode::EXECUTE) {
+        auto cpu = pick_execute_cpu(buf);
+        if (cpu) {
+            return *cpu;
+        }
+    }
     return engine().cpu_id();
 }
 
+// Returns the shard owning the partition an EXECUTE request is for, if the
+// bound values of the prepared statement fully define its partition key.
+// This saves storage_proxy a hop to that shard. The choice is only a hint,
+// so malformed requests are left for process_execute() to report.
+//
+// Only the values up to the last partition key one are read; the rest of
+// the options are parsed by process_execute() on the chosen shard. Values
+// bound by name would have to be matched to the bound names first, so such
+// requests stay on this shard, as do those of protocol v1, which puts the
+// values after the options.
+std::experimental::optional<unsigned> cql_server::connection::pick_execute_cpu(bytes_view buf)
+{
+    try {
+        auto id = read_short_bytes(buf);
+        auto prepared = _server._query_processor.local().get_prepared(id);
+        if (!prepared || prepared->partition_key_bind_indices.empty() || _version < 2) {
+            return {};
+        }
+        read_consistency(buf);
+        auto flags = enum_set<options_flag_enum>::from_mask(read_byte(buf));
+        if (!flags.contains<options_flag::VALUES>() || flags.contains<options_flag::NAMES_FOR_VALUES>()) {
+            return {};
+        }
+        auto& indices = prepared->partition_key_bind_indices;
+        auto count = read_short(buf);
+        auto needed = *boost::max_element(indices) + 1;
+        if (needed > count) {
+            return {};
+        }
+        std::vector<bytes_view_opt> values;
+        values.reserve(needed);
+        for (unsigned i = 0; i < needed; ++i) {
+            values.push_back(read_value_view(buf));
+        }
+        std::vector<bytes_view> components;
+        components.reserve(indices.size());
+        for (auto i : indices) {
+            if (!values[i]) {
+                return {};
+            }
+            components.push_back(*values[i]);
+        }
+        auto& s = *prepared->key_schema;
+        auto key = partition_key::from_exploded(components);
+        return dht::shard_of(dht::global_partitioner().get_token(s, key));
+    } catch (...) {
+        return {};
+    }
+}
+
+future<temporary_buffer<char>> cql_server::connection::read_compressed_body_header(uint32_t length)
+{
+    return _read_buf.read_exactly(std::min<size_t>(length, compressed_frame_body_header_size));
+}
+
+temporary_buffer<char> cql_server::connection::decompress_body(temporary_buffer<char> header, temporary_buffer<char> rest)
+{
+    // The decompressors need the body in one piece.
+    temporary_buffer<char> body(header.size() + rest.size());
+    std::copy_n(header.get(), header.size(), body.get_write());
+    std::copy_n(rest.get(), rest.size(), body.get_write() + header.size());
+    auto ret = decompress_frame_body(_compression, body.get(), body.size());
+    _compression_stats.request_compressed_bytes += body.size();
+    _compression_stats.request_uncompressed_bytes += ret.size();
+    _server._compression_stats.request_compressed_bytes += body.size();
+    _server._compression_stats.request_uncompressed_bytes += ret.size();
+    return ret;
+}
+
 future<response_type> cql_server::connection::process_startup(uint16_t stream, bytes_view buf, service::client_state client_state)
 {
-    /*auto string_map =*/ read_string_map(buf);
+    auto options = read_string_map(buf);
+    auto compression = options.find("COMPRESSION");
+    if (compression != options.end()) {
+        auto algorithm = boost::algorithm::to_lower_copy(compression->second);
+        if (algorithm == "lz4") {
+            _compression = cql_compression::lz4;
+        } else if (algorithm == "snappy") {
+            _compression = cql_compression::snappy;
+        } else {
+            throw exceptions::protocol_exception(sprint("Unknown compression algorithm: %s", compression->second));
+        }
+    }
     auto& a = auth::authenticator::get();
     if (a.require_authentication()) {
         return make_ready_future<response_type>(std::make_pair(make_autheticate(stream, a.class_name()), client_state));
@@ -866,13 +1106,13 @@ shared_ptr<cql_server::response> cql_server::connection::make_autheticate(int16_
 
 shared_ptr<cql_server::response> cql_server::connection::make_auth_success(int16_t stream, bytes b) {
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::AUTH_SUCCESS);
-    response->write_bytes(std::move(b));
+    response->write_bytes(b);
     return response;
 }
 
 shared_ptr<cql_server::response> cql_server::connection::make_auth_challenge(int16_t stream, bytes b) {
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::AUTH_CHALLENGE);
-    response->write_bytes(std::move(b));
+    response->write_bytes(b);
     return response;
 }
 
@@ -880,6 +1120,7 @@ shared_ptr<cql_server::response> cql_server::connection::make_supported(int16_t
 {
     std::multimap<sstring, sstring> opts;
     opts.insert({"CQL_VERSION", cql3::query_processor::CQL_VERSION});
+    opts.insert({"COMPRESSION", "lz4"});
     opts.insert({"COMPRESSION", "snappy"});
     auto response = make_shared<cql_server::response>(stream, cql_binary_opcode::SUPPORTED);
     response->write_string_multimap(opts);
@@ -953,6 +1194,16 @@ cql_server::connection::make_result(int16_t stream, shared_ptr<messages::result_
     return response;
 }
 
+size_t cql_server::result_bytes_copied(uint8_t version, shared_ptr<messages::result_message> msg)
+{
+    auto response = make_shared<cql_server::response>(0, cql_binary_opcode::RESULT);
+    fmt_visitor fmt{version, response};
+    msg->accept(fmt);
+    size_t compressed_size;
+    response->make_message(version, cql_compression::none, compressed_size);
+    return response->bytes_copied();
+}
+
 shared_ptr<cql_server::response>
 cql_server::connection::make_topology_change_event(const event::topology_change& event)
 {
@@ -985,10 +1236,19 @@ cql_server::connection::make_schema_change_event(const event::schema_change& eve
 future<> cql_server::connection::write_response(foreign_ptr<shared_ptr<cql_server::response>>&& response)
 {
     _ready_to_respond = _ready_to_respond.then([this, response = std::move(response)] () mutable {
-        return do_with(std::move(response), [this] (auto& response) {
-            return response->output(_write_buf, _version).then([this] {
-                return _write_buf.flush();
-            });
+        size_t compressed_size;
+        auto msg = response->make_message(_version, _compression, compressed_size);
+        if (compressed_size) {
+            _compression_stats.response_compressed_bytes += compressed_size;
+            _compression_stats.response_uncompressed_bytes += response->body_size();
+            _server._compression_stats.response_compressed_bytes += compressed_size;
+            _server._compression_stats.response_uncompressed_bytes += response->body_size();
+        }
+        // The output stream may hold on to the message past the write, so
+        // the message owns the response whose body it refers to.
+        msg.on_delete([response = std::move(response)] { });
+        return _write_buf.write(std::move(msg)).then([this] {
+            return _write_buf.flush();
         });
     });
     return make_ready_future<>();
@@ -1117,26 +1377,6 @@ std::unordered_map<sstring, sstring> cql_server::connection::read_string_map(byt
     return string_map;
 }
 
-enum class options_flag {
-    VALUES,
-    SKIP_METADATA,
-    PAGE_SIZE,
-    PAGING_STATE,
-    SERIAL_CONSISTENCY,
-    TIMESTAMP,
-    NAMES_FOR_VALUES
-};
-
-using options_flag_enum = super_enum<options_flag,
-    options_flag::VALUES,
-    options_flag::SKIP_METADATA,
-    options_flag::PAGE_SIZE,
-    options_flag::PAGING_STATE,
-    options_flag::SERIAL_CONSISTENCY,
-    options_flag::TIMESTAMP,
-    options_flag::NAMES_FOR_VALUES
->;
-
 std::unique_ptr<cql3::query_options> cql_server::connection::read_options(bytes_view& buf)
 {
     return read_options(buf, _version);
@@ -1253,26 +1493,44 @@ bytes_view_opt cql_server::connection::read_value_view(bytes_view& buf) {
     return {std::move(bv)};
 }
 
-scattered_message<char> cql_server::response::make_message(uint8_t version) {
+// Returns the compressed body, or an empty buffer if the body should be
+// sent as is.
+temporary_buffer<char> cql_server::response::compress_body(cql_compression compression) {
+    if (compression == cql_compression::none || _body.size() < min_compressed_body_size) {
+        return {};
+    }
+    // The compressors need contiguous input.
+    if (!_body.is_linearized()) {
+        _bytes_copied += _body.size();
+    }
+    auto body = _body.linearize();
+    auto ret = compress_frame_body(compression, reinterpret_cast<const char*>(body.data()), body.size());
+    if (ret.size() >= _body.size()) {
+        return {};
+    }
+    return ret;
+}
+
+// The message refers to the body fragments rather than copying them, so the
+// caller must make the message keep the response alive, with on_delete().
+scattered_message<char> cql_server::response::make_message(uint8_t version, cql_compression compression, size_t& compressed_size) {
     scattered_message<char> msg;
-    sstring body{_body.data(), _body.size()};
-    sstring frame = make_frame(version, body.size());
+    auto compressed = compress_body(compression);
+    compressed_size = compressed.size();
+    auto frame = compressed_size ? make_frame(version, compressed.size(), frame_flag_compression) : make_frame(version, _body.size());
+    _bytes_copied += frame.size();
     msg.append(std::move(frame));
-    msg.append(std::move(body));
+    if (compressed_size) {
+        msg.append_static(compressed.get(), compressed.size());
+        msg.on_delete([compressed = std::move(compressed)] { });
+    } else {
+        for (bytes_view fragment : _body.fragments()) {
+            msg.append_static(reinterpret_cast<const char*>(fragment.data()), fragment.size());
+        }
+    }
     return msg;
 }
 
-future<>
-cql_server::response::output(output_stream<char>& out, uint8_t version) {
-    auto frame = make_frame(version, _body.size());
-    auto tmp = temporary_buffer<char>(frame.size());
-    std::copy_n(frame.begin(), frame.size(), tmp.get_write());
-    auto f = out.write(tmp.get(), tmp.size());
-    return f.then([this, &out, tmp = std::move(tmp)] {
-        return out.write(_body.data(), _body.size());
-    });
-}
-
 void cql_server::response::serialize(const event::schema_change& event, uint8_t version)
 {
     if (version >= 3) {
@@ -1301,7 +1559,7 @@ void cql_server::response::serialize(const event::schema_change& event, uint8_t
     }
 }
 
-sstring cql_server::response::make_frame(uint8_t version, size_t length)
+sstring cql_server::response::make_frame(uint8_t version, size_t length, uint8_t flags)
 {
     switch (version) {
     case 0x01:
@@ -1309,7 +1567,7 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
         sstring frame_buf(sstring::initialized_later(), sizeof(cql_binary_frame_v1));
         auto* frame = reinterpret_cast<cql_binary_frame_v1*>(frame_buf.begin());
         frame->version = version | 0x80;
-        frame->flags   = 0x00;
+        frame->flags   = flags;
         frame->stream  = _stream;
         frame->opcode  = static_cast<uint8_t>(_opcode);
         frame->length  = htonl(length);
@@ -1320,7 +1578,7 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
         sstring frame_buf(sstring::initialized_later(), sizeof(cql_binary_frame_v3));
         auto* frame = reinterpret_cast<cql_binary_frame_v3*>(frame_buf.begin());
         frame->version = version | 0x80;
-        frame->flags   = 0x00;
+        frame->flags   = flags;
         frame->stream  = htons(_stream);
         frame->opcode  = static_cast<uint8_t>(_opcode);
         frame->length  = htonl(length);
@@ -1333,28 +1591,25 @@ sstring cql_server::response::make_frame(uint8_t version, size_t length)
 
 void cql_server::response::write_byte(uint8_t b)
 {
-    _body.insert(_body.end(), b);
+    *_body.write_place_holder(1) = b;
 }
 
 void cql_server::response::write_int(int32_t n)
 {
     auto u = htonl(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(reinterpret_cast<const char*>(&u), sizeof(u));
 }
 
 void cql_server::response::write_long(int64_t n)
 {
     auto u = htonq(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(reinterpret_cast<const char*>(&u), sizeof(u));
 }
 
 void cql_server::response::write_short(uint16_t n)
 {
     auto u = htons(n);
-    auto *s = reinterpret_cast<const char*>(&u);
-    _body.insert(_body.end(), s, s+sizeof(u));
+    _body.write(reinterpret_cast<const char*>(&u), sizeof(u));
 }
 
 template<typename T>
@@ -1370,13 +1625,13 @@ T cast_if_fits(size_t v) {
 void cql_server::response::write_string(const sstring& s)
 {
     write_short(cast_if_fits<uint16_t>(s.size()));
-    _body.insert(_body.end(), s.begin(), s.end());
+    copy_into_body(s.data(), s.size());
 }
 
 void cql_server::response::write_long_string(const sstring& s)
 {
     write_int(cast_if_fits<int32_t>(s.size()));
-    _body.insert(_body.end(), s.begin(), s.end());
+    copy_into_body(s.data(), s.size());
 }
 
 void cql_server::response::write_uuid(utils::UUID uuid)
@@ -1385,7 +1640,7 @@ void cql_server::response::write_uuid(utils::UUID uuid)
     assert(0);
 }
 
-void cql_server::response::write_string_list(std::vector<sstring> string_list)
+void cql_server::response::write_string_list(const std::vector<sstring>& string_list)
 {
     write_short(cast_if_fits<uint16_t>(string_list.size()));
     for (auto&& s : string_list) {
@@ -1393,25 +1648,25 @@ void cql_server::response::write_string_list(std::vector<sstring> string_list)
     }
 }
 
-void cql_server::response::write_bytes(bytes b)
+void cql_server::response::write_bytes(bytes_view b)
 {
     write_int(cast_if_fits<int32_t>(b.size()));
-    _body.insert(_body.end(), b.begin(), b.end());
+    copy_into_body(b);
 }
 
-void cql_server::response::write_short_bytes(bytes b)
+void cql_server::response::write_short_bytes(bytes_view b)
 {
     write_short(cast_if_fits<uint16_t>(b.size()));
-    _body.insert(_body.end(), b.begin(), b.end());
+    copy_into_body(b);
 }
 
-void cql_server::response::write_option(std::pair<int16_t, data_value> opt)
+void cql_server::response::write_option(const std::pair<int16_t, data_value>& opt)
 {
     // FIXME
     assert(0);
 }
 
-void cql_server::response::write_option_list(std::vector<std::pair<int16_t, data_value>> opt_list)
+void cql_server::response::write_option_list(const std::vector<std::pair<int16_t, data_value>>& opt_list)
 {
     // FIXME
     assert(0);
@@ -1432,7 +1687,7 @@ void cql_server::response::write_consistency(db::consistency_level c)
     write_short(consistency_to_wire(c));
 }
 
-void cql_server::response::write_string_map(std::map<sstring, sstring> string_map)
+void cql_server::response::write_string_map(const std::map<sstring, sstring>& string_map)
 {
     write_short(cast_if_fits<uint16_t>(string_map.size()));
     for (auto&& s : string_map) {
@@ -1441,7 +1696,7 @@ void cql_server::response::write_string_map(std::map<sstring, sstring> string_ma
     }
 }
 
-void cql_server::response::write_string_multimap(std::multimap<sstring, sstring> string_map)
+void cql_server::response::write_string_multimap(const std::multimap<sstring, sstring>& string_map)
 {
     std::vector<sstring> keys;
     for (auto it = string_map.begin(), end = string_map.end(); it != end; it = string_map.upper_bound(it->first)) {
@@ -1459,7 +1714,7 @@ void cql_server::response::write_string_multimap(std::multimap<sstring, sstring>
     }
 }
 
-void cql_server::response::write_value(bytes_opt value)
+void cql_server::response::write_value(bytes_view_opt value)
 {
     if (!value) {
         write_int(-1);
@@ -1467,7 +1722,16 @@ void cql_server::response::write_value(bytes_opt value)
     }
 
     write_int(value->size());
-    _body.insert(_body.end(), value->begin(), value->end());
+    copy_into_body(*value);
+}
+
+void cql_server::response::write_value(const bytes_opt& value)
+{
+    if (!value) {
+        write_value(bytes_view_opt());
+    } else {
+        write_value(bytes_view_opt(*value));
+    }
 }
 
 class type_codec {
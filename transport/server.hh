@@ -72,10 +72,44 @@ struct [[gnu::packed]] cql_binary_frame_v3 {
 enum class cql_load_balance {
     none,
     round_robin,
+    // EXECUTE requests whose bound values define the partition key are
+    // processed on the shard owning it; others as with none.
+    token_aware,
 };
 
 cql_load_balance parse_load_balance(sstring value);
 
+// Frame body compression, negotiated with the COMPRESSION option of STARTUP.
+enum class cql_compression {
+    none,
+    lz4,
+    snappy,
+};
+
+// Frame body compression as specified by the native protocol. A body
+// compressed with LZ4 is preceded by its uncompressed length as a 4 byte
+// big-endian integer, Snappy records the length itself as a varint.
+// Malformed compressed bodies are reported with a protocol_exception.
+temporary_buffer<char> compress_frame_body(cql_compression compression, const char* data, size_t size);
+temporary_buffer<char> decompress_frame_body(cql_compression compression, const char* data, size_t size);
+
+// Enough of a compressed body to tell its uncompressed length.
+static constexpr size_t compressed_frame_body_header_size = 5;
+
+// Returns the length a compressed body will have once decompressed, from the
+// first compressed_frame_body_header_size bytes of it, or all of it if it is
+// shorter.
+size_t uncompressed_frame_body_length(cql_compression compression, const char* data, size_t size);
+
+// Frame body sizes, for frames which were sent compressed, on the wire and
+// decompressed.
+struct cql_compression_stats {
+    uint64_t request_compressed_bytes = 0;
+    uint64_t request_uncompressed_bytes = 0;
+    uint64_t response_compressed_bytes = 0;
+    uint64_t response_uncompressed_bytes = 0;
+};
+
 struct cql_query_state {
     service::query_state query_state;
     std::unique_ptr<cql3::query_options> options;
@@ -104,12 +138,19 @@ class cql_server {
     uint64_t _connections = 0;
     uint64_t _requests_served = 0;
     uint64_t _requests_serving = 0;
+    // Totals over all connections, see connection::_compression_stats.
+    cql_compression_stats _compression_stats;
     cql_load_balance _lb;
 public:
     cql_server(distributed<service::storage_proxy>& proxy, distributed<cql3::query_processor>& qp, cql_load_balance lb);
     future<> listen(ipv4_addr addr, ::shared_ptr<seastar::tls::server_credentials> = {}, bool keepalive = false);
     future<> do_accepts(int which, bool keepalive);
     future<> stop();
+
+    // Serializes msg into a RESULT frame of the given protocol version, as it
+    // would be sent to a client, and returns the number of bytes copied while
+    // doing so. Used by perf_simple_query.
+    static size_t result_bytes_copied(uint8_t version, shared_ptr<transport::messages::result_message> msg);
 public:
     class response;
     using response_type = std::pair<shared_ptr<cql_server::response>, service::client_state>;
@@ -127,6 +168,8 @@ class cql_server {
         service::client_state _client_state;
         std::unordered_map<uint16_t, cql_query_state> _query_states;
         unsigned _request_cpu = 0;
+        cql_compression _compression = cql_compression::none;
+        cql_compression_stats _compression_stats;
 
         enum class state : uint8_t {
             UNINITIALIZED, AUTHENTICATION, READY
@@ -143,8 +186,11 @@ class cql_server {
     private:
         future<response_type> process_request_one(bytes_view buf, uint8_t op, uint16_t stream, service::client_state client_state);
         unsigned frame_size() const;
-        unsigned pick_request_cpu();
+        unsigned pick_request_cpu(cql_binary_opcode op, bytes_view buf);
+        std::experimental::optional<unsigned> pick_execute_cpu(bytes_view buf);
         cql_binary_frame_v3 parse_frame(temporary_buffer<char> buf);
+        future<temporary_buffer<char>> read_compressed_body_header(uint32_t length);
+        temporary_buffer<char> decompress_body(temporary_buffer<char> header, temporary_buffer<char> rest);
         future<std::experimental::optional<cql_binary_frame_v3>> read_frame();
         future<response_type> process_startup(uint16_t stream, bytes_view buf, service::client_state client_state);
         future<response_type> process_auth_response(uint16_t stream, bytes_view buf, service::client_state client_state);
@@ -51,47 +51,23 @@
 
 namespace utils {
 namespace filter {
-static thread_local auto reusable_indexes = std::vector<long>();
 
-void bloom_filter::set_indexes(int64_t base, int64_t inc, int count, long max, std::vector<long>& results) {
-    for (int i = 0; i < count; i++) {
-        results[i] = abs(base % max);
-        base = static_cast<int64_t>(static_cast<uint64_t>(base) + static_cast<uint64_t>(inc));
+filter_ptr create_filter(int hash, large_bitset&& bitset, filter_format format) {
+    if (format == filter_format::blocked) {
+        return std::make_unique<blocked_bloom_filter>(hash, std::move(bitset));
     }
+    return std::make_unique<bloom_filter>(hash, std::move(bitset));
 }
 
-std::vector<long> bloom_filter::get_hash_buckets(const bytes_view& key, int hash_count, long max) {
-    std::array<uint64_t, 2> h;
-    hash(key, 0, h);
-
-    auto indexes = std::vector<long>();
-
-    indexes.resize(hash_count);
-    set_indexes(h[0], h[1], hash_count, max, indexes);
-    return indexes;
-}
-
-std::vector<long> bloom_filter::indexes(const bytes_view& key) {
-    // we use the same array both for storing the hash result, and for storing the indexes we return,
-    // so that we do not need to allocate two arrays.
-    auto& idx = reusable_indexes;
-    std::array<uint64_t, 2> h;
-    hash(key, 0, h);
-
-    idx.resize(_hash_count);
-    set_indexes(h[0], h[1], _hash_count, _bitset.size(), idx);
-    return idx;
-}
-
-filter_ptr create_filter(int hash, large_bitset&& bitset) {
-    return std::make_unique<murmur3_bloom_filter>(hash, std::move(bitset));
-}
-
-filter_ptr create_filter(int hash, long num_elements, int buckets_per) {
+filter_ptr create_filter(int hash, long num_elements, int buckets_per, filter_format format) {
     long num_bits = (num_elements * buckets_per) + bloom_calculations::EXCESS;
-    num_bits = align_up<long>(num_bits, 64);  // Seems to be implied in origin
+    if (format == filter_format::blocked) {
+        num_bits = align_up<long>(num_bits, blocked_bloom_filter::block_bits);
+    } else {
+        num_bits = align_up<long>(num_bits, 64);  // Seems to be implied in origin
+    }
     large_bitset bitset(num_bits);
-    return std::make_unique<murmur3_bloom_filter>(hash, std::move(bitset));
+    return create_filter(hash, std::move(bitset), format);
 }
 }
 }
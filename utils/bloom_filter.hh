@@ -43,10 +43,9 @@
  */
 #pragma once
 #include "i_filter.hh"
-#include "utils/murmur_hash.hh"
 #include "utils/large_bitset.hh"
 
-#include <vector>
+#include <cstdlib>
 
 namespace utils {
 namespace filter {
@@ -55,40 +54,47 @@ class bloom_filter: public i_filter {
 public:
     using bitmap = large_bitset;
 
-private:
+protected:
     bitmap _bitset;
     int _hash_count;
 
-    void set_indexes(int64_t base, int64_t inc, int count, long max, std::vector<long>& results);
-    std::vector<long> get_hash_buckets(const bytes_view& key, int hash_count, long max);
-    std::vector<long> indexes(const bytes_view& key);
-
+    // Calls func with each of the _hash_count bit indexes of the key, until
+    // it returns false.
+    template <typename Func>
+    bool for_each_index(const hashed_key& key, Func&& func) const {
+        auto base = static_cast<int64_t>(key.hash[0]);
+        auto inc = static_cast<int64_t>(key.hash[1]);
+        long max = _bitset.size();
+        for (int i = 0; i < _hash_count; i++) {
+            if (!func(std::abs(base % max))) {
+                return false;
+            }
+            base = static_cast<int64_t>(static_cast<uint64_t>(base) + static_cast<uint64_t>(inc));
+        }
+        return true;
+    }
 public:
     int num_hashes() { return _hash_count; }
     bitmap& bits() { return _bitset; }
+    virtual filter_format format() const { return filter_format::classic; }
 
     bloom_filter(int hashes, bitmap&& bs) : _bitset(std::move(bs)), _hash_count(hashes) {
     }
 
-    virtual void hash(const bytes_view& b, long seed, std::array<uint64_t, 2>& result) = 0;
+    using i_filter::add;
+    using i_filter::is_present;
 
-    virtual void add(const bytes_view& key) override {
-
-        auto idx = indexes(key);
-        for (int i = 0; i < _hash_count; i++) {
-            _bitset.set(idx[i]);
-        }
+    virtual void add(const hashed_key& key) override {
+        for_each_index(key, [this] (size_t idx) {
+            _bitset.set(idx);
+            return true;
+        });
     }
 
-    virtual bool is_present(const bytes_view& key) override {
-
-        auto idx = indexes(key);
-        for (int i = 0; i < _hash_count; i++) {
-            if (!_bitset.test(idx[i])) {
-                return false;
-            }
-        }
-        return true;
+    virtual bool is_present(const hashed_key& key) override {
+        return for_each_index(key, [this] (size_t idx) {
+            return _bitset.test(idx);
+        });
     }
 
     virtual void clear() override {
@@ -102,22 +108,69 @@ class bloom_filter: public i_filter {
     }
 };
 
-struct murmur3_bloom_filter: public bloom_filter {
+// A bloom filter which sets all the bits of a key within a single block of
+// one cache line, chosen by the key's hash. A probe thus costs at most one
+// cache miss instead of one per hash function, at the price of a slightly
+// higher false positive rate for the same size.
+class blocked_bloom_filter final : public bloom_filter {
+public:
+    static constexpr size_t block_bits = 512;
+private:
+    size_t _nr_blocks;
+
+    // The block is picked from the high bits of hash[1], and the bits within
+    // it from the low halves of both words: the high bits of hash[0] are the
+    // token, which is clustered for the keys of a single sstable.
+    template <typename Func>
+    bool for_each_index(const hashed_key& key, Func&& func) const {
+        auto block = size_t((unsigned __int128)key.hash[1] * _nr_blocks >> 64);
+        auto base = block * block_bits;
+        auto pos = uint32_t(key.hash[0]);
+        auto inc = uint32_t(key.hash[1]) | 1;
+        for (int i = 0; i < _hash_count; i++) {
+            if (!func(base + (pos & (block_bits - 1)))) {
+                return false;
+            }
+            pos += inc;
+        }
+        return true;
+    }
+public:
+    blocked_bloom_filter(int hashes, bitmap&& bs)
+        : bloom_filter(hashes, std::move(bs))
+        , _nr_blocks(std::max<size_t>(_bitset.size() / block_bits, 1)) {
+        assert(_bitset.size() >= block_bits);
+    }
+
+    virtual filter_format format() const override { return filter_format::blocked; }
 
-    murmur3_bloom_filter(int hashes, bitmap&& bs) : bloom_filter(hashes, std::move(bs)) {}
+    using i_filter::add;
+    using i_filter::is_present;
 
-    virtual void hash(const bytes_view& b, long seed, std::array<uint64_t, 2>& result) {
-        utils::murmur_hash::hash3_x64_128(b, seed, result);
+    virtual void add(const hashed_key& key) override {
+        for_each_index(key, [this] (size_t idx) {
+            _bitset.set(idx);
+            return true;
+        });
+    }
+
+    virtual bool is_present(const hashed_key& key) override {
+        return for_each_index(key, [this] (size_t idx) {
+            return _bitset.test(idx);
+        });
     }
 };
 
 struct always_present_filter: public i_filter {
 
-    virtual bool is_present(const bytes_view& key) override {
+    using i_filter::add;
+    using i_filter::is_present;
+
+    virtual bool is_present(const hashed_key& key) override {
         return true;
     }
 
-    virtual void add(const bytes_view& key) override { }
+    virtual void add(const hashed_key& key) override { }
 
     virtual void clear() override { }
 
@@ -128,7 +181,7 @@ struct always_present_filter: public i_filter {
     }
 };
 
-filter_ptr create_filter(int hash, large_bitset&& bitset);
-filter_ptr create_filter(int hash, long num_elements, int buckets_per);
+filter_ptr create_filter(int hash, large_bitset&& bitset, filter_format format = filter_format::classic);
+filter_ptr create_filter(int hash, long num_elements, int buckets_per, filter_format format = filter_format::classic);
 }
 }
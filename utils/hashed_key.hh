@@ -0,0 +1,51 @@
+/*
+ * Copyright 2016 ScyllaDB
+ */
+
+/*
+ * This file is part of Scylla.
+ *
+ * Scylla is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Scylla is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Scylla.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include "bytes.hh"
+#include "utils/murmur_hash.hh"
+
+namespace utils {
+
+// The 128-bit murmur3 hash (seed 0) of the serialized form of a partition
+// key. Bloom filters hash keys to it, and the murmur3 partitioner derives
+// tokens from it, so it can be computed once per key and used to probe any
+// number of filters.
+struct hashed_key {
+    std::array<uint64_t, 2> hash;
+};
+
+inline hashed_key make_hashed_key(bytes_view key) {
+    hashed_key h;
+    murmur_hash::hash3_x64_128(key, 0, h.hash);
+    return h;
+}
+
+template <typename InputIterator>
+inline hashed_key make_hashed_key(InputIterator in, uint32_t length) {
+    hashed_key h;
+    murmur_hash::hash3_x64_128(in, length, 0, h.hash);
+    return h;
+}
+
+}
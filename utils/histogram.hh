@@ -22,6 +22,10 @@
 #pragma once
 
 #include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
 #include "latency.hh"
 
 namespace utils {
@@ -110,4 +114,90 @@ class ihistogram {
     }
 };
 
+/**
+ * A latency histogram which forgets old samples: every half_life(), all
+ * bucket counts are halved, so that percentiles follow recent behaviour.
+ *
+ * Latencies are kept in microseconds, in buckets four per power of two, so
+ * percentiles are accurate to within 25%. Latencies above max_latency()
+ * count as max_latency().
+ */
+class decaying_histogram {
+public:
+    using clock = latency_counter::clock;
+    static constexpr std::chrono::seconds half_life() {
+        return std::chrono::seconds(30);
+    }
+    static constexpr std::chrono::microseconds max_latency() {
+        return std::chrono::microseconds(1 << 24); // ~16s
+    }
+private:
+    // Four buckets per power of two below max_latency(), plus overflow.
+    static constexpr size_t bucket_count = 4 * 23 + 1;
+    std::array<uint32_t, bucket_count> _buckets{};
+    uint64_t _count = 0;
+    clock::time_point _last_decay = clock::now();
+private:
+    static size_t bucket_of(int64_t us) {
+        if (us < 4) {
+            return std::max<int64_t>(us, 0);
+        }
+        if (us >= max_latency().count()) {
+            return bucket_count - 1;
+        }
+        unsigned log2 = 63 - __builtin_clzll(us);
+        return 4 * (log2 - 1) + ((us >> (log2 - 2)) & 3);
+    }
+    // The largest latency falling into the given bucket.
+    static int64_t bucket_limit(size_t bucket) {
+        if (bucket < 4) {
+            return bucket;
+        }
+        if (bucket == bucket_count - 1) {
+            return max_latency().count();
+        }
+        unsigned log2 = bucket / 4 + 1;
+        return ((int64_t(4 + bucket % 4 + 1)) << (log2 - 2)) - 1;
+    }
+    void decay(clock::time_point now) {
+        auto periods = (now - _last_decay) / half_life();
+        if (periods <= 0) {
+            return;
+        }
+        _last_decay += periods * half_life();
+        auto shift = std::min<int64_t>(periods, 32);
+        _count = 0;
+        for (auto& b : _buckets) {
+            b = shift < 32 ? b >> shift : 0;
+            _count += b;
+        }
+    }
+public:
+    void mark(clock::duration latency, clock::time_point now = clock::now()) {
+        decay(now);
+        auto& b = _buckets[bucket_of(std::chrono::duration_cast<std::chrono::microseconds>(latency).count())];
+        if (b != std::numeric_limits<uint32_t>::max()) {
+            ++b;
+            ++_count;
+        }
+    }
+    // The number of samples, after decay.
+    uint64_t count() const {
+        return _count;
+    }
+    // The latency below which the given fraction (in [0, 1]) of the samples
+    // fall, or zero if there are no samples.
+    clock::duration percentile(double p) const {
+        uint64_t wanted = std::ceil(_count * std::min(std::max(p, 0.0), 1.0));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += _buckets[i];
+            if (seen >= wanted && seen) {
+                return std::chrono::microseconds(bucket_limit(i));
+            }
+        }
+        return clock::duration(0);
+    }
+};
+
 }
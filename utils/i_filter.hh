@@ -42,19 +42,34 @@
 
 #include "bytes.hh"
 #include "bloom_calculations.hh"
+#include "hashed_key.hh"
 
 namespace utils {
 
 struct i_filter;
 using filter_ptr = std::unique_ptr<i_filter>;
 
+enum class filter_format {
+    // The layout of Origin: each hash sets a bit anywhere in the bitmap.
+    classic,
+    // All the bits of a key lie within one cache line.
+    blocked,
+};
+
 // FIXME: serialize() and serialized_size() not implemented. We should only be serializing to
 // disk, not in the wire.
 struct i_filter {
     virtual ~i_filter() {}
 
-    virtual void add(const bytes_view& key) = 0;
-    virtual bool is_present(const bytes_view& key) = 0;
+    virtual void add(const hashed_key& key) = 0;
+    virtual bool is_present(const hashed_key& key) = 0;
+
+    void add(const bytes_view& key) {
+        add(make_hashed_key(key));
+    }
+    bool is_present(const bytes_view& key) {
+        return is_present(make_hashed_key(key));
+    }
     virtual void clear() = 0;
     virtual void close() = 0;
 
@@ -67,11 +82,11 @@ struct i_filter {
      *         Asserts that the given probability can be satisfied using this
      *         filter.
      */
-    static filter_ptr get_filter(long num_elements, double max_false_pos_prob);
+    static filter_ptr get_filter(long num_elements, double max_false_pos_prob, filter_format format = filter_format::classic);
     /**
      * @return A bloom_filter with the lowest practical false positive
      *         probability for the given number of elements.
      */
-    static filter_ptr get_filter(long num_elements, int target_buckets_per_elem);
+    static filter_ptr get_filter(long num_elements, int target_buckets_per_elem, filter_format format = filter_format::classic);
 };
 }